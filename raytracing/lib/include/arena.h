@@ -0,0 +1,107 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define FRAME_ARENA_MAX_THREADS 256
+
+struct MemoryArenaStats
+{
+	long long allocations;
+	long long bytes;
+	int blockAllocations; // the heap allocations among them
+
+	MemoryArenaStats() : allocations(0), bytes(0), blockAllocations(0) { }
+};
+
+// Monotonic allocator: memory comes from large blocks and is given back all
+// at once, by Reset or by rewinding to a mark taken earlier. Blocks are kept
+// for reuse, so an arena stops touching the heap once it has served its
+// largest workload. Nothing allocated here is destroyed; use it for plain
+// data. One thread at a time.
+class MemoryArena
+{
+public:
+	struct Mark
+	{
+		int block;
+		size_t offset;
+	};
+
+	MemoryArena(size_t blockSize = ARENA_BLOCK_SIZE);
+	~MemoryArena();
+
+	void *Alloc(size_t size, size_t align = 16);
+
+	// count default constructed Ts
+	template<class T>
+	T *AllocArray(int count) {
+		T *items = (T *)Alloc(count * sizeof(T));
+		for (int i = 0; i < count; i++)
+			new (items + i) T;
+		return items;
+	}
+
+	Mark GetMark() const;
+	// frees everything allocated since mark was taken
+	void Rewind(const Mark &mark);
+	void Reset();
+	// Reset, and the blocks go back to the heap too
+	void Release();
+
+	size_t GetBytesReserved() const;
+	const MemoryArenaStats &GetStats() const { return stats; }
+	void ClearStats() { stats = MemoryArenaStats(); }
+private:
+	struct Block
+	{
+		char *data;
+		size_t size;
+	};
+
+	vector<Block> blocks;
+	int current;
+	size_t offset;
+	size_t blockSize;
+	MemoryArenaStats stats;
+
+	MemoryArena(const MemoryArena &);
+	MemoryArena &operator=(const MemoryArena &);
+};
+
+// rewinds an arena to where it was when the scope began
+class ArenaScope
+{
+public:
+	ArenaScope(MemoryArena &arena) : arena(arena), mark(arena.GetMark()) { }
+	~ArenaScope() { arena.Rewind(mark); }
+private:
+	MemoryArena &arena;
+	MemoryArena::Mark mark;
+
+	ArenaScope(const ArenaScope &);
+	ArenaScope &operator=(const ArenaScope &);
+};
+
+// Scratch memory for one frame: each thread that asks gets an arena of its
+// own, from a fixed set of slots like the profiler's. BeginFrameAllocations
+// resets them all and starts counting the frame's allocations; call it
+// between frames, while no thread holds frame memory.
+MemoryArena &GetFrameArena();
+void BeginFrameAllocations();
+
+struct FrameAllocStats
+{
+	int threads;            // arenas handed out this frame
+	MemoryArenaStats total; // summed over them
+	size_t bytesReserved;   // held by every frame arena, used or not
+};
+
+FrameAllocStats GetFrameAllocStats();
+
+#endif // _ARENA_H_
@@ -64,7 +64,7 @@ protected:
 	virtual WindowInfoStruct GetWindowInfo();
 	virtual LRESULT HandleMessage(UINT uMsg, WPARAM wParam, LPARAM lParam);
 private:
-	struct Shared
+	struct Shared : public RefCounted
 	{
 		HWND hwnd;
 		ATOM classAtom;
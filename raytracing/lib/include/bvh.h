@@ -0,0 +1,244 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <vector>
+#include "datatypes.h"
+#include "geometry.h"
+#include "meshdata.h"
+#include "platform.h"
+#include "sharedptr.h"
+
+using namespace std;
+
+#define BVH_STACK_SIZE 64
+
+struct BVHBuildParams
+{
+	int maxLeafSize;
+	int numBins;
+	float traversalCost;
+	float intersectionCost;
+
+	// SBVH: mesh builds may split triangle references at spatial planes
+	bool spatialSplits;
+	float spatialSplitAlpha; // child overlap, relative to the root area, that triggers a spatial split search
+	float duplicationBudget; // extra references allowed, as a fraction of the face count
+
+	BVHBuildParams() :
+		maxLeafSize(4),
+		numBins(16),
+		traversalCost(1.0f),
+		intersectionCost(1.0f),
+		spatialSplits(false),
+		spatialSplitAlpha(1e-5f),
+		duplicationBudget(0.3f)
+	{ }
+};
+
+// 32 bytes, nodes are stored depth first so the left child
+// of an interior node always follows its parent
+struct BVHNode
+{
+	Vector3f vmin;
+	int offset;    // interior: index of the right child, leaf: first primitive
+	Vector3f vmax;
+	int count;     // number of primitives, 0 for interior nodes
+
+	bool IsLeaf() const { return count != 0; }
+};
+
+struct BVHStats
+{
+	int nodeCount;
+	int leafCount;
+	int maxDepth;
+	int primitiveCount;
+	int primitiveRefs;
+	float sahCost;
+	size_t memoryUsage;
+
+	BVHStats() : nodeCount(0), leafCount(0), maxDepth(0),
+		primitiveCount(0), primitiveRefs(0), sahCost(0), memoryUsage(0) { }
+
+	float BytesPerPrimitive() const {
+		return primitiveCount ? (float)memoryUsage / primitiveCount : 0.0f;
+	}
+};
+
+// Ray-box test against precomputed reciprocal direction, returns the entry distance
+inline bool IntersectBox(const Vector3f &vmin, const Vector3f &vmax,
+	const Vector3f &orig, const Vector3f &invDir, float tmax, float &tnear)
+{
+	float tx1 = (vmin.x - orig.x) * invDir.x, tx2 = (vmax.x - orig.x) * invDir.x;
+	float ty1 = (vmin.y - orig.y) * invDir.y, ty2 = (vmax.y - orig.y) * invDir.y;
+	float tz1 = (vmin.z - orig.z) * invDir.z, tz2 = (vmax.z - orig.z) * invDir.z;
+
+	float t0 = min(tx1, tx2), t1 = max(tx1, tx2);
+	t0 = max(t0, min(ty1, ty2)); t1 = min(t1, max(ty1, ty2));
+	t0 = max(t0, min(tz1, tz2)); t1 = min(t1, max(tz1, tz2));
+
+	tnear = t0;
+	return t1 >= max(t0, 0.0f) && t0 <= tmax;
+}
+
+// Optional counters for ray statistics. Traversals take NoTraversalStats
+// unless asked, whose empty calls compile away.
+struct TraversalStats
+{
+	int steps;     // BVH nodes or grid cells visited
+	int primTests; // intersector calls
+
+	TraversalStats() : steps(0), primTests(0) { }
+	void Step() { steps++; }
+	void Test() { primTests++; }
+};
+
+struct NoTraversalStats
+{
+	void Step() { }
+	void Test() { }
+};
+
+inline Vector3f SafeInverse(const Vector3f &v)
+{
+	const float eps = 1e-20f;
+	return Vector3f(
+		1.0f / (fabs(v.x) > eps ? v.x : (v.x < 0 ? -eps : eps)),
+		1.0f / (fabs(v.y) > eps ? v.y : (v.y < 0 ? -eps : eps)),
+		1.0f / (fabs(v.z) > eps ? v.z : (v.z < 0 ? -eps : eps)));
+}
+
+// Bounding volume hierarchy built with binned SAH. The generic build works on
+// primitive bounding boxes and is traversed with a user intersector; the mesh
+// build additionally keeps leaf-ordered triangle copies for fast intersection.
+// A mesh BVH can be saved to a file and later used directly from a read-only
+// mapping of it, see bvhcache.h.
+class BVH : public RefCounted
+{
+public:
+	BVH();
+	BVH(const BVH &bvh);
+	BVH &operator=(const BVH &bvh);
+
+	bool Build(const MeshData &mesh, const BVHBuildParams &params = BVHBuildParams());
+	bool Build(const AABox *bounds, int count, const BVHBuildParams &params = BVHBuildParams());
+	void Clear();
+
+	// key identifies the mesh and build parameters the file was made for,
+	// Load fails if it differs or the file doesn't match this build
+	bool Save(const char *filename, unsigned long long key) const;
+	bool Load(const MeshData &mesh, const char *filename, unsigned long long key,
+		const BVHBuildParams &params = BVHBuildParams());
+	bool IsMapped() const { return mapping.Get() != NULL; }
+
+	// triangle queries, only valid after building from a mesh
+	bool Intersect(const Ray &ray, RayHit &hit) const;
+	bool IntersectAny(const Ray &ray, float tmax) const;
+
+	// Intersector::operator()(int primitive, const Ray &ray, float &tmax) returns
+	// true and shortens tmax when the primitive is hit closer than tmax.
+	// Setting tmax below zero stops the traversal, for any-hit queries.
+	// stats, see TraversalStats, counts visited nodes and intersector calls.
+	template<class Intersector>
+	bool Traverse(const Ray &ray, float &tmax, Intersector &intersector) const {
+		NoTraversalStats stats;
+		return Traverse(ray, tmax, intersector, stats);
+	}
+	template<class Intersector, class Stats>
+	bool Traverse(const Ray &ray, float &tmax, Intersector &intersector, Stats &stats) const;
+
+	bool IsEmpty() const { return nodeCount == 0; }
+	int GetNodeCount() const { return nodeCount; }
+	const BVHNode *GetNodes() const { return nodeData; }
+	const int *GetPrimIndices() const { return primData; }
+	int GetPrimIndicesCount() const { return primCount; }
+	const MeshData *GetMesh() const { return mesh; }
+	const BVHBuildParams &GetBuildParams() const { return params; }
+	AABox GetBounds() const;
+	BVHStats GetStats() const;
+private:
+	// leaf-ordered triangle in the form used by Moller-Trumbore
+	struct BVHTriangle
+	{
+		Vector3f p1, e1, e2;
+		int face;
+	};
+
+	const MeshData *mesh;
+	BVHBuildParams params;
+	vector<BVHNode> nodes;
+	vector<int> primIndices;
+	vector<BVHTriangle> triangles;
+
+	// what queries read: either the vectors above or a mapped cache file
+	const BVHNode *nodeData;
+	const int *primData;
+	const BVHTriangle *triData;
+	int nodeCount, primCount, triCount;
+
+	// shared by copies of a BVH loaded from a cache file
+	struct Mapping : public RefCounted
+	{
+		MappedFile file;
+	};
+	my_shared_ptr<Mapping> mapping;
+
+	void updateViews();
+	void build(const AABox *bounds, const Vector3f *centroids, int nodeIndex, int begin, int end);
+	void buildSpatial(const MeshData &mesh);
+	void makeLeaf(BVHNode &node, int begin, int end);
+	float sahCost(int nodeIndex, float rootArea, int depth, BVHStats &stats) const;
+};
+
+template<class Intersector, class Stats>
+bool BVH::Traverse(const Ray &ray, float &tmax, Intersector &intersector, Stats &stats) const
+{
+	if (nodeCount == 0) return false;
+
+	Vector3f invDir = SafeInverse(ray.v);
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIndex = 0;
+	bool hit = false;
+	float tnear = 0;
+
+	if (!IntersectBox(nodeData[0].vmin, nodeData[0].vmax, ray.p, invDir, tmax, tnear))
+		return false;
+
+	for (;;)
+	{
+		const BVHNode &node = nodeData[nodeIndex];
+		stats.Step();
+		if (node.IsLeaf()) {
+			for (int i = node.offset, n = node.offset + node.count; i < n; i++) {
+				stats.Test();
+				if (intersector(primData[i], ray, tmax)) {
+					hit = true;
+					if (tmax < 0.0f) return true;
+				}
+			}
+		}
+		else
+		{
+			int left = nodeIndex + 1, right = node.offset;
+			float tl = 0, tr = 0;
+			bool hitLeft = IntersectBox(nodeData[left].vmin, nodeData[left].vmax, ray.p, invDir, tmax, tl);
+			bool hitRight = IntersectBox(nodeData[right].vmin, nodeData[right].vmax, ray.p, invDir, tmax, tr);
+
+			if (hitLeft && hitRight) {
+				if (tr < tl) { int t = left; left = right; right = t; }
+				stack[stackSize++] = right;
+				nodeIndex = left;
+				continue;
+			}
+			else if (hitLeft) { nodeIndex = left; continue; }
+			else if (hitRight) { nodeIndex = right; continue; }
+		}
+
+		if (stackSize == 0) break;
+		nodeIndex = stack[--stackSize];
+	}
+	return hit;
+}
+
+#endif // _BVH_H_
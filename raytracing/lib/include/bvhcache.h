@@ -0,0 +1,23 @@
+#ifndef _BVH_CACHE_H_
+#define _BVH_CACHE_H_
+
+#include <string>
+#include "bvh.h"
+#include "meshdata.h"
+
+using namespace std;
+
+// 64-bit hash of the vertex and index buffers and the build parameters,
+// used as the key of a BVH cache file
+unsigned long long HashMeshData(const MeshData &mesh, const BVHBuildParams &params);
+
+// cache file kept next to the model, "model.obj" -> "model.obj.bvh"
+string GetBVHCachePath(const char *modelFile);
+
+// Maps the BVH from cacheFile if it was built for the same mesh contents and
+// parameters, otherwise builds it and rewrites the cache. Failing to write the
+// cache is not an error, the BVH is still built.
+bool LoadOrBuildBVH(BVH &bvh, const MeshData &mesh, const char *cacheFile,
+	const BVHBuildParams &params = BVHBuildParams());
+
+#endif // _BVH_CACHE_H_
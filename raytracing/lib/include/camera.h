@@ -2,7 +2,9 @@
 #define _CAMERA_H_
 
 #include "datatypes.h"
+#ifndef RT_HEADLESS
 #include "glcontext.h"
+#endif
 
 enum CameraType {
 	CAM_FREE = 1,
@@ -16,7 +18,9 @@ public:
 	Camera(CameraType type = CAM_LAND);
 
 	virtual Matrix44f GetViewMatrix();
+#ifndef RT_HEADLESS
 	void ApplyTransform(GLRenderingContext *rc);
+#endif
 	void ResetTransform();
 
 	Vector3f GetPosition() { return t; }
@@ -0,0 +1,48 @@
+#ifndef _CAMERA_PATH_H_
+#define _CAMERA_PATH_H_
+
+#include <vector>
+#include "datatypes.h"
+#include "quaternion.h"
+
+using namespace std;
+
+// rotation turns camera space into world space, the camera looks down its -z
+struct CameraKey
+{
+	float time;
+	Point3f position;
+	Quaternion rotation;
+};
+
+// Keyframed camera motion: positions are interpolated linearly and rotations
+// with Quaternion::Slerp. Before the first and after the last key the camera
+// holds still.
+class CameraPath
+{
+public:
+	// text file with one "key <time> <x y z> <qx qy qz qw>" per line,
+	// '#' starts a comment
+	bool Load(const char *filename, int *errorLine = NULL);
+
+	void AddKey(const CameraKey &key); // keeps the keys sorted by time
+	void Clear() { keys.clear(); }
+
+	bool IsEmpty() const { return keys.empty(); }
+	int GetKeysCount() const { return (int)keys.size(); }
+	const CameraKey &GetKey(int i) const { return keys[i]; }
+	float GetStartTime() const { return keys.empty() ? 0.0f : keys.front().time; }
+	float GetEndTime() const { return keys.empty() ? 0.0f : keys.back().time; }
+
+	CameraKey Evaluate(float time) const;
+
+	// camera to world, the form CameraRayGenerator::SetCamera expects
+	Matrix44f GetViewMatrix(float time) const;
+private:
+	vector<CameraKey> keys;
+};
+
+// camera to world for a camera at eye looking at target, +y up
+Matrix44f LookAtView(const Point3f &eye, const Point3f &target);
+
+#endif // _CAMERA_PATH_H_
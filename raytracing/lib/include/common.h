@@ -3,18 +3,34 @@
 
 #define _USE_MATH_DEFINES
 
+#ifdef _WIN32
 #include <Windows.h>
+#endif
+
+// RT_HEADLESS builds (the CLI tools, non-Windows platforms) have no windowing or GL
+#ifndef RT_HEADLESS
 #include <gl/glew.h>
 #include <gl/gl.h>
 #include <gl/glext.h>
 #include <gl/wglext.h>
-#include <math.h>
 
 #pragma comment(lib, "opengl32.lib")
 #pragma comment(lib, "glew32.lib")
+#endif
+
+#include <math.h>
+
+#ifndef _WIN32
+// Windows.h provides these as macros
+#include <algorithm>
+using std::min;
+using std::max;
+#endif
 
+#ifndef M_PIf
 #define M_PIf 3.141592653589f
+#endif
 #define DEG_TO_RAD(a) ((a) * M_PIf / 180.0f)
 #define RAD_TO_DEG(a) ((a) / M_PIf * 180.0f)
 
-#endif // _COMMON_H_
\ No newline at end of file
+#endif // _COMMON_H_
@@ -0,0 +1,80 @@
+#ifndef _COMPRESSED_BVH_H_
+#define _COMPRESSED_BVH_H_
+
+#include <vector>
+#include "bvh.h"
+#include "meshdata.h"
+#include "packedmesh.h"
+
+using namespace std;
+
+#define CBVH_LEAF_BIT     0x80000000u
+#define CBVH_EMPTY_CHILD  0xFFFFFFFFu
+#define CBVH_MAX_LEAF_SIZE 16
+#define CBVH_MAX_PRIMS    (1 << 27)
+
+// 20 bytes for two children. Child boxes are quantized to 8 bits relative to
+// the box of the node that holds them, so only the root box is stored in floats.
+// A child is either an interior node index or a leaf packed as
+// CBVH_LEAF_BIT | (count - 1) << 27 | first primitive.
+struct CompressedBVHNode
+{
+	unsigned char qmin[2][3];
+	unsigned char qmax[2][3];
+	unsigned int child[2];
+};
+
+// Memory-lean BVH for very large meshes. Leaves reference faces of the
+// MeshData the tree was built from, which must stay alive and unchanged;
+// no vertex data is copied.
+//
+// Given a PackedMeshData, leaves read its quantized vertices instead and the
+// MeshData is no longer needed once built. The BVH must then be built over
+// the packed mesh's decoded positions, see PackedMeshData::Unpack, so its
+// boxes hold the triangles as they are decoded.
+class CompressedBVH
+{
+public:
+	CompressedBVH() : mesh(NULL), packed(NULL) { }
+
+	bool Build(const BVH &bvh, const PackedMeshData *packed = NULL);
+	void Clear();
+
+	bool Intersect(const Ray &ray, RayHit &hit) const;
+	bool IntersectAny(const Ray &ray, float tmax) const;
+
+	bool IsEmpty() const { return nodes.empty(); }
+	int GetNodeCount() const { return (int)nodes.size(); }
+	const MeshData *GetMesh() const { return mesh; }
+	const PackedMeshData *GetPackedMesh() const { return packed; }
+	BVHStats GetStats() const;
+private:
+	const MeshData *mesh; // NULL with a packed mesh
+	const PackedMeshData *packed;
+	Vector3f rootMin, rootScale;
+	vector<CompressedBVHNode> nodes;
+	vector<int> faces;
+
+	unsigned int encode(const BVH &bvh, int nodeIndex, const Vector3f &lo, const Vector3f &scale);
+	// hit == NULL requests an any-hit query
+	bool traverse(const Ray &ray, float &tmax, RayHit *hit) const;
+	bool intersectLeaf(unsigned int child, const Ray &ray, RayHit *hit, float &tmax) const;
+};
+
+// the scale is inflated slightly so that the quantized grid always covers the parent box
+inline Vector3f QuantizationScale(const Vector3f &lo, const Vector3f &hi) {
+	return (hi - lo) * (1.0001f / 255.0f);
+}
+
+inline void DecodeChildBox(const CompressedBVHNode &node, int i,
+	const Vector3f &lo, const Vector3f &scale, Vector3f &cmin, Vector3f &cmax)
+{
+	cmin.x = lo.x + node.qmin[i][0] * scale.x;
+	cmin.y = lo.y + node.qmin[i][1] * scale.y;
+	cmin.z = lo.z + node.qmin[i][2] * scale.z;
+	cmax.x = lo.x + node.qmax[i][0] * scale.x;
+	cmax.y = lo.y + node.qmax[i][1] * scale.y;
+	cmax.z = lo.z + node.qmax[i][2] * scale.z;
+}
+
+#endif // _COMPRESSED_BVH_H_
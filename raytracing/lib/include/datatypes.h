@@ -261,8 +261,14 @@ union Color3
 	bool operator==(const Color3 &c) const;
 	bool operator!=(const Color3 &c) const;
 
+	Color3 operator+(const Color3 &c) const;
+	Color3 operator-(const Color3 &c) const;
+	Color3 operator*(const Color3 &c) const;
 	Color3 operator*(T scale) const;
 	Color3 operator/(T scale) const;
+
+	Color3 &operator+=(const Color3 &c);
+	Color3 &operator*=(T scale);
 };
 
 template<class T>
@@ -608,6 +608,33 @@ Color3<T> Color3<T>::operator/(T scale) const {
 	T f = T(1) / scale;
 	return Color3<T>(r*f, g*f, b*f);
 }
+
+template<class T>
+Color3<T> Color3<T>::operator+(const Color3<T> &c) const {
+	return Color3<T>(r + c.r, g + c.g, b + c.b);
+}
+
+template<class T>
+Color3<T> Color3<T>::operator-(const Color3<T> &c) const {
+	return Color3<T>(r - c.r, g - c.g, b - c.b);
+}
+
+template<class T>
+Color3<T> Color3<T>::operator*(const Color3<T> &c) const {
+	return Color3<T>(r*c.r, g*c.g, b*c.b);
+}
+
+template<class T>
+Color3<T> &Color3<T>::operator+=(const Color3<T> &c) {
+	r += c.r; g += c.g; b += c.b;
+	return *this;
+}
+
+template<class T>
+Color3<T> &Color3<T>::operator*=(T scale) {
+	r *= scale; g *= scale; b *= scale;
+	return *this;
+}
 #pragma endregion
 #pragma region Color4
 
@@ -628,7 +655,7 @@ Color4<T> operator*(T scale, Color4<T> c) {
 
 template<class T>
 Color4<T> Color4<T>::operator*(T scale) const {
-	return Color4<T>(r*scale, g*scale, b*scale, c.a*scale);
+	return Color4<T>(r*scale, g*scale, b*scale, a*scale);
 }
 
 template<class T>
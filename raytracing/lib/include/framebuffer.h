@@ -0,0 +1,67 @@
+#ifndef _FRAMEBUFFER_H_
+#define _FRAMEBUFFER_H_
+
+#include <vector>
+#include "datatypes.h"
+#include "image.h"
+
+using namespace std;
+
+enum ToneMapOperator
+{
+	TONEMAP_NONE,     // clamp only, what the shader writes to gl_FragColor
+	TONEMAP_REINHARD, // x / (1 + x), per channel
+	TONEMAP_ACES,     // Narkowicz's fit of the ACES filmic curve
+	TONEMAP_OPERATOR_COUNT
+};
+
+struct ToneMapParams
+{
+	ToneMapOperator op;
+	float exposure; // stops, the pixels are scaled by 2^exposure first
+	bool srgb;      // encode with the sRGB curve, otherwise values stay linear
+	bool dither;    // 4x4 ordered dither when quantizing to 8 bit
+
+	ToneMapParams() : op(TONEMAP_NONE), exposure(0.0f), srgb(false), dither(false) { }
+};
+
+const char *GetToneMapName(int op);
+bool ParseToneMap(const char *name, ToneMapOperator &op);
+
+// Float RGB or RGBA pixels for rendering and post-processing without
+// clipping, row 0 is the top one. The tone map and 8 bit conversions use
+// SSE2 where available, four channel values at a time, and leave alpha
+// untouched apart from clamping.
+class FrameBuffer
+{
+public:
+	FrameBuffer() : width(0), height(0), channels(0) { }
+
+	// 3 or 4 floats per pixel, zero filled
+	bool Create(int width, int height, int channels = 3);
+
+	bool IsEmpty() const { return data.empty(); }
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	int GetChannels() const { return channels; }
+	float *GetData() { return data.empty() ? NULL : data.data(); }
+	const float *GetData() const { return data.empty() ? NULL : data.data(); }
+	float *GetRow(int y) { return &data[y * width * channels]; }
+	const float *GetRow(int y) const { return &data[y * width * channels]; }
+
+	// RGB buffers only, laid out as RayTracer::Render writes pixels
+	Color3f *GetPixels() { return channels == 3 ? (Color3f *)GetData() : NULL; }
+	const Color3f *GetPixels() const { return channels == 3 ? (const Color3f *)GetData() : NULL; }
+
+	// exposure, tone curve and sRGB encode in place; params.dither is ignored
+	void ToneMap(const ToneMapParams &params);
+	// the whole chain down to 8 bit, 24 or 32 bit depending on the channels
+	bool Convert(Image &image, const ToneMapParams &params) const;
+	// one row of Convert, width * channels bytes in BGR(A) order
+	void ConvertRow(int y, unsigned char *out, const ToneMapParams &params) const;
+private:
+	int width, height, channels;
+	vector<float> data;
+};
+
+#endif // _FRAMEBUFFER_H_
@@ -0,0 +1,51 @@
+#ifndef _FRAME_PACER_H_
+#define _FRAME_PACER_H_
+
+struct FramePacerStats
+{
+	int frames;
+	int missed;          // deadlines dropped by frames a whole interval late
+	double totalTime;    // seconds between the first and the last frame start
+	double maxFrameTime;
+
+	FramePacerStats() : frames(0), missed(0), totalTime(0), maxFrameTime(0) { }
+
+	double AverageFrameTime() const { return frames > 1 ? totalTime / (frames - 1) : 0.0; }
+};
+
+// Fixed rate frame loop timed by a real clock. Frame starts are due at
+// whole intervals from the first one, so sleep granularity doesn't add up
+// into drift; a frame more than an interval late drops the deadlines it
+// missed rather than rushing frames to catch up.
+//
+// The now arguments are seconds from the same clock as GetTime, so the
+// logic can be driven by a made-up clock; Wait and the overloads without
+// now use the real one.
+class FramePacer
+{
+public:
+	FramePacer(double interval = 1.0 / 60.0);
+
+	double GetInterval() const { return interval; }
+	void SetInterval(double interval) { this->interval = interval; }
+
+	// call as a frame starts; returns the seconds since the previous start,
+	// 0 for the first frame
+	double BeginFrame(double now);
+	double BeginFrame();
+
+	// seconds from now until the next frame is due, 0 if it already is
+	double GetWaitTime(double now) const;
+	// sleeps until the next frame is due
+	void Wait();
+
+	const FramePacerStats &GetStats() const { return stats; }
+	void ResetStats() { stats = FramePacerStats(); }
+private:
+	double interval;
+	double lastFrame, nextFrame;
+	bool started;
+	FramePacerStats stats;
+};
+
+#endif // _FRAME_PACER_H_
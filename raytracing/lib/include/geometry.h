@@ -2,6 +2,7 @@
 #define _GEOMETRY_H_
 
 #include "datatypes.h"
+#include <float.h>
 
 class Plane;
 class Sphere;
@@ -13,7 +14,7 @@ public:
 	Vector3f v;
 
 	Line() { }
-	Line(const Point3f &p, Vector3f &v) : p(p), v(v) {
+	Line(const Point3f &p, const Vector3f &v) : p(p), v(v) {
 		this->v.Normalize();
 	}
 
@@ -29,7 +30,7 @@ public:
 	Vector3f v;
 
 	Ray() { }
-	Ray(const Point3f &p, Vector3f &v) : p(p), v(v) {
+	Ray(const Point3f &p, const Vector3f &v) : p(p), v(v) {
 		this->v.Normalize();
 	}
 
@@ -168,19 +169,138 @@ public:
 	}*/
 };
 
+class Triangle
+{
+public:
+	Point3f p1, p2, p3;
+
+	Triangle() { }
+	Triangle(const Point3f &p1, const Point3f &p2, const Point3f &p3)
+		: p1(p1), p2(p2), p3(p3) { }
+
+	Vector3f Normal() const {
+		return Normalize(Cross(p2 - p1, p3 - p1));
+	}
+
+	// Moller-Trumbore test, u and v are the barycentric coordinates of p2 and p3
+	bool Intersect(const Ray &r, float &t, float &u, float &v) const {
+		return IntersectTriangle(r, p1, p2 - p1, p3 - p1, t, u, v);
+	}
+
+	static bool IntersectTriangle(const Ray &r, const Point3f &p1,
+		const Vector3f &e1, const Vector3f &e2, float &t, float &u, float &v)
+	{
+		Vector3f pv = Cross(r.v, e2);
+		float det = Dot(e1, pv);
+		if (det > -1e-8f && det < 1e-8f) return false;
+
+		float invDet = 1.0f / det;
+		Vector3f tv = r.p - p1;
+		u = Dot(tv, pv) * invDet;
+		if (u < 0.0f || u > 1.0f) return false;
+
+		Vector3f qv = Cross(tv, e1);
+		v = Dot(r.v, qv) * invDet;
+		if (v < 0.0f || u + v > 1.0f) return false;
+
+		t = Dot(e2, qv) * invDet;
+		return t >= 0.0f;
+	}
+};
+
+struct RayHit
+{
+	float t;
+	float u, v;
+	int primitive; // -1 if nothing was hit
+
+	RayHit() : t(FLT_MAX), u(0), v(0), primitive(-1) { }
+};
+
 class AABox
 {
 public:
 	Vector3f vmin, vmax;
 
+	// default box is empty, so that the first Extend sets it to a point
+	AABox() : vmin(FLT_MAX), vmax(-FLT_MAX) { }
+	AABox(const Vector3f &vmin, const Vector3f &vmax) : vmin(vmin), vmax(vmax) { }
+
+	bool IsEmpty() const {
+		return vmin.x > vmax.x || vmin.y > vmax.y || vmin.z > vmax.z;
+	}
+
+	Point3f Center() const { return (vmin + vmax) * 0.5f; }
+	Vector3f Size() const { return vmax - vmin; }
+
+	float SurfaceArea() const {
+		if (IsEmpty()) return 0.0f;
+		Vector3f d = vmax - vmin;
+		return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
+	}
+
+	int MaxExtentAxis() const {
+		Vector3f d = vmax - vmin;
+		if (d.x > d.y && d.x > d.z) return 0;
+		return d.y > d.z ? 1 : 2;
+	}
+
+	void Extend(const Point3f &p)
+	{
+		if (p.x < vmin.x) vmin.x = p.x;
+		if (p.y < vmin.y) vmin.y = p.y;
+		if (p.z < vmin.z) vmin.z = p.z;
+		if (p.x > vmax.x) vmax.x = p.x;
+		if (p.y > vmax.y) vmax.y = p.y;
+		if (p.z > vmax.z) vmax.z = p.z;
+	}
+
+	void Extend(const AABox &b)
+	{
+		if (b.vmin.x < vmin.x) vmin.x = b.vmin.x;
+		if (b.vmin.y < vmin.y) vmin.y = b.vmin.y;
+		if (b.vmin.z < vmin.z) vmin.z = b.vmin.z;
+		if (b.vmax.x > vmax.x) vmax.x = b.vmax.x;
+		if (b.vmax.y > vmax.y) vmax.y = b.vmax.y;
+		if (b.vmax.z > vmax.z) vmax.z = b.vmax.z;
+	}
+
+	bool Contains(const Point3f &p) const {
+		return p.x >= vmin.x && p.x <= vmax.x &&
+			p.y >= vmin.y && p.y <= vmax.y &&
+			p.z >= vmin.z && p.z <= vmax.z;
+	}
+
 	bool Intersect(const Ray &ray) const
 	{
-	
+		float tmin, tmax;
+		return Intersect(ray, tmin, tmax);
 	}
 
 	bool Intersect(const Ray &ray, Vector3f &p1, Vector3f &p2) const
 	{
-		
+		float tmin, tmax;
+		if (!Intersect(ray, tmin, tmax)) return false;
+		p1 = ray.p + ray.v * tmin;
+		p2 = ray.p + ray.v * tmax;
+		return true;
+	}
+
+	// slab test, tmin is clamped to the ray origin
+	bool Intersect(const Ray &ray, float &tmin, float &tmax) const
+	{
+		tmin = 0.0f;
+		tmax = FLT_MAX;
+		for (int i = 0; i < 3; i++) {
+			float invDir = 1.0f / ray.v[i];
+			float t1 = (vmin[i] - ray.p[i]) * invDir;
+			float t2 = (vmax[i] - ray.p[i]) * invDir;
+			if (t1 > t2) { float t = t1; t1 = t2; t2 = t; }
+			if (t1 > tmin) tmin = t1;
+			if (t2 < tmax) tmax = t2;
+			if (tmin > tmax) return false;
+		}
+		return true;
 	}
 };
 
@@ -45,7 +45,9 @@ public:
 		ShowWindow(m_hwnd, (bFullScreen && nCmdShow == SW_MAXIMIZE) ? SW_SHOW : nCmdShow);
 	}
 
-	void Redraw() {
+	// windows that draw on a thread of their own override it to wake that
+	// thread instead
+	virtual void Redraw() {
 		OnDisplay();
 		SwapBuffers(m_hdc);
 	}
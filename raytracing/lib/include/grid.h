@@ -0,0 +1,246 @@
+#ifndef _GRID_H_
+#define _GRID_H_
+
+#include <vector>
+#include "datatypes.h"
+#include "geometry.h"
+#include "bvh.h"
+
+using namespace std;
+
+struct GridParams
+{
+	float density;        // cells per object
+	int maxResolution;    // per axis
+	float topDensity;     // two-level grid: cells per object of the top level
+	int subgridThreshold; // two-level grid: objects in a top cell that get their own grid
+
+	GridParams() :
+		density(2.0f),
+		maxResolution(512),
+		topDensity(0.125f),
+		subgridThreshold(16)
+	{ }
+};
+
+// One level of a grid: cells are stored in compressed form, items of cell i are
+// items[cellStart[i]] .. items[cellStart[i + 1] - 1]. Built with two parallel
+// counting-sort passes, so rebuilding every frame stays cheap.
+struct GridLevel
+{
+	AABox bounds;
+	int res[3];
+	Vector3f cellSize, invCellSize;
+	vector<int> cellStart;
+	vector<int> items;
+
+	GridLevel() { res[0] = res[1] = res[2] = 0; }
+
+	// ids == NULL means objects 0..count-1
+	void Build(const AABox &box, const AABox *objBounds, const int *ids, int count,
+		float density, int maxResolution, bool parallel);
+	void Clear();
+
+	int GetCellsCount() const { return res[0] * res[1] * res[2]; }
+	size_t GetMemoryUsage() const {
+		return cellStart.size() * sizeof(int) + items.size() * sizeof(int);
+	}
+
+	// 3D-DDA through the cells between tmin and tmax. visit(cell, tEnter, tExit)
+	// may shorten tmax; the walk stops when tmax ends inside the current cell.
+	template<class Visitor>
+	bool Traverse(const Ray &ray, const Vector3f &invDir, float tmin, float &tmax, Visitor &visit) const;
+};
+
+// Intersector::operator()(int object, const Ray &ray, float &tmax) has the same
+// contract as for BVH::Traverse; traversal stops when tmax drops below zero.
+class UniformGrid
+{
+public:
+	void Build(const AABox *objBounds, int count, const GridParams &params = GridParams());
+	void Clear() { grid.Clear(); }
+
+	template<class Intersector>
+	bool Traverse(const Ray &ray, float &tmax, Intersector &intersector) const {
+		NoTraversalStats stats;
+		return Traverse(ray, tmax, intersector, stats);
+	}
+	template<class Intersector, class Stats>
+	bool Traverse(const Ray &ray, float &tmax, Intersector &intersector, Stats &stats) const;
+
+	bool IsEmpty() const { return grid.items.empty(); }
+	const GridLevel &GetLevel() const { return grid; }
+	size_t GetMemoryUsage() const { return grid.GetMemoryUsage(); }
+private:
+	GridLevel grid;
+};
+
+// Two-level grid: a coarse top level whose crowded cells get a nested grid,
+// which keeps cell counts low for scenes with very uneven object density.
+class HierarchicalGrid
+{
+public:
+	void Build(const AABox *objBounds, int count, const GridParams &params = GridParams());
+	void Clear();
+
+	template<class Intersector>
+	bool Traverse(const Ray &ray, float &tmax, Intersector &intersector) const {
+		NoTraversalStats stats;
+		return Traverse(ray, tmax, intersector, stats);
+	}
+	template<class Intersector, class Stats>
+	bool Traverse(const Ray &ray, float &tmax, Intersector &intersector, Stats &stats) const;
+
+	bool IsEmpty() const { return top.items.empty(); }
+	int GetSubgridsCount() const { return (int)subgrids.size(); }
+	size_t GetMemoryUsage() const;
+private:
+	GridLevel top;
+	vector<int> cellSubgrid; // index into subgrids or -1
+	vector<GridLevel> subgrids;
+};
+
+template<class Visitor>
+bool GridLevel::Traverse(const Ray &ray, const Vector3f &invDir, float tmin, float &tmax, Visitor &visit) const
+{
+	float t0 = 0, t1 = 0;
+	if (!IntersectBox(bounds.vmin, bounds.vmax, ray.p, invDir, tmax, t0)) return false;
+	for (int a = 0; a < 3; a++) {
+		float ta = (bounds.vmin[a] - ray.p[a]) * invDir[a];
+		float tb = (bounds.vmax[a] - ray.p[a]) * invDir[a];
+		float far = ta > tb ? ta : tb;
+		if (a == 0 || far < t1) t1 = far;
+	}
+	if (t0 < tmin) t0 = tmin;
+	if (t1 > tmax) t1 = tmax;
+	if (t0 > t1) return false;
+
+	int c[3], step[3], out[3];
+	float tNext[3], tDelta[3];
+	Point3f p = ray.p + ray.v * t0;
+
+	for (int a = 0; a < 3; a++)
+	{
+		c[a] = (int)((p[a] - bounds.vmin[a]) * invCellSize[a]);
+		if (c[a] < 0) c[a] = 0;
+		if (c[a] >= res[a]) c[a] = res[a] - 1;
+
+		if (ray.v[a] >= 0) {
+			step[a] = 1;
+			out[a] = res[a];
+			tNext[a] = t0 + (bounds.vmin[a] + (c[a] + 1) * cellSize[a] - p[a]) * invDir[a];
+		}
+		else {
+			step[a] = -1;
+			out[a] = -1;
+			tNext[a] = t0 + (bounds.vmin[a] + c[a] * cellSize[a] - p[a]) * invDir[a];
+		}
+		tDelta[a] = cellSize[a] * fabs(invDir[a]);
+	}
+
+	bool hit = false;
+	float tEnter = t0;
+	for (;;)
+	{
+		int axis = tNext[0] < tNext[1] ?
+			(tNext[0] < tNext[2] ? 0 : 2) :
+			(tNext[1] < tNext[2] ? 1 : 2);
+		float tExit = tNext[axis] < t1 ? tNext[axis] : t1;
+
+		int cell = c[0] + res[0] * (c[1] + res[1] * c[2]);
+		if (visit(cell, tEnter, tExit)) hit = true;
+		if (tmax < 0.0f || tmax <= tExit || tExit >= t1) break;
+
+		c[axis] += step[axis];
+		if (c[axis] == out[axis]) break;
+		tEnter = tNext[axis];
+		tNext[axis] += tDelta[axis];
+	}
+	return hit;
+}
+
+template<class Intersector, class Stats>
+struct GridCellVisitor
+{
+	const GridLevel &grid;
+	const Ray &ray;
+	float &tmax;
+	Intersector &intersector;
+	Stats &stats;
+
+	GridCellVisitor(const GridLevel &grid, const Ray &ray, float &tmax, Intersector &intersector, Stats &stats)
+		: grid(grid), ray(ray), tmax(tmax), intersector(intersector), stats(stats) { }
+
+	bool operator()(int cell, float, float)
+	{
+		bool hit = false;
+		stats.Step();
+		for (int i = grid.cellStart[cell], n = grid.cellStart[cell + 1]; i < n; i++) {
+			stats.Test();
+			if (intersector(grid.items[i], ray, tmax)) {
+				hit = true;
+				if (tmax < 0.0f) break;
+			}
+		}
+		return hit;
+	}
+private:
+	GridCellVisitor &operator=(const GridCellVisitor &);
+};
+
+template<class Intersector, class Stats>
+bool UniformGrid::Traverse(const Ray &ray, float &tmax, Intersector &intersector, Stats &stats) const
+{
+	if (grid.items.empty()) return false;
+	Vector3f invDir = SafeInverse(ray.v);
+	GridCellVisitor<Intersector, Stats> visitor(grid, ray, tmax, intersector, stats);
+	return grid.Traverse(ray, invDir, 0.0f, tmax, visitor);
+}
+
+template<class Intersector, class Stats>
+struct SubgridVisitor
+{
+	const GridLevel &top;
+	const vector<int> &cellSubgrid;
+	const vector<GridLevel> &subgrids;
+	const Ray &ray;
+	const Vector3f &invDir;
+	float &tmax;
+	Intersector &intersector;
+	Stats &stats;
+
+	SubgridVisitor(const GridLevel &top, const vector<int> &cellSubgrid,
+		const vector<GridLevel> &subgrids, const Ray &ray, const Vector3f &invDir,
+		float &tmax, Intersector &intersector, Stats &stats)
+		: top(top), cellSubgrid(cellSubgrid), subgrids(subgrids), ray(ray),
+		invDir(invDir), tmax(tmax), intersector(intersector), stats(stats) { }
+
+	bool operator()(int cell, float tEnter, float tExit)
+	{
+		int sub = cellSubgrid[cell];
+		if (sub < 0) {
+			GridCellVisitor<Intersector, Stats> visitor(top, ray, tmax, intersector, stats);
+			return visitor(cell, tEnter, tExit);
+		}
+		stats.Step();
+
+		// objects crossing the cell border may be hit beyond tExit, so the
+		// nested walk keeps the full tmax and only starts at tEnter
+		const GridLevel &grid = subgrids[sub];
+		GridCellVisitor<Intersector, Stats> visitor(grid, ray, tmax, intersector, stats);
+		return grid.Traverse(ray, invDir, tEnter, tmax, visitor);
+	}
+private:
+	SubgridVisitor &operator=(const SubgridVisitor &);
+};
+
+template<class Intersector, class Stats>
+bool HierarchicalGrid::Traverse(const Ray &ray, float &tmax, Intersector &intersector, Stats &stats) const
+{
+	if (top.items.empty()) return false;
+	Vector3f invDir = SafeInverse(ray.v);
+	SubgridVisitor<Intersector, Stats> visitor(top, cellSubgrid, subgrids, ray, invDir, tmax, intersector, stats);
+	return top.Traverse(ray, invDir, 0.0f, tmax, visitor);
+}
+
+#endif // _GRID_H_
@@ -4,8 +4,17 @@
 #include "common.h"
 #include "sharedptr.h"
 #include "datatypes.h"
+#include "platform.h"
 #include <new>
 
+// a 0..1 color channel as 8 bits, clamped and rounded to the nearest; the
+// one quantizer for the image writers and texture border colors
+inline unsigned char ColorToByte(float c)
+{
+	c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+	return (unsigned char)(c * 255.0f + 0.5f);
+}
+
 class Image
 {
 private:
@@ -15,7 +24,12 @@ public:
 	Image() : isGood(false), dataSize(0), ptr(new Shared) {
 		width = height = depth = 0;
 	}
+	// 8, 24 (BGR) or 32 (BGRA) bit, zero filled, row 0 is the top one
+	bool Create(int width, int height, int depth);
+	// uncompressed or run-length encoded true color, grayscale and colormapped
+	// TGA; colormapped and 15/16 bit images load as 24 or 32 bit
 	bool LoadTga(const char *filename);
+	bool SaveTga(const char *filename) const;
 
 	operator bool() const { return isGood; }
 	bool IsGood() const { return isGood; }
@@ -23,7 +37,7 @@ public:
 	int GetHeight() const { return height; }
 	int GetDepth() const { return depth; }
 	int GetDataSize() const { return dataSize; }
-	BYTE *GetData() const { return ptr->data; };
+	unsigned char *GetData() const { return ptr->data; };
 
 	Color4b GetPixel(int x, int y) const
 	{
@@ -42,9 +56,9 @@ public:
 
 	Image Clone() const;
 private:
-	struct Shared
+	struct Shared : public RefCounted
 	{
-		BYTE *data;
+		unsigned char *data;
 		Shared() : data(0) { }
 		~Shared() { delete [] data; }
 	};
@@ -53,7 +67,6 @@ private:
 	int dataSize;
 	int width, height;
 	int depth;
-	void read(HANDLE hFile, LPVOID lpBuffer, DWORD nNumBytes);
 };
 
 #endif // _IAMGE_H_
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef _IMAGE_WRITER_H_
+#define _IMAGE_WRITER_H_
+
+#include "datatypes.h"
+#include "image.h"
+#include "framebuffer.h"
+
+struct ImageSource;
+
+enum ImageFormat
+{
+	IMAGE_TGA,     // uncompressed, as Image::SaveTga writes it
+	IMAGE_TGA_RLE, // run-length encoded, one packet sequence per row
+	IMAGE_PPM,     // binary P6, or P5 for 8 bit images
+	IMAGE_PFM,     // float RGB
+	IMAGE_HDR,     // Radiance RGBE with run-length encoded rows
+	IMAGE_FORMAT_COUNT
+};
+
+// from the extension: .tga, .ppm, .pgm, .pfm or .hdr; .tga gives IMAGE_TGA
+bool GetImageFormat(const char *filename, ImageFormat &format);
+const char *GetImageFormatName(ImageFormat format);
+
+struct ImageWriteStats
+{
+	size_t bytes; // file size
+	double time;  // seconds, encoding and writing
+
+	ImageWriteStats() : bytes(0), time(0) { }
+	double Throughput() const { return time > 0 ? bytes / (time * 1024.0 * 1024.0) : 0; } // MB/s
+};
+
+// Writes an Image or a float framebuffer in any ImageFormat. Blocks of rows
+// are encoded in parallel into per-row buffers and handed to a thread that
+// writes them in file order while the next block is encoded, so besides the
+// source only two blocks are ever held in memory. Float pixels are clamped
+// for the 8 bit formats, 8 bit images are scaled to [0, 1] for the float ones.
+class ImageWriter
+{
+public:
+	ImageWriter() : parallel(true), blockRows(0) { }
+
+	// encoding is spread over all threads unless disabled, e.g. because
+	// the caller already writes several images in parallel
+	void SetParallel(bool enable) { parallel = enable; }
+	// rows per block, 0 picks a count from the number of threads
+	void SetBlockRows(int rows) { blockRows = rows; }
+
+	bool Write(const char *filename, const Image &image, ImageFormat format);
+	// pixels holds width * height colors, top row first
+	bool Write(const char *filename, const Color3f *pixels, int width, int height, ImageFormat format);
+	// 8 bit formats go through FrameBuffer::ConvertRow with toneMap, the
+	// float ones get the pixels as they are, without alpha
+	bool Write(const char *filename, const FrameBuffer &frame, ImageFormat format,
+		const ToneMapParams &toneMap = ToneMapParams());
+
+	const ImageWriteStats &GetStats() const { return stats; }
+private:
+	bool parallel;
+	int blockRows;
+	ImageWriteStats stats;
+
+	bool write(const char *filename, const ImageSource &source, ImageFormat format);
+};
+
+#endif // _IMAGE_WRITER_H_
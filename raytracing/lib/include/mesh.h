@@ -12,6 +12,10 @@
 #include "vertexbuffer.h"
 #include "shader.h"
 #include "geometry.h"
+#include "meshdata.h"
+#include "meshlod.h"
+#include "bvh.h"
+#include "sharedptr.h"
 
 using namespace std;
 
@@ -52,30 +56,77 @@ public:
 	}
 };
 
+// a level of detail as a range of the index buffer, see ModelLoader::EnableLod
+struct MeshLodRange
+{
+	int firstIndex;
+	int indicesCount;
+	float error; // object space, see MeshLodLevel
+};
+
+// GL buffers of a mesh, shared by its copies
+struct MeshBuffers : public RefCounted
+{
+	VertexBuffer *vertices;
+	VertexBuffer *indices;
+	VertexBuffer *normals;
+	VertexBuffer *texCoords;
+	VertexBuffer *tangents, *binormals;
+	// GL_FLOAT, or the packed formats ModelLoader::EnableCompression uploads:
+	// GL_INT_2_10_10_10_REV normals, tangents and binormals, GL_HALF_FLOAT
+	// texture coordinates
+	GLenum normalType, texCoordType;
+
+	MeshBuffers() : vertices(NULL), indices(NULL), normals(NULL), texCoords(NULL),
+		tangents(NULL), binormals(NULL), normalType(GL_FLOAT), texCoordType(GL_FLOAT) { }
+	~MeshBuffers();
+
+	// a copy with its own GL buffers holding the same data
+	MeshBuffers *Clone(GLRenderingContext *rc) const;
+private:
+	MeshBuffers(const MeshBuffers &);
+	MeshBuffers &operator=(const MeshBuffers &);
+};
+
+// Copies of a mesh share its buffers and textures by reference: the meshes
+// ModelLoader makes for the objects of one file all draw from the same
+// buffers. Call MakeUnique before changing the contents of buffers.
 class Mesh
 {
 public:
 	Mesh(GLRenderingContext *rc);
-	Mesh(const Mesh &m);
-	~Mesh();
+	Mesh(GLRenderingContext *rc, const my_shared_ptr<MeshBuffers> &buffers);
 
-	Mesh &operator=(const Mesh &m);
-
-	bool HasNormals() const { return normals != NULL; }
-	bool HasTexCoords() const { return texCoords != NULL; }
-	int GetVerticesCount() const { return vertices->GetSize() / sizeof(Vector3f); }
-	int GetIndicesCount() const { return indicesCount >= 0 ? indicesCount : indices->GetSize() / sizeof(int); }
+	bool HasNormals() const { return buffers->normals != NULL; }
+	bool HasTexCoords() const { return buffers->texCoords != NULL; }
+	int GetVerticesCount() const { return buffers->vertices->GetSize() / sizeof(Vector3f); }
+	int GetIndicesCount() const { return indicesCount >= 0 ? indicesCount : buffers->indices->GetSize() / sizeof(int); }
 	int GetFaceCount() const { return GetIndicesCount() / 3; }
 
 	void SetFirstIndex(int firstIndex) { this->firstIndex = firstIndex; }
 	void SetIndicesCount(int indicesCount) { this->indicesCount = indicesCount; } // -1 to draw all
 
+	// Level 0 is the full mesh. Select picks the level for one instance, from
+	// the distance between the eye and the instance's nearest point, and sets
+	// it for the following draws; see GetLodScreenScale.
+	int GetLodCount() const { return lods.empty() ? 1 : (int)lods.size(); }
+	void SetLod(int level);
+	int SelectLod(float distance, float screenScale, float maxPixelError = 1.0f);
+
 	void BindTexture(const BaseTexture &texture);
 	void BindNormalMap(const Texture2D &normalMap);
 	void BindSpecularMap(const Texture2D &specularMap);
 
+	// Tangents are computed over the whole vertex array, so meshes sharing
+	// the buffers share them too.
 	void RecalcTangents();
 
+	// whether other meshes draw from this mesh's buffers
+	bool IsShared() const { return !buffers.IsUnique(); }
+	// copies the buffers if they are shared, so that writes to them only
+	// change this mesh
+	void MakeUnique();
+
 	void Draw();
 	void DrawInstanced(int instanceCount);
 	void DrawFixed();
@@ -85,22 +136,23 @@ public:
 	BoundingBox boundingBox;
 	Sphere boundingSphere;
 
-	VertexBuffer *vertices;
-	VertexBuffer *indices;
-	VertexBuffer *normals;
-	VertexBuffer *texCoords;
-	VertexBuffer *tangents, *binormals;
+	my_shared_ptr<MeshBuffers> buffers;
+
+	// CPU side geometry, shared between meshes loaded from the same file
+	my_shared_ptr<MeshData> data;
+	// built over all of data when requested from ModelLoader, shared the same way
+	my_shared_ptr<BVH> bvh;
+	vector<MeshLodRange> lods;
 private:
 	GLRenderingContext *rc;
-	BaseTexture *texture;
-	Texture2D *normalMap, *specularMap;
+	my_shared_ptr<BaseTexture> texture;
+	my_shared_ptr<Texture2D> normalMap, specularMap;
 
 	int firstIndex;
 	int indicesCount;
-	bool tangentsComputed;
 
-	void clone(const Mesh &m);
-	void cleanup();
+	void enableAttribs();
+	void disableAttribs();
 };
 
 #endif // _MESH_H_
\ No newline at end of file
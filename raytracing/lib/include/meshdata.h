@@ -0,0 +1,73 @@
+#ifndef _MESH_DATA_H_
+#define _MESH_DATA_H_
+
+#include <vector>
+#include "datatypes.h"
+#include "geometry.h"
+#include "sharedptr.h"
+
+using namespace std;
+
+// CPU copy of the geometry uploaded to a Mesh. ModelLoader fills it once
+// and every Mesh loaded from the same file references it, so acceleration
+// structures can index into these arrays instead of copying triangles.
+class MeshData : public RefCounted
+{
+public:
+	vector<Vector3f> vertices;
+	vector<Vector3f> normals;
+	vector<Vector2f> texCoords;
+	vector<int> indices;
+
+	bool HasNormals() const { return !normals.empty(); }
+	bool HasTexCoords() const { return !texCoords.empty(); }
+	int GetVerticesCount() const { return (int)vertices.size(); }
+	int GetIndicesCount() const { return (int)indices.size(); }
+	int GetFaceCount() const { return (int)indices.size() / 3; }
+
+	Triangle GetTriangle(int face) const
+	{
+		const int *i = &indices[face * 3];
+		return Triangle(vertices[i[0]], vertices[i[1]], vertices[i[2]]);
+	}
+
+	AABox GetFaceBounds(int face) const
+	{
+		const int *i = &indices[face * 3];
+		AABox box;
+		box.Extend(vertices[i[0]]);
+		box.Extend(vertices[i[1]]);
+		box.Extend(vertices[i[2]]);
+		return box;
+	}
+
+	// at barycentric u, v of a face as RayHit reports them
+	Vector3f InterpolateNormal(int face, float u, float v) const
+	{
+		const int *i = &indices[face * 3];
+		Vector3f n = normals[i[0]] * (1.0f - u - v) + normals[i[1]] * u + normals[i[2]] * v;
+		n.Normalize();
+		return n;
+	}
+
+	Vector2f InterpolateTexCoord(int face, float u, float v) const
+	{
+		const int *i = &indices[face * 3];
+		return texCoords[i[0]] * (1.0f - u - v) + texCoords[i[1]] * u + texCoords[i[2]] * v;
+	}
+
+	AABox GetBounds() const
+	{
+		AABox box;
+		for (int i = 0, n = (int)vertices.size(); i < n; i++)
+			box.Extend(vertices[i]);
+		return box;
+	}
+
+	size_t GetMemoryUsage() const {
+		return vertices.size() * sizeof(Vector3f) + normals.size() * sizeof(Vector3f) +
+			texCoords.size() * sizeof(Vector2f) + indices.size() * sizeof(int);
+	}
+};
+
+#endif // _MESH_DATA_H_
@@ -0,0 +1,23 @@
+#ifndef _MESH_LOADER_H_
+#define _MESH_LOADER_H_
+
+#include <vector>
+#include "meshdata.h"
+
+using namespace std;
+
+// One object of a model file as a range of MeshData::indices
+struct SubMesh
+{
+	int firstIndex;
+	int indicesCount;
+	Vector3f vmin, vmax;
+};
+
+// File parsing behind ModelLoader, without any GL objects, so it can be used
+// by headless tools. Unless separateMeshes is set, an OBJ file gives one
+// submesh for all of its objects.
+bool LoadObjMeshData(const char *filename, MeshData &data, vector<SubMesh> &subMeshes, bool separateMeshes = true);
+bool LoadRawMeshData(const char *filename, MeshData &data, vector<SubMesh> &subMeshes);
+
+#endif // _MESH_LOADER_H_
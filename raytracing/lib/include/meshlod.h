@@ -0,0 +1,58 @@
+#ifndef _MESH_LOD_H_
+#define _MESH_LOD_H_
+
+#include <vector>
+#include "meshdata.h"
+#include "meshloader.h"
+
+using namespace std;
+
+#define MESH_LOD_LEVELS 6
+
+// pixels a unit spans at distance 1 for a vertical field of view in degrees
+float GetLodScreenScale(int height, float fovY);
+
+// whether an object space error seen from distance projects to more than
+// maxPixelError pixels
+inline bool IsLodErrorVisible(float error, float distance, float screenScale, float maxPixelError) {
+	return error * screenScale > maxPixelError * distance;
+}
+
+struct MeshLodLevel
+{
+	vector<int> indices; // into the vertices of the MeshData the levels were built from
+	float error;         // how far, in object space, the surface may have moved; 0 for level 0
+};
+
+// Levels of detail of one index range of a MeshData, each with about
+// reduction times the triangles of the one before. Levels are made by
+// quadric error edge collapses (Garland and Heckbert 1997) that move a
+// vertex onto a neighbour, so every level indexes the original vertex
+// array and keeps its normals and texture coordinates; open edges, texture
+// seams included, are held in place. The simplifier stops early when every
+// remaining collapse would fold a triangle over or pinch the surface.
+class MeshLod
+{
+public:
+	vector<MeshLodLevel> levels;
+
+	void Build(const MeshData &mesh, int firstIndex, int indicesCount,
+		int maxLevels = MESH_LOD_LEVELS, float reduction = 0.5f);
+	void Clear() { levels.clear(); }
+
+	int GetLevelCount() const { return (int)levels.size(); }
+	int GetFaceCount(int level) const { return (int)levels[level].indices.size() / 3; }
+
+	// the coarsest level whose error stays within maxPixelError pixels at
+	// distance, the distance from the eye to the nearest point of the object
+	int Select(float distance, float screenScale, float maxPixelError = 1.0f) const;
+
+	// a standalone mesh of one level, for building acceleration structures
+	void GetLevelMesh(const MeshData &mesh, int level, MeshData &result) const;
+};
+
+// one MeshLod per submesh, built in parallel
+void BuildMeshLods(const MeshData &mesh, const vector<SubMesh> &subMeshes, vector<MeshLod> &lods,
+	int maxLevels = MESH_LOD_LEVELS, float reduction = 0.5f);
+
+#endif // _MESH_LOD_H_
@@ -0,0 +1,35 @@
+#ifndef _MESH_ORDER_H_
+#define _MESH_ORDER_H_
+
+#include <vector>
+#include "meshdata.h"
+#include "meshloader.h"
+
+using namespace std;
+
+// post-transform cache the orderings are tuned for and ACMR is reported at
+#define MESH_VERTEX_CACHE_SIZE 16
+
+// Average cache miss ratio: vertices a FIFO cache of cacheSize entries
+// misses per triangle, from 3 for no reuse down to about 0.5 for a regular
+// grid; file order is often near 1.
+float ComputeACMR(const int *indices, int indicesCount, int cacheSize = MESH_VERTEX_CACHE_SIZE);
+
+// Reorders the triangles of one index range for vertex cache reuse with
+// Tipsify (Sander, Nehab and Barczak 2007): fans around a vertex, picking the
+// next one among the vertices just used that will still be in the cache
+// when its remaining triangles are emitted. Linear in the triangle count.
+void OptimizeVertexCache(int *indices, int indicesCount, int verticesCount,
+	int cacheSize = MESH_VERTEX_CACHE_SIZE);
+
+// Renumbers vertices in the order the indices first use them, so triangles
+// that follow each other read neighbouring vertices; unused vertices move
+// to the end. Every attribute array is permuted the same way.
+void OptimizeVertexFetch(MeshData &data);
+
+// Both passes, for a mesh as the loaders return it: triangles are reordered
+// within their submesh, so SubMesh ranges and bounds stay valid.
+void OptimizeMeshOrder(MeshData &data, const vector<SubMesh> &subMeshes,
+	int cacheSize = MESH_VERTEX_CACHE_SIZE);
+
+#endif // _MESH_ORDER_H_
@@ -0,0 +1,187 @@
+#ifndef _MIP_TEXTURE_H_
+#define _MIP_TEXTURE_H_
+
+#include <vector>
+#include <math.h>
+#include "datatypes.h"
+#include "image.h"
+
+using namespace std;
+
+// the GL_TEXTURE_WRAP_S/T modes BaseTexture::SetWrapMode takes
+enum TextureWrap
+{
+	TEX_WRAP_REPEAT,          // GL_REPEAT
+	TEX_WRAP_MIRRORED_REPEAT, // GL_MIRRORED_REPEAT
+	TEX_WRAP_CLAMP_TO_EDGE,   // GL_CLAMP_TO_EDGE
+	TEX_WRAP_CLAMP_TO_BORDER  // GL_CLAMP_TO_BORDER, see SetBorderColor
+};
+
+enum TextureFilter
+{
+	TEX_FILTER_NEAREST,   // nearest texel of the nearest level
+	TEX_FILTER_BILINEAR,  // of the nearest level
+	TEX_FILTER_TRILINEAR  // bilinear on the two closest levels, blended
+};
+
+enum TextureLayout
+{
+	TEX_LAYOUT_LINEAR, // row-major, as in Image
+	TEX_LAYOUT_TILED   // 8x8 texel tiles in row-major order, Morton order inside
+};
+
+#define TEX_TILE_SIZE 8
+#define TEX_CACHE_LINE 64
+
+// texel coordinates beyond this are folded back so the conversion to int
+// can't overflow
+#define TEX_COORD_LIMIT 1048576.0f
+
+// a texel coordinate before floor and WrapTexelCoord, folded within
+// TEX_COORD_LIMIT
+inline float FoldTexelCoord(float c)
+{
+	return c > TEX_COORD_LIMIT || c < -TEX_COORD_LIMIT ? fmodf(c, TEX_COORD_LIMIT) : c;
+}
+
+// texel coordinate i on an axis of n texels after wrapping, -1 for the border
+inline int WrapTexelCoord(int i, int n, TextureWrap wrap)
+{
+	if (i >= 0 && i < n) return i;
+	switch (wrap)
+	{
+	case TEX_WRAP_REPEAT:
+		i %= n;
+		return i < 0 ? i + n : i;
+	case TEX_WRAP_MIRRORED_REPEAT:
+		i %= 2 * n;
+		if (i < 0) i += 2 * n;
+		return i < n ? i : 2 * n - 1 - i;
+	case TEX_WRAP_CLAMP_TO_EDGE:
+		return i < 0 ? 0 : n - 1;
+	default:
+		return -1;
+	}
+}
+
+// GL's level of detail for a footprint given as texture coordinate
+// derivatives along the image x and y: log2 of the longer one in texels
+float GetTextureLod(int width, int height, const Vector2f &dUVdx, const Vector2f &dUVdy);
+
+// bilinear blend of the BGRA8 texels t[0..3], the 2x2 footprint in row
+// order, with fractions ax and ay; bgra receives 0..255 floats
+void FilterTexels(const unsigned int *t, float ax, float ay, float *bgra);
+
+// lod limited to the levels 0..last, NaN to 0
+inline float ClampTextureLod(float lod, int last)
+{
+	if (!(lod > 0.0f)) return 0.0f;
+	return lod > (float)last ? (float)last : lod;
+}
+
+// the trilinear step: bgra, sampled from a level, moved a fraction f
+// toward next, sampled from the level below
+inline void BlendTexelLevels(float *bgra, const float *next, float f)
+{
+	for (int c = 0; c < 4; c++)
+		bgra[c] += (next[c] - bgra[c]) * f;
+}
+
+// 0..255 BGRA floats, as FilterTexels gives them, as a color
+inline Color4f BgraToColor(const float *bgra)
+{
+	const float s = 1.0f / 255.0f;
+	return Color4f(bgra[2] * s, bgra[1] * s, bgra[0] * s, bgra[3] * s);
+}
+
+struct MipLevel
+{
+	int width, height;
+	int tilesX;    // tiles per row, tiled layout only
+	size_t offset; // of the first texel in the texel array
+};
+
+// CPU texture for the tracer, built from an Image. Texels are BGRA8 as in a
+// 32 bit Image; with the tiled layout the four texels of a bilinear lookup
+// nearly always share a 256 byte tile, which keeps minified and rotated
+// access patterns within a few cache lines. Bilinear weights are applied to
+// whole texels with SSE2 where available.
+//
+// Texture coordinates follow the viewer's GL textures: (0, 0) is the first
+// texel of the first Image row.
+class MipTexture
+{
+public:
+	MipTexture();
+
+	// 8, 24 or 32 bit images; the mip chain, down to 1x1, is built in parallel
+	bool Create(const Image &image, bool mipmaps = true, TextureLayout layout = TEX_LAYOUT_TILED);
+	void Clear();
+
+	void SetFilter(TextureFilter filter) { this->filter = filter; }
+	void SetWrapMode(TextureWrap wrapS, TextureWrap wrapT) { this->wrapS = wrapS; this->wrapT = wrapT; }
+	void SetBorderColor(const Color4f &color);
+
+	bool IsEmpty() const { return levels.empty(); }
+	int GetWidth() const { return levels.empty() ? 0 : levels[0].width; }
+	int GetHeight() const { return levels.empty() ? 0 : levels[0].height; }
+	int GetLevelCount() const { return (int)levels.size(); }
+	const MipLevel &GetLevel(int level) const { return levels[level]; }
+	TextureLayout GetLayout() const { return layout; }
+	TextureFilter GetFilter() const { return filter; }
+	size_t GetMemoryUsage() const { return texels.size() * sizeof(unsigned int); }
+
+	// lod is the mip level to sample, 0 the finest; fractional levels
+	// only matter for trilinear filtering
+	Color4f Sample(const Vector2f &uv, float lod = 0.0f) const;
+	float GetLod(const Vector2f &dUVdx, const Vector2f &dUVdy) const {
+		return levels.empty() ? 0.0f : GetTextureLod(levels[0].width, levels[0].height, dUVdx, dUVdy);
+	}
+
+	// Records the 64 byte lines of texel memory that samples read, to measure
+	// the memory traffic a frame causes. Tracking is not thread safe, so
+	// sample from a single thread while it is on.
+	void EnableAccessTracking(bool enable);
+	void ResetAccessTracking();
+	size_t GetBytesTouched() const;
+
+	// BGRA8 texel, x and y within the level
+	unsigned int GetTexel(int level, int x, int y) const {
+		return texels[texelIndex(levels[level], x, y)];
+	}
+private:
+	vector<unsigned int> texels;
+	vector<MipLevel> levels;
+	TextureLayout layout;
+	TextureFilter filter;
+	TextureWrap wrapS, wrapT;
+	unsigned int border;
+	mutable vector<unsigned char> touchedLines; // empty unless tracking
+
+	// Texel offsets split into a column and a row part that are added, so a
+	// bilinear lookup computes two of each. In the tiled layout x and y bits
+	// below the tile size interleave, x in the even bits.
+	size_t columnOffset(int x) const
+	{
+		if (layout == TEX_LAYOUT_LINEAR) return x;
+		int t = x & 7;
+		return (size_t)(x >> 3) * (TEX_TILE_SIZE * TEX_TILE_SIZE) + ((t & 1) | (t & 2) << 1 | (t & 4) << 2);
+	}
+	size_t rowOffset(const MipLevel &m, int y) const
+	{
+		if (layout == TEX_LAYOUT_LINEAR) return (size_t)y * m.width;
+		int t = y & 7;
+		return (size_t)(y >> 3) * m.tilesX * (TEX_TILE_SIZE * TEX_TILE_SIZE) + ((t & 1) << 1 | (t & 2) << 2 | (t & 4) << 3);
+	}
+	size_t texelIndex(const MipLevel &m, int x, int y) const {
+		return m.offset + columnOffset(x) + rowOffset(m, y);
+	}
+	void touch(size_t index) const {
+		touchedLines[index * sizeof(unsigned int) / TEX_CACHE_LINE] = 1;
+	}
+	void buildLevel(int level);
+	Color4f sampleNearest(const MipLevel &m, const Vector2f &uv) const;
+	void sampleBilinear(const MipLevel &m, const Vector2f &uv, float *bgra) const;
+};
+
+#endif // _MIP_TEXTURE_H_
@@ -3,22 +3,73 @@
 
 #include <vector>
 #include "mesh.h"
+#include "meshloader.h"
+#include "resourceloader.h"
 #include "glcontext.h"
 using namespace std;
 
+class ModelLoad;
+
 class ModelLoader
 {
 public:
-	ModelLoader(GLRenderingContext *rc) : rc(rc) {  }
+	ModelLoader(GLRenderingContext *rc) : rc(rc), buildBVH(false), cacheBVH(false), compress(false), reorder(false), lodLevels(1) {  }
+
+	// loaded meshes get a BVH, cached next to the model file if useCache is set
+	void EnableBVH(bool enable, const BVHBuildParams &params = BVHBuildParams(), bool useCache = true);
+
+	// Normals, tangents and binormals go to GL as GL_INT_2_10_10_10_REV and
+	// texture coordinates as GL_HALF_FLOAT where the driver supports them:
+	// 4 bytes instead of 12 for each direction and 4 instead of 8 for texture
+	// coordinates. The CPU copy in Mesh::data keeps full precision.
+	void EnableCompression(bool enable) { compress = enable; }
+
+	// loaded meshes get their triangles reordered for the vertex cache and
+	// their vertices renumbered in first-use order, see OptimizeMeshOrder
+	void EnableReordering(bool enable) { reorder = enable; }
+
+	// Loaded meshes get levels of detail, built in parallel across the
+	// file's objects and appended to the index buffer; see MeshLod and
+	// Mesh::SelectLod. Mesh::data and the BVH keep the full meshes.
+	void EnableLod(bool enable, int maxLevels = MESH_LOD_LEVELS) { lodLevels = enable ? maxLevels : 1; }
+
 	bool LoadObj(const char *filename, Mesh &mesh);
 	bool LoadObj(const char *filename, vector<Mesh *> &meshes);
 	bool LoadRaw(const char *filename, Mesh &mesh);
 	bool LoadRaw(const char *filename, vector<Mesh *> &meshes);
+
+	// The file is parsed, and reordered, simplified and given a BVH as set
+	// up here, on the loader's worker threads; the meshes are made when the
+	// loader publishes the task. Unless separateMeshes is set the file gives
+	// one mesh, as with LoadObj(filename, mesh).
+	my_shared_ptr<ModelLoad> LoadObjAsync(ResourceLoader &loader, const char *filename, bool separateMeshes = true);
+	my_shared_ptr<ModelLoad> LoadRawAsync(ResourceLoader &loader, const char *filename);
 private:
+	friend class ModelLoad;
+
 	GLRenderingContext *rc;
-	void read_num(const string &line, char &c, int &i, int &n);
-	bool loadObj(const char *filename, vector<Mesh *> &meshes, bool separateMeshes);
-	bool loadRaw(const char *filename, vector<Mesh *> &meshes, bool separateMeshes);
+	bool buildBVH, cacheBVH;
+	bool compress, reorder;
+	int lodLevels;
+	BVHBuildParams bvhParams;
+
+	void setOptions(MeshDataLoad &task) const;
+	void createMeshes(const MeshDataLoad &task, vector<Mesh *> &meshes);
+	bool load(MeshDataLoad &task, vector<Mesh *> &meshes);
+};
+
+// A model on its way through a ResourceLoader. Once it is ready the meshes
+// belong to the caller, as those of ModelLoader::LoadObj do.
+class ModelLoad : public MeshDataLoad
+{
+public:
+	vector<Mesh *> meshes;
+
+	ModelLoad(const ModelLoader &loader, const char *filename) : MeshDataLoad(filename), loader(loader) { }
+
+	bool Publish();
+private:
+	ModelLoader loader;
 };
 
 #endif // _MODEL_LOADER_H_
\ No newline at end of file
@@ -0,0 +1,129 @@
+#ifndef _PACKED_MESH_H_
+#define _PACKED_MESH_H_
+
+#include <vector>
+#include <string.h>
+#include "datatypes.h"
+#include "meshdata.h"
+
+using namespace std;
+
+// Octahedral unit vector: the direction projected onto the octahedron
+// |x| + |y| + |z| = 1, whose lower half is folded over the upper one, then
+// x and y as 16 bit snorms, x in the low half. The error stays below 0.008
+// degrees anywhere on the sphere.
+unsigned int EncodeOctahedral(const Vector3f &n);
+
+inline Vector3f DecodeOctahedral(unsigned int e)
+{
+	float x = max((short)(e & 0xFFFF) * (1.0f / 32767.0f), -1.0f);
+	float y = max((short)(e >> 16) * (1.0f / 32767.0f), -1.0f);
+	float z = 1.0f - fabs(x) - fabs(y);
+	if (z < 0.0f) {
+		float fx = (1.0f - fabs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+		y = (1.0f - fabs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+		x = fx;
+	}
+	Vector3f n(x, y, z);
+	n.Normalize();
+	return n;
+}
+
+// GL_INT_2_10_10_10_REV with x in the low bits, the packed format GL reads
+// normalized without shader changes
+unsigned int EncodeSnorm1010102(const Vector3f &n);
+
+// IEEE half floats, rounded to nearest even; magnitudes past 65504 become
+// infinities
+unsigned short FloatToHalf(float f);
+
+inline float HalfToFloat(unsigned short h)
+{
+	unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+	unsigned int exp = (h >> 10) & 0x1F, mant = h & 0x3FF;
+	unsigned int bits;
+	float f;
+	if (exp == 0) {
+		// zero or denormal, mant * 2^-24
+		f = mant * (1.0f / 16777216.0f);
+		return sign ? -f : f;
+	}
+	if (exp == 31) bits = sign | 0x7F800000u | mant << 13;
+	else bits = sign | (exp + 112) << 23 | mant << 13;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+// per vertex tangents and binormals along the texture axes, as
+// Mesh::RecalcTangents uploads them; each vertex gets the frame of the last
+// face that uses it
+void ComputeTangents(const Vector3f *vertices, const Vector2f *texCoords, const int *indices,
+	int indicesCount, Vector3f *tangents, Vector3f *binormals);
+
+struct PackedPosition
+{
+	unsigned short x, y, z;
+};
+
+struct PackedTexCoord
+{
+	unsigned short u, v; // half floats
+};
+
+// Compressed copy of a MeshData: positions quantized to 16 bits per axis
+// within the mesh's bounding box, normals and the optional tangent frame
+// octahedral in 32 bits, texture coordinates as half floats. That is 14
+// bytes a vertex instead of 32, and 8 instead of 24 for the tangent frame.
+//
+// The tracer decodes vertices as it intersects and shades them, see
+// CompressedBVH::Build. Quantization moves vertices by up to half a step,
+// the box size / 131070, so acceleration structures for it are built over
+// the decoded positions Unpack returns; shared vertices decode to the same
+// point and the mesh stays watertight.
+class PackedMeshData
+{
+public:
+	vector<PackedPosition> positions;
+	vector<unsigned int> normals;
+	vector<PackedTexCoord> texCoords;
+	vector<unsigned int> tangents, binormals;
+	vector<int> indices;
+	Vector3f origin, scale; // position = origin + q * scale
+
+	PackedMeshData() : origin(0.0f), scale(0.0f) { }
+
+	// encodes in parallel; the tangent frame needs normals and texture coordinates
+	void Pack(const MeshData &mesh, bool withTangents = false);
+	void Clear();
+	// mesh gets the decoded positions, normals and texture coordinates
+	void Unpack(MeshData &mesh) const;
+
+	bool HasNormals() const { return !normals.empty(); }
+	bool HasTexCoords() const { return !texCoords.empty(); }
+	bool HasTangents() const { return !tangents.empty(); }
+	int GetVerticesCount() const { return (int)positions.size(); }
+	int GetFaceCount() const { return (int)indices.size() / 3; }
+
+	Vector3f GetVertex(int i) const {
+		const PackedPosition &p = positions[i];
+		return Vector3f(origin.x + p.x * scale.x, origin.y + p.y * scale.y, origin.z + p.z * scale.z);
+	}
+	Vector3f GetNormal(int i) const { return DecodeOctahedral(normals[i]); }
+	Vector3f GetTangent(int i) const { return DecodeOctahedral(tangents[i]); }
+	Vector3f GetBinormal(int i) const { return DecodeOctahedral(binormals[i]); }
+	Vector2f GetTexCoord(int i) const {
+		return Vector2f(HalfToFloat(texCoords[i].u), HalfToFloat(texCoords[i].v));
+	}
+
+	// at barycentric u, v of a face as RayHit reports them
+	Vector3f InterpolateNormal(int face, float u, float v) const;
+	Vector2f InterpolateTexCoord(int face, float u, float v) const;
+
+	size_t GetMemoryUsage() const {
+		return positions.size() * sizeof(PackedPosition) + normals.size() * sizeof(unsigned int) +
+			texCoords.size() * sizeof(PackedTexCoord) + (tangents.size() + binormals.size()) * sizeof(unsigned int) +
+			indices.size() * sizeof(int);
+	}
+};
+
+#endif // _PACKED_MESH_H_
@@ -0,0 +1,41 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include "platform.h"
+
+class ParallelTask
+{
+public:
+	virtual ~ParallelTask() { }
+	virtual void Run(int begin, int end) = 0;
+};
+
+// Splits [begin, end) into chunks of grainSize items (0 picks a size from the
+// thread count) and runs them on all threads, the calling thread included.
+// The worker threads are kept between calls. Only one call uses them at a
+// time; nested calls, or calls from other threads meanwhile, run serially.
+void RunParallel(ParallelTask &task, int begin, int end, int grainSize = 0);
+
+int GetNumberOfThreads();
+void SetNumberOfThreads(int count); // 0 to use every core
+
+template<class Func>
+class ParallelFunc : public ParallelTask
+{
+public:
+	ParallelFunc(const Func &func) : func(func) { }
+	void Run(int begin, int end) { func(begin, end); }
+private:
+	const Func &func;
+	ParallelFunc &operator=(const ParallelFunc &);
+};
+
+// func(int begin, int end) is called for every chunk of the range
+template<class Func>
+void ParallelFor(int begin, int end, const Func &func, int grainSize = 0)
+{
+	ParallelFunc<Func> task(func);
+	RunParallel(task, begin, end, grainSize);
+}
+
+#endif // _PARALLEL_H_
@@ -0,0 +1,159 @@
+#ifndef _PLATFORM_H_
+#define _PLATFORM_H_
+
+#include <stddef.h>
+
+// Thin layer over the OS, implemented in platform_win32.cpp and
+// platform_posix.cpp. Everything outside the windowing code uses only this.
+
+enum FileMode
+{
+	FILE_READ,
+	FILE_WRITE // creates the file or truncates an existing one
+};
+
+class File
+{
+public:
+	File();
+	~File();
+
+	bool Open(const char *filename, FileMode mode);
+	void Close();
+	bool IsOpen() const;
+
+	// both fail unless all size bytes were transferred
+	bool Read(void *buffer, size_t size);
+	bool Write(const void *buffer, size_t size);
+
+	bool Skip(long long bytes);
+	long long GetSize() const;
+
+	// reads at an absolute offset; several threads may call it at once on
+	// a file opened for reading
+	bool ReadAt(long long offset, void *buffer, size_t size);
+private:
+	void *handle;
+
+	File(const File &);
+	File &operator=(const File &);
+};
+
+// Read-only memory mapping of a whole file. Pages are loaded by the OS on
+// first access, so opening a large file costs almost nothing.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const char *filename);
+	void Close();
+
+	bool IsOpen() const { return data != NULL; }
+	const void *GetData() const { return data; }
+	size_t GetSize() const { return size; }
+private:
+	const void *data;
+	size_t size;
+	void *hMapping;
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+// Moves from over to, replacing to if it exists. Where a rename can't
+// touch open files (Windows) it fails while to is open or mapped; otherwise
+// readers that have the old file open or mapped keep it.
+bool ReplaceFileWith(const char *to, const char *from);
+
+// seconds since an arbitrary point, monotonic
+double GetTime();
+void SleepMs(int milliseconds);
+
+int GetProcessorCount();
+int GetProcessIdentifier();
+
+// bytes, the largest resident set the process has had so far
+size_t GetPeakMemoryUsage();
+
+class Thread
+{
+public:
+	typedef void (*ThreadFunc)(void *param);
+
+	Thread();
+	~Thread(); // joins
+
+	bool Start(ThreadFunc func, void *param);
+	void Join();
+	bool IsRunning() const { return handle != NULL; }
+private:
+	void *handle;
+
+	Thread(const Thread &);
+	Thread &operator=(const Thread &);
+};
+
+class Mutex
+{
+public:
+	Mutex();
+	~Mutex();
+
+	void Lock();
+	void Unlock();
+private:
+	void *handle;
+
+	Mutex(const Mutex &);
+	Mutex &operator=(const Mutex &);
+	friend class ConditionVariable;
+};
+
+// Lets threads sleep until another changes state guarded by a mutex. Wait
+// unlocks the mutex while it sleeps and locks it again before returning; it
+// may also return without a notification, so wait in a loop on the state.
+class ConditionVariable
+{
+public:
+	ConditionVariable();
+	~ConditionVariable();
+
+	void Wait(Mutex &mutex);
+	void NotifyOne();
+	void NotifyAll();
+private:
+	void *handle;
+
+	ConditionVariable(const ConditionVariable &);
+	ConditionVariable &operator=(const ConditionVariable &);
+};
+
+// locks for the lifetime of the object
+class MutexLock
+{
+public:
+	MutexLock(Mutex &mutex) : mutex(mutex) { mutex.Lock(); }
+	~MutexLock() { mutex.Unlock(); }
+private:
+	Mutex &mutex;
+
+	MutexLock(const MutexLock &);
+	MutexLock &operator=(const MutexLock &);
+};
+
+// returns the value before the addition
+int AtomicAdd(volatile int *value, int add);
+// stores exchange if *value equals comparand, returns the previous value;
+// like AtomicAdd a full memory barrier
+int AtomicCompareExchange(volatile int *value, int exchange, int comparand);
+
+// per-thread storage for plain data, no constructors or destructors
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#endif // _PLATFORM_H_
@@ -0,0 +1,144 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdio.h>
+#include <vector>
+#include "platform.h"
+
+using namespace std;
+
+// Scoped timers for CPU rendering and loading, compiled in only when
+// RT_PROFILE is defined; otherwise the macros below expand to nothing.
+//
+// PROFILE_SCOPE(name) records a trace event and suits coarse work: frames,
+// rows, file loads. PROFILE_STAGE(stage) only adds its time to per-thread
+// totals, cheap enough for per-ray code. Every thread writes to its own
+// slot, claimed with an atomic increment, so nothing takes a lock.
+//
+// ProfileBeginFrame and ProfileEndFrame gather the slots; they must be called
+// while no other thread is inside a profiled scope, e.g. between renders.
+
+#define PROFILE_MAX_THREADS 256
+
+enum ProfileStage
+{
+	PROF_CAMERA,    // camera ray generation
+	PROF_INTERSECT, // closest-hit queries
+	PROF_SHADOW,    // shadow ray queries
+	PROF_SHADING,   // lighting at hit points
+	PROF_STAGE_COUNT
+};
+
+enum ProfileCounter
+{
+	PROF_RAYS,
+	PROF_SHADOW_RAYS,
+	PROF_BYTES_LOADED,
+	PROF_BYTES_WRITTEN,
+	PROF_COUNTER_COUNT
+};
+
+struct ProfileEvent
+{
+	const char *name; // string literal
+	double start, end;
+	int thread;
+};
+
+struct ProfileScopeTotal
+{
+	const char *name;
+	long long calls;
+	double time;
+};
+
+struct ProfileFrame
+{
+	double start, end;
+	int threads;                            // slots used during the frame
+	double stageTime[PROF_STAGE_COUNT];     // seconds, summed over threads
+	long long stageCalls[PROF_STAGE_COUNT];
+	long long counters[PROF_COUNTER_COUNT];
+	vector<ProfileScopeTotal> scopes;
+
+	ProfileFrame();
+};
+
+struct ProfileThreadData
+{
+	int index;
+	double stageTime[PROF_STAGE_COUNT];
+	long long stageCalls[PROF_STAGE_COUNT];
+	long long counters[PROF_COUNTER_COUNT];
+	vector<ProfileEvent> events;
+};
+
+// NULL once every slot is taken
+ProfileThreadData *GetProfileThreadData();
+
+bool IsProfilerCompiledIn();
+const char *GetProfileStageName(int stage);
+const char *GetProfileCounterName(int counter);
+
+// BeginFrame drops stage totals gathered so far, their events go to the trace
+void ProfileBeginFrame();
+void ProfileEndFrame(ProfileFrame &frame);
+void PrintProfileFrame(FILE *f, const ProfileFrame &frame);
+
+// every event and frame since the last ClearProfile, in the Chrome
+// trace event format (chrome://tracing, Perfetto)
+bool WriteChromeTrace(const char *filename);
+void ClearProfile();
+
+class ProfileScope
+{
+public:
+	ProfileScope(const char *name) : name(name), start(GetTime()) { }
+	~ProfileScope()
+	{
+		ProfileThreadData *t = GetProfileThreadData();
+		if (!t) return;
+		ProfileEvent e = { name, start, GetTime(), t->index };
+		t->events.push_back(e);
+	}
+private:
+	const char *name;
+	double start;
+};
+
+class ProfileStageScope
+{
+public:
+	ProfileStageScope(ProfileStage stage) : stage(stage), start(GetTime()) { }
+	~ProfileStageScope()
+	{
+		double end = GetTime();
+		ProfileThreadData *t = GetProfileThreadData();
+		if (!t) return;
+		t->stageTime[stage] += end - start;
+		t->stageCalls[stage]++;
+	}
+private:
+	ProfileStage stage;
+	double start;
+};
+
+inline void ProfileCount(ProfileCounter counter, long long n)
+{
+	ProfileThreadData *t = GetProfileThreadData();
+	if (t) t->counters[counter] += n;
+}
+
+#ifdef RT_PROFILE
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_STAGE(stage) ProfileStageScope PROFILE_CONCAT(profileStage, __LINE__)(stage)
+#define PROFILE_COUNT(counter, n) ProfileCount(counter, n)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_STAGE(stage)
+#define PROFILE_COUNT(counter, n)
+#endif
+
+#endif // _PROFILER_H_
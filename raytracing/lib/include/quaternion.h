@@ -28,6 +28,10 @@ public:
 	static Quaternion Subtract(const Quaternion &q1, const Quaternion &q2);
 	static Quaternion Multiply(const Quaternion &q1, const Quaternion &q2);
 	static Quaternion Multiply(const Quaternion &q1, float scale);
+	static float Dot(const Quaternion &q1, const Quaternion &q2);
+
+	// spherical interpolation along the shorter arc, t in [0, 1]
+	static Quaternion Slerp(const Quaternion &q1, const Quaternion &q2, float t);
 
 	Quaternion operator+(const Quaternion &q) const;
 	Quaternion operator-(const Quaternion &q) const;
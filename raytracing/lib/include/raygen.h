@@ -0,0 +1,79 @@
+#ifndef _RAYGEN_H_
+#define _RAYGEN_H_
+
+#include <vector>
+#include "datatypes.h"
+#include "geometry.h"
+
+using namespace std;
+
+#define RAY_PACKET_SIZE 4
+
+// Camera rays for RAY_PACKET_SIZE neighbouring pixels of one row. All rays
+// start at the camera position, normalized directions are stored per component.
+struct RayPacket
+{
+	Point3f origin;
+	float dx[RAY_PACKET_SIZE];
+	float dy[RAY_PACKET_SIZE];
+	float dz[RAY_PACKET_SIZE];
+	int x, y;  // first pixel
+	int count; // valid rays, less than RAY_PACKET_SIZE only at the end of a row
+
+	Ray GetRay(int i) const {
+		return Ray(origin, Vector3f(dx[i], dy[i], dz[i]));
+	}
+};
+
+// How a ray changes from one pixel to the next, after Igehy's "Tracing Ray
+// Differentials": origin and direction derivatives along the image x and y.
+// Camera rays only have direction derivatives; hits give them positional ones.
+struct RayDifferential
+{
+	Vector3f dPdx, dPdy;
+	Vector3f dDdx, dDdy;
+};
+
+// CPU version of GetCameraRay from shader.frag.glsl. Camera space directions
+// only depend on the column and the row, so they are kept in two tables that
+// are rebuilt when the resolution or fov change; per frame only the camera
+// basis is applied, as a 3x3 transform of a whole packet at once.
+class CameraRayGenerator
+{
+public:
+	CameraRayGenerator();
+
+	void SetResolution(int width, int height, float fovDegrees);
+	// camera to world transform, as returned by RaytraceCamera::GetViewMatrix
+	void SetCamera(const Matrix44f &view);
+	// random sub-pixel offsets, a different seed gives a different pattern
+	void SetJitter(bool enable, unsigned int seed = 0);
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	float GetFov() const { return fov; }
+	bool IsJittered() const { return jitter; }
+	int GetPacketsPerRow() const { return (width + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE; }
+
+	// packets must have room for GetPacketsPerRow() packets, row 0 is the top one
+	void GenerateRow(int y, RayPacket *packets) const;
+	Ray GetRay(int x, int y) const;
+	// differentials of a camera ray with normalized direction dir, the
+	// derivative of GetCameraRay's direction over one pixel
+	void GetDifferential(const Vector3f &dir, RayDifferential &diff) const;
+private:
+	int width, height;
+	float fov;
+	float pixelSizeX, pixelSizeY; // in camera space, scales the jitter
+	vector<float> columnDirs;     // x of the camera space direction, padded to whole packets
+	vector<float> rowDirs;        // y of the camera space direction, z is always -1
+
+	Matrix33f basis;
+	Point3f origin;
+	bool jitter;
+	unsigned int seed;
+
+	void getJitter(int x, int y, float &jx, float &jy) const;
+};
+
+#endif // _RAYGEN_H_
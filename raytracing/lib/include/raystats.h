@@ -0,0 +1,61 @@
+#ifndef _RAY_STATS_H_
+#define _RAY_STATS_H_
+
+#include <stdio.h>
+#include "image.h"
+
+enum RayType
+{
+	RAY_CAMERA,
+	RAY_REFLECTION,
+	RAY_REFRACTION,
+	RAY_SHADOW,
+	RAY_TYPE_COUNT
+};
+
+#define RAY_STATS_MAX_DEPTH 16
+
+// Ray counts of a frame or any part of it. Steps are BVH nodes or grid
+// cells visited, primitive tests include the unbounded planes.
+struct RayStats
+{
+	long long rays[RAY_TYPE_COUNT];
+	long long depthRays[RAY_STATS_MAX_DEPTH]; // rays cast at each bounce depth, shadow rays included
+	long long steps;
+	long long primTests;
+
+	RayStats() { Clear(); }
+
+	void Clear();
+	void Add(const RayStats &stats);
+	long long GetRaysCount() const;
+	void Print(FILE *f) const;
+};
+
+// what the heatmaps are made from, one per pixel
+struct PixelRayStats
+{
+	unsigned int rays;
+	unsigned int steps;
+	unsigned int primTests;
+	unsigned int maxDepth;
+};
+
+enum HeatmapChannel
+{
+	HEATMAP_RAYS,
+	HEATMAP_STEPS,
+	HEATMAP_PRIM_TESTS,
+	HEATMAP_DEPTH,
+	HEATMAP_CHANNEL_COUNT
+};
+
+const char *GetRayTypeName(int type);
+const char *GetHeatmapChannelName(int channel);
+
+// 24-bit image of one channel, blue for the cheapest pixels to red for the
+// most expensive. Values are scaled to the 99th percentile so that a few
+// outliers don't flatten everything else.
+bool MakeHeatmap(const PixelRayStats *pixels, int width, int height, HeatmapChannel channel, Image &image);
+
+#endif // _RAY_STATS_H_
@@ -0,0 +1,85 @@
+#ifndef _RAYTRACER_H_
+#define _RAYTRACER_H_
+
+#include "datatypes.h"
+#include "geometry.h"
+#include "scene.h"
+#include "raygen.h"
+#include "raystats.h"
+
+#define TRACE_DEPTH 3
+
+struct RenderStats
+{
+	long long cameraRays;
+	long long rays;        // camera, shadow and secondary rays
+	double rayGenTime;     // seconds, summed over all threads
+	double traceTime;      // seconds, summed over all threads
+	double frameTime;      // wall clock seconds
+
+	RenderStats() : cameraRays(0), rays(0), rayGenTime(0), traceTime(0), frameTime(0) { }
+
+	// per thread, so the numbers don't depend on the core count
+	double RayGenRate() const { return rayGenTime > 0 ? cameraRays / rayGenTime : 0; }
+	double TraceRate() const { return traceTime > 0 ? rays / traceTime : 0; }
+};
+
+// CPU port of shader.frag.glsl: the same Blinn-Phong shading, hard shadows,
+// and mirror and glass bounces down to TRACE_DEPTH levels.
+class RayTracer
+{
+public:
+	RayTracer() : maxDepth(TRACE_DEPTH), parallel(true), rayStatsEnabled(false), rayDifferentials(true) { }
+
+	void SetMaxDepth(int depth) { maxDepth = depth; }
+	int GetMaxDepth() const { return maxDepth; }
+
+	// rows are spread over all threads unless disabled, e.g. because
+	// the caller already renders several frames in parallel
+	void SetParallel(bool enable) { parallel = enable; }
+
+	// Textures are filtered over each hit's footprint, from ray differentials
+	// that start at the camera and follow mirror and glass bounces. Without
+	// them, or in Trace, the finest mip level is sampled.
+	void EnableRayDifferentials(bool enable) { rayDifferentials = enable; }
+	bool IsRayDifferentialsEnabled() const { return rayDifferentials; }
+
+	// Opt-in ray statistics: counts by ray type and depth, traversal steps
+	// and primitive tests, for the frame and per pixel. Off by default, since
+	// counting slows tracing down.
+	void EnableRayStats(bool enable) { rayStatsEnabled = enable; }
+	bool IsRayStatsEnabled() const { return rayStatsEnabled; }
+	const RayStats &GetRayStats() const { return rayStats; }
+	const PixelRayStats *GetPixelRayStats() const { return pixelStats.empty() ? NULL : pixelStats.data(); }
+
+	// pixels holds camera.GetWidth() * camera.GetHeight() colors, top row first
+	void Render(const Scene &scene, const CameraRayGenerator &camera, Color3f *pixels);
+	Color3f Trace(const Scene &scene, const Ray &ray) const;
+
+	const RenderStats &GetStats() const { return stats; }
+private:
+	// what castRay counts, one per row so threads never share it
+	struct TraceContext
+	{
+		long long rays;
+		RayStats *stats;       // NULL unless ray stats are enabled
+		PixelRayStats *pixel;
+
+		TraceContext() : rays(0), stats(NULL), pixel(NULL) { }
+	};
+
+	int maxDepth;
+	bool parallel;
+	RenderStats stats;
+	bool rayStatsEnabled;
+	RayStats rayStats;
+	vector<PixelRayStats> pixelStats;
+	bool rayDifferentials;
+
+	// diff is NULL when the ray carries no differentials
+	Color3f castRay(const Scene &scene, const Ray &ray, const RayDifferential *diff, int objFrom,
+		int depth, RayType type, TraceContext &ctx) const;
+	static void countRay(TraceContext &ctx, RayType type, int depth, const TraversalStats &traversal);
+};
+
+#endif // _RAYTRACER_H_
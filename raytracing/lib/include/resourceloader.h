@@ -0,0 +1,144 @@
+#ifndef _RESOURCE_LOADER_H_
+#define _RESOURCE_LOADER_H_
+
+#include <deque>
+#include <vector>
+#include <string>
+#include "platform.h"
+#include "sharedptr.h"
+#include "meshdata.h"
+#include "meshloader.h"
+#include "meshlod.h"
+#include "bvh.h"
+#include "image.h"
+
+using namespace std;
+
+enum LoadState
+{
+	LOAD_QUEUED,
+	LOAD_LOADING,
+	LOAD_LOADED,  // waiting for ResourceLoader::Publish
+	LOAD_READY,
+	LOAD_FAILED   // also loads dropped by the loader's destructor
+};
+
+// One resource on its way through a ResourceLoader. Load runs on a worker
+// thread and does the file reading and parsing, everything that needs no GL;
+// Publish then runs on the thread that calls ResourceLoader::Publish, the
+// render thread, and makes the GL objects. The handle Submit returns works
+// as a future: the results are read from the task once IsReady.
+class ResourceLoader;
+
+class LoadTask : public RefCounted
+{
+public:
+	LoadTask() : state(LOAD_QUEUED), loader(NULL) { }
+	virtual ~LoadTask() { }
+
+	virtual bool Load() = 0;
+	virtual bool Publish() { return true; }
+
+	LoadState GetState() const { return (LoadState)state; }
+	bool IsReady() const { return state == LOAD_READY; }
+	bool IsFailed() const { return state == LOAD_FAILED; }
+	bool IsDone() const { return state == LOAD_READY || state == LOAD_FAILED; }
+private:
+	friend class ResourceLoader;
+	volatile int state; // changed under the loader's mutex
+	ResourceLoader *loader; // the one it was submitted to, only compared
+
+	LoadTask(const LoadTask &);
+	LoadTask &operator=(const LoadTask &);
+};
+
+// the whole file, bytes as they are
+bool ReadTextFile(const char *filename, string &text);
+
+// A model file parsed into a MeshData, with the optional steps ModelLoader
+// applies to it; set the options before submitting.
+class MeshDataLoad : public LoadTask
+{
+public:
+	string filename;
+	bool raw;            // LoadRawMeshData instead of LoadObjMeshData
+	bool separateMeshes;
+	bool reorder;        // OptimizeMeshOrder
+	int lodLevels;       // BuildMeshLods when more than 1
+	bool buildBVH;
+	bool cacheBVH;       // LoadOrBuildBVH with the file's GetBVHCachePath
+	BVHBuildParams bvhParams;
+
+	my_shared_ptr<MeshData> data;
+	vector<SubMesh> subMeshes;
+	vector<MeshLod> lods;
+	my_shared_ptr<BVH> bvh;
+
+	MeshDataLoad(const char *filename)
+		: filename(filename), raw(false), separateMeshes(true), reorder(false),
+		lodLevels(1), buildBVH(false), cacheBVH(true) { }
+
+	bool Load();
+};
+
+class ImageLoad : public LoadTask
+{
+public:
+	string filename;
+	Image image;
+
+	ImageLoad(const char *filename) : filename(filename) { }
+
+	bool Load() { return image.LoadTga(filename.c_str()); }
+};
+
+// Background loading. Tasks are loaded by the worker threads in the order
+// they were submitted, and loaded tasks are published in the order they
+// finished. Publish is meant to be called once a frame by the render
+// thread; the loader itself never touches GL.
+class ResourceLoader
+{
+public:
+	// 0 threads leaves one core for the caller, with at least one worker
+	ResourceLoader(int threads = 0);
+	~ResourceLoader(); // drops the tasks not loaded yet and joins
+
+	// the loader takes a reference of its own until the task is done
+	template<class T>
+	my_shared_ptr<T> Submit(T *task) {
+		my_shared_ptr<T> handle(task);
+		submit(task);
+		return handle;
+	}
+
+	// Publishes loaded tasks until budget seconds have passed, at least one
+	// when there is one, so a large budget drains everything loaded so far.
+	// Returns how many were published.
+	int Publish(double budget);
+
+	// Waits for a task submitted here to load, or loads it on the caller if
+	// no worker has started it, and publishes it at once: for resources the
+	// next frame can't do without. True if it is ready; a task submitted to
+	// another loader, or one a concurrent Publish has taken, isn't waited for.
+	bool Finish(LoadTask *task);
+
+	// tasks submitted and not yet published or failed
+	int GetPendingCount();
+private:
+	Thread *threads;
+	int threadCount;
+	Mutex mutex;
+	ConditionVariable wake, loaded;
+	deque<my_shared_ptr<LoadTask> > queue, finished;
+	int pending;
+	bool quit;
+
+	void submit(LoadTask *task);
+	void publish(LoadTask *task);
+	static void workerMain(void *param);
+
+	ResourceLoader(const ResourceLoader &);
+	ResourceLoader &operator=(const ResourceLoader &);
+};
+
+#endif // _RESOURCE_LOADER_H_
@@ -0,0 +1,192 @@
+#ifndef _SCENE_H_
+#define _SCENE_H_
+
+#include <vector>
+#include "datatypes.h"
+#include "geometry.h"
+#include "bvh.h"
+#include "grid.h"
+#include "miptexture.h"
+#include "texcache.h"
+#include "camera.h"
+
+using namespace std;
+
+#define SCENE_INV_PI 0.318309886f
+#define SCENE_INV_2PI 0.159154943f
+
+// material ids are the ones used by shaders/shader.frag.glsl
+enum MaterialType
+{
+	MAT_DIFFUSE = 0,
+	MAT_DIFFUSE_SPECULAR = 1,
+	MAT_MIRROR = 2,
+	MAT_MIRROR_SPECULAR = 3,
+	MAT_GLASS = 4
+};
+
+struct Material
+{
+	Color3f color;
+	int type;
+	float specPower;
+	float refractIndex;
+	int texture;      // into Scene::textures, modulates color; -1 for none
+	int pagedTexture; // handle in Scene::textureCache, used if texture is -1
+	float texScale;   // texture coordinates are multiplied by it
+
+	Material() : type(MAT_DIFFUSE), specPower(40.0f), refractIndex(0.3f),
+		texture(-1), pagedTexture(-1), texScale(1.0f) { }
+	Material(const Color3f &color, int type, float specPower, float refractIndex)
+		: color(color), type(type), specPower(specPower), refractIndex(refractIndex),
+		texture(-1), pagedTexture(-1), texScale(1.0f) { }
+};
+
+struct SceneSphere
+{
+	Material base;
+	Point3f center;
+	float radius;
+
+	SceneSphere() : radius(0) { }
+	SceneSphere(const Point3f &center, float radius, const Material &base)
+		: base(base), center(center), radius(radius) { }
+
+	AABox GetBounds() const {
+		return AABox(center - Vector3f(radius), center + Vector3f(radius));
+	}
+
+	// same test as the shader: spheres behind the ray origin are never hit
+	bool Intersect(const Ray &ray, float &t) const
+	{
+		float r2 = radius * radius;
+		Vector3f u = center - ray.p;
+		float d = Dot(u, ray.v);
+		if (d < 0.0f) return false;
+		float d2 = Dot(u, u) - d*d;
+		if (d2 > r2) return false;
+
+		t = d - sqrt(r2 - d2);
+		return t >= 0.0f;
+	}
+
+	// latitude-longitude mapping around the y axis, v = 0 at the top; takes
+	// the unit normal at the hit point
+	static Vector2f GetTexCoords(const Vector3f &n)
+	{
+		float y = n.y < -1.0f ? -1.0f : (n.y > 1.0f ? 1.0f : n.y);
+		return Vector2f(atan2(n.z, n.x) * SCENE_INV_2PI + 0.5f, acos(y) * SCENE_INV_PI);
+	}
+	// change of GetTexCoords for a change dn of the normal; ignores the seam
+	static Vector2f GetTexDerivative(const Vector3f &n, const Vector3f &dn)
+	{
+		float r2 = max(n.x * n.x + n.z * n.z, 1e-6f);
+		return Vector2f((n.x * dn.z - n.z * dn.x) / r2 * SCENE_INV_2PI, -dn.y / sqrt(r2) * SCENE_INV_PI);
+	}
+};
+
+struct ScenePlane
+{
+	Material base;
+	Vector3f normal;
+	float D;
+
+	ScenePlane() : D(0) { }
+	ScenePlane(const Vector3f &normal, float D, const Material &base)
+		: base(base), normal(normal), D(D) { }
+
+	bool Intersect(const Ray &ray, float &t) const
+	{
+		float d = Dot(ray.v, normal);
+		if (d == 0.0f) return false;
+		t = -(D + Dot(ray.p, normal)) / d;
+		return t >= 0.0f;
+	}
+
+	// planar mapping, a unit of texture coordinates per unit of distance
+	void GetTexAxes(Vector3f &u, Vector3f &v) const
+	{
+		u = Normalize(Cross(normal, fabs(normal.y) < 0.9f ? Vector3f(0, 1, 0) : Vector3f(0, 0, 1)));
+		v = Cross(normal, u);
+	}
+	Vector2f GetTexCoords(const Point3f &p) const
+	{
+		Vector3f u, v;
+		GetTexAxes(u, v);
+		return Vector2f(Dot(p, u), Dot(p, v));
+	}
+};
+
+enum SceneAccelType
+{
+	ACCEL_NONE,
+	ACCEL_BVH,
+	ACCEL_GRID,
+	ACCEL_HIERARCHICAL_GRID
+};
+
+struct SceneHit
+{
+	float t;
+	int object; // spheres first, then planes, -1 if nothing was hit
+
+	SceneHit() : t(FLT_MAX), object(-1) { }
+};
+
+// CPU counterpart of the uniforms in shader.frag.glsl. Spheres go into the
+// selected acceleration structure; infinite planes can't be bounded and are
+// kept in a separate list that is tested directly.
+class Scene
+{
+public:
+	vector<SceneSphere> spheres;
+	vector<ScenePlane> planes;
+	vector<MipTexture> textures;
+	TextureCache *textureCache; // not owned, NULL unless materials use paged textures
+
+	Point3f lightSource;
+	Color3f lightAmbient;
+	Color3f backColor;
+
+	Scene();
+
+	// call again whenever spheres are added or moved
+	void Build(SceneAccelType accelType = ACCEL_GRID, const GridParams &gridParams = GridParams());
+	SceneAccelType GetAccelType() const { return accelType; }
+	size_t GetAccelMemoryUsage() const;
+
+	int GetObjectsCount() const { return (int)(spheres.size() + planes.size()); }
+
+	// objFrom is skipped, as in the shader, to avoid self intersections.
+	// stats, if given, receives the traversal steps and objects tested.
+	bool Intersect(const Ray &ray, int objFrom, SceneHit &hit, TraversalStats *stats = NULL) const;
+	bool IntersectAny(const Ray &ray, int objFrom, float tmax, TraversalStats *stats = NULL) const;
+private:
+	SceneAccelType accelType;
+	vector<AABox> sphereBounds;
+	BVH bvh;
+	UniformGrid grid;
+	HierarchicalGrid hgrid;
+
+	template<class Intersector, class Stats>
+	bool traverseCounted(const Ray &ray, float &tmax, Intersector &intersector, Stats &stats) const;
+	template<class Intersector>
+	bool traverseSpheres(const Ray &ray, float &tmax, Intersector &intersector, TraversalStats *stats) const;
+};
+
+// the room with three spheres shown by MainWindow
+void MakeRoomScene(Scene &scene);
+// the view of the room MainWindow starts with
+void SetRoomStartView(Camera &camera);
+
+// the room with textures on its walls and mirror spheres: three procedural
+// textures of textureSize^2 texels, repeated every few units, for measuring
+// texture filtering and its memory traffic
+void MakeTexturedRoomScene(Scene &scene, int textureSize);
+
+// Haines' sphere flake on a floor: every sphere carries nine children of a
+// third of its radius, (9^(levels+1) - 1) / 8 spheres in total. The top
+// sphere has radius 1 and sits at the origin.
+void MakeSphereFlakeScene(Scene &scene, int levels);
+
+#endif // _SCENE_H_
@@ -0,0 +1,27 @@
+#ifndef _SCENE_FILE_H_
+#define _SCENE_FILE_H_
+
+#include "scene.h"
+
+// Text scene description, one statement per line, '#' starts a comment:
+//
+//   light <x y z>
+//   ambient <r g b>
+//   background <r g b>
+//   material <name> <type> <r g b> [specPower [refractIndex]]
+//   sphere <x y z> <radius> <material>
+//   plane <nx ny nz> <D> <material>
+//   texture <material> <image.tga> [scale]
+//   room
+//
+// type is diffuse, diffuse_specular, mirror, mirror_specular or glass.
+// Materials must be declared before use, "room" adds MakeRoomScene's
+// objects and lighting. "texture" modulates a material's color with a mip
+// mapped image, relative paths start at the scene file's directory; scale
+// multiplies the texture coordinates (default 1). Tiled .rtt files are
+// opened in scene.textureCache, which the caller sets up beforehand, and
+// paged in while rendering. On failure errorLine receives the offending line,
+// or 0 if the file couldn't be opened.
+bool LoadSceneFile(const char *filename, Scene &scene, int *errorLine = NULL);
+
+#endif // _SCENE_FILE_H_
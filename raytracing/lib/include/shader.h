@@ -6,6 +6,7 @@
 #include "glcontext.h"
 #include "vertexbuffer.h"
 #include "sharedptr.h"
+#include "resourceloader.h"
 #include <fstream>
 #include <vector>
 #include <string>
@@ -34,7 +35,7 @@ public:
 	bool CompileFile(const char *filename);
 	bool CompileSource(const char *source, int length = 0);
 private:
-	struct Shared
+	struct Shared : public RefCounted
 	{
 		GLuint handle;
 		bool compiled;
@@ -45,7 +46,7 @@ private:
 	bool _log();
 };
 
-class _PO_Shared
+class _PO_Shared : public RefCounted
 {
 private:
 	GLRenderingContext *rc;
@@ -140,4 +141,23 @@ private:
 	}
 };
 
+// The two shader files read on a ResourceLoader's worker, compiled and
+// linked when the loader publishes the task
+class ProgramLoad : public LoadTask
+{
+public:
+	string vertPath, fragPath;
+	ProgramObject *program; // made by Publish, shares its GL program with copies
+
+	ProgramLoad(GLRenderingContext *rc, const char *vertPath, const char *fragPath)
+		: vertPath(vertPath), fragPath(fragPath), program(NULL), rc(rc) { }
+	~ProgramLoad() { delete program; }
+
+	bool Load();
+	bool Publish();
+private:
+	GLRenderingContext *rc;
+	string vertSource, fragSource;
+};
+
 #endif // _SHADER_H_
\ No newline at end of file
@@ -1,16 +1,44 @@
 #ifndef _SHARED_PTR_H_
 #define _SHARED_PTR_H_
 
+#include "platform.h"
+
+// Base of the objects my_shared_ptr holds: the count lives in the object,
+// so sharing one costs no allocation. Copies of an object start with no
+// owners of their own.
+class RefCounted
+{
+public:
+	RefCounted() : refCount(0) { }
+	RefCounted(const RefCounted &) : refCount(0) { }
+	RefCounted &operator=(const RefCounted &) { return *this; }
+
+	void AddRef() const { AtomicAdd(&refCount, 1); }
+	// true when that was the last owner
+	bool Release() const { return AtomicAdd(&refCount, -1) == 1; }
+	int GetRefCount() const { return refCount; }
+private:
+	mutable volatile int refCount;
+};
+
+// Reference counting handle to a T derived from RefCounted. The count is
+// changed atomically, so handles to one object can be copied and destroyed
+// on different threads; one handle object, like any other value, must not
+// be assigned on one thread while another reads it.
 template<class T>
 class my_shared_ptr
 {
 public:
 	my_shared_ptr(T *ptr = 0) : ptr(ptr) {
-		refCount = new int(1);
+		if (ptr) ptr->AddRef();
 	}
 
-	my_shared_ptr(const my_shared_ptr &p) {
-		addref(p);
+	my_shared_ptr(const my_shared_ptr &p) : ptr(p.ptr) {
+		if (ptr) ptr->AddRef();
+	}
+
+	my_shared_ptr(my_shared_ptr &&p) : ptr(p.ptr) {
+		p.ptr = 0;
 	}
 
 	~my_shared_ptr() {
@@ -18,11 +46,25 @@ public:
 	}
 
 	my_shared_ptr &operator=(const my_shared_ptr &p) {
+		// the new owner first, in case p is held only through this object
+		if (p.ptr) p.ptr->AddRef();
 		release();
-		addref(p);
+		ptr = p.ptr;
 		return *this;
 	}
 
+	my_shared_ptr &operator=(my_shared_ptr &&p) {
+		if (this != &p) {
+			release();
+			ptr = p.ptr;
+			p.ptr = 0;
+		}
+		return *this;
+	}
+
+	// whether this is the only owner, so the object can be changed in place
+	bool IsUnique() const { return !ptr || ptr->GetRefCount() == 1; }
+
 	T *Get() { return ptr; }
 	const T *Get() const { return ptr; }
 
@@ -32,20 +74,11 @@ public:
 	const T &operator*() const { return *ptr; }
 private:
 	T *ptr;
-	int *refCount;
-
-	void addref(const my_shared_ptr &p) {
-		ptr = p.ptr;
-		refCount = p.refCount;
-		++*refCount;
-	}
 
 	void release() {
-		if (--*refCount == 0) {
+		if (ptr && ptr->Release())
 			delete ptr;
-			delete refCount;
-		}
 	}
 };
 
-#endif // _SHARED_PTR_H_
\ No newline at end of file
+#endif // _SHARED_PTR_H_
@@ -0,0 +1,132 @@
+#ifndef _TEXCACHE_H_
+#define _TEXCACHE_H_
+
+#include <vector>
+#include "datatypes.h"
+#include "image.h"
+#include "miptexture.h"
+#include "platform.h"
+
+using namespace std;
+
+// Tiled texture files, written by WriteTiledTexture or the rttile tool:
+//
+//   "RTTX", then little-endian 32 bit version (1), width, height, tile
+//   size and level count; after this 24 byte header the tiles of level 0,
+//   1, ..., each level's in row-major order. A tile is tileSize^2 BGRA8
+//   texels, row-major; tiles at the right and bottom edges repeat the last
+//   column and row.
+//
+// Levels halve down to 1x1 as in MipTexture.
+
+#define TEX_CACHE_TILE_SIZE 64
+
+bool WriteTiledTexture(const char *filename, const MipTexture &texture, int tileSize = TEX_CACHE_TILE_SIZE);
+bool WriteTiledTexture(const char *filename, const Image &image, int tileSize = TEX_CACHE_TILE_SIZE);
+
+struct TextureCacheStats
+{
+	long long lookups;   // tile lookups, one per bilinear footprint in most cases
+	long long misses;    // lookups that loaded the tile or waited for it
+	long long evictions;
+	long long bytesRead;
+	double stallTime;    // seconds spent in misses, summed over threads
+
+	TextureCacheStats() : lookups(0), misses(0), evictions(0), bytesRead(0), stallTime(0) { }
+
+	double HitRate() const { return lookups > 0 ? 1.0 - (double)misses / lookups : 1.0; }
+	void Add(const TextureCacheStats &s);
+};
+
+// Demand-paged textures. Open only reads a tiled file's header; a tile is
+// read from disk the first time a sample touches it and stays in one of a
+// fixed number of slots until the CLOCK hand evicts it, so the memory in
+// use never exceeds the limit whatever the size of the files.
+//
+// Sample may be called from any number of threads. A hit takes no lock,
+// only an atomic pin of the slot while its texels are read; misses take the
+// cache's mutex to claim a slot and release it for the disk read, so
+// threads missing different tiles load them at the same time. Open,
+// SetWrapMode and Create must not overlap sampling.
+class TextureCache
+{
+public:
+	TextureCache();
+	~TextureCache();
+
+	// memoryLimit bytes of tiles, at least a few tiles' worth; all files
+	// must use tileSize. Closes the textures opened so far.
+	bool Create(size_t memoryLimit, int tileSize = TEX_CACHE_TILE_SIZE);
+	void Clear();
+
+	// returns the texture's handle, -1 on failure
+	int Open(const char *filename);
+	void SetWrapMode(int texture, TextureWrap wrapS, TextureWrap wrapT);
+
+	int GetTextureCount() const { return (int)textures.size(); }
+	int GetWidth(int texture) const { return textures[texture]->levels[0].width; }
+	int GetHeight(int texture) const { return textures[texture]->levels[0].height; }
+	size_t GetMemoryLimit() const { return (size_t)slotCount * tileBytes; }
+
+	// trilinear, like MipTexture::Sample; the border color is transparent black
+	Color4f Sample(int texture, const Vector2f &uv, float lod = 0.0f);
+	float GetLod(int texture, const Vector2f &dUVdx, const Vector2f &dUVdy) const {
+		return GetTextureLod(GetWidth(texture), GetHeight(texture), dUVdx, dUVdy);
+	}
+
+	// counts since the last reset; threads count separately, so a reset
+	// while sampling may lose a few
+	TextureCacheStats GetStats() const;
+	void ResetStats();
+private:
+	struct Level
+	{
+		int width, height;
+		int tilesX;
+		int firstTile;    // global tile id of the first tile
+		long long offset; // in the file
+	};
+
+	struct Texture
+	{
+		File file;
+		vector<Level> levels;
+		TextureWrap wrapS, wrapT;
+	};
+
+	struct Slot
+	{
+		volatile int tile;    // global id, TILE_EMPTY or TILE_LOADING
+		volatile int pins;    // readers using the texels
+		volatile int referenced;
+	};
+
+	// counters are spread over stripes by thread, padded to their own lines
+	struct StatsStripe
+	{
+		TextureCacheStats stats;
+		char pad[64];
+	};
+
+	int tileSize, tileBytes;
+	int slotCount;
+	unsigned int *memory;    // slotCount tiles
+	Slot *slots;
+	vector<int> tileSlots;   // slot of every tile of every texture, or TILE_EMPTY / TILE_LOADING
+	vector<Texture *> textures;
+	Mutex mutex;
+	int clockHand;
+	vector<StatsStripe> stripes;
+
+	TextureCacheStats &getStats();
+	int acquireTile(Texture &texture, int level, int tx, int ty);
+	int loadTile(Texture &texture, int level, int tile, TextureCacheStats &stats);
+	int findVictim(TextureCacheStats &stats);
+	void releaseTile(int slot) { AtomicAdd(&slots[slot].pins, -1); }
+	void sampleBilinear(Texture &texture, int level, const Vector2f &uv, float *bgra);
+
+	TextureCache(const TextureCache &);
+	TextureCache &operator=(const TextureCache &);
+};
+
+#endif // _TEXCACHE_H_
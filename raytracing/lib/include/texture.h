@@ -6,10 +6,11 @@
 #include "glcontext.h"
 #include "sharedptr.h"
 #include "image.h"
+#include "resourceloader.h"
 
 #define TEX_GENERATE_ID GLuint(-1)
 
-class BaseTexture
+class BaseTexture : public RefCounted
 {
 protected:
 	struct Shared;
@@ -34,7 +35,7 @@ protected:
 	bool loadFromTGA(const char *filename, Image &img);
 	void texImage2D(GLenum target, const Image &img);
 
-	struct Shared
+	struct Shared : public RefCounted
 	{
 		bool needDelete;
 		GLuint id;
@@ -63,6 +64,7 @@ public:
 
 	bool IsLoaded() const { return ptr->loaded; }
 	bool LoadFromTGA(const char *filename);
+	void SetImage(const Image &img);
 	void SetTexImage(GLenum level, GLint internalFormat, GLsizei width, GLsizei height,
 		GLint border, GLenum format, GLenum type, const GLvoid *data);
 };
@@ -77,4 +79,19 @@ public:
 	bool LoadFromTGA(const char **sides);
 };
 
+// A TGA file read and decoded on a ResourceLoader's worker, uploaded to a
+// new texture when the loader publishes it
+class TextureLoad : public ImageLoad
+{
+public:
+	my_shared_ptr<Texture2D> texture;
+
+	TextureLoad(const char *filename, GLenum textureUnit = GL_TEXTURE0)
+		: ImageLoad(filename), textureUnit(textureUnit) { }
+
+	bool Publish();
+private:
+	GLenum textureUnit;
+};
+
 #endif // _TEXTURE2D_H_
\ No newline at end of file
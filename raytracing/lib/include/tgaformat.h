@@ -0,0 +1,24 @@
+#ifndef _TGA_FORMAT_H_
+#define _TGA_FORMAT_H_
+
+// The file header of a TGA image, as Image::LoadTga reads it and the
+// writers in imagewriter.cpp write it.
+#pragma pack(push, 1)
+struct TGAHEADER
+{
+	unsigned char  idLength;
+	unsigned char  colorMapType;
+	unsigned char  imageType;
+	unsigned short colorMapOffset;
+	unsigned short colorMapLength;
+	unsigned char  colorMapEntrySize;
+	unsigned short xOrigin;
+	unsigned short yOrigin;
+	unsigned short width;
+	unsigned short height;
+	unsigned char  depth;
+	unsigned char  descriptor;
+};
+#pragma pack(pop)
+
+#endif // _TGA_FORMAT_H_
@@ -0,0 +1,53 @@
+#ifndef _TRIPLE_BUFFER_H_
+#define _TRIPLE_BUFFER_H_
+
+#include "platform.h"
+
+// Hands the latest of a stream of values from one writer thread to one
+// reader thread without locks. Each side owns one of three slots and the
+// third sits between them: Publish swaps the writer's slot with the middle
+// one and Update swaps the reader's with it if it holds a newer value. The
+// writer never waits for the reader; values the reader was too slow to see
+// are simply overwritten.
+template<class T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : front(0), back(2), state(1) { }
+
+	// the writer's slot, to fill before Publish
+	T &GetWriteSlot() { return slots[back]; }
+	void Publish() { back = exchange(back | FRESH) & INDEX; }
+	void Write(const T &value) {
+		slots[back] = value;
+		Publish();
+	}
+
+	// takes the newest published value, false if there was none since the
+	// last Update
+	bool Update() {
+		if (!(state & FRESH)) return false;
+		front = exchange(front) & INDEX;
+		return true;
+	}
+	// the reader's slot: the value of the last Update, or a default T
+	const T &Get() const { return slots[front]; }
+private:
+	enum { INDEX = 3, FRESH = 4 };
+
+	T slots[3];
+	int front, back;     // owned by the reader and the writer
+	volatile int state;  // the middle slot, FRESH if it has a value the reader hasn't taken
+
+	int exchange(int value) {
+		for (;;) {
+			int old = state;
+			if (AtomicCompareExchange(&state, value, old) == old) return old;
+		}
+	}
+
+	TripleBuffer(const TripleBuffer &);
+	TripleBuffer &operator=(const TripleBuffer &);
+};
+
+#endif // _TRIPLE_BUFFER_H_
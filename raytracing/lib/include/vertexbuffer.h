@@ -45,7 +45,7 @@ public:
 
 	void CloneTo(VertexBuffer &vb) const;
 private:
-	struct Shared
+	struct Shared : public RefCounted
 	{
 		GLuint id;
 		int size;
@@ -0,0 +1,151 @@
+#include "arena.h"
+#include "platform.h"
+
+MemoryArena::MemoryArena(size_t blockSize) : current(0), offset(0), blockSize(blockSize) { }
+
+MemoryArena::~MemoryArena() {
+	Release();
+}
+
+static size_t alignOffset(const char *data, size_t offset, size_t align)
+{
+	size_t address = (size_t)(data + offset);
+	return offset + (align - address % align) % align;
+}
+
+void *MemoryArena::Alloc(size_t size, size_t align)
+{
+	stats.allocations++;
+	stats.bytes += size;
+
+	for (; current < (int)blocks.size(); current++, offset = 0)
+	{
+		const Block &b = blocks[current];
+		size_t start = alignOffset(b.data, offset, align);
+		if (start + size <= b.size) {
+			offset = start + size;
+			return b.data + start;
+		}
+	}
+
+	// none of the kept blocks has room left, a new one goes last
+	Block b;
+	b.size = size + align > blockSize ? size + align : blockSize;
+	b.data = new char[b.size];
+	blocks.push_back(b);
+	stats.blockAllocations++;
+
+	current = (int)blocks.size() - 1;
+	size_t start = alignOffset(b.data, 0, align);
+	offset = start + size;
+	return b.data + start;
+}
+
+MemoryArena::Mark MemoryArena::GetMark() const
+{
+	Mark mark = { current, offset };
+	return mark;
+}
+
+void MemoryArena::Rewind(const Mark &mark)
+{
+	current = mark.block;
+	offset = mark.offset;
+}
+
+void MemoryArena::Reset()
+{
+	current = 0;
+	offset = 0;
+}
+
+void MemoryArena::Release()
+{
+	for (int i = 0, n = (int)blocks.size(); i < n; i++)
+		delete [] blocks[i].data;
+	vector<Block>().swap(blocks);
+	Reset();
+}
+
+size_t MemoryArena::GetBytesReserved() const
+{
+	size_t bytes = 0;
+	for (int i = 0, n = (int)blocks.size(); i < n; i++)
+		bytes += blocks[i].size;
+	return bytes;
+}
+
+static MemoryArena frameArenas[FRAME_ARENA_MAX_THREADS];
+static volatile int frameSlotCount = 0;
+static volatile int frameGeneration = 1;
+
+static THREAD_LOCAL MemoryArena *threadArena = NULL;
+static THREAD_LOCAL int threadGeneration = 0;
+
+// threads past the slots get an arena of their own until the next frame
+static Mutex overflowMutex;
+static vector<MemoryArena *> overflowArenas;
+
+MemoryArena &GetFrameArena()
+{
+	if (threadArena && threadGeneration == frameGeneration) return *threadArena;
+
+	int slot = AtomicAdd(&frameSlotCount, 1);
+	MemoryArena *arena;
+	if (slot < FRAME_ARENA_MAX_THREADS) arena = &frameArenas[slot];
+	else {
+		arena = new MemoryArena;
+		MutexLock lock(overflowMutex);
+		overflowArenas.push_back(arena);
+	}
+
+	threadArena = arena;
+	threadGeneration = frameGeneration;
+	return *arena;
+}
+
+void BeginFrameAllocations()
+{
+	int used = frameSlotCount < FRAME_ARENA_MAX_THREADS ? frameSlotCount : FRAME_ARENA_MAX_THREADS;
+	for (int i = 0; i < used; i++) {
+		frameArenas[i].Reset();
+		frameArenas[i].ClearStats();
+	}
+	{
+		MutexLock lock(overflowMutex);
+		for (int i = 0, n = (int)overflowArenas.size(); i < n; i++)
+			delete overflowArenas[i];
+		overflowArenas.clear();
+	}
+
+	// threads holding an arena see the new generation and claim another
+	frameSlotCount = 0;
+	AtomicAdd(&frameGeneration, 1);
+}
+
+static void addStats(MemoryArenaStats &total, const MemoryArenaStats &s)
+{
+	total.allocations += s.allocations;
+	total.bytes += s.bytes;
+	total.blockAllocations += s.blockAllocations;
+}
+
+FrameAllocStats GetFrameAllocStats()
+{
+	FrameAllocStats stats;
+	stats.threads = frameSlotCount;
+	stats.bytesReserved = 0;
+
+	int used = frameSlotCount < FRAME_ARENA_MAX_THREADS ? frameSlotCount : FRAME_ARENA_MAX_THREADS;
+	for (int i = 0; i < used; i++)
+		addStats(stats.total, frameArenas[i].GetStats());
+	for (int i = 0; i < FRAME_ARENA_MAX_THREADS; i++)
+		stats.bytesReserved += frameArenas[i].GetBytesReserved();
+
+	MutexLock lock(overflowMutex);
+	for (int i = 0, n = (int)overflowArenas.size(); i < n; i++) {
+		addStats(stats.total, overflowArenas[i]->GetStats());
+		stats.bytesReserved += overflowArenas[i]->GetBytesReserved();
+	}
+	return stats;
+}
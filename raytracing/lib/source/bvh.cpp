@@ -0,0 +1,939 @@
+#include "bvh.h"
+#include "arena.h"
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+
+#define BVH_MAX_DEPTH (BVH_STACK_SIZE - 2)
+#define BVH_MAX_BINS 64
+
+struct BVHBin
+{
+	AABox bounds;
+	int count;
+	BVHBin() : count(0) { }
+};
+
+static int binIndex(float c, float cmin, float scale, int numBins)
+{
+	int b = (int)((c - cmin) * scale);
+	return b < 0 ? 0 : (b >= numBins ? numBins - 1 : b);
+}
+
+static void clampBuildParams(BVHBuildParams &params)
+{
+	if (params.numBins > BVH_MAX_BINS) params.numBins = BVH_MAX_BINS;
+	if (params.numBins < 2) params.numBins = 2;
+	if (params.maxLeafSize < 1) params.maxLeafSize = 1;
+	if (params.duplicationBudget < 0.0f) params.duplicationBudget = 0.0f;
+}
+
+#define BVH_CACHE_MAGIC   0x48564252 // "RBVH"
+#define BVH_CACHE_VERSION 1
+
+struct BVHCacheHeader
+{
+	int magic;
+	int version;
+	unsigned long long key;
+	int nodeSize, triangleSize;
+	int nodeCount, primCount, triCount;
+	int reserved;
+};
+
+BVH::BVH() : mesh(NULL) {
+	updateViews();
+}
+
+BVH::BVH(const BVH &bvh) : RefCounted(), mesh(NULL) {
+	*this = bvh;
+}
+
+BVH &BVH::operator=(const BVH &bvh)
+{
+	mesh = bvh.mesh;
+	params = bvh.params;
+	nodes = bvh.nodes;
+	primIndices = bvh.primIndices;
+	triangles = bvh.triangles;
+	mapping = bvh.mapping;
+
+	if (mapping.Get()) {
+		nodeData = bvh.nodeData;
+		primData = bvh.primData;
+		triData = bvh.triData;
+		nodeCount = bvh.nodeCount;
+		primCount = bvh.primCount;
+		triCount = bvh.triCount;
+	}
+	else updateViews();
+	return *this;
+}
+
+void BVH::updateViews()
+{
+	nodeData = nodes.data();
+	primData = primIndices.data();
+	triData = triangles.data();
+	nodeCount = (int)nodes.size();
+	primCount = (int)primIndices.size();
+	triCount = (int)triangles.size();
+}
+
+bool BVH::Build(const MeshData &mesh, const BVHBuildParams &params)
+{
+	int faceCount = mesh.GetFaceCount();
+	if (params.spatialSplits)
+	{
+		Clear();
+		if (faceCount == 0) return false;
+		this->params = params;
+		clampBuildParams(this->params);
+		buildSpatial(mesh);
+	}
+	else
+	{
+		vector<AABox> bounds(faceCount);
+		for (int i = 0; i < faceCount; i++)
+			bounds[i] = mesh.GetFaceBounds(i);
+
+		if (!Build(bounds.data(), faceCount, params))
+			return false;
+	}
+	this->mesh = &mesh;
+
+	triangles.resize(primIndices.size());
+	for (int i = 0, n = (int)primIndices.size(); i < n; i++)
+	{
+		Triangle tri = mesh.GetTriangle(primIndices[i]);
+		BVHTriangle &t = triangles[i];
+		t.p1 = tri.p1;
+		t.e1 = tri.p2 - tri.p1;
+		t.e2 = tri.p3 - tri.p1;
+		t.face = primIndices[i];
+	}
+	updateViews();
+	return true;
+}
+
+bool BVH::Build(const AABox *bounds, int count, const BVHBuildParams &params)
+{
+	Clear();
+	if (count <= 0) return false;
+
+	this->params = params;
+	clampBuildParams(this->params);
+
+	vector<Vector3f> centroids(count);
+	primIndices.resize(count);
+	for (int i = 0; i < count; i++) {
+		centroids[i] = bounds[i].Center();
+		primIndices[i] = i;
+	}
+
+	nodes.reserve(count * 2);
+	nodes.push_back(BVHNode());
+	build(bounds, centroids.data(), 0, 0, count);
+	updateViews();
+	return true;
+}
+
+void BVH::Clear()
+{
+	mesh = NULL;
+	nodes.clear();
+	primIndices.clear();
+	triangles.clear();
+	mapping = my_shared_ptr<Mapping>();
+	updateViews();
+}
+
+bool BVH::Save(const char *filename, unsigned long long key) const
+{
+	if (nodeCount == 0 || triCount == 0) return false;
+
+	BVHCacheHeader header = { };
+	header.magic = BVH_CACHE_MAGIC;
+	header.version = BVH_CACHE_VERSION;
+	header.key = key;
+	header.nodeSize = sizeof(BVHNode);
+	header.triangleSize = sizeof(BVHTriangle);
+	header.nodeCount = nodeCount;
+	header.primCount = primCount;
+	header.triCount = triCount;
+
+	// Written next to the cache and renamed over it: BVHs loaded earlier
+	// keep mapping the old file, and concurrent writers each replace the
+	// whole file instead of mixing their bytes.
+	static volatile int saveCount = 0;
+	char suffix[64];
+	sprintf(suffix, ".%d.%d.tmp", GetProcessIdentifier(), AtomicAdd(&saveCount, 1));
+	string tmpName = string(filename) + suffix;
+
+	ofstream file(tmpName.c_str(), ios::binary | ios::trunc);
+	if (!file) return false;
+	file.write((const char *)&header, sizeof(header));
+	file.write((const char *)nodeData, nodeCount * sizeof(BVHNode));
+	file.write((const char *)primData, primCount * sizeof(int));
+	file.write((const char *)triData, triCount * sizeof(BVHTriangle));
+	file.close();
+
+	if (!file || !ReplaceFileWith(filename, tmpName.c_str())) {
+		remove(tmpName.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Whether the nodes form one depth-first tree within the stack depth
+// Traverse allows, with leaves inside the primitive list and primitives
+// inside the mesh, so a damaged cache file is rejected rather than read
+// out of bounds.
+static bool validateTree(const BVHNode *nodes, int nodeCount, const int *prims, int primCount, int faceCount)
+{
+	for (int i = 0; i < primCount; i++)
+		if (prims[i] < 0 || prims[i] >= faceCount) return false;
+
+	struct Entry { int node, depth; };
+	vector<Entry> stack;
+	Entry root = { 0, 1 };
+	stack.push_back(root);
+	int visited = 0;
+
+	while (!stack.empty())
+	{
+		Entry e = stack.back();
+		stack.pop_back();
+		// depth first order numbers the nodes in the order they are reached
+		if (e.node != visited++ || e.depth > BVH_STACK_SIZE) return false;
+
+		const BVHNode &node = nodes[e.node];
+		if (node.IsLeaf()) {
+			if (node.count < 0 || node.offset < 0 || node.offset > primCount - node.count)
+				return false;
+			continue;
+		}
+		int left = e.node + 1, right = node.offset;
+		if (right <= left || right >= nodeCount) return false;
+		Entry r = { right, e.depth + 1 }, l = { left, e.depth + 1 };
+		stack.push_back(r);
+		stack.push_back(l);
+	}
+	return visited == nodeCount;
+}
+
+bool BVH::Load(const MeshData &mesh, const char *filename, unsigned long long key,
+	const BVHBuildParams &params)
+{
+	Clear();
+
+	my_shared_ptr<Mapping> shared(new Mapping);
+	MappedFile &file = shared->file;
+	if (!file.Open(filename) || file.GetSize() < sizeof(BVHCacheHeader))
+		return false;
+
+	const char *data = (const char *)file.GetData();
+	const BVHCacheHeader *header = (const BVHCacheHeader *)data;
+	if (header->magic != BVH_CACHE_MAGIC ||
+		header->version != BVH_CACHE_VERSION ||
+		header->key != key ||
+		header->nodeSize != sizeof(BVHNode) ||
+		header->triangleSize != sizeof(BVHTriangle) ||
+		header->nodeCount <= 0 ||
+		header->primCount != header->triCount ||
+		header->triCount < mesh.GetFaceCount())
+		return false;
+
+	size_t size = sizeof(BVHCacheHeader) +
+		(size_t)header->nodeCount * sizeof(BVHNode) +
+		(size_t)header->primCount * sizeof(int) +
+		(size_t)header->triCount * sizeof(BVHTriangle);
+	if (file.GetSize() != size) return false;
+
+	// the sections are 4 byte aligned, the mapping itself is page aligned
+	data += sizeof(BVHCacheHeader);
+	nodeData = (const BVHNode *)data;
+	data += header->nodeCount * sizeof(BVHNode);
+	primData = (const int *)data;
+	data += header->primCount * sizeof(int);
+	triData = (const BVHTriangle *)data;
+
+	if (!validateTree(nodeData, header->nodeCount, primData, header->primCount, mesh.GetFaceCount()))
+		return false;
+	for (int i = 0; i < header->triCount; i++)
+		if (triData[i].face < 0 || triData[i].face >= mesh.GetFaceCount()) return false;
+
+	nodeCount = header->nodeCount;
+	primCount = header->primCount;
+	triCount = header->triCount;
+	mapping = shared;
+
+	this->mesh = &mesh;
+	this->params = params;
+	clampBuildParams(this->params);
+	return true;
+}
+
+void BVH::makeLeaf(BVHNode &node, int begin, int end)
+{
+	node.offset = begin;
+	node.count = end - begin;
+}
+
+void BVH::build(const AABox *bounds, const Vector3f *centroids, int nodeIndex, int begin, int end)
+{
+	struct Task { int node, begin, end, depth; };
+	vector<Task> tasks;
+	Task first = { nodeIndex, begin, end, 0 };
+	tasks.push_back(first);
+
+	BVHBin bins[BVH_MAX_BINS];
+	float rightArea[BVH_MAX_BINS];
+	const int numBins = params.numBins;
+
+	while (!tasks.empty())
+	{
+		Task task = tasks.back();
+		tasks.pop_back();
+
+		AABox box, centroidBox;
+		for (int i = task.begin; i < task.end; i++) {
+			box.Extend(bounds[primIndices[i]]);
+			centroidBox.Extend(centroids[primIndices[i]]);
+		}
+
+		BVHNode &node = nodes[task.node];
+		node.vmin = box.vmin;
+		node.vmax = box.vmax;
+
+		int count = task.end - task.begin;
+		if (count == 1 || task.depth >= BVH_MAX_DEPTH) {
+			makeLeaf(node, task.begin, task.end);
+			continue;
+		}
+
+		float leafCost = params.intersectionCost * count;
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestSplit = 0;
+		float invArea = 1.0f / max(box.SurfaceArea(), 1e-20f);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float cmin = centroidBox.vmin[axis];
+			float extent = centroidBox.vmax[axis] - cmin;
+			if (extent <= 0.0f) continue;
+			float scale = numBins / extent;
+
+			for (int b = 0; b < numBins; b++)
+				bins[b] = BVHBin();
+
+			for (int i = task.begin; i < task.end; i++) {
+				int p = primIndices[i];
+				BVHBin &bin = bins[binIndex(centroids[p][axis], cmin, scale, numBins)];
+				bin.bounds.Extend(bounds[p]);
+				bin.count++;
+			}
+
+			AABox acc;
+			for (int b = numBins - 1; b > 0; b--) {
+				acc.Extend(bins[b].bounds);
+				rightArea[b] = acc.SurfaceArea();
+			}
+
+			acc = AABox();
+			int leftCount = 0;
+			for (int b = 0; b < numBins - 1; b++)
+			{
+				acc.Extend(bins[b].bounds);
+				leftCount += bins[b].count;
+				int rightCount = count - leftCount;
+				if (leftCount == 0 || rightCount == 0) continue;
+
+				float cost = params.traversalCost + params.intersectionCost * invArea *
+					(acc.SurfaceArea() * leftCount + rightArea[b + 1] * rightCount);
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		if (count <= params.maxLeafSize && bestCost >= leafCost) {
+			makeLeaf(node, task.begin, task.end);
+			continue;
+		}
+
+		int mid;
+		if (bestAxis != -1)
+		{
+			float cmin = centroidBox.vmin[bestAxis];
+			float scale = numBins / (centroidBox.vmax[bestAxis] - cmin);
+			int *p = stable_partition(&primIndices[task.begin], &primIndices[0] + task.end,
+				[&](int prim) {
+					return binIndex(centroids[prim][bestAxis], cmin, scale, numBins) <= bestSplit;
+				});
+			mid = (int)(p - &primIndices[0]);
+		}
+		else
+		{
+			// all centroids coincide, split by count
+			mid = (task.begin + task.end) / 2;
+		}
+
+		int left = (int)nodes.size();
+		int right = left + 1;
+		nodes.push_back(BVHNode());
+		nodes.push_back(BVHNode());
+
+		BVHNode &parent = nodes[task.node];
+		parent.count = 0;
+
+		Task l = { left, task.begin, mid, task.depth + 1 };
+		Task r = { right, mid, task.end, task.depth + 1 };
+		tasks.push_back(r);
+		tasks.push_back(l);
+		parent.offset = right;
+	}
+
+	// reorder nodes depth first: left child immediately follows its parent
+	vector<BVHNode> ordered;
+	ordered.reserve(nodes.size());
+	vector<int> stack;
+	stack.push_back(nodeIndex);
+	vector<int> remap(nodes.size(), -1);
+
+	while (!stack.empty())
+	{
+		int n = stack.back();
+		stack.pop_back();
+		remap[n] = (int)ordered.size();
+		ordered.push_back(nodes[n]);
+
+		if (!nodes[n].IsLeaf()) {
+			int right = nodes[n].offset;
+			int left = right - 1;
+			stack.push_back(right);
+			stack.push_back(left);
+		}
+	}
+
+	for (int i = 0, n = (int)ordered.size(); i < n; i++) {
+		if (!ordered[i].IsLeaf())
+			ordered[i].offset = remap[ordered[i].offset];
+	}
+	nodes.swap(ordered);
+}
+
+// Spatial split BVH (Stich et al. 2009). Triangle references that straddle
+// a spatial split plane are clipped and duplicated into both children, as
+// long as the duplication budget allows it.
+struct SpatialRef
+{
+	AABox bounds;
+	int face;
+};
+
+struct SpatialBin
+{
+	AABox bounds;
+	int entries, exits;
+	SpatialBin() : entries(0), exits(0) { }
+};
+
+struct SplitCandidate
+{
+	float cost;
+	int axis;
+	int bin;
+	AABox left, right;
+	int leftCount, rightCount;
+
+	SplitCandidate() : cost(FLT_MAX), axis(-1), bin(0), leftCount(0), rightCount(0) { }
+};
+
+static AABox intersectBoxes(const AABox &a, const AABox &b)
+{
+	AABox r;
+	for (int i = 0; i < 3; i++) {
+		r.vmin[i] = max(a.vmin[i], b.vmin[i]);
+		r.vmax[i] = min(a.vmax[i], b.vmax[i]);
+	}
+	return r;
+}
+
+static AABox unionBoxes(const AABox &a, const AABox &b)
+{
+	AABox r = a;
+	r.Extend(b);
+	return r;
+}
+
+// clips the triangle of ref against the plane axis = pos, both parts
+// are limited to the bounds of the original reference
+static void splitReference(const MeshData &mesh, const SpatialRef &ref,
+	int axis, float pos, SpatialRef &left, SpatialRef &right)
+{
+	left.face = right.face = ref.face;
+	left.bounds = right.bounds = AABox();
+
+	const int *f = &mesh.indices[ref.face * 3];
+	for (int i = 0; i < 3; i++)
+	{
+		const Vector3f &v0 = mesh.vertices[f[i]];
+		const Vector3f &v1 = mesh.vertices[f[(i + 1) % 3]];
+		float p0 = v0[axis], p1 = v1[axis];
+
+		if (p0 <= pos) left.bounds.Extend(v0);
+		if (p0 >= pos) right.bounds.Extend(v0);
+		if ((p0 < pos && p1 > pos) || (p0 > pos && p1 < pos)) {
+			Vector3f t = v0 + (v1 - v0) * ((pos - p0) / (p1 - p0));
+			t[axis] = pos;
+			left.bounds.Extend(t);
+			right.bounds.Extend(t);
+		}
+	}
+
+	left.bounds = intersectBoxes(left.bounds, ref.bounds);
+	right.bounds = intersectBoxes(right.bounds, ref.bounds);
+}
+
+// reference lists are carved from an arena, a node's children's lists
+// freed together once both subtrees are built
+struct SpatialBuilder
+{
+	const MeshData &mesh;
+	const BVHBuildParams &params;
+	vector<BVHNode> &nodes;
+	vector<int> &primIndices;
+	MemoryArena &arena;
+	float rootArea;
+	int refBudget;
+
+	SpatialBuilder(const MeshData &mesh, const BVHBuildParams &params,
+		vector<BVHNode> &nodes, vector<int> &primIndices, MemoryArena &arena)
+		: mesh(mesh), params(params), nodes(nodes), primIndices(primIndices), arena(arena),
+		rootArea(0), refBudget(0)
+	{ }
+
+	int build(const SpatialRef *refs, int count, int depth);
+	void findObjectSplit(const SpatialRef *refs, int count, const AABox &centroidBox, SplitCandidate &split);
+	void findSpatialSplit(const SpatialRef *refs, int count, const AABox &box, SplitCandidate &split);
+	float splitPosition(const AABox &box, int axis, int bin) const;
+	void makeLeaf(int nodeIndex, const SpatialRef *refs, int count);
+};
+
+float SpatialBuilder::splitPosition(const AABox &box, int axis, int bin) const {
+	return box.vmin[axis] + (box.vmax[axis] - box.vmin[axis]) * (bin + 1) / params.numBins;
+}
+
+void SpatialBuilder::makeLeaf(int nodeIndex, const SpatialRef *refs, int count)
+{
+	BVHNode &node = nodes[nodeIndex];
+	node.offset = (int)primIndices.size();
+	node.count = count;
+	for (int i = 0; i < count; i++)
+		primIndices.push_back(refs[i].face);
+}
+
+void SpatialBuilder::findObjectSplit(const SpatialRef *refs, int count,
+	const AABox &centroidBox, SplitCandidate &split)
+{
+	const int numBins = params.numBins;
+	BVHBin bins[BVH_MAX_BINS];
+	AABox rightBoxes[BVH_MAX_BINS];
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float cmin = centroidBox.vmin[axis];
+		float extent = centroidBox.vmax[axis] - cmin;
+		if (extent <= 0.0f) continue;
+		float scale = numBins / extent;
+
+		for (int b = 0; b < numBins; b++)
+			bins[b] = BVHBin();
+		for (int i = 0; i < count; i++) {
+			BVHBin &bin = bins[binIndex(refs[i].bounds.Center()[axis], cmin, scale, numBins)];
+			bin.bounds.Extend(refs[i].bounds);
+			bin.count++;
+		}
+
+		AABox acc;
+		for (int b = numBins - 1; b > 0; b--) {
+			acc.Extend(bins[b].bounds);
+			rightBoxes[b] = acc;
+		}
+
+		acc = AABox();
+		int leftCount = 0;
+		for (int b = 0; b < numBins - 1; b++)
+		{
+			acc.Extend(bins[b].bounds);
+			leftCount += bins[b].count;
+			int rightCount = count - leftCount;
+			if (leftCount == 0 || rightCount == 0) continue;
+
+			float cost = acc.SurfaceArea() * leftCount + rightBoxes[b + 1].SurfaceArea() * rightCount;
+			if (cost < split.cost) {
+				split.cost = cost;
+				split.axis = axis;
+				split.bin = b;
+				split.left = acc;
+				split.right = rightBoxes[b + 1];
+				split.leftCount = leftCount;
+				split.rightCount = rightCount;
+			}
+		}
+	}
+}
+
+void SpatialBuilder::findSpatialSplit(const SpatialRef *refs, int count,
+	const AABox &box, SplitCandidate &split)
+{
+	const int numBins = params.numBins;
+	SpatialBin bins[BVH_MAX_BINS];
+	AABox rightBoxes[BVH_MAX_BINS];
+	int rightCounts[BVH_MAX_BINS];
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float bmin = box.vmin[axis];
+		float extent = box.vmax[axis] - bmin;
+		if (extent <= 0.0f) continue;
+		float scale = numBins / extent;
+
+		for (int b = 0; b < numBins; b++)
+			bins[b] = SpatialBin();
+
+		for (int i = 0; i < count; i++)
+		{
+			const SpatialRef &ref = refs[i];
+			int b0 = binIndex(ref.bounds.vmin[axis], bmin, scale, numBins);
+			int b1 = binIndex(ref.bounds.vmax[axis], bmin, scale, numBins);
+
+			// chop the reference into the bins it spans
+			SpatialRef cur = ref, left, right;
+			for (int b = b0; b < b1; b++) {
+				splitReference(mesh, cur, axis, splitPosition(box, axis, b), left, right);
+				bins[b].bounds.Extend(left.bounds);
+				cur = right;
+			}
+			bins[b1].bounds.Extend(cur.bounds);
+			bins[b0].entries++;
+			bins[b1].exits++;
+		}
+
+		AABox acc;
+		int rightCount = 0;
+		for (int b = numBins - 1; b > 0; b--) {
+			acc.Extend(bins[b].bounds);
+			rightCount += bins[b].exits;
+			rightBoxes[b] = acc;
+			rightCounts[b] = rightCount;
+		}
+
+		acc = AABox();
+		int leftCount = 0;
+		for (int b = 0; b < numBins - 1; b++)
+		{
+			acc.Extend(bins[b].bounds);
+			leftCount += bins[b].entries;
+			if (leftCount == 0 || rightCounts[b + 1] == 0) continue;
+
+			float cost = acc.SurfaceArea() * leftCount +
+				rightBoxes[b + 1].SurfaceArea() * rightCounts[b + 1];
+			if (cost < split.cost) {
+				split.cost = cost;
+				split.axis = axis;
+				split.bin = b;
+				split.left = acc;
+				split.right = rightBoxes[b + 1];
+				split.leftCount = leftCount;
+				split.rightCount = rightCounts[b + 1];
+			}
+		}
+	}
+}
+
+int SpatialBuilder::build(const SpatialRef *refs, int count, int depth)
+{
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back(BVHNode());
+
+	AABox box, centroidBox;
+	for (int i = 0; i < count; i++) {
+		box.Extend(refs[i].bounds);
+		centroidBox.Extend(refs[i].bounds.Center());
+	}
+	nodes[nodeIndex].vmin = box.vmin;
+	nodes[nodeIndex].vmax = box.vmax;
+	if (depth == 0) rootArea = max(box.SurfaceArea(), 1e-20f);
+
+	if (count == 1 || depth >= BVH_MAX_DEPTH) {
+		makeLeaf(nodeIndex, refs, count);
+		return nodeIndex;
+	}
+
+	SplitCandidate objectSplit, spatialSplit;
+	findObjectSplit(refs, count, centroidBox, objectSplit);
+
+	// only look for spatial splits where the object split children overlap noticeably
+	if (refBudget > 0) {
+		float overlap = objectSplit.axis == -1 ? box.SurfaceArea() :
+			intersectBoxes(objectSplit.left, objectSplit.right).SurfaceArea();
+		if (overlap / rootArea > params.spatialSplitAlpha)
+			findSpatialSplit(refs, count, box, spatialSplit);
+	}
+
+	float invArea = 1.0f / max(box.SurfaceArea(), 1e-20f);
+	float leafCost = params.intersectionCost * count;
+	float bestCost = params.traversalCost + params.intersectionCost * invArea *
+		min(objectSplit.cost, spatialSplit.cost);
+
+	if (count <= params.maxLeafSize && bestCost >= leafCost) {
+		makeLeaf(nodeIndex, refs, count);
+		return nodeIndex;
+	}
+
+	// a reference lands on each side at most once; the object split's
+	// counts are exact
+	ArenaScope scope(arena);
+	MemoryArena::Mark lists = arena.GetMark();
+	SpatialRef *leftRefs = NULL, *rightRefs = NULL;
+	int nl = 0, nr = 0;
+	bool useSpatial = spatialSplit.cost < objectSplit.cost;
+
+	if (useSpatial)
+	{
+		int axis = spatialSplit.axis;
+		float pos = splitPosition(box, axis, spatialSplit.bin);
+		AABox lbox = spatialSplit.left, rbox = spatialSplit.right;
+		int leftCount = spatialSplit.leftCount, rightCount = spatialSplit.rightCount;
+		leftRefs = arena.AllocArray<SpatialRef>(count);
+		rightRefs = arena.AllocArray<SpatialRef>(count);
+
+		for (int i = 0; i < count; i++)
+		{
+			const SpatialRef &ref = refs[i];
+			if (ref.bounds.vmax[axis] <= pos) leftRefs[nl++] = ref;
+			else if (ref.bounds.vmin[axis] >= pos) rightRefs[nr++] = ref;
+			else
+			{
+				// reference unsplitting: keep the triangle on one side if that is cheaper
+				float splitCost = lbox.SurfaceArea() * leftCount + rbox.SurfaceArea() * rightCount;
+				float leftCost = unionBoxes(lbox, ref.bounds).SurfaceArea() * leftCount + rbox.SurfaceArea() * (rightCount - 1);
+				float rightCost = lbox.SurfaceArea() * (leftCount - 1) + unionBoxes(rbox, ref.bounds).SurfaceArea() * rightCount;
+
+				if (leftCost < splitCost && leftCost <= rightCost) {
+					leftRefs[nl++] = ref;
+					lbox.Extend(ref.bounds);
+					rightCount--;
+				}
+				else if (rightCost < splitCost) {
+					rightRefs[nr++] = ref;
+					rbox.Extend(ref.bounds);
+					leftCount--;
+				}
+				else {
+					SpatialRef l, r;
+					splitReference(mesh, ref, axis, pos, l, r);
+					if (!l.bounds.IsEmpty()) leftRefs[nl++] = l;
+					if (!r.bounds.IsEmpty()) rightRefs[nr++] = r;
+				}
+			}
+		}
+
+		int duplicated = nl + nr - count;
+		if (duplicated > refBudget || nl == 0 || nr == 0) {
+			useSpatial = false;
+			arena.Rewind(lists);
+			nl = nr = 0;
+		}
+		else refBudget -= duplicated;
+	}
+
+	if (!useSpatial)
+	{
+		if (objectSplit.axis != -1)
+		{
+			leftRefs = arena.AllocArray<SpatialRef>(objectSplit.leftCount);
+			rightRefs = arena.AllocArray<SpatialRef>(objectSplit.rightCount);
+			float cmin = centroidBox.vmin[objectSplit.axis];
+			float scale = params.numBins / (centroidBox.vmax[objectSplit.axis] - cmin);
+			for (int i = 0; i < count; i++) {
+				float c = refs[i].bounds.Center()[objectSplit.axis];
+				if (binIndex(c, cmin, scale, params.numBins) <= objectSplit.bin)
+					leftRefs[nl++] = refs[i];
+				else rightRefs[nr++] = refs[i];
+			}
+		}
+		else
+		{
+			// the halves of the parent's list, which outlives both subtrees
+			build(refs, count / 2, depth + 1);
+			int right = build(refs + count / 2, count - count / 2, depth + 1);
+			nodes[nodeIndex].offset = right;
+			nodes[nodeIndex].count = 0;
+			return nodeIndex;
+		}
+	}
+
+	build(leftRefs, nl, depth + 1);
+	int right = build(rightRefs, nr, depth + 1);
+	nodes[nodeIndex].offset = right;
+	nodes[nodeIndex].count = 0;
+	return nodeIndex;
+}
+
+void BVH::buildSpatial(const MeshData &mesh)
+{
+	int faceCount = mesh.GetFaceCount();
+	MemoryArena arena(max((size_t)faceCount * sizeof(SpatialRef), (size_t)ARENA_BLOCK_SIZE));
+	SpatialRef *refs = arena.AllocArray<SpatialRef>(faceCount);
+	for (int i = 0; i < faceCount; i++) {
+		refs[i].face = i;
+		refs[i].bounds = mesh.GetFaceBounds(i);
+	}
+
+	nodes.reserve(faceCount * 2);
+	primIndices.reserve(faceCount);
+
+	SpatialBuilder builder(mesh, params, nodes, primIndices, arena);
+	builder.refBudget = (int)(faceCount * params.duplicationBudget);
+	builder.build(refs, faceCount, 0);
+}
+
+AABox BVH::GetBounds() const
+{
+	if (nodeCount == 0) return AABox();
+	return AABox(nodeData[0].vmin, nodeData[0].vmax);
+}
+
+float BVH::sahCost(int nodeIndex, float rootArea, int depth, BVHStats &stats) const
+{
+	const BVHNode &node = nodeData[nodeIndex];
+	float area = AABox(node.vmin, node.vmax).SurfaceArea() / rootArea;
+	if (depth > stats.maxDepth) stats.maxDepth = depth;
+
+	if (node.IsLeaf()) {
+		stats.leafCount++;
+		stats.primitiveRefs += node.count;
+		return area * params.intersectionCost * node.count;
+	}
+	return area * params.traversalCost +
+		sahCost(nodeIndex + 1, rootArea, depth + 1, stats) +
+		sahCost(node.offset, rootArea, depth + 1, stats);
+}
+
+BVHStats BVH::GetStats() const
+{
+	BVHStats stats;
+	if (nodeCount == 0) return stats;
+
+	stats.nodeCount = nodeCount;
+	stats.primitiveCount = mesh ? mesh->GetFaceCount() : primCount;
+	float rootArea = max(GetBounds().SurfaceArea(), 1e-20f);
+	stats.sahCost = sahCost(0, rootArea, 0, stats);
+	stats.memoryUsage = nodeCount * sizeof(BVHNode) +
+		primCount * sizeof(int) +
+		triCount * sizeof(BVHTriangle);
+	return stats;
+}
+
+bool BVH::Intersect(const Ray &ray, RayHit &hit) const
+{
+	if (triCount == 0) return false;
+
+	Vector3f invDir = SafeInverse(ray.v);
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIndex = 0;
+	float tmax = hit.t, tnear = 0;
+	bool found = false;
+
+	if (!IntersectBox(nodeData[0].vmin, nodeData[0].vmax, ray.p, invDir, tmax, tnear))
+		return false;
+
+	for (;;)
+	{
+		const BVHNode &node = nodeData[nodeIndex];
+		if (node.IsLeaf()) {
+			for (int i = node.offset, n = node.offset + node.count; i < n; i++) {
+				const BVHTriangle &tri = triData[i];
+				float t, u, v;
+				if (Triangle::IntersectTriangle(ray, tri.p1, tri.e1, tri.e2, t, u, v) && t < tmax) {
+					tmax = t;
+					hit.t = t; hit.u = u; hit.v = v;
+					hit.primitive = tri.face;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			int left = nodeIndex + 1, right = node.offset;
+			float tl = 0, tr = 0;
+			bool hitLeft = IntersectBox(nodeData[left].vmin, nodeData[left].vmax, ray.p, invDir, tmax, tl);
+			bool hitRight = IntersectBox(nodeData[right].vmin, nodeData[right].vmax, ray.p, invDir, tmax, tr);
+
+			if (hitLeft && hitRight) {
+				if (tr < tl) { int t = left; left = right; right = t; }
+				stack[stackSize++] = right;
+				nodeIndex = left;
+				continue;
+			}
+			else if (hitLeft) { nodeIndex = left; continue; }
+			else if (hitRight) { nodeIndex = right; continue; }
+		}
+
+		if (stackSize == 0) break;
+		nodeIndex = stack[--stackSize];
+	}
+	return found;
+}
+
+bool BVH::IntersectAny(const Ray &ray, float tmax) const
+{
+	if (triCount == 0) return false;
+
+	Vector3f invDir = SafeInverse(ray.v);
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIndex = 0;
+	float tnear = 0;
+
+	if (!IntersectBox(nodeData[0].vmin, nodeData[0].vmax, ray.p, invDir, tmax, tnear))
+		return false;
+
+	for (;;)
+	{
+		const BVHNode &node = nodeData[nodeIndex];
+		if (node.IsLeaf()) {
+			for (int i = node.offset, n = node.offset + node.count; i < n; i++) {
+				const BVHTriangle &tri = triData[i];
+				float t, u, v;
+				if (Triangle::IntersectTriangle(ray, tri.p1, tri.e1, tri.e2, t, u, v) && t < tmax)
+					return true;
+			}
+		}
+		else
+		{
+			int left = nodeIndex + 1, right = node.offset;
+			float tl = 0, tr = 0;
+			bool hitLeft = IntersectBox(nodeData[left].vmin, nodeData[left].vmax, ray.p, invDir, tmax, tl);
+			bool hitRight = IntersectBox(nodeData[right].vmin, nodeData[right].vmax, ray.p, invDir, tmax, tr);
+
+			if (hitLeft && hitRight) {
+				stack[stackSize++] = right;
+				nodeIndex = left;
+				continue;
+			}
+			else if (hitLeft) { nodeIndex = left; continue; }
+			else if (hitRight) { nodeIndex = right; continue; }
+		}
+
+		if (stackSize == 0) break;
+		nodeIndex = stack[--stackSize];
+	}
+	return false;
+}
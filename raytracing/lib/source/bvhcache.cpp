@@ -0,0 +1,83 @@
+#include "bvhcache.h"
+#include <string.h>
+
+// MurmurHash64A, fed block by block so several buffers hash as one stream
+struct MeshHasher
+{
+	static const unsigned long long m = 0xc6a4a7935bd1e995ULL;
+	static const int r = 47;
+	unsigned long long h;
+
+	MeshHasher(unsigned long long seed) : h(seed) { }
+
+	void mix(unsigned long long k)
+	{
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	void Add(const void *data, size_t size)
+	{
+		const unsigned char *p = (const unsigned char *)data;
+		size_t blocks = size / 8;
+		for (size_t i = 0; i < blocks; i++) {
+			unsigned long long k;
+			memcpy(&k, p + i * 8, 8);
+			mix(k);
+		}
+
+		unsigned long long tail = 0;
+		memcpy(&tail, p + blocks * 8, size & 7);
+		mix(tail ^ (unsigned long long)size << 56);
+	}
+
+	unsigned long long Finish()
+	{
+		h ^= h >> r;
+		h *= m;
+		h ^= h >> r;
+		return h;
+	}
+};
+
+unsigned long long HashMeshData(const MeshData &mesh, const BVHBuildParams &params)
+{
+	MeshHasher hasher(0x9e3779b97f4a7c15ULL);
+
+	int counts[2] = { mesh.GetVerticesCount(), mesh.GetIndicesCount() };
+	hasher.Add(counts, sizeof(counts));
+	hasher.Add(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vector3f));
+	hasher.Add(mesh.indices.data(), mesh.indices.size() * sizeof(int));
+
+	// hashed field by field, the struct has padding
+	hasher.Add(&params.maxLeafSize, sizeof(int));
+	hasher.Add(&params.numBins, sizeof(int));
+	hasher.Add(&params.traversalCost, sizeof(float));
+	hasher.Add(&params.intersectionCost, sizeof(float));
+	int spatial = params.spatialSplits ? 1 : 0;
+	hasher.Add(&spatial, sizeof(int));
+	if (spatial) {
+		hasher.Add(&params.spatialSplitAlpha, sizeof(float));
+		hasher.Add(&params.duplicationBudget, sizeof(float));
+	}
+	return hasher.Finish();
+}
+
+string GetBVHCachePath(const char *modelFile) {
+	return string(modelFile) + ".bvh";
+}
+
+bool LoadOrBuildBVH(BVH &bvh, const MeshData &mesh, const char *cacheFile,
+	const BVHBuildParams &params)
+{
+	unsigned long long key = HashMeshData(mesh, params);
+	if (cacheFile && bvh.Load(mesh, cacheFile, key, params))
+		return true;
+
+	if (!bvh.Build(mesh, params)) return false;
+	if (cacheFile) bvh.Save(cacheFile, key);
+	return true;
+}
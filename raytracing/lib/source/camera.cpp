@@ -21,9 +21,11 @@ Matrix44f Camera::GetViewMatrix()
 	return view;
 }
 
+#ifndef RT_HEADLESS
 void Camera::ApplyTransform(GLRenderingContext *rc) {
 	rc->MultModelView(GetViewMatrix());
 }
+#endif
 
 void Camera::ResetTransform() {
 	x = y = z = t = Vector3f(0.0f);
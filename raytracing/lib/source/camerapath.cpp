@@ -0,0 +1,90 @@
+#include "camerapath.h"
+#include <fstream>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+void CameraPath::AddKey(const CameraKey &key)
+{
+	CameraKey k = key;
+	k.rotation.Normalize();
+
+	vector<CameraKey>::iterator it = keys.end();
+	while (it != keys.begin() && (it - 1)->time > k.time) --it;
+	keys.insert(it, k);
+}
+
+bool CameraPath::Load(const char *filename, int *errorLine)
+{
+	if (errorLine) *errorLine = 0;
+	ifstream file(filename);
+	if (!file) return false;
+
+	keys.clear();
+	string line;
+	for (int lineNumber = 1; getline(file, line); lineNumber++)
+	{
+		char cmd[32];
+		int n = 0;
+		if (sscanf(line.c_str(), " %31s%n", cmd, &n) != 1 || cmd[0] == '#') continue;
+
+		CameraKey key;
+		Quaternion &q = key.rotation;
+		if (strcmp(cmd, "key") != 0 || sscanf(line.c_str() + n, "%f %f %f %f %f %f %f %f", &key.time,
+			&key.position.x, &key.position.y, &key.position.z, &q.x, &q.y, &q.z, &q.w) != 8 ||
+			q.Norm() == 0.0f)
+		{
+			if (errorLine) *errorLine = lineNumber;
+			keys.clear();
+			return false;
+		}
+		AddKey(key);
+	}
+	return true;
+}
+
+CameraKey CameraPath::Evaluate(float time) const
+{
+	if (keys.empty()) {
+		CameraKey key;
+		key.time = time;
+		return key;
+	}
+	if (time <= keys.front().time) return keys.front();
+	if (time >= keys.back().time) return keys.back();
+
+	int i = 1;
+	while (keys[i].time < time) i++;
+	const CameraKey &k1 = keys[i - 1];
+	const CameraKey &k2 = keys[i];
+
+	float span = k2.time - k1.time;
+	float t = span > 0.0f ? (time - k1.time) / span : 1.0f;
+
+	CameraKey key;
+	key.time = time;
+	key.position = k1.position + (k2.position - k1.position) * t;
+	key.rotation = Quaternion::Slerp(k1.rotation, k2.rotation, t);
+	return key;
+}
+
+Matrix44f CameraPath::GetViewMatrix(float time) const
+{
+	CameraKey key = Evaluate(time);
+	Matrix44f view;
+	key.rotation.ToMatrix(view);
+	view.translate = key.position;
+	return view;
+}
+
+Matrix44f LookAtView(const Point3f &eye, const Point3f &target)
+{
+	Vector3f z = Normalize(eye - target);
+	Vector3f x = Normalize(Cross(Vector3f(0, 1, 0), z));
+	Matrix44f view;
+	view.xAxis = x;
+	view.yAxis = Cross(z, x);
+	view.zAxis = z;
+	view.translate = eye;
+	return view;
+}
@@ -0,0 +1,226 @@
+#include "compressedbvh.h"
+
+struct CBVHStackEntry
+{
+	unsigned int node;
+	Vector3f lo, scale;
+};
+
+static void quantizeAxis(float cmin, float cmax, float lo, float scale,
+	unsigned char &qmin, unsigned char &qmax)
+{
+	if (scale <= 0.0f) {
+		qmin = 0; qmax = 0;
+		return;
+	}
+
+	// round outwards, then correct for float error so the decoded box
+	// computed during traversal always contains the exact child box
+	int q0 = (int)floor((cmin - lo) / scale);
+	int q1 = (int)ceil((cmax - lo) / scale);
+	q0 = q0 < 0 ? 0 : (q0 > 255 ? 255 : q0);
+	q1 = q1 < 0 ? 0 : (q1 > 255 ? 255 : q1);
+	while (q0 > 0 && lo + q0 * scale > cmin) q0--;
+	while (q1 < 255 && lo + q1 * scale < cmax) q1++;
+
+	qmin = (unsigned char)q0;
+	qmax = (unsigned char)q1;
+}
+
+bool CompressedBVH::Build(const BVH &bvh, const PackedMeshData *packed)
+{
+	Clear();
+	if (bvh.IsEmpty() || !bvh.GetMesh()) return false;
+	if (packed && packed->GetFaceCount() != bvh.GetMesh()->GetFaceCount()) return false;
+	if (bvh.GetPrimIndicesCount() > CBVH_MAX_PRIMS) return false;
+
+	const BVHNode *bvhNodes = bvh.GetNodes();
+	for (int i = 0, n = bvh.GetNodeCount(); i < n; i++) {
+		if (bvhNodes[i].count > CBVH_MAX_LEAF_SIZE) return false;
+	}
+
+	if (packed) this->packed = packed;
+	else mesh = bvh.GetMesh();
+	faces.assign(bvh.GetPrimIndices(), bvh.GetPrimIndices() + bvh.GetPrimIndicesCount());
+	nodes.reserve(bvh.GetNodeCount() / 2 + 1);
+
+	rootMin = bvhNodes[0].vmin;
+	rootScale = QuantizationScale(bvhNodes[0].vmin, bvhNodes[0].vmax);
+
+	if (bvhNodes[0].IsLeaf())
+	{
+		// a single leaf still needs a node to hold its box
+		CompressedBVHNode node;
+		for (int k = 0; k < 3; k++) {
+			node.qmin[0][k] = node.qmin[1][k] = 0;
+			node.qmax[0][k] = node.qmax[1][k] = 255;
+		}
+		node.child[0] = CBVH_LEAF_BIT | (bvhNodes[0].count - 1) << 27 | bvhNodes[0].offset;
+		node.child[1] = CBVH_EMPTY_CHILD;
+		nodes.push_back(node);
+	}
+	else encode(bvh, 0, rootMin, rootScale);
+	return true;
+}
+
+unsigned int CompressedBVH::encode(const BVH &bvh, int nodeIndex, const Vector3f &lo, const Vector3f &scale)
+{
+	const BVHNode *bvhNodes = bvh.GetNodes();
+	const BVHNode &bvhNode = bvhNodes[nodeIndex];
+	int children[2] = { nodeIndex + 1, bvhNode.offset };
+
+	unsigned int index = (unsigned int)nodes.size();
+	nodes.push_back(CompressedBVHNode());
+
+	for (int i = 0; i < 2; i++)
+	{
+		const BVHNode &c = bvhNodes[children[i]];
+		CompressedBVHNode &node = nodes[index];
+		for (int k = 0; k < 3; k++)
+			quantizeAxis(c.vmin[k], c.vmax[k], lo[k], scale[k], node.qmin[i][k], node.qmax[i][k]);
+
+		if (c.IsLeaf()) {
+			node.child[i] = CBVH_LEAF_BIT | (c.count - 1) << 27 | c.offset;
+		}
+		else {
+			Vector3f cmin, cmax;
+			DecodeChildBox(node, i, lo, scale, cmin, cmax);
+			unsigned int child = encode(bvh, children[i], cmin, QuantizationScale(cmin, cmax));
+			nodes[index].child[i] = child;
+		}
+	}
+	return index;
+}
+
+void CompressedBVH::Clear()
+{
+	mesh = NULL;
+	packed = NULL;
+	nodes.clear();
+	faces.clear();
+}
+
+bool CompressedBVH::intersectLeaf(unsigned int child, const Ray &ray, RayHit *hit, float &tmax) const
+{
+	int first = child & ((1 << 27) - 1);
+	int count = ((child >> 27) & 15) + 1;
+	const int *inds = packed ? packed->indices.data() : mesh->indices.data();
+	bool found = false;
+
+	for (int i = first; i < first + count; i++)
+	{
+		const int *f = &inds[faces[i] * 3];
+		Vector3f p1, p2, p3;
+		if (packed) {
+			p1 = packed->GetVertex(f[0]);
+			p2 = packed->GetVertex(f[1]);
+			p3 = packed->GetVertex(f[2]);
+		}
+		else {
+			p1 = mesh->vertices[f[0]];
+			p2 = mesh->vertices[f[1]];
+			p3 = mesh->vertices[f[2]];
+		}
+		float t, u, v;
+		if (Triangle::IntersectTriangle(ray, p1, p2 - p1, p3 - p1, t, u, v) && t < tmax)
+		{
+			tmax = t;
+			found = true;
+			if (!hit) return true;
+			hit->t = t; hit->u = u; hit->v = v;
+			hit->primitive = faces[i];
+		}
+	}
+	return found;
+}
+
+bool CompressedBVH::traverse(const Ray &ray, float &tmax, RayHit *hit) const
+{
+	Vector3f invDir = SafeInverse(ray.v);
+	CBVHStackEntry stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	bool found = false;
+
+	CBVHStackEntry cur = { 0, rootMin, rootScale };
+	for (;;)
+	{
+		const CompressedBVHNode &node = nodes[cur.node];
+		float tnear[2];
+		bool hitChild[2];
+		Vector3f cmin[2], cmax[2];
+
+		for (int i = 0; i < 2; i++) {
+			hitChild[i] = node.child[i] != CBVH_EMPTY_CHILD;
+			if (hitChild[i]) {
+				DecodeChildBox(node, i, cur.lo, cur.scale, cmin[i], cmax[i]);
+				hitChild[i] = IntersectBox(cmin[i], cmax[i], ray.p, invDir, tmax, tnear[i]);
+			}
+		}
+
+		// leaves are tested immediately, interior children are descended near first
+		int next[2];
+		int nextCount = 0;
+		for (int i = 0; i < 2; i++)
+		{
+			if (!hitChild[i]) continue;
+			if (node.child[i] & CBVH_LEAF_BIT) {
+				if (intersectLeaf(node.child[i], ray, hit, tmax)) {
+					found = true;
+					if (!hit) return true;
+				}
+			}
+			else next[nextCount++] = i;
+		}
+
+		if (nextCount == 2 && tnear[next[1]] < tnear[next[0]]) {
+			int t = next[0]; next[0] = next[1]; next[1] = t;
+		}
+
+		if (nextCount == 2) {
+			int i = next[1];
+			CBVHStackEntry e = { node.child[i], cmin[i], QuantizationScale(cmin[i], cmax[i]) };
+			stack[stackSize++] = e;
+		}
+
+		if (nextCount >= 1) {
+			int i = next[0];
+			CBVHStackEntry e = { node.child[i], cmin[i], QuantizationScale(cmin[i], cmax[i]) };
+			cur = e;
+			continue;
+		}
+
+		if (stackSize == 0) break;
+		cur = stack[--stackSize];
+	}
+	return found;
+}
+
+bool CompressedBVH::Intersect(const Ray &ray, RayHit &hit) const
+{
+	if (nodes.empty()) return false;
+	float tmax = hit.t;
+	return traverse(ray, tmax, &hit);
+}
+
+bool CompressedBVH::IntersectAny(const Ray &ray, float tmax) const
+{
+	if (nodes.empty()) return false;
+	return traverse(ray, tmax, NULL);
+}
+
+BVHStats CompressedBVH::GetStats() const
+{
+	BVHStats stats;
+	stats.nodeCount = (int)nodes.size();
+	stats.primitiveCount = mesh ? mesh->GetFaceCount() : (packed ? packed->GetFaceCount() : 0);
+	stats.primitiveRefs = (int)faces.size();
+	for (int i = 0, n = (int)nodes.size(); i < n; i++) {
+		for (int k = 0; k < 2; k++) {
+			unsigned int c = nodes[i].child[k];
+			if (c != CBVH_EMPTY_CHILD && (c & CBVH_LEAF_BIT)) stats.leafCount++;
+		}
+	}
+	// vertex and index arrays are shared with the mesh and not counted
+	stats.memoryUsage = nodes.size() * sizeof(CompressedBVHNode) + faces.size() * sizeof(int);
+	return stats;
+}
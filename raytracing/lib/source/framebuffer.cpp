@@ -0,0 +1,261 @@
+#include "framebuffer.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAMEBUFFER_SSE2
+#include <emmintrin.h>
+#endif
+
+// ACES fit: x (a x + b) / (x (c x + d) + e)
+#define ACES_A 2.51f
+#define ACES_B 0.03f
+#define ACES_C 2.43f
+#define ACES_D 0.59f
+#define ACES_E 0.14f
+
+// the power segment of the sRGB curve from three square roots,
+// within a quarter of an 8 bit step of the exact one
+#define SRGB_S1 0.662002687f
+#define SRGB_S2 0.684122060f
+#define SRGB_S3 -0.323583601f
+#define SRGB_X -0.0225411470f
+#define SRGB_LINEAR_END 0.0031308f
+
+// dither thresholds repeat every 4 pixels, which is 48 floats for 3 or 4
+// channels and a whole number of 16 float steps
+#define DITHER_PERIOD 48
+
+static const int bayer4[16] =
+{
+	0, 8, 2, 10,
+	12, 4, 14, 6,
+	3, 11, 1, 9,
+	15, 7, 13, 5
+};
+
+const char *GetToneMapName(int op)
+{
+	static const char *names[TONEMAP_OPERATOR_COUNT] = { "none", "reinhard", "aces" };
+	return op >= 0 && op < TONEMAP_OPERATOR_COUNT ? names[op] : "";
+}
+
+bool ParseToneMap(const char *name, ToneMapOperator &op)
+{
+	for (int i = 0; i < TONEMAP_OPERATOR_COUNT; i++)
+		if (!strcmp(name, GetToneMapName(i))) {
+			op = (ToneMapOperator)i;
+			return true;
+		}
+	return false;
+}
+
+bool FrameBuffer::Create(int width, int height, int channels)
+{
+	data.clear();
+	this->width = this->height = this->channels = 0;
+	if (width <= 0 || height <= 0 || (channels != 3 && channels != 4))
+		return false;
+
+	data.assign((size_t)width * height * channels, 0.0f);
+	this->width = width;
+	this->height = height;
+	this->channels = channels;
+	return true;
+}
+
+static inline float clamp01(float v)
+{
+	return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+// scalar kernels, for the ends of rows and builds without SSE2
+template<int op, bool srgb>
+static inline float mapValue(float v, float scale)
+{
+	v *= scale;
+	if (op == TONEMAP_REINHARD) {
+		v = max(v, 0.0f);
+		v = v / (1.0f + v);
+	}
+	else if (op == TONEMAP_ACES) {
+		v = max(v, 0.0f);
+		v = v * (ACES_A * v + ACES_B) / (v * (ACES_C * v + ACES_D) + ACES_E);
+	}
+	v = clamp01(v);
+	if (srgb) {
+		if (v <= SRGB_LINEAR_END) v *= 12.92f;
+		else {
+			float s1 = sqrtf(v), s2 = sqrtf(s1), s3 = sqrtf(s2);
+			v = SRGB_S1 * s1 + SRGB_S2 * s2 + SRGB_S3 * s3 + SRGB_X * v;
+		}
+	}
+	return v;
+}
+
+#ifdef FRAMEBUFFER_SSE2
+template<int op, bool srgb>
+static inline __m128 mapVector(__m128 v, __m128 scale)
+{
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	v = _mm_mul_ps(v, scale);
+	if (op == TONEMAP_REINHARD) {
+		v = _mm_max_ps(v, zero);
+		v = _mm_div_ps(v, _mm_add_ps(one, v));
+	}
+	else if (op == TONEMAP_ACES) {
+		v = _mm_max_ps(v, zero);
+		__m128 num = _mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(ACES_A)), _mm_set1_ps(ACES_B)));
+		__m128 den = _mm_add_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(ACES_C)),
+			_mm_set1_ps(ACES_D))), _mm_set1_ps(ACES_E));
+		v = _mm_div_ps(num, den);
+	}
+	v = _mm_min_ps(_mm_max_ps(v, zero), one);
+	if (srgb) {
+		__m128 s1 = _mm_sqrt_ps(v), s2 = _mm_sqrt_ps(s1), s3 = _mm_sqrt_ps(s2);
+		__m128 curve = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(s1, _mm_set1_ps(SRGB_S1)), _mm_mul_ps(s2, _mm_set1_ps(SRGB_S2))),
+			_mm_add_ps(_mm_mul_ps(s3, _mm_set1_ps(SRGB_S3)), _mm_mul_ps(v, _mm_set1_ps(SRGB_X))));
+		__m128 linear = _mm_mul_ps(v, _mm_set1_ps(12.92f));
+		__m128 mask = _mm_cmple_ps(v, _mm_set1_ps(SRGB_LINEAR_END));
+		v = _mm_or_ps(_mm_and_ps(mask, linear), _mm_andnot_ps(mask, curve));
+	}
+	return v;
+}
+
+// lanes that hold alpha only get clamped
+static inline __m128 mapWithAlpha(__m128 mapped, __m128 original, __m128 alphaMask)
+{
+	__m128 alpha = _mm_min_ps(_mm_max_ps(original, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	return _mm_or_ps(_mm_and_ps(alphaMask, alpha), _mm_andnot_ps(alphaMask, mapped));
+}
+
+static inline __m128 getAlphaMask(int channels)
+{
+	return channels == 4 ? _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0)) : _mm_setzero_ps();
+}
+#endif
+
+template<int op, bool srgb>
+static void toneMapRow(float *row, int count, int channels, float scale)
+{
+	int i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	__m128 s = _mm_set1_ps(scale), alphaMask = getAlphaMask(channels);
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_loadu_ps(row + i);
+		_mm_storeu_ps(row + i, mapWithAlpha(mapVector<op, srgb>(v, s), v, alphaMask));
+	}
+#endif
+	for (; i < count; i++)
+		row[i] = channels == 4 && (i & 3) == 3 ? clamp01(row[i]) : mapValue<op, srgb>(row[i], scale);
+}
+
+// RGB rows are written in order and swapped to BGR afterwards, RGBA vectors
+// hold exactly one pixel and are swizzled on the way
+template<int op, bool srgb>
+static void convertRow(const float *row, unsigned char *out, int count, int channels,
+	float scale, const float *thresholds)
+{
+	int i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	__m128 s = _mm_set1_ps(scale), alphaMask = getAlphaMask(channels);
+	__m128 k255 = _mm_set1_ps(255.0f);
+	for (int t = 0; i + 16 <= count; i += 16, t = (t + 16) % DITHER_PERIOD)
+	{
+		__m128i q[4];
+		for (int j = 0; j < 4; j++) {
+			__m128 v = _mm_loadu_ps(row + i + j * 4);
+			__m128 m = mapWithAlpha(mapVector<op, srgb>(v, s), v, alphaMask);
+			if (channels == 4) m = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 0, 1, 2));
+			m = _mm_add_ps(_mm_mul_ps(m, k255), _mm_loadu_ps(thresholds + t + j * 4));
+			q[j] = _mm_cvttps_epi32(m);
+		}
+		__m128i lo = _mm_packs_epi32(q[0], q[1]), hi = _mm_packs_epi32(q[2], q[3]);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		int c = i % channels;
+		float v = c == 3 ? clamp01(row[i]) : mapValue<op, srgb>(row[i], scale);
+		int q = (int)(v * 255.0f + thresholds[i % DITHER_PERIOD]);
+		int dst = channels == 4 && c != 3 ? i - c + 2 - c : i;
+		out[dst] = (unsigned char)(q > 255 ? 255 : q);
+	}
+
+	if (channels == 3) {
+		for (int p = 0; p < count; p += 3) {
+			unsigned char t = out[p];
+			out[p] = out[p + 2];
+			out[p + 2] = t;
+		}
+	}
+}
+
+typedef void (*ToneMapRowFunc)(float *, int, int, float);
+typedef void (*ConvertRowFunc)(const float *, unsigned char *, int, int, float, const float *);
+
+static const ToneMapRowFunc toneMapFuncs[TONEMAP_OPERATOR_COUNT][2] =
+{
+	{ toneMapRow<TONEMAP_NONE, false>, toneMapRow<TONEMAP_NONE, true> },
+	{ toneMapRow<TONEMAP_REINHARD, false>, toneMapRow<TONEMAP_REINHARD, true> },
+	{ toneMapRow<TONEMAP_ACES, false>, toneMapRow<TONEMAP_ACES, true> }
+};
+
+static const ConvertRowFunc convertFuncs[TONEMAP_OPERATOR_COUNT][2] =
+{
+	{ convertRow<TONEMAP_NONE, false>, convertRow<TONEMAP_NONE, true> },
+	{ convertRow<TONEMAP_REINHARD, false>, convertRow<TONEMAP_REINHARD, true> },
+	{ convertRow<TONEMAP_ACES, false>, convertRow<TONEMAP_ACES, true> }
+};
+
+static float exposureScale(const ToneMapParams &params)
+{
+	return powf(2.0f, params.exposure);
+}
+
+void FrameBuffer::ToneMap(const ToneMapParams &params)
+{
+	if (data.empty() || params.op < 0 || params.op >= TONEMAP_OPERATOR_COUNT) return;
+	PROFILE_SCOPE("FrameBuffer::ToneMap");
+	ToneMapRowFunc func = toneMapFuncs[params.op][params.srgb];
+	float scale = exposureScale(params);
+	int count = width * channels;
+
+	ParallelFor(0, height, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+			func(GetRow(y), count, channels, scale);
+	}, 16);
+}
+
+void FrameBuffer::ConvertRow(int y, unsigned char *out, const ToneMapParams &params) const
+{
+	if (params.op < 0 || params.op >= TONEMAP_OPERATOR_COUNT) return;
+
+	// thresholds in 8 bit steps, the same for every channel of a pixel;
+	// without dithering plain rounding
+	float thresholds[DITHER_PERIOD];
+	for (int i = 0; i < DITHER_PERIOD; i++) {
+		int x = (i / channels) & 3;
+		thresholds[i] = params.dither ? (bayer4[(y & 3) * 4 + x] + 0.5f) / 16.0f : 0.5f;
+	}
+	convertFuncs[params.op][params.srgb](GetRow(y), out, width * channels, channels,
+		exposureScale(params), thresholds);
+}
+
+bool FrameBuffer::Convert(Image &image, const ToneMapParams &params) const
+{
+	if (data.empty() || !image.Create(width, height, channels * 8)) return false;
+	PROFILE_SCOPE("FrameBuffer::Convert");
+	unsigned char *out = image.GetData();
+	int rowSize = width * channels;
+
+	ParallelFor(0, height, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+			ConvertRow(y, out + y * rowSize, params);
+	}, 16);
+	return true;
+}
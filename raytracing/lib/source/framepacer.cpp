@@ -0,0 +1,57 @@
+#include "framepacer.h"
+#include "platform.h"
+
+FramePacer::FramePacer(double interval)
+	: interval(interval), lastFrame(0), nextFrame(0), started(false) { }
+
+double FramePacer::BeginFrame(double now)
+{
+	if (!started) {
+		started = true;
+		lastFrame = now;
+		nextFrame = now + interval;
+		stats.frames++;
+		return 0.0;
+	}
+
+	double dt = now - lastFrame;
+	lastFrame = now;
+	if (stats.frames > 0) {
+		stats.totalTime += dt;
+		if (dt > stats.maxFrameTime) stats.maxFrameTime = dt;
+	}
+	stats.frames++;
+
+	// the next deadline stays on the grid of whole intervals
+	if (now - nextFrame >= interval) {
+		int late = (int)((now - nextFrame) / interval);
+		stats.missed += late;
+		nextFrame += (late + 1) * interval;
+	}
+	else nextFrame += interval;
+	return dt;
+}
+
+double FramePacer::BeginFrame()
+{
+	return BeginFrame(GetTime());
+}
+
+double FramePacer::GetWaitTime(double now) const
+{
+	if (!started) return 0.0;
+	double wait = nextFrame - now;
+	return wait > 0.0 ? wait : 0.0;
+}
+
+void FramePacer::Wait()
+{
+	// sleeps may overshoot by a millisecond, so the last two are yielded away
+	for (;;)
+	{
+		double wait = GetWaitTime(GetTime());
+		if (wait <= 0.0) break;
+		if (wait > 0.002) SleepMs((int)(wait * 1000.0) - 1);
+		else SleepMs(0);
+	}
+}
@@ -0,0 +1,219 @@
+#include "grid.h"
+#include "parallel.h"
+#include <algorithm>
+
+static void cellRange(const GridLevel &g, const AABox &box, int lo[3], int hi[3])
+{
+	for (int a = 0; a < 3; a++) {
+		lo[a] = (int)((box.vmin[a] - g.bounds.vmin[a]) * g.invCellSize[a]);
+		hi[a] = (int)((box.vmax[a] - g.bounds.vmin[a]) * g.invCellSize[a]);
+		lo[a] = lo[a] < 0 ? 0 : (lo[a] >= g.res[a] ? g.res[a] - 1 : lo[a]);
+		hi[a] = hi[a] < 0 ? 0 : (hi[a] >= g.res[a] ? g.res[a] - 1 : hi[a]);
+	}
+}
+
+// exclusive prefix sum, blocks are summed in parallel and then offset
+static int prefixSum(int *data, int count, bool parallel)
+{
+	const int blockSize = 1 << 16;
+	int blocks = (count + blockSize - 1) / blockSize;
+	if (!parallel || blocks < 2)
+	{
+		int sum = 0;
+		for (int i = 0; i < count; i++) {
+			int c = data[i];
+			data[i] = sum;
+			sum += c;
+		}
+		return sum;
+	}
+
+	vector<int> blockSums(blocks + 1, 0);
+	ParallelFor(0, blocks, [&](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			int sum = 0;
+			for (int i = b * blockSize, n = min(count, (b + 1) * blockSize); i < n; i++) {
+				int c = data[i];
+				data[i] = sum;
+				sum += c;
+			}
+			blockSums[b] = sum;
+		}
+	}, 1);
+
+	int total = prefixSum(blockSums.data(), blocks, false);
+
+	ParallelFor(1, blocks, [&](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			int offset = blockSums[b];
+			for (int i = b * blockSize, n = min(count, (b + 1) * blockSize); i < n; i++)
+				data[i] += offset;
+		}
+	}, 1);
+	return total;
+}
+
+void GridLevel::Clear()
+{
+	res[0] = res[1] = res[2] = 0;
+	cellStart.clear();
+	items.clear();
+}
+
+void GridLevel::Build(const AABox &box, const AABox *objBounds, const int *ids, int count,
+	float density, int maxResolution, bool parallel)
+{
+	bounds = box;
+	Vector3f size = box.Size();
+	float maxSize = max(max(size.x, size.y), size.z);
+	if (maxSize <= 0.0f) maxSize = 1.0f;
+
+	// flat boxes still need a volume for the resolution estimate
+	for (int a = 0; a < 3; a++) {
+		if (size[a] < maxSize * 1e-3f) {
+			float pad = maxSize * 1e-3f;
+			bounds.vmin[a] -= pad * 0.5f;
+			bounds.vmax[a] += pad * 0.5f;
+			size[a] += pad;
+		}
+	}
+
+	float volume = size.x * size.y * size.z;
+	float k = pow(density * count / volume, 1.0f / 3.0f);
+	for (int a = 0; a < 3; a++) {
+		res[a] = (int)(size[a] * k);
+		res[a] = res[a] < 1 ? 1 : (res[a] > maxResolution ? maxResolution : res[a]);
+		cellSize[a] = size[a] / res[a];
+		invCellSize[a] = 1.0f / cellSize[a];
+	}
+
+	int cellsCount = GetCellsCount();
+	cellStart.assign(cellsCount + 1, 0);
+	int *counts = cellStart.data();
+
+	// counting pass
+	auto countCells = [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			int lo[3], hi[3];
+			cellRange(*this, objBounds[ids ? ids[i] : i], lo, hi);
+			for (int z = lo[2]; z <= hi[2]; z++)
+				for (int y = lo[1]; y <= hi[1]; y++)
+					for (int x = lo[0]; x <= hi[0]; x++) {
+						int cell = x + res[0] * (y + res[1] * z);
+						if (parallel) AtomicAdd(&counts[cell], 1);
+						else counts[cell]++;
+					}
+		}
+	};
+	if (parallel) ParallelFor(0, count, countCells);
+	else countCells(0, count);
+
+	int total = prefixSum(counts, cellsCount + 1, parallel);
+	items.resize(total);
+
+	// scatter pass, cursors start at the cell offsets
+	vector<int> cursor(cellStart.begin(), cellStart.end() - 1);
+	int *cur = cursor.data();
+	int *out = items.data();
+	auto scatter = [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			int id = ids ? ids[i] : i;
+			int lo[3], hi[3];
+			cellRange(*this, objBounds[id], lo, hi);
+			for (int z = lo[2]; z <= hi[2]; z++)
+				for (int y = lo[1]; y <= hi[1]; y++)
+					for (int x = lo[0]; x <= hi[0]; x++) {
+						int cell = x + res[0] * (y + res[1] * z);
+						int slot = parallel ? AtomicAdd(&cur[cell], 1) : cur[cell]++;
+						out[slot] = id;
+					}
+		}
+	};
+	if (parallel) ParallelFor(0, count, scatter);
+	else scatter(0, count);
+}
+
+static AABox computeBounds(const AABox *objBounds, int count)
+{
+	int threads = GetNumberOfThreads();
+	int grain = (count + threads - 1) / threads;
+	vector<AABox> partial(threads);
+
+	ParallelFor(0, count, [&](int begin, int end) {
+		AABox box;
+		for (int i = begin; i < end; i++)
+			box.Extend(objBounds[i]);
+		partial[begin / grain] = box;
+	}, grain);
+
+	AABox box;
+	for (int i = 0; i < threads; i++)
+		box.Extend(partial[i]);
+	return box;
+}
+
+void UniformGrid::Build(const AABox *objBounds, int count, const GridParams &params)
+{
+	grid.Clear();
+	if (count <= 0) return;
+	grid.Build(computeBounds(objBounds, count), objBounds, NULL, count,
+		params.density, params.maxResolution, true);
+}
+
+void HierarchicalGrid::Clear()
+{
+	top.Clear();
+	cellSubgrid.clear();
+	subgrids.clear();
+}
+
+void HierarchicalGrid::Build(const AABox *objBounds, int count, const GridParams &params)
+{
+	Clear();
+	if (count <= 0) return;
+
+	top.Build(computeBounds(objBounds, count), objBounds, NULL, count,
+		params.topDensity, params.maxResolution, true);
+
+	int cellsCount = top.GetCellsCount();
+	cellSubgrid.assign(cellsCount, -1);
+	for (int i = 0; i < cellsCount; i++) {
+		if (top.cellStart[i + 1] - top.cellStart[i] > params.subgridThreshold) {
+			cellSubgrid[i] = (int)subgrids.size();
+			subgrids.push_back(GridLevel());
+		}
+	}
+
+	// nested grids are small, so they are built serially but in parallel with each other
+	vector<int> cells;
+	cells.reserve(subgrids.size());
+	for (int i = 0; i < cellsCount; i++)
+		if (cellSubgrid[i] >= 0) cells.push_back(i);
+
+	ParallelFor(0, (int)cells.size(), [&](int begin, int end) {
+		for (int k = begin; k < end; k++)
+		{
+			int cell = cells[k];
+			int x = cell % top.res[0];
+			int y = (cell / top.res[0]) % top.res[1];
+			int z = cell / (top.res[0] * top.res[1]);
+
+			AABox box;
+			box.vmin = top.bounds.vmin + Vector3f(x * top.cellSize.x, y * top.cellSize.y, z * top.cellSize.z);
+			box.vmax = box.vmin + top.cellSize;
+
+			int first = top.cellStart[cell];
+			int n = top.cellStart[cell + 1] - first;
+			subgrids[cellSubgrid[cell]].Build(box, objBounds, &top.items[first], n,
+				params.density, params.maxResolution, false);
+		}
+	}, 1);
+}
+
+size_t HierarchicalGrid::GetMemoryUsage() const
+{
+	size_t size = top.GetMemoryUsage() + cellSubgrid.size() * sizeof(int);
+	for (int i = 0, n = (int)subgrids.size(); i < n; i++)
+		size += subgrids[i].GetMemoryUsage() + sizeof(GridLevel);
+	return size;
+}
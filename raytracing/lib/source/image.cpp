@@ -1,22 +1,11 @@
 #include "image.h"
+#include "imagewriter.h"
+#include "tgaformat.h"
+#include "profiler.h"
+#include <string.h>
+#include <vector>
 
-#pragma pack(push, 1)
-struct TGAHEADER
-{
-	BYTE   idLength;
-	BYTE   colorMapType;
-	BYTE   imageType;
-	USHORT colorMapOffset;
-	USHORT colorMapLength;
-	BYTE   colorMapEntrySize;
-	USHORT xOrigin;
-	USHORT yOrigin;
-	USHORT width;
-	USHORT height;
-	BYTE   depth;
-	BYTE   descriptor;
-};
-#pragma pack(pop)
+using namespace std;
 
 Image Image::Clone() const
 {
@@ -24,94 +13,269 @@ Image Image::Clone() const
 	img.isGood = isGood;
 	img.width = width;
 	img.height = height;
+	img.depth = depth;
 	img.dataSize = dataSize;
 
 	if (dataSize != 0) {
-		img.ptr->data = new BYTE[dataSize];
+		img.ptr->data = new unsigned char[dataSize];
 		memcpy(img.ptr->data, ptr->data, dataSize);
 	}
 	return img;
 }
 
-void Image::read(HANDLE hFile, LPVOID lpBuffer, DWORD nNumBytes)
+bool Image::Create(int width, int height, int depth)
+{
+	ptr = my_shared_ptr<Shared>(new Shared);
+	this->width = this->height = this->depth = 0;
+	dataSize = 0;
+	isGood = false;
+
+	if (width <= 0 || height <= 0 || (depth != 8 && depth != 24 && depth != 32))
+		return false;
+
+	int size = width * height * (depth / 8);
+	ptr->data = new(std::nothrow) unsigned char[size];
+	if (!ptr->data) return false;
+	memset(ptr->data, 0, size);
+
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	dataSize = size;
+	return isGood = true;
+}
+
+bool Image::SaveTga(const char *filename) const
 {
-	DWORD bytesRead;
-	BOOL success = ReadFile(hFile, lpBuffer, nNumBytes, &bytesRead, NULL);
-	if (!success || bytesRead != nNumBytes)
-		throw false;
+	// rows are only copied, not worth spreading over threads
+	ImageWriter writer;
+	writer.SetParallel(false);
+	return writer.Write(filename, *this, IMAGE_TGA);
 }
 
+// 5-5-5 BGR with an attribute bit to 8 bit BGR
+static void expand16(const unsigned char *src, unsigned char *out)
+{
+	int v = src[0] | src[1] << 8;
+	int b = v & 31, g = (v >> 5) & 31, r = (v >> 10) & 31;
+	out[0] = (unsigned char)(b << 3 | b >> 2);
+	out[1] = (unsigned char)(g << 3 | g >> 2);
+	out[2] = (unsigned char)(r << 3 | r >> 2);
+}
+
+// Puts decoded pixels in place in file order, applying the origin flips as
+// it goes, so rows never have to be swapped or mirrored afterwards. Pixels
+// arrive in the file's format and are translated when it differs from the
+// image's: colormap indices and 15/16 bit colors.
+struct TgaDecoder
+{
+	unsigned char *data;
+	int width, height, bpp; // of the image
+	bool flipX, flipY;      // the file starts at the right or at the bottom
+	int x, y;               // next pixel in file order
+
+	int srcBpp;
+	const unsigned char *palette; // entries already in the image's format
+	int paletteFirst, paletteCount;
+	bool expand;                  // 15/16 bit colors
+
+	bool IsDone() const { return y >= height; }
+
+	// count literal pixels
+	void Put(const unsigned char *src, int count)
+	{
+		unsigned char tmp[128 * 4];
+		while (count > 0 && y < height)
+		{
+			int n = min(count, width - x);
+			if (!palette && !expand) place(src, n);
+			else {
+				for (int i = 0; i < n; ) {
+					int k = min(n - i, 128);
+					translate(src + i * srcBpp, k, tmp);
+					place(tmp, k);
+					i += k;
+				}
+			}
+			src += n * srcBpp;
+			count -= n;
+		}
+	}
+
+	// count copies of one pixel
+	void Fill(const unsigned char *src, int count)
+	{
+		unsigned char pixel[4];
+		translate(src, 1, pixel);
+		while (count > 0 && y < height)
+		{
+			int n = min(count, width - x);
+			// a mirrored span is still contiguous
+			unsigned char *dst = row() + (flipX ? width - x - n : x) * bpp;
+			if (bpp == 1) memset(dst, pixel[0], n);
+			else {
+				memcpy(dst, pixel, bpp);
+				for (int filled = 1; filled < n; ) {
+					int k = min(filled, n - filled);
+					memcpy(dst + filled * bpp, dst, k * bpp);
+					filled += k;
+				}
+			}
+			advance(n);
+			count -= n;
+		}
+	}
+private:
+	unsigned char *row() const {
+		return data + (flipY ? height - 1 - y : y) * width * bpp;
+	}
+
+	void advance(int n) {
+		x += n;
+		if (x == width) { x = 0; y++; }
+	}
+
+	// n pixels of the image's format, no further than the end of the row
+	void place(const unsigned char *pixels, int n)
+	{
+		unsigned char *r = row();
+		if (!flipX) memcpy(r + x * bpp, pixels, n * bpp);
+		else {
+			for (int i = 0; i < n; i++)
+				memcpy(r + (width - 1 - x - i) * bpp, pixels + i * bpp, bpp);
+		}
+		advance(n);
+	}
+
+	void translate(const unsigned char *src, int count, unsigned char *out) const
+	{
+		for (int i = 0; i < count; i++, src += srcBpp, out += bpp)
+		{
+			if (palette) {
+				int index = (srcBpp == 1 ? src[0] : src[0] | src[1] << 8) - paletteFirst;
+				if (index >= 0 && index < paletteCount) memcpy(out, palette + index * bpp, bpp);
+				else memset(out, 0, bpp);
+			}
+			else if (expand) expand16(src, out);
+			else memcpy(out, src, bpp);
+		}
+	}
+};
+
 bool Image::LoadTga(const char *filename)
 {
+	PROFILE_SCOPE("Image::LoadTga");
 	ptr = my_shared_ptr<Shared>(new Shared);
 	width = height = depth = 0;
 	dataSize = 0;
 
-	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, 0);
-	if (file == INVALID_HANDLE_VALUE)
+	MappedFile file;
+	if (!file.Open(filename))
 		return isGood = false;
 
-	BYTE *data = 0;
+	const unsigned char *p = (const unsigned char *)file.GetData();
+	const unsigned char *end = p + file.GetSize();
+	unsigned char *data = 0;
 	isGood = true;
 	try {
-		TGAHEADER tgaHeader = { };
-		read(file, &tgaHeader, sizeof(TGAHEADER));
+		TGAHEADER tgaHeader;
+		if (file.GetSize() < sizeof(TGAHEADER)) throw false;
+		memcpy(&tgaHeader, p, sizeof(TGAHEADER));
+		p += sizeof(TGAHEADER);
 
-		if (tgaHeader.colorMapType != 0 ||
-			tgaHeader.imageType != 2 && tgaHeader.imageType != 3) {
+		// 1 colormapped, 2 true color, 3 grayscale, +8 run-length encoded
+		int type = tgaHeader.imageType & ~8;
+		bool rle = (tgaHeader.imageType & 8) != 0;
+		int srcDepth = tgaHeader.depth;
+		int entrySize = tgaHeader.colorMapEntrySize;
+		int imageDepth = 0;
+
+		if (type == 1 && tgaHeader.colorMapType == 1 && tgaHeader.colorMapLength > 0 &&
+			(srcDepth == 8 || srcDepth == 16) &&
+			(entrySize == 15 || entrySize == 16 || entrySize == 24 || entrySize == 32))
+			imageDepth = entrySize == 32 ? 32 : 24;
+		else if (type == 2 && (srcDepth == 15 || srcDepth == 16 || srcDepth == 24 || srcDepth == 32))
+			imageDepth = srcDepth == 32 ? 32 : 24;
+		else if (type == 3 && srcDepth == 8)
+			imageDepth = 8;
+		if (!imageDepth || tgaHeader.width == 0 || tgaHeader.height == 0)
 			throw false;
-		}
 
-		if (tgaHeader.idLength != 0) {
-			SetFilePointer(file, tgaHeader.idLength, NULL, FILE_CURRENT);
+		if (end - p < tgaHeader.idLength) throw false;
+		p += tgaHeader.idLength;
+
+		// true color images may carry a colormap too, it is skipped
+		vector<unsigned char> palette;
+		int bpp = imageDepth / 8;
+		if (tgaHeader.colorMapType == 1)
+		{
+			int entryBytes = (entrySize + 7) / 8;
+			size_t mapSize = (size_t)tgaHeader.colorMapLength * entryBytes;
+			if ((size_t)(end - p) < mapSize) throw false;
+			if (type == 1) {
+				palette.resize(tgaHeader.colorMapLength * bpp);
+				for (int i = 0; i < tgaHeader.colorMapLength; i++) {
+					if (entryBytes == 2) expand16(p + i * 2, &palette[i * bpp]);
+					else memcpy(&palette[i * bpp], p + i * entryBytes, bpp);
+				}
+			}
+			p += mapSize;
 		}
 
-		DWORD imageSize = tgaHeader.width * tgaHeader.height * tgaHeader.depth / 8;
-		data = new(std::nothrow) BYTE[imageSize];
+		int imageSize = tgaHeader.width * tgaHeader.height * bpp;
+		data = new(std::nothrow) unsigned char[imageSize];
 		if (!data) throw false;
 
-		read(file, data, imageSize);
-		width = tgaHeader.width;
-		height = tgaHeader.height;
+		TgaDecoder decoder = { };
+		decoder.data = data;
+		decoder.width = tgaHeader.width;
+		decoder.height = tgaHeader.height;
+		decoder.bpp = bpp;
+		decoder.flipX = (tgaHeader.descriptor & 0x10) != 0;
+		decoder.flipY = (tgaHeader.descriptor & 0x20) == 0;
+		decoder.srcBpp = (srcDepth + 7) / 8;
+		decoder.palette = type == 1 ? palette.data() : NULL;
+		decoder.paletteFirst = tgaHeader.colorMapOffset;
+		decoder.paletteCount = tgaHeader.colorMapLength;
+		decoder.expand = type == 2 && decoder.srcBpp == 2;
+		int srcBpp = decoder.srcBpp;
 
-		int rowSize = imageSize / height;
-		if ((~tgaHeader.descriptor & 0x10)) {
-			BYTE *tmp = new BYTE[rowSize];
-			for (int i = 0; i < height / 2; i++)
-			{
-				BYTE *r1 = &data[rowSize*i];
-				BYTE *r2 = &data[rowSize*(height - i - 1)];
-				memcpy(tmp, r1, rowSize);
-				memcpy(r1, r2, rowSize);
-				memcpy(r2, tmp, rowSize);
-			}
-			delete [] tmp;
+		if (!rle) {
+			if ((size_t)(end - p) < (size_t)tgaHeader.width * tgaHeader.height * srcBpp) throw false;
+			decoder.Put(p, tgaHeader.width * tgaHeader.height);
 		}
-
-		if (tgaHeader.descriptor & 8) {
-			int components = tgaHeader.depth / 8;
-			BYTE *tmp = new BYTE[components];
-			for (int i = 0; i < height; i++) {
-				for (int j = 0; j < width / 2; j++) {
-					BYTE *c1 = &data[rowSize*i + j*components];
-					BYTE *c2 = &data[rowSize*i + (rowSize - (j+1)*components)];
-					memcpy(tmp, c1, components);
-					memcpy(c1, c2, components);
-					memcpy(c2, tmp, components);
+		else
+		{
+			// packets: a header byte, then one pixel repeated or up to 128 literal ones
+			while (!decoder.IsDone())
+			{
+				if (p >= end) throw false;
+				int packet = *p++;
+				int count = (packet & 0x7f) + 1;
+				if (packet & 0x80) {
+					if (end - p < srcBpp) throw false;
+					decoder.Fill(p, count);
+					p += srcBpp;
+				}
+				else {
+					if (end - p < count * srcBpp) throw false;
+					decoder.Put(p, count);
+					p += count * srcBpp;
 				}
 			}
-			delete [] tmp;
 		}
-		
+		PROFILE_COUNT(PROF_BYTES_LOADED, file.GetSize());
+
+		width = tgaHeader.width;
+		height = tgaHeader.height;
 		ptr->data = data;
 		dataSize = imageSize;
-		depth = tgaHeader.depth;
+		depth = imageDepth;
 	}
 	catch(bool) {
 		delete [] data;
 		isGood = false;
 	}
 
-	CloseHandle(file);
 	return isGood;
-}
\ No newline at end of file
+}
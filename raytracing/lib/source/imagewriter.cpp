@@ -0,0 +1,402 @@
+#include "imagewriter.h"
+#include "tgaformat.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+struct ImageSource
+{
+	const Image *image;         // either an image
+	const Color3f *pixels;      // or float pixels
+	const FrameBuffer *frame;   // or a frame buffer
+	const ToneMapParams *toneMap;
+	int width, height;
+	int channels;          // of 8 bit output: 1, 3 or 4
+};
+
+typedef vector<unsigned char> ByteBuffer;
+
+// rows of one block, encoded and ready to be written
+struct WriteJob
+{
+	File *file;
+	const ByteBuffer *rows;
+	int count;
+	bool ok;
+};
+
+static void writeRows(void *param)
+{
+	WriteJob *job = (WriteJob *)param;
+	for (int i = 0; i < job->count && job->ok; i++) {
+		const ByteBuffer &row = job->rows[i];
+		if (!row.empty() && !job->file->Write(row.data(), row.size()))
+			job->ok = false;
+	}
+}
+
+static bool hasExtension(const char *filename, const char *ext)
+{
+	size_t n = strlen(filename), e = strlen(ext);
+	if (n < e) return false;
+	for (size_t i = 0; i < e; i++) {
+		char c = filename[n - e + i];
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		if (c != ext[i]) return false;
+	}
+	return true;
+}
+
+bool GetImageFormat(const char *filename, ImageFormat &format)
+{
+	if (hasExtension(filename, ".tga")) format = IMAGE_TGA;
+	else if (hasExtension(filename, ".ppm") || hasExtension(filename, ".pgm")) format = IMAGE_PPM;
+	else if (hasExtension(filename, ".pfm")) format = IMAGE_PFM;
+	else if (hasExtension(filename, ".hdr")) format = IMAGE_HDR;
+	else return false;
+	return true;
+}
+
+const char *GetImageFormatName(ImageFormat format)
+{
+	static const char *names[IMAGE_FORMAT_COUNT] = { "tga", "tga rle", "ppm", "pfm", "hdr" };
+	return format >= 0 && format < IMAGE_FORMAT_COUNT ? names[format] : "";
+}
+
+// source row y as channels bytes per pixel, BGR(A) order or RGB when rgb is set
+static void getBytes(const ImageSource &src, int y, bool rgb, unsigned char *out, ByteBuffer &tmp)
+{
+	int w = src.width;
+	if (src.frame)
+	{
+		int channels = src.frame->GetChannels();
+		if (!rgb) {
+			src.frame->ConvertRow(y, out, *src.toneMap);
+			return;
+		}
+		tmp.resize(w * channels);
+		src.frame->ConvertRow(y, tmp.data(), *src.toneMap);
+		for (int x = 0; x < w; x++, out += 3) {
+			out[0] = tmp[x * channels + 2];
+			out[1] = tmp[x * channels + 1];
+			out[2] = tmp[x * channels + 0];
+		}
+		return;
+	}
+	if (src.pixels)
+	{
+		const Color3f *p = src.pixels + y * w;
+		int r = rgb ? 0 : 2, b = rgb ? 2 : 0;
+		for (int x = 0; x < w; x++, out += 3) {
+			out[r] = ColorToByte(p[x].r);
+			out[1] = ColorToByte(p[x].g);
+			out[b] = ColorToByte(p[x].b);
+		}
+		return;
+	}
+
+	int depth = src.image->GetDepth() / 8;
+	const unsigned char *row = src.image->GetData() + y * w * depth;
+	if (!rgb || depth == 1) {
+		memcpy(out, row, w * depth);
+		return;
+	}
+	for (int x = 0; x < w; x++, row += depth, out += 3) {
+		out[0] = row[2];
+		out[1] = row[1];
+		out[2] = row[0];
+	}
+}
+
+// source row y as RGB floats
+static void getFloats(const ImageSource &src, int y, float *out)
+{
+	int w = src.width;
+	if (src.pixels) {
+		memcpy(out, src.pixels + y * w, w * sizeof(Color3f));
+		return;
+	}
+	if (src.frame) {
+		const float *row = src.frame->GetRow(y);
+		int channels = src.frame->GetChannels();
+		if (channels == 3) memcpy(out, row, w * 3 * sizeof(float));
+		else {
+			for (int x = 0; x < w; x++, row += channels, out += 3) {
+				out[0] = row[0];
+				out[1] = row[1];
+				out[2] = row[2];
+			}
+		}
+		return;
+	}
+
+	int depth = src.image->GetDepth() / 8;
+	const unsigned char *row = src.image->GetData() + y * w * depth;
+	for (int x = 0; x < w; x++, row += depth, out += 3)
+	{
+		if (depth == 1) out[0] = out[1] = out[2] = row[0] / 255.0f;
+		else {
+			out[0] = row[2] / 255.0f;
+			out[1] = row[1] / 255.0f;
+			out[2] = row[0] / 255.0f;
+		}
+	}
+}
+
+static void append(ByteBuffer &out, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	out.insert(out.end(), p, p + size);
+}
+
+// TGA packets: a run of 2 to 128 equal pixels, or 1 to 128 literal ones
+static void encodeTgaRle(const unsigned char *pixels, int count, int bpp, ByteBuffer &out)
+{
+	int x = 0;
+	while (x < count)
+	{
+		const unsigned char *p = pixels + x * bpp;
+		int run = 1;
+		while (x + run < count && run < 128 && !memcmp(p, p + run * bpp, bpp)) run++;
+		if (run >= 2) {
+			out.push_back((unsigned char)(0x80 | (run - 1)));
+			append(out, p, bpp);
+			x += run;
+			continue;
+		}
+
+		int start = x;
+		while (x < count && x - start < 128) {
+			if (x + 1 < count && !memcmp(pixels + x * bpp, pixels + (x + 1) * bpp, bpp)) break;
+			x++;
+		}
+		out.push_back((unsigned char)(x - start - 1));
+		append(out, p, (x - start) * bpp);
+	}
+}
+
+// Radiance packets for one component: a run of 4 to 127 equal bytes as
+// 128 + length, or 1 to 128 literal bytes
+static void encodeHdrRle(const unsigned char *data, int count, ByteBuffer &out)
+{
+	int x = 0;
+	while (x < count)
+	{
+		int run = 1;
+		while (x + run < count && run < 127 && data[x + run] == data[x]) run++;
+		if (run >= 4) {
+			out.push_back((unsigned char)(128 + run));
+			out.push_back(data[x]);
+			x += run;
+			continue;
+		}
+
+		int start = x;
+		while (x < count && x - start < 128) {
+			int r = 1;
+			while (x + r < count && r < 4 && data[x + r] == data[x]) r++;
+			if (r >= 4) break;
+			x++;
+		}
+		out.push_back((unsigned char)(x - start));
+		append(out, data + start, x - start);
+	}
+}
+
+static void toRgbe(const float *rgb, unsigned char *e)
+{
+	float r = max(rgb[0], 0.0f), g = max(rgb[1], 0.0f), b = max(rgb[2], 0.0f);
+	float v = max(max(r, g), b);
+	if (v < 1e-32f) {
+		e[0] = e[1] = e[2] = e[3] = 0;
+		return;
+	}
+	int exponent;
+	float scale = (float)frexp(v, &exponent) * 256.0f / v;
+	e[0] = (unsigned char)(r * scale);
+	e[1] = (unsigned char)(g * scale);
+	e[2] = (unsigned char)(b * scale);
+	e[3] = (unsigned char)(exponent + 128);
+}
+
+// per thread scratch space for converting a source row
+struct RowScratch
+{
+	ByteBuffer bytes;
+	ByteBuffer convert;
+	vector<float> floats;
+	ByteBuffer rgbe;
+};
+
+static void encodeRow(const ImageSource &src, ImageFormat format, int y,
+	RowScratch &scratch, ByteBuffer &out)
+{
+	int w = src.width;
+	out.clear();
+
+	switch (format)
+	{
+	case IMAGE_TGA:
+	case IMAGE_PPM:
+		out.resize(w * src.channels);
+		getBytes(src, y, format == IMAGE_PPM, out.data(), scratch.convert);
+		break;
+	case IMAGE_TGA_RLE:
+		scratch.bytes.resize(w * src.channels);
+		getBytes(src, y, false, scratch.bytes.data(), scratch.convert);
+		encodeTgaRle(scratch.bytes.data(), w, src.channels, out);
+		break;
+	case IMAGE_PFM:
+		out.resize(w * 3 * sizeof(float));
+		getFloats(src, y, (float *)out.data());
+		break;
+	case IMAGE_HDR:
+		{
+			scratch.floats.resize(w * 3);
+			getFloats(src, y, scratch.floats.data());
+			scratch.rgbe.resize(w * 4);
+			for (int x = 0; x < w; x++)
+				toRgbe(&scratch.floats[x * 3], &scratch.rgbe[x * 4]);
+
+			// the run-length scheme only covers these widths
+			if (w < 8 || w > 0x7fff) {
+				out.swap(scratch.rgbe);
+				break;
+			}
+			unsigned char header[4] = { 2, 2, (unsigned char)(w >> 8), (unsigned char)(w & 0xff) };
+			append(out, header, 4);
+			scratch.bytes.resize(w);
+			for (int c = 0; c < 4; c++) {
+				for (int x = 0; x < w; x++)
+					scratch.bytes[x] = scratch.rgbe[x * 4 + c];
+				encodeHdrRle(scratch.bytes.data(), w, out);
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static bool writeHeader(File &file, const ImageSource &src, ImageFormat format, size_t &bytes)
+{
+	char text[128];
+	int w = src.width, h = src.height;
+
+	if (format == IMAGE_TGA || format == IMAGE_TGA_RLE)
+	{
+		if (w > 65535 || h > 65535) return false;
+		TGAHEADER tgaHeader = { };
+		tgaHeader.imageType = src.channels == 1 ? 3 : 2;
+		if (format == IMAGE_TGA_RLE) tgaHeader.imageType |= 8;
+		tgaHeader.width = (unsigned short)w;
+		tgaHeader.height = (unsigned short)h;
+		tgaHeader.depth = (unsigned char)(src.channels * 8);
+		tgaHeader.descriptor = src.channels == 4 ? 8 : 0; // alpha bits, bottom-up rows
+		bytes = sizeof(TGAHEADER);
+		return file.Write(&tgaHeader, sizeof(TGAHEADER));
+	}
+
+	if (format == IMAGE_PPM)
+		sprintf(text, "%s\n%d %d\n255\n", src.channels == 1 ? "P5" : "P6", w, h);
+	else if (format == IMAGE_PFM) {
+		// a negative scale marks little endian floats
+		unsigned int probe = 1;
+		sprintf(text, "PF\n%d %d\n%s\n", w, h, *(unsigned char *)&probe ? "-1.0" : "1.0");
+	}
+	else if (format == IMAGE_HDR)
+		sprintf(text, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", h, w);
+	else return false;
+
+	bytes = strlen(text);
+	return file.Write(text, bytes);
+}
+
+bool ImageWriter::Write(const char *filename, const Image &image, ImageFormat format)
+{
+	if (!image.IsGood()) return false;
+	ImageSource src = { &image, NULL, NULL, NULL, image.GetWidth(), image.GetHeight(), image.GetDepth() / 8 };
+	// PPM has no alpha
+	if (format == IMAGE_PPM && src.channels == 4) src.channels = 3;
+	return write(filename, src, format);
+}
+
+bool ImageWriter::Write(const char *filename, const Color3f *pixels, int width, int height, ImageFormat format)
+{
+	if (!pixels || width <= 0 || height <= 0) return false;
+	ImageSource src = { NULL, pixels, NULL, NULL, width, height, 3 };
+	return write(filename, src, format);
+}
+
+bool ImageWriter::Write(const char *filename, const FrameBuffer &frame, ImageFormat format,
+	const ToneMapParams &toneMap)
+{
+	if (frame.IsEmpty()) return false;
+	ImageSource src = { NULL, NULL, &frame, &toneMap, frame.GetWidth(), frame.GetHeight(), frame.GetChannels() };
+	if (format == IMAGE_PPM) src.channels = 3;
+	return write(filename, src, format);
+}
+
+bool ImageWriter::write(const char *filename, const ImageSource &src, ImageFormat format)
+{
+	PROFILE_SCOPE("ImageWriter::Write");
+	stats = ImageWriteStats();
+	double start = GetTime();
+
+	File file;
+	size_t headerSize = 0;
+	if (!file.Open(filename, FILE_WRITE) || !writeHeader(file, src, format, headerSize))
+		return false;
+
+	// TGA and PFM store the bottom row first
+	bool bottomUp = format == IMAGE_TGA || format == IMAGE_TGA_RLE || format == IMAGE_PFM;
+	int rows = blockRows > 0 ? blockRows : max(16, (parallel ? GetNumberOfThreads() : 1) * 8);
+	if (rows > src.height) rows = src.height;
+
+	// one block is written while the next is encoded
+	vector<ByteBuffer> blocks[2];
+	blocks[0].resize(rows);
+	blocks[1].resize(rows);
+	WriteJob job = { &file, NULL, 0, true };
+	Thread writer;
+	size_t bytes = headerSize;
+	int current = 0;
+
+	for (int first = 0; first < src.height && job.ok; first += rows)
+	{
+		int count = min(rows, src.height - first);
+		ByteBuffer *block = blocks[current].data();
+		auto encode = [&](int begin, int end) {
+			RowScratch scratch;
+			for (int i = begin; i < end; i++) {
+				int r = first + i;
+				encodeRow(src, format, bottomUp ? src.height - 1 - r : r, scratch, block[i]);
+			}
+		};
+		if (parallel) ParallelFor(0, count, encode, 1);
+		else encode(0, count);
+
+		for (int i = 0; i < count; i++) bytes += block[i].size();
+
+		writer.Join();
+		if (!job.ok) break;
+		job.rows = block;
+		job.count = count;
+		if (!parallel || !writer.Start(writeRows, &job))
+			writeRows(&job);
+		current ^= 1;
+	}
+	writer.Join();
+	if (!job.ok) return false;
+
+	file.Close();
+	stats.bytes = bytes;
+	stats.time = GetTime() - start;
+	PROFILE_COUNT(PROF_BYTES_WRITTEN, bytes);
+	return true;
+}
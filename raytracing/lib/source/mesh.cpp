@@ -1,234 +1,230 @@
 #include "mesh.h"
 #include "datatypes.h"
 #include "modelloader.h"
+#include "packedmesh.h"
 
 #define TEX_ID_NONE GLuint(-2)
 
-Mesh::Mesh(GLRenderingContext *rc) : rc(rc)
+MeshBuffers::~MeshBuffers()
 {
-	firstIndex = 0;
-	indicesCount = -1;
-
-	vertices = indices = normals = texCoords = NULL;
-	tangents = binormals = NULL;
-	texture = NULL;
-	normalMap = specularMap = NULL;
-	tangentsComputed = false;
+	delete vertices;
+	delete indices;
+	delete normals;
+	delete texCoords;
+	delete tangents;
+	delete binormals;
 }
 
-Mesh::Mesh(const Mesh &m) {
-	clone(m);
+static VertexBuffer *cloneBuffer(GLRenderingContext *rc, const VertexBuffer *vb)
+{
+	if (!vb) return NULL;
+	VertexBuffer *copy = new VertexBuffer(rc, vb->GetTarget());
+	vb->CloneTo(*copy);
+	return copy;
 }
 
-Mesh::~Mesh() {
-	cleanup();
+MeshBuffers *MeshBuffers::Clone(GLRenderingContext *rc) const
+{
+	MeshBuffers *b = new MeshBuffers;
+	b->vertices = cloneBuffer(rc, vertices);
+	b->indices = cloneBuffer(rc, indices);
+	b->normals = cloneBuffer(rc, normals);
+	b->texCoords = cloneBuffer(rc, texCoords);
+	b->tangents = cloneBuffer(rc, tangents);
+	b->binormals = cloneBuffer(rc, binormals);
+	b->normalType = normalType;
+	b->texCoordType = texCoordType;
+	return b;
 }
 
-Mesh &Mesh::operator=(const Mesh &m) {
-	cleanup();
-	clone(m);
-	return *this;
+Mesh::Mesh(GLRenderingContext *rc) : buffers(new MeshBuffers), rc(rc)
+{
+	firstIndex = 0;
+	indicesCount = -1;
 }
 
-void Mesh::clone(const Mesh &m)
+Mesh::Mesh(GLRenderingContext *rc, const my_shared_ptr<MeshBuffers> &buffers)
+	: buffers(buffers), rc(rc)
 {
-	rc = m.rc;
-
-	firstIndex = m.firstIndex;
-	indicesCount = m.indicesCount;
-
-	vertices = m.vertices ? new VertexBuffer(*m.vertices) : NULL;
-	indices = m.indices ? new VertexBuffer(*m.indices) : NULL;
-	normals = m.normals ? new VertexBuffer(*m.normals) : NULL;
-	texCoords = m.texCoords  ? new VertexBuffer(*m.texCoords) : NULL;
-	tangents = m.tangents ? new VertexBuffer(*m.tangents) : NULL;
-	binormals = m.binormals ? new VertexBuffer(*m.binormals) : NULL;
-
-	texture = m.texture ? new BaseTexture(*m.texture) : NULL;
-	normalMap = m.normalMap ? new Texture2D(*m.normalMap) : NULL;
-	specularMap = m.specularMap ? new Texture2D(*m.specularMap) : NULL;
-
-	tangentsComputed = m.tangentsComputed;
-	boundingBox = m.boundingBox;
-	boundingSphere = m.boundingSphere;
+	firstIndex = 0;
+	indicesCount = -1;
 }
 
-void Mesh::cleanup()
+void Mesh::MakeUnique()
 {
-	delete vertices;
-	delete indices;
-	delete normals;
-	delete texCoords;
-	delete tangents;
-	delete binormals;
-	delete texture;
-	delete normalMap;
-	delete specularMap;
+	if (IsShared())
+		buffers = my_shared_ptr<MeshBuffers>(buffers->Clone(rc));
 }
 
 void Mesh::BindTexture(const BaseTexture &texture) {
-	delete this->texture;
-	this->texture = new BaseTexture(texture);
+	this->texture = my_shared_ptr<BaseTexture>(new BaseTexture(texture));
 }
 
 void Mesh::BindNormalMap(const Texture2D &normalMap) {
-	delete this->normalMap;
-	this->normalMap = new Texture2D(normalMap);
-	if (!tangentsComputed) {
-		RecalcTangents();
-		tangentsComputed = true;
-	}
+	this->normalMap = my_shared_ptr<Texture2D>(new Texture2D(normalMap));
+	if (!buffers->tangents) RecalcTangents();
 }
 
 void Mesh::BindSpecularMap(const Texture2D &specularMap) {
-	delete this->specularMap;
-	this->specularMap = new Texture2D(specularMap);
+	this->specularMap = my_shared_ptr<Texture2D>(new Texture2D(specularMap));
+}
+
+void Mesh::SetLod(int level)
+{
+	if (lods.empty()) return;
+	firstIndex = lods[level].firstIndex;
+	indicesCount = lods[level].indicesCount;
+}
+
+int Mesh::SelectLod(float distance, float screenScale, float maxPixelError)
+{
+	int level = 0;
+	for (int i = 1, n = (int)lods.size(); i < n; i++) {
+		if (IsLodErrorVisible(lods[i].error, distance, screenScale, maxPixelError)) break;
+		level = i;
+	}
+	SetLod(level);
+	return level;
 }
 
 void Mesh::RecalcTangents()
 {
 	if (!HasNormals() || !HasTexCoords()) return;
+	MeshBuffers &b = *buffers;
+
+	// packed texture coordinates can't be read back as floats, so take the
+	// CPU copy where there is one
+	const Vector3f *verts;
+	const Vector2f *texs;
+	const int *inds;
+	if (data.Get()) {
+		verts = data->vertices.data();
+		texs = data->texCoords.data();
+		inds = data->indices.data();
+	}
+	else {
+		verts = (const Vector3f *)b.vertices->Map(GL_READ_ONLY);
+		texs = (const Vector2f *)b.texCoords->Map(GL_READ_ONLY);
+		inds = (const int *)b.indices->Map(GL_READ_ONLY);
+	}
 
-	Vector3f *verts = (Vector3f *)vertices->Map(GL_READ_ONLY);
-	Vector2f *texs = (Vector2f *)texCoords->Map(GL_READ_ONLY);
-	int *inds = (int *)indices->Map(GL_READ_ONLY);
-	
+	// every face of the buffers rather than the range this mesh draws
+	int indicesCount = data.Get() ? data->GetIndicesCount() : b.indices->GetSize() / sizeof(int);
 	int verticesCount = GetVerticesCount();
-	int indicesCount = GetIndicesCount();
 	Vector3f *ts = new Vector3f[verticesCount];
 	Vector3f *bs = new Vector3f[verticesCount];
+	ComputeTangents(verts, texs, inds, indicesCount, ts, bs);
 
-	for (int i = 0; i < indicesCount; i += 3)
+	if (!b.tangents) b.tangents = new VertexBuffer(rc, GL_ARRAY_BUFFER);
+	if (!b.binormals) b.binormals = new VertexBuffer(rc, GL_ARRAY_BUFFER);
+	if (b.normalType == GL_INT_2_10_10_10_REV)
 	{
-		int i1 = inds[i], i2 = inds[i+1], i3 = inds[i+2];
-
-		Vector3f &v1 = verts[i1];
-		Vector3f &v2 = verts[i2];
-		Vector3f &v3 = verts[i3];
-
-		Vector2f &t1 = texs[i1];
-		Vector2f &t2 = texs[i2];
-		Vector2f &t3 = texs[i3];
-
-		Vector3f edge1 = v2 - v1;
-		Vector3f edge2 = v3 - v1;
-		Vector2f uv1 = t2 - t1;
-		Vector2f uv2 = t3 - t1;
-
-		float f = 1.0f / (uv1.x * uv2.y - uv2.x * uv1.y);
-		Vector3f tangent = (uv2.y * edge1 - uv1.y * edge2) * f;
-		Vector3f binormal = (uv1.x * edge2 - uv2.x * edge1) * f;
-		tangent.Normalize();
-		binormal.Normalize();
-
-		ts[i1] = ts[i2] = ts[i3] = tangent;
-		bs[i1] = bs[i2] = bs[i3] = binormal;
+		unsigned int *packed = new unsigned int[verticesCount * 2];
+		for (int i = 0; i < verticesCount; i++) {
+			packed[i] = EncodeSnorm1010102(ts[i]);
+			packed[verticesCount + i] = EncodeSnorm1010102(bs[i]);
+		}
+		b.tangents->SetData(verticesCount*sizeof(unsigned int), packed, GL_STATIC_DRAW);
+		b.binormals->SetData(verticesCount*sizeof(unsigned int), packed + verticesCount, GL_STATIC_DRAW);
+		delete [] packed;
+	}
+	else {
+		b.tangents->SetData(verticesCount*sizeof(Vector3f), ts, GL_STATIC_DRAW);
+		b.binormals->SetData(verticesCount*sizeof(Vector3f), bs, GL_STATIC_DRAW);
 	}
-	
-	if (!tangents) tangents = new VertexBuffer(rc, GL_ARRAY_BUFFER);
-	if (!binormals) binormals = new VertexBuffer(rc, GL_ARRAY_BUFFER);
-	tangents->SetData(verticesCount*sizeof(Vector3f), ts, GL_STATIC_DRAW);
-	binormals->SetData(verticesCount*sizeof(Vector3f), bs, GL_STATIC_DRAW);
 
 	delete [] ts;
 	delete [] bs;
 
-	vertices->Unmap();
-	texCoords->Unmap();
-	indices->Unmap();
+	if (!data.Get()) {
+		b.vertices->Unmap();
+		b.texCoords->Unmap();
+		b.indices->Unmap();
+	}
 }
 
-void Mesh::Draw()
+// packed normals are signed normalized with four components, the
+// shaders' vec3 ignores the fourth
+void Mesh::enableAttribs()
 {
-	if (texture) texture->Bind();
-	if (specularMap) specularMap->Bind();
-	if (normalMap) {
-		normalMap->Bind();
+	const MeshBuffers &b = *buffers;
+	GLint normalSize = b.normalType == GL_FLOAT ? 3 : 4;
+	GLboolean normalized = b.normalType == GL_FLOAT ? GL_FALSE : GL_TRUE;
+
+	if (normalMap.Get()) {
 		glEnableVertexAttribArray(AttribsLocations.Tangent);
 		glEnableVertexAttribArray(AttribsLocations.Binormal);
-		tangents->AttribPointer(AttribsLocations.Tangent, 3, GL_FLOAT);
-		binormals->AttribPointer(AttribsLocations.Binormal, 3, GL_FLOAT);
+		b.tangents->AttribPointer(AttribsLocations.Tangent, normalSize, b.normalType, normalized);
+		b.binormals->AttribPointer(AttribsLocations.Binormal, normalSize, b.normalType, normalized);
 	}
 
 	glEnableVertexAttribArray(AttribsLocations.Vertex);
-	vertices->AttribPointer(AttribsLocations.Vertex, 3, GL_FLOAT);
+	b.vertices->AttribPointer(AttribsLocations.Vertex, 3, GL_FLOAT);
 
 	if (HasNormals()) {
 		glEnableVertexAttribArray(AttribsLocations.Normal);
-		normals->AttribPointer(AttribsLocations.Normal, 3, GL_FLOAT);
+		b.normals->AttribPointer(AttribsLocations.Normal, normalSize, b.normalType, normalized);
 	}
 
 	if (HasTexCoords()) {
 		glEnableVertexAttribArray(AttribsLocations.TexCoord);
-		texCoords->AttribPointer(AttribsLocations.TexCoord, 2, GL_FLOAT);
+		b.texCoords->AttribPointer(AttribsLocations.TexCoord, 2, b.texCoordType);
 	}
+}
 
-	indices->DrawElements(GL_TRIANGLES, GetIndicesCount(), GL_UNSIGNED_INT, firstIndex * sizeof(int));
-
+void Mesh::disableAttribs()
+{
 	glDisableVertexAttribArray(AttribsLocations.Vertex);
 	glDisableVertexAttribArray(AttribsLocations.Normal);
 	glDisableVertexAttribArray(AttribsLocations.TexCoord);
-	if (normalMap) {
+	if (normalMap.Get()) {
 		glDisableVertexAttribArray(AttribsLocations.Tangent);
 		glDisableVertexAttribArray(AttribsLocations.Binormal);
 	}
 }
 
-void Mesh::DrawInstanced(int instanceCount)
+void Mesh::Draw()
 {
-	if (texture) texture->Bind();
-	if (specularMap) specularMap->Bind();
-	if (normalMap) {
-		normalMap->Bind();
-		glEnableVertexAttribArray(AttribsLocations.Tangent);
-		glEnableVertexAttribArray(AttribsLocations.Binormal);
-		tangents->AttribPointer(AttribsLocations.Tangent, 3, GL_FLOAT);
-		binormals->AttribPointer(AttribsLocations.Binormal, 3, GL_FLOAT);
-	}
+	if (texture.Get()) texture->Bind();
+	if (specularMap.Get()) specularMap->Bind();
+	if (normalMap.Get()) normalMap->Bind();
 
-	glEnableVertexAttribArray(AttribsLocations.Vertex);
-	vertices->AttribPointer(AttribsLocations.Vertex, 3, GL_FLOAT);
-
-	if (HasNormals()) {
-		glEnableVertexAttribArray(AttribsLocations.Normal);
-		normals->AttribPointer(AttribsLocations.Normal, 3, GL_FLOAT);
-	}
+	enableAttribs();
+	buffers->indices->DrawElements(GL_TRIANGLES, GetIndicesCount(), GL_UNSIGNED_INT, firstIndex * sizeof(int));
+	disableAttribs();
+}
 
-	if (HasTexCoords()) {
-		glEnableVertexAttribArray(AttribsLocations.TexCoord);
-		texCoords->AttribPointer(AttribsLocations.TexCoord, 2, GL_FLOAT);
-	}
+void Mesh::DrawInstanced(int instanceCount)
+{
+	if (texture.Get()) texture->Bind();
+	if (specularMap.Get()) specularMap->Bind();
+	if (normalMap.Get()) normalMap->Bind();
 
-	indices->DrawElementsInstanced(GL_TRIANGLES, GetIndicesCount(),
+	enableAttribs();
+	buffers->indices->DrawElementsInstanced(GL_TRIANGLES, GetIndicesCount(),
 		GL_UNSIGNED_INT, instanceCount, firstIndex * sizeof(int));
-
-	glDisableVertexAttribArray(AttribsLocations.Vertex);
-	glDisableVertexAttribArray(AttribsLocations.Normal);
-	glDisableVertexAttribArray(AttribsLocations.TexCoord);
-	if (normalMap) {
-		glDisableVertexAttribArray(AttribsLocations.Tangent);
-		glDisableVertexAttribArray(AttribsLocations.Binormal);
-	}
+	disableAttribs();
 }
 
 void Mesh::DrawFixed()
 {
-	if (texture) texture->Bind();
+	const MeshBuffers &b = *buffers;
+	if (texture.Get()) texture->Bind();
 
 	glEnableClientState(GL_VERTEX_ARRAY);
-	vertices->VertexPointer(3, GL_FLOAT, 0);
+	b.vertices->VertexPointer(3, GL_FLOAT, 0);
 
 	if (HasNormals()) {
 		glEnableClientState(GL_NORMAL_ARRAY);
-		normals->NormalPointer(GL_FLOAT, 0);
+		b.normals->NormalPointer(b.normalType, 0);
 	}
 
 	if (HasTexCoords()) {
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		texCoords->TexCoordPointer(2, GL_FLOAT, 0);
+		b.texCoords->TexCoordPointer(2, b.texCoordType, 0);
 	}
 
-	indices->DrawElements(GL_TRIANGLES, GetIndicesCount(), GL_UNSIGNED_INT, firstIndex);
+	b.indices->DrawElements(GL_TRIANGLES, GetIndicesCount(), GL_UNSIGNED_INT, firstIndex);
 
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_NORMAL_ARRAY);
@@ -0,0 +1,267 @@
+#include "meshloader.h"
+#include "platform.h"
+#include "profiler.h"
+#include <fstream>
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#pragma pack(push, 1)
+struct MeshDesc
+{
+	int firstIndex;
+	Vector3f vmin;
+	Vector3f vmax;
+};
+#pragma pack(pop)
+
+static void read_num(const char *line, char &c, int &i, int &n)
+{
+	n = 0;
+	c = line[i++];
+	bool neg = c == '-';
+	if (neg) c = line[i++];
+	while (c != '/' && c != ' ' && c != 0) {
+		n = n*10 + c-'0';
+		c = line[i++];
+	}
+	if (neg) n = -n;
+}
+
+static void addSubMesh(vector<SubMesh> &subMeshes, int firstIndex, int indicesCount,
+	const Vector3f &vmin, const Vector3f &vmax)
+{
+	SubMesh sm;
+	sm.firstIndex = firstIndex;
+	sm.indicesCount = indicesCount;
+	sm.vmin = vmin;
+	sm.vmax = vmax;
+	subMeshes.push_back(sm);
+}
+
+bool LoadObjMeshData(const char *filename, MeshData &data, vector<SubMesh> &subMeshes, bool separateMeshes)
+{
+	PROFILE_SCOPE("LoadObjMeshData");
+	ifstream file(filename);
+	if (!file) return false;
+
+	Vector3f v;
+	Vector2f tc;
+
+	vector<Vector3f> verts, norms;
+	vector<Vector2f> texs;
+	vector<int> iverts, inorms, itexs;
+
+	Vector3f vmax, vmin;
+	bool first_vert = true;
+	bool first_mesh = true;
+	int lastIndex = 0;
+
+	// the line buffer is reused and parsed in place, so reading makes no
+	// allocations beyond the growth of the arrays
+	string text;
+	while (getline(file, text))
+	{
+		if (text.size() < 2) continue;
+		char prefix[3] = { text[0], text[1], 0 };
+
+		int s = 2;
+		while (isspace(text[s++]));
+		const char *line = text.c_str() + s - 1;
+
+		if (!strcmp(prefix, "o "))
+		{
+			if (!separateMeshes) continue;
+
+			if (first_mesh)
+				first_mesh = false;
+			else {
+				addSubMesh(subMeshes, lastIndex, iverts.size() - lastIndex, vmin, vmax);
+				lastIndex = iverts.size();
+				first_vert = true;
+			}
+		}
+		else if (!strcmp(prefix, "v ")) {
+			sscanf(line, "%f %f %f", &v.x, &v.y, &v.z);
+			verts.push_back(v);
+
+			if (first_vert) {
+				vmax = vmin = v;
+				first_vert = false;
+			}
+			else {
+				if (v.x > vmax.x) vmax.x = v.x;
+				if (v.y > vmax.y) vmax.y = v.y;
+				if (v.z > vmax.z) vmax.z = v.z;
+
+				if (v.x < vmin.x) vmin.x = v.x;
+				if (v.y < vmin.y) vmin.y = v.y;
+				if (v.z < vmin.z) vmin.z = v.z;
+			}
+		}
+		else if (!strcmp(prefix, "vn")) {
+			sscanf(line, "%f %f %f", &v.x, &v.y, &v.z);
+			norms.push_back(v);	 
+		}
+		else if (!strcmp(prefix, "vt")) {
+			sscanf(line, "%f %f", &tc.x, &tc.y);
+			texs.push_back(tc);
+		}
+		else if (!strcmp(prefix, "f "))
+		{
+			char c = 0;
+			int i = 0;
+			int n = 0;
+			int vertsCount = verts.size();
+
+			for (int k = 0; k < 3; k++) {
+				read_num(line, c, i, n);
+				iverts.push_back(n > 0 ? n - 1 : vertsCount + n);
+
+				if (c == '/')
+				{
+					bool skip = line[i] == '/';
+					if (skip) i++;
+					read_num(line, c, i, n);
+
+					if (skip)
+						inorms.push_back(n > 0 ? n - 1 : vertsCount + n);
+					else {
+						itexs.push_back(n > 0 ? n - 1 : vertsCount + n);
+						if (c == '/') {
+							read_num(line, c, i, n);
+							inorms.push_back(n > 0 ? n - 1 : vertsCount + n);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	file.close();
+
+	int verticesCount = verts.size();
+	if (verticesCount == 0) {
+		subMeshes.clear();
+		return false;
+	}
+	addSubMesh(subMeshes, lastIndex, iverts.size() - lastIndex, vmin, vmax);
+
+	bool hasNormals = norms.size() != 0;
+	bool hasTexCoords = texs.size() != 0;
+
+	// OBJ indexes positions, normals and texture coordinates separately,
+	// vertices used with different attributes are duplicated
+	vector<Vector3f> norms_new;
+	vector<Vector2f> texs_new;
+
+	if (hasNormals || hasTexCoords)
+	{
+		if (hasNormals) {
+			norms_new.resize(verticesCount);
+			memset(&norms_new[0], -1, verticesCount * sizeof(Vector3f));
+		}
+		if (hasTexCoords) {
+			texs_new.resize(verticesCount);
+			memset(&texs_new[0], -1, verticesCount * sizeof(Vector2f));
+		}
+
+		for (int i = 0, k = iverts.size(); i < k; i++) {
+			int iv = iverts[i];
+			int it = hasTexCoords ? itexs[i] : 0;
+			int in = hasNormals ? inorms[i] : 0;
+
+			if ((!hasNormals || *(int *)&norms_new[iv].x == -1) &&
+				(!hasTexCoords || *(int *)&texs_new[iv].x == -1))
+			{
+				if (hasNormals) norms_new[iv] = norms[in];
+				if (hasTexCoords) texs_new[iv] = texs[it];
+			}
+			else if (hasNormals && norms_new[iv] != norms[in] ||
+						hasTexCoords && texs_new[iv] != texs[it])
+			{
+ 				int same = -1;
+				for (int j = verticesCount, n = verts.size(); j < n; j++)
+				{
+					if (verts[j] == verts[iv] &&
+						(!hasNormals || norms_new[j] == norms[in]) &&
+						(!hasTexCoords || texs_new[j] == texs[it]))
+					{
+						same = j;
+						break;
+					}
+				}
+
+				if (same != -1) iverts[i] = same;
+				else {
+					iverts[i] = verts.size();
+					verts.push_back(verts[iv]);
+					if (hasNormals) norms_new.push_back(norms[in]);
+					if (hasTexCoords) texs_new.push_back(texs[it]);
+				}
+			}
+		}
+	}
+
+	data.vertices.swap(verts);
+	data.normals.swap(norms_new);
+	data.texCoords.swap(texs_new);
+	data.indices.swap(iverts);
+	PROFILE_COUNT(PROF_BYTES_LOADED, data.GetMemoryUsage());
+	return true;
+}
+
+bool LoadRawMeshData(const char *filename, MeshData &data, vector<SubMesh> &subMeshes)
+{
+	PROFILE_SCOPE("LoadRawMeshData");
+	File file;
+	if (!file.Open(filename, FILE_READ)) return false;
+
+	unsigned char signature[4] = { };
+	if (!file.Read(signature, 3) || *(int *)signature != 0x00574152) return false;
+
+	int verticesCount = 0;
+	int indicesCount = 0;
+	bool hasNormals = false;
+	bool hasTexCoords = false;
+	int numMeshes = 0;
+
+	bool ok =
+		file.Read(&verticesCount, sizeof(int)) &&
+		file.Read(&indicesCount, sizeof(int)) &&
+		file.Read(&hasNormals, 1) &&
+		file.Read(&hasTexCoords, 1) &&
+		file.Read(&numMeshes, sizeof(int));
+	if (!ok || verticesCount <= 0 || indicesCount < 0 || numMeshes <= 0) return false;
+
+	vector<MeshDesc> meshDesc(numMeshes);
+	if (!file.Read(meshDesc.data(), numMeshes*sizeof(MeshDesc))) return false;
+
+	// read straight into the CPU copy shared by all submeshes
+	data.vertices.resize(verticesCount);
+	data.indices.resize(indicesCount);
+	ok = file.Read(data.vertices.data(), verticesCount*sizeof(Vector3f)) &&
+		file.Read(data.indices.data(), indicesCount*sizeof(int));
+
+	if (ok && hasNormals) {
+		data.normals.resize(verticesCount);
+		ok = file.Read(data.normals.data(), verticesCount*sizeof(Vector3f));
+	}
+	if (ok && hasTexCoords) {
+		data.texCoords.resize(verticesCount);
+		ok = file.Read(data.texCoords.data(), verticesCount*sizeof(Vector2f));
+	}
+	if (!ok) {
+		data = MeshData();
+		return false;
+	}
+
+	for (int i = 0; i < numMeshes; i++) {
+		int next = i == numMeshes - 1 ? indicesCount : meshDesc[i + 1].firstIndex;
+		addSubMesh(subMeshes, meshDesc[i].firstIndex, next - meshDesc[i].firstIndex,
+			meshDesc[i].vmin, meshDesc[i].vmax);
+	}
+	PROFILE_COUNT(PROF_BYTES_LOADED, data.GetMemoryUsage());
+	return true;
+}
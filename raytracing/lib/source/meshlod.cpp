@@ -0,0 +1,363 @@
+#include "meshlod.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <math.h>
+#include <algorithm>
+#include <queue>
+
+// open edges are held by planes along them, weighted against the planes of
+// the one or two faces every edge otherwise contributes
+#define LOD_BOUNDARY_WEIGHT 100.0
+
+// collapses that turn a face by more than this (cosine) are rejected
+#define LOD_MAX_FOLD 0.2f
+
+float GetLodScreenScale(int height, float fovY) {
+	return height / (2.0f * tan(fovY * (3.14159265f / 360.0f)));
+}
+
+// symmetric 4x4 matrix of summed squared plane distances, upper triangle
+struct Quadric
+{
+	double a[10];
+
+	Quadric() { for (int i = 0; i < 10; i++) a[i] = 0.0; }
+
+	void AddPlane(double nx, double ny, double nz, double d, double w)
+	{
+		a[0] += w * nx * nx; a[1] += w * nx * ny; a[2] += w * nx * nz; a[3] += w * nx * d;
+		a[4] += w * ny * ny; a[5] += w * ny * nz; a[6] += w * ny * d;
+		a[7] += w * nz * nz; a[8] += w * nz * d;
+		a[9] += w * d * d;
+	}
+
+	void Add(const Quadric &q) { for (int i = 0; i < 10; i++) a[i] += q.a[i]; }
+
+	double Evaluate(const Vector3f &p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x +
+			a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y +
+			a[7] * z * z + 2 * a[8] * z + a[9];
+		return e > 0.0 ? e : 0.0;
+	}
+};
+
+struct Collapse
+{
+	double cost;
+	int from, to;       // local vertices, from moves onto to
+	int fromStamp, toStamp;
+
+	bool operator<(const Collapse &c) const { return cost > c.cost; } // min-heap
+};
+
+// Edge collapses on one index range. Vertices are numbered locally; faces
+// keep a list per vertex that may hold dead faces until it is next rebuilt.
+class EdgeCollapser
+{
+public:
+	EdgeCollapser(const MeshData &mesh, const int *indices, int indicesCount);
+
+	// collapses until at most targetFaces are left; false when no collapse is left
+	bool Reduce(int targetFaces);
+	int GetFaceCount() const { return liveFaces; }
+	float GetError() const { return (float)sqrt(maxCost); }
+	void GetIndices(vector<int> &result) const;
+private:
+	vector<int> global;        // local vertex -> MeshData vertex
+	vector<Vector3f> positions;
+	vector<Quadric> quadrics;
+	vector<int> stamps;        // changes whenever a vertex's quadric or position does
+	vector<char> alive;
+	vector<int> faces;         // 3 local vertices each
+	vector<char> faceAlive;
+	vector<vector<int> > vertexFaces;
+	priority_queue<Collapse> heap;
+	int liveFaces;
+	double maxCost;
+	vector<int> neighbours, otherNeighbours;
+
+	void pushEdge(int a, int b);
+	void collectNeighbours(int v, vector<int> &result);
+	bool canCollapse(int from, int to);
+	void collapse(int from, int to);
+	Vector3f faceNormal(int face, int replace, const Vector3f &p) const;
+};
+
+EdgeCollapser::EdgeCollapser(const MeshData &mesh, const int *indices, int indicesCount) :
+	liveFaces(0), maxCost(0.0)
+{
+	int faceCount = indicesCount / 3;
+	global.assign(indices, indices + faceCount * 3);
+	sort(global.begin(), global.end());
+	global.erase(unique(global.begin(), global.end()), global.end());
+
+	int count = (int)global.size();
+	positions.resize(count);
+	quadrics.resize(count);
+	stamps.assign(count, 0);
+	alive.assign(count, 1);
+	vertexFaces.resize(count);
+	for (int i = 0; i < count; i++)
+		positions[i] = mesh.vertices[global[i]];
+
+	faces.resize(faceCount * 3);
+	faceAlive.assign(faceCount, 1);
+	for (int i = 0; i < faceCount * 3; i++)
+		faces[i] = (int)(lower_bound(global.begin(), global.end(), indices[i]) - global.begin());
+
+	// every edge with the face it borders; sorted, an edge that appears once is open
+	vector<pair<long long, int> > edges;
+	edges.reserve(faceCount * 3);
+	for (int f = 0; f < faceCount; f++)
+	{
+		const int *v = &faces[f * 3];
+		if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2]) {
+			faceAlive[f] = 0;
+			continue;
+		}
+		liveFaces++;
+		for (int k = 0; k < 3; k++) vertexFaces[v[k]].push_back(f);
+
+		Vector3f n = Cross(positions[v[1]] - positions[v[0]], positions[v[2]] - positions[v[0]]);
+		float len = n.Length();
+		if (len > 0.0f)
+		{
+			n = n * (1.0f / len);
+			double d = -Dot(n, positions[v[0]]);
+			for (int k = 0; k < 3; k++) quadrics[v[k]].AddPlane(n.x, n.y, n.z, d, 1.0);
+		}
+		for (int k = 0; k < 3; k++) {
+			int a = v[k], b = v[(k + 1) % 3];
+			long long key = (long long)min(a, b) << 32 | max(a, b);
+			edges.push_back(make_pair(key, f));
+		}
+	}
+	sort(edges.begin(), edges.end());
+
+	for (int i = 0, n = (int)edges.size(); i < n; )
+	{
+		int j = i + 1;
+		while (j < n && edges[j].first == edges[i].first) j++;
+		int a = (int)(edges[i].first >> 32), b = (int)(edges[i].first & 0xFFFFFFFF);
+
+		if (j - i == 1)
+		{
+			// plane through the edge, perpendicular to its face
+			const int *v = &faces[edges[i].second * 3];
+			Vector3f fn = Cross(positions[v[1]] - positions[v[0]], positions[v[2]] - positions[v[0]]);
+			Vector3f n = Cross(positions[b] - positions[a], fn);
+			float len = n.Length();
+			if (len > 0.0f) {
+				n = n * (1.0f / len);
+				double d = -Dot(n, positions[a]);
+				quadrics[a].AddPlane(n.x, n.y, n.z, d, LOD_BOUNDARY_WEIGHT);
+				quadrics[b].AddPlane(n.x, n.y, n.z, d, LOD_BOUNDARY_WEIGHT);
+			}
+		}
+		i = j;
+	}
+
+	for (int i = 0, n = (int)edges.size(); i < n; i++) {
+		if (i > 0 && edges[i].first == edges[i - 1].first) continue;
+		pushEdge((int)(edges[i].first >> 32), (int)(edges[i].first & 0xFFFFFFFF));
+	}
+}
+
+void EdgeCollapser::pushEdge(int a, int b)
+{
+	Quadric q = quadrics[a];
+	q.Add(quadrics[b]);
+	double toA = q.Evaluate(positions[a]), toB = q.Evaluate(positions[b]);
+
+	Collapse c;
+	c.cost = min(toA, toB);
+	c.from = toA < toB ? b : a;
+	c.to = toA < toB ? a : b;
+	c.fromStamp = stamps[c.from];
+	c.toStamp = stamps[c.to];
+	heap.push(c);
+}
+
+void EdgeCollapser::collectNeighbours(int v, vector<int> &result)
+{
+	result.clear();
+	const vector<int> &vf = vertexFaces[v];
+	for (int i = 0, n = (int)vf.size(); i < n; i++) {
+		if (!faceAlive[vf[i]]) continue;
+		const int *f = &faces[vf[i] * 3];
+		for (int k = 0; k < 3; k++) {
+			if (f[k] != v) result.push_back(f[k]);
+		}
+	}
+	sort(result.begin(), result.end());
+	result.erase(unique(result.begin(), result.end()), result.end());
+}
+
+Vector3f EdgeCollapser::faceNormal(int face, int replace, const Vector3f &p) const
+{
+	const int *f = &faces[face * 3];
+	Vector3f v0 = f[0] == replace ? p : positions[f[0]];
+	Vector3f v1 = f[1] == replace ? p : positions[f[1]];
+	Vector3f v2 = f[2] == replace ? p : positions[f[2]];
+	return Cross(v1 - v0, v2 - v0);
+}
+
+bool EdgeCollapser::canCollapse(int from, int to)
+{
+	// link condition: the vertices around both ends may only be the
+	// opposite corners of the faces they share, or the surface pinches
+	collectNeighbours(from, neighbours);
+	collectNeighbours(to, otherNeighbours);
+	int common = 0, shared = 0;
+	for (int i = 0, j = 0; i < (int)neighbours.size() && j < (int)otherNeighbours.size(); ) {
+		if (neighbours[i] < otherNeighbours[j]) i++;
+		else if (neighbours[i] > otherNeighbours[j]) j++;
+		else { common++; i++; j++; }
+	}
+
+	const vector<int> &vf = vertexFaces[from];
+	for (int i = 0, n = (int)vf.size(); i < n; i++)
+	{
+		int face = vf[i];
+		if (!faceAlive[face]) continue;
+		const int *f = &faces[face * 3];
+		if (f[0] == to || f[1] == to || f[2] == to) {
+			shared++;
+			continue;
+		}
+
+		// the faces that stay must not turn over
+		Vector3f before = faceNormal(face, -1, positions[from]);
+		Vector3f after = faceNormal(face, from, positions[to]);
+		float lb = before.Length(), la = after.Length();
+		if (la <= 0.0f) return false;
+		if (lb > 0.0f && Dot(before, after) < LOD_MAX_FOLD * lb * la) return false;
+	}
+	return shared > 0 && common == shared;
+}
+
+void EdgeCollapser::collapse(int from, int to)
+{
+	vector<int> &vf = vertexFaces[from];
+	vector<int> &vt = vertexFaces[to];
+	for (int i = 0, n = (int)vf.size(); i < n; i++)
+	{
+		int face = vf[i];
+		if (!faceAlive[face]) continue;
+		int *f = &faces[face * 3];
+		if (f[0] == to || f[1] == to || f[2] == to) {
+			faceAlive[face] = 0;
+			liveFaces--;
+			continue;
+		}
+		for (int k = 0; k < 3; k++) {
+			if (f[k] == from) f[k] = to;
+		}
+		vt.push_back(face);
+	}
+	vector<int>().swap(vf);
+	alive[from] = 0;
+
+	// drop the dead faces while the list is at hand
+	int live = 0;
+	for (int i = 0, n = (int)vt.size(); i < n; i++) {
+		if (faceAlive[vt[i]]) vt[live++] = vt[i];
+	}
+	vt.resize(live);
+
+	quadrics[to].Add(quadrics[from]);
+	stamps[to]++;
+
+	collectNeighbours(to, neighbours);
+	for (int i = 0, n = (int)neighbours.size(); i < n; i++)
+		pushEdge(to, neighbours[i]);
+}
+
+bool EdgeCollapser::Reduce(int targetFaces)
+{
+	while (liveFaces > targetFaces)
+	{
+		if (heap.empty()) return false;
+		Collapse c = heap.top();
+		heap.pop();
+
+		// stale: an end has gone or changed since the entry was pushed
+		if (!alive[c.from] || !alive[c.to]) continue;
+		if (stamps[c.from] != c.fromStamp || stamps[c.to] != c.toStamp) continue;
+		if (!canCollapse(c.from, c.to)) continue;
+
+		collapse(c.from, c.to);
+		maxCost = max(maxCost, c.cost);
+	}
+	return true;
+}
+
+void EdgeCollapser::GetIndices(vector<int> &result) const
+{
+	result.clear();
+	result.reserve(liveFaces * 3);
+	for (int f = 0, n = (int)faceAlive.size(); f < n; f++) {
+		if (!faceAlive[f]) continue;
+		for (int k = 0; k < 3; k++) result.push_back(global[faces[f * 3 + k]]);
+	}
+}
+
+void MeshLod::Build(const MeshData &mesh, int firstIndex, int indicesCount, int maxLevels, float reduction)
+{
+	PROFILE_SCOPE("MeshLod::Build");
+	Clear();
+	const int *indices = mesh.indices.data() + firstIndex;
+	levels.resize(1);
+	levels[0].indices.assign(indices, indices + indicesCount / 3 * 3);
+	levels[0].error = 0.0f;
+
+	// one run of collapses, the levels are snapshots of it on the way down
+	EdgeCollapser collapser(mesh, indices, indicesCount);
+	int faces = indicesCount / 3;
+	while ((int)levels.size() < maxLevels)
+	{
+		int target = (int)(faces * reduction);
+		if (target < 4) break;
+		bool reached = collapser.Reduce(target);
+		int count = collapser.GetFaceCount();
+		// a simplifier that stalls well short of the target adds no level
+		if (count > faces * (1.0f + reduction) * 0.5f) break;
+
+		levels.push_back(MeshLodLevel());
+		collapser.GetIndices(levels.back().indices);
+		levels.back().error = collapser.GetError();
+		faces = count;
+		if (!reached) break;
+	}
+}
+
+int MeshLod::Select(float distance, float screenScale, float maxPixelError) const
+{
+	int level = 0;
+	for (int i = 1, n = (int)levels.size(); i < n; i++) {
+		if (IsLodErrorVisible(levels[i].error, distance, screenScale, maxPixelError)) break;
+		level = i;
+	}
+	return level;
+}
+
+void MeshLod::GetLevelMesh(const MeshData &mesh, int level, MeshData &result) const
+{
+	result.vertices = mesh.vertices;
+	result.normals = mesh.normals;
+	result.texCoords = mesh.texCoords;
+	result.indices = levels[level].indices;
+}
+
+void BuildMeshLods(const MeshData &mesh, const vector<SubMesh> &subMeshes, vector<MeshLod> &lods,
+	int maxLevels, float reduction)
+{
+	PROFILE_SCOPE("BuildMeshLods");
+	lods.resize(subMeshes.size());
+	ParallelFor(0, (int)subMeshes.size(), [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+			lods[i].Build(mesh, subMeshes[i].firstIndex, subMeshes[i].indicesCount, maxLevels, reduction);
+	}, 1);
+}
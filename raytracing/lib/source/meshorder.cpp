@@ -0,0 +1,178 @@
+#include "meshorder.h"
+#include "profiler.h"
+
+float ComputeACMR(const int *indices, int indicesCount, int cacheSize)
+{
+	if (indicesCount < 3) return 0.0f;
+
+	// a FIFO as a ring of the last cacheSize misses; the stamps say when a
+	// vertex went in, so a lookup is one comparison
+	int verticesCount = 0;
+	for (int i = 0; i < indicesCount; i++)
+		verticesCount = max(verticesCount, indices[i] + 1);
+	vector<int> stamps(verticesCount, -cacheSize - 1);
+
+	int misses = 0;
+	for (int i = 0; i < indicesCount; i++) {
+		int v = indices[i];
+		if (misses - stamps[v] > cacheSize) {
+			stamps[v] = misses;
+			misses++;
+		}
+	}
+	return (float)misses / (indicesCount / 3);
+}
+
+// next vertex to fan around: the candidate whose triangles all still fit
+// in the cache and that went in earliest, else -1
+static int nextVertex(const vector<int> &candidates, const int *liveCount, const int *stamps,
+	int time, int cacheSize)
+{
+	int best = -1, bestPriority = -1;
+	for (int i = 0, n = (int)candidates.size(); i < n; i++)
+	{
+		int v = candidates[i];
+		if (liveCount[v] == 0) continue;
+		int priority = 0;
+		if (time - stamps[v] + 2 * liveCount[v] <= cacheSize)
+			priority = time - stamps[v];
+		if (priority > bestPriority) {
+			bestPriority = priority;
+			best = v;
+		}
+	}
+	return best;
+}
+
+// a recently used vertex with triangles left, else the next one in index order
+static int skipDeadEnd(vector<int> &deadEnds, const int *liveCount, int &cursor, int verticesCount)
+{
+	while (!deadEnds.empty()) {
+		int v = deadEnds.back();
+		deadEnds.pop_back();
+		if (liveCount[v] > 0) return v;
+	}
+	for (; cursor < verticesCount; cursor++) {
+		if (liveCount[cursor] > 0) return cursor;
+	}
+	return -1;
+}
+
+void OptimizeVertexCache(int *indices, int indicesCount, int verticesCount, int cacheSize)
+{
+	int faceCount = indicesCount / 3;
+	if (faceCount < 2) return;
+
+	// triangles around every vertex, in CSR form
+	vector<int> liveCount(verticesCount, 0);
+	for (int i = 0; i < faceCount * 3; i++)
+		liveCount[indices[i]]++;
+	vector<int> offsets(verticesCount + 1, 0);
+	for (int v = 0; v < verticesCount; v++)
+		offsets[v + 1] = offsets[v] + liveCount[v];
+	vector<int> adjacency(offsets[verticesCount]);
+	vector<int> fill(offsets.begin(), offsets.end() - 1);
+	for (int i = 0; i < faceCount * 3; i++)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	vector<int> stamps(verticesCount, 0);
+	vector<char> emitted(faceCount, 0);
+	vector<int> deadEnds, candidates;
+	vector<int> result;
+	result.reserve(faceCount * 3);
+
+	int time = cacheSize + 1;
+	int cursor = 0;
+	int fan = skipDeadEnd(deadEnds, liveCount.data(), cursor, verticesCount);
+	while (fan >= 0)
+	{
+		candidates.clear();
+		for (int a = offsets[fan], end = offsets[fan + 1]; a < end; a++)
+		{
+			int face = adjacency[a];
+			if (emitted[face]) continue;
+			emitted[face] = 1;
+			for (int k = 0; k < 3; k++)
+			{
+				int v = indices[face * 3 + k];
+				result.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveCount[v]--;
+				if (time - stamps[v] > cacheSize)
+					stamps[v] = time++;
+			}
+		}
+
+		fan = nextVertex(candidates, liveCount.data(), stamps.data(), time, cacheSize);
+		if (fan < 0) fan = skipDeadEnd(deadEnds, liveCount.data(), cursor, verticesCount);
+	}
+
+	for (int i = 0, n = (int)result.size(); i < n; i++)
+		indices[i] = result[i];
+}
+
+template<class T>
+static void permute(vector<T> &values, const vector<int> &newIndex)
+{
+	if (values.empty()) return;
+	vector<T> moved(values.size());
+	for (int i = 0, n = (int)values.size(); i < n; i++)
+		moved[newIndex[i]] = values[i];
+	values.swap(moved);
+}
+
+void OptimizeVertexFetch(MeshData &data)
+{
+	int verticesCount = data.GetVerticesCount();
+	vector<int> newIndex(verticesCount, -1);
+	int next = 0;
+	for (int i = 0, n = data.GetIndicesCount(); i < n; i++) {
+		int &v = data.indices[i];
+		if (newIndex[v] < 0) newIndex[v] = next++;
+		v = newIndex[v];
+	}
+	for (int v = 0; v < verticesCount; v++) {
+		if (newIndex[v] < 0) newIndex[v] = next++;
+	}
+
+	permute(data.vertices, newIndex);
+	permute(data.normals, newIndex);
+	permute(data.texCoords, newIndex);
+}
+
+void OptimizeMeshOrder(MeshData &data, const vector<SubMesh> &subMeshes, int cacheSize)
+{
+	PROFILE_SCOPE("OptimizeMeshOrder");
+
+	// each range is optimized on its own vertices numbered from 0, so small
+	// submeshes of a large mesh don't pay for the whole vertex count
+	vector<int> local(data.GetVerticesCount(), -1);
+	vector<int> global;
+	vector<int> rangeIndices;
+	for (int s = 0, ns = (int)subMeshes.size(); s < ns; s++)
+	{
+		int *indices = data.indices.data() + subMeshes[s].firstIndex;
+		int count = subMeshes[s].indicesCount / 3 * 3;
+
+		global.clear();
+		rangeIndices.resize(count);
+		for (int i = 0; i < count; i++) {
+			int v = indices[i];
+			if (local[v] < 0) {
+				local[v] = (int)global.size();
+				global.push_back(v);
+			}
+			rangeIndices[i] = local[v];
+		}
+
+		OptimizeVertexCache(rangeIndices.data(), count, (int)global.size(), cacheSize);
+
+		for (int i = 0; i < count; i++)
+			indices[i] = global[rangeIndices[i]];
+		for (int i = 0, n = (int)global.size(); i < n; i++)
+			local[global[i]] = -1;
+	}
+
+	OptimizeVertexFetch(data);
+}
@@ -0,0 +1,261 @@
+#include "miptexture.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPTEXTURE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define LOG2_E 1.44269504f
+
+MipTexture::MipTexture() :
+	layout(TEX_LAYOUT_TILED),
+	filter(TEX_FILTER_TRILINEAR),
+	wrapS(TEX_WRAP_REPEAT),
+	wrapT(TEX_WRAP_REPEAT),
+	border(0)
+{ }
+
+void MipTexture::SetBorderColor(const Color4f &color)
+{
+	border = ColorToByte(color.b) | ColorToByte(color.g) << 8 | ColorToByte(color.r) << 16 | (unsigned int)ColorToByte(color.a) << 24;
+}
+
+void MipTexture::Clear()
+{
+	texels.clear();
+	levels.clear();
+	touchedLines.clear();
+}
+
+void MipTexture::EnableAccessTracking(bool enable)
+{
+	touchedLines.clear();
+	if (enable && !texels.empty())
+		touchedLines.assign((texels.size() * sizeof(unsigned int) + TEX_CACHE_LINE - 1) / TEX_CACHE_LINE, 0);
+}
+
+void MipTexture::ResetAccessTracking()
+{
+	fill(touchedLines.begin(), touchedLines.end(), 0);
+}
+
+size_t MipTexture::GetBytesTouched() const
+{
+	size_t lines = 0;
+	for (size_t i = 0, n = touchedLines.size(); i < n; i++)
+		lines += touchedLines[i];
+	return lines * TEX_CACHE_LINE;
+}
+
+float GetTextureLod(int width, int height, const Vector2f &dUVdx, const Vector2f &dUVdy)
+{
+	float w = (float)width, h = (float)height;
+	float lx = dUVdx.x * dUVdx.x * w * w + dUVdx.y * dUVdx.y * h * h;
+	float ly = dUVdy.x * dUVdy.x * w * w + dUVdy.y * dUVdy.y * h * h;
+	float rho2 = max(lx, ly);
+	// 0.5 * log2 of the squared length; Sample clamps what is out of range
+	return rho2 > 0.0f ? 0.5f * logf(rho2) * LOG2_E : 0.0f;
+}
+
+bool MipTexture::Create(const Image &image, bool mipmaps, TextureLayout layout)
+{
+	Clear();
+	int depth = image.GetDepth();
+	if (!image.IsGood() || (depth != 8 && depth != 24 && depth != 32))
+		return false;
+	PROFILE_SCOPE("MipTexture::Create");
+	this->layout = layout;
+
+	// level sizes halve down to 1x1 as in glGenerateMipmap
+	size_t total = 0;
+	int w = image.GetWidth(), h = image.GetHeight();
+	for (;;)
+	{
+		MipLevel m;
+		m.width = w;
+		m.height = h;
+		m.tilesX = (w + TEX_TILE_SIZE - 1) / TEX_TILE_SIZE;
+		m.offset = total;
+		levels.push_back(m);
+		if (layout == TEX_LAYOUT_TILED) {
+			int tilesY = (h + TEX_TILE_SIZE - 1) / TEX_TILE_SIZE;
+			total += (size_t)m.tilesX * tilesY * TEX_TILE_SIZE * TEX_TILE_SIZE;
+		}
+		else total += (size_t)w * h;
+
+		if (!mipmaps || (w == 1 && h == 1)) break;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	texels.assign(total, 0);
+
+	const MipLevel &top = levels[0];
+	const unsigned char *data = image.GetData();
+	int bpp = depth / 8;
+	ParallelFor(0, top.height, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			const unsigned char *row = data + (size_t)y * top.width * bpp;
+			for (int x = 0; x < top.width; x++, row += bpp)
+			{
+				unsigned int t;
+				if (bpp == 1) t = row[0] | row[0] << 8 | row[0] << 16 | 0xff000000u;
+				else t = row[0] | row[1] << 8 | row[2] << 16 | (bpp == 4 ? (unsigned int)row[3] << 24 : 0xff000000u);
+				texels[texelIndex(top, x, y)] = t;
+			}
+		}
+	});
+
+	for (int i = 1, n = (int)levels.size(); i < n; i++)
+		buildLevel(i);
+	return true;
+}
+
+// 2x2 box filter of the level above. An odd last row or column is left
+// out, as by a plain glGenerateMipmap box filter; a source only 1 texel
+// wide or tall is read twice along that axis.
+void MipTexture::buildLevel(int level)
+{
+	const MipLevel &src = levels[level - 1];
+	const MipLevel &dst = levels[level];
+
+	ParallelFor(0, dst.height, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			int y0 = min(y * 2, src.height - 1), y1 = min(y * 2 + 1, src.height - 1);
+			for (int x = 0; x < dst.width; x++)
+			{
+				int x0 = min(x * 2, src.width - 1), x1 = min(x * 2 + 1, src.width - 1);
+				unsigned int t[4] = {
+					texels[texelIndex(src, x0, y0)], texels[texelIndex(src, x1, y0)],
+					texels[texelIndex(src, x0, y1)], texels[texelIndex(src, x1, y1)]
+				};
+				unsigned int result = 0;
+				for (int c = 0; c < 32; c += 8) {
+					unsigned int sum = ((t[0] >> c) & 0xff) + ((t[1] >> c) & 0xff) +
+						((t[2] >> c) & 0xff) + ((t[3] >> c) & 0xff);
+					result |= ((sum + 2) / 4) << c;
+				}
+				texels[texelIndex(dst, x, y)] = result;
+			}
+		}
+	});
+}
+
+void FilterTexels(const unsigned int *t, float ax, float ay, float *bgra)
+{
+	float w[4] = { (1 - ax) * (1 - ay), ax * (1 - ay), (1 - ax) * ay, ax * ay };
+
+#ifdef MIPTEXTURE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	// all four texels widened to 32 bit lanes, B G R A
+	__m128i packed = _mm_setr_epi32((int)t[0], (int)t[1], (int)t[2], (int)t[3]);
+	__m128i lo = _mm_unpacklo_epi8(packed, zero), hi = _mm_unpackhi_epi8(packed, zero);
+	__m128 c0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+	__m128 c1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+	__m128 c2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+	__m128 c3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+	__m128 sum = _mm_add_ps(
+		_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(w[0])), _mm_mul_ps(c1, _mm_set1_ps(w[1]))),
+		_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(w[2])), _mm_mul_ps(c3, _mm_set1_ps(w[3]))));
+	_mm_storeu_ps(bgra, sum);
+#else
+	for (int c = 0; c < 4; c++) {
+		int shift = c * 8;
+		bgra[c] = ((t[0] >> shift) & 0xff) * w[0] + ((t[1] >> shift) & 0xff) * w[1] +
+			((t[2] >> shift) & 0xff) * w[2] + ((t[3] >> shift) & 0xff) * w[3];
+	}
+#endif
+}
+
+Color4f MipTexture::sampleNearest(const MipLevel &m, const Vector2f &uv) const
+{
+	int x = WrapTexelCoord((int)floorf(FoldTexelCoord(uv.x * m.width)), m.width, wrapS);
+	int y = WrapTexelCoord((int)floorf(FoldTexelCoord(uv.y * m.height)), m.height, wrapT);
+	unsigned int t = border;
+	if (x >= 0 && y >= 0) {
+		size_t i = texelIndex(m, x, y);
+		t = texels[i];
+		if (!touchedLines.empty()) touch(i);
+	}
+	float bgra[4] = { (float)(t & 0xff), (float)((t >> 8) & 0xff), (float)((t >> 16) & 0xff), (float)(t >> 24) };
+	return BgraToColor(bgra);
+}
+
+void MipTexture::sampleBilinear(const MipLevel &m, const Vector2f &uv, float *bgra) const
+{
+	float fx = FoldTexelCoord(uv.x * m.width - 0.5f), fy = FoldTexelCoord(uv.y * m.height - 0.5f);
+	float bx = floorf(fx), by = floorf(fy);
+	float ax = fx - bx, ay = fy - by;
+	int x0 = (int)bx, y0 = (int)by;
+
+	unsigned int t[4];
+	const unsigned int *base = &texels[m.offset];
+	if (x0 >= 0 && x0 + 1 < m.width && y0 >= 0 && y0 + 1 < m.height)
+	{
+		// the whole footprint is inside, no wrapping
+		size_t c0 = columnOffset(x0), c1 = columnOffset(x0 + 1);
+		size_t r0 = rowOffset(m, y0), r1 = rowOffset(m, y0 + 1);
+		t[0] = base[c0 + r0];
+		t[1] = base[c1 + r0];
+		t[2] = base[c0 + r1];
+		t[3] = base[c1 + r1];
+		if (!touchedLines.empty()) {
+			touch(m.offset + c0 + r0);
+			touch(m.offset + c1 + r0);
+			touch(m.offset + c0 + r1);
+			touch(m.offset + c1 + r1);
+		}
+	}
+	else
+	{
+		int xs[2] = { WrapTexelCoord(x0, m.width, wrapS), WrapTexelCoord(x0 + 1, m.width, wrapS) };
+		int ys[2] = { WrapTexelCoord(y0, m.height, wrapT), WrapTexelCoord(y0 + 1, m.height, wrapT) };
+		for (int j = 0; j < 2; j++)
+			for (int i = 0; i < 2; i++)
+			{
+				if (xs[i] < 0 || ys[j] < 0) {
+					t[j * 2 + i] = border;
+					continue;
+				}
+				size_t index = m.offset + columnOffset(xs[i]) + rowOffset(m, ys[j]);
+				t[j * 2 + i] = texels[index];
+				if (!touchedLines.empty()) touch(index);
+			}
+	}
+	FilterTexels(t, ax, ay, bgra);
+}
+
+Color4f MipTexture::Sample(const Vector2f &uv, float lod) const
+{
+	if (levels.empty()) return Color4f();
+
+	int last = (int)levels.size() - 1;
+	lod = ClampTextureLod(lod, last);
+
+	float bgra[4];
+	switch (filter)
+	{
+	case TEX_FILTER_NEAREST:
+		return sampleNearest(levels[(int)(lod + 0.5f)], uv);
+	case TEX_FILTER_BILINEAR:
+		sampleBilinear(levels[(int)(lod + 0.5f)], uv, bgra);
+		return BgraToColor(bgra);
+	default:
+		{
+			int level = (int)lod;
+			float f = lod - level;
+			sampleBilinear(levels[level], uv, bgra);
+			if (f > 0.0f && level < last) {
+				float next[4];
+				sampleBilinear(levels[level + 1], uv, next);
+				BlendTexelLevels(bgra, next, f);
+			}
+			return BgraToColor(bgra);
+		}
+	}
+}
@@ -1,299 +1,104 @@
 #include "modelloader.h"
-#include <fstream>
+#include "bvhcache.h"
+#include "meshorder.h"
+#include "packedmesh.h"
+#include "profiler.h"
 
-#pragma pack(push, 1)
-struct MeshDesc
+void ModelLoader::EnableBVH(bool enable, const BVHBuildParams &params, bool useCache)
 {
-	int firstIndex;
-	Vector3f vmin;
-	Vector3f vmax;
-};
-#pragma pack(pop)
+	buildBVH = enable;
+	cacheBVH = useCache;
+	bvhParams = params;
+}
 
-void ModelLoader::read_num(const string &line, char &c, int &i, int &n)
+void ModelLoader::setOptions(MeshDataLoad &task) const
 {
-	n = 0;
-	c = line[i++];
-	bool neg = c == '-';
-	if (neg) c = line[i++];
-	while (c != '/' && c != ' ' && c != 0) {
-		n = n*10 + c-'0';
-		c = line[i++];
-	}
-	if (neg) n = -n;
+	task.reorder = reorder;
+	task.lodLevels = lodLevels;
+	task.buildBVH = buildBVH;
+	task.cacheBVH = cacheBVH;
+	task.bvhParams = bvhParams;
 }
 
-bool ModelLoader::loadObj(const char *filename, vector<Mesh *> &meshes, bool separateMeshes)
+void ModelLoader::createMeshes(const MeshDataLoad &task, vector<Mesh *> &meshes)
 {
-	ifstream file(filename);
-	if (!file) return false;
-
-	VertexBuffer *vertices = NULL;
-	VertexBuffer *indices = NULL;
-	VertexBuffer *texCoords = NULL;
-	VertexBuffer *normals = NULL;
-
-	Vector3f v;
-	Vector2f tc;
-
-	vector<Vector3f> verts, norms;
-	vector<Vector2f> texs;
-	vector<int> iverts, inorms, itexs;
-
-	Vector3f vmax, vmin;
-	bool first_vert = true;
-	bool first_mesh = true;
-	int lastIndex = 0;
-
-	string line;
-	while (getline(file, line))
+	PROFILE_SCOPE("ModelLoader::createMeshes");
+	const my_shared_ptr<MeshData> &data = task.data;
+	const vector<SubMesh> &subMeshes = task.subMeshes;
+	const vector<MeshLod> &lods = task.lods;
+
+	// one set of buffers for all the file's meshes
+	my_shared_ptr<MeshBuffers> buffers(new MeshBuffers);
+	MeshBuffers &b = *buffers;
+	b.vertices = new VertexBuffer(rc, GL_ARRAY_BUFFER);
+	b.indices = new VertexBuffer(rc, GL_ELEMENT_ARRAY_BUFFER);
+	b.vertices->SetData(data->vertices.size()*sizeof(Vector3f), data->vertices.data(), GL_STATIC_DRAW);
+
+	// levels of detail follow the full index buffer, each submesh's in order
+	if (!lods.empty())
 	{
-		if (line.size() < 2) continue;
-		string prefix = line.substr(0, 2);
-		line[0] = line[1] = ' ';
-
-		int s = 2;
-		while (isspace(line[s++]));
-		line = line.substr(s - 1);
-
-		if (prefix == "o ")
-		{
-			if (!separateMeshes) continue;
-
-			if (first_mesh)
-				first_mesh = false;
-			else {
-				Mesh *m = new Mesh(rc);
-				m->SetFirstIndex(lastIndex);
-				m->SetIndicesCount(iverts.size() - lastIndex);
-				lastIndex = iverts.size();
-				meshes.push_back(m);
-
-				m->boundingBox.front = Plane(0, 0, 1, -vmax.z);
-				m->boundingBox.back = Plane(0, 0, -1, vmin.z);
-				m->boundingBox.top = Plane(0, 1, 0, -vmax.y);
-				m->boundingBox.bottom = Plane(0, -1, 0, vmin.y);
-				m->boundingBox.left = Plane(-1, 0, 0, vmin.x);
-				m->boundingBox.right = Plane(1, 0, 0, -vmax.x);
-
-				m->boundingSphere.center = (vmax + vmin) / 2;
-				m->boundingSphere.radius = max(max(vmax.x - vmin.x, vmax.y - vmin.y), vmax.z - vmin.z);
-
-				first_vert = true;
-			}
+		vector<int> indices(data->indices);
+		for (int i = 0, s = lods.size(); i < s; i++) {
+			for (int l = 1, nl = lods[i].GetLevelCount(); l < nl; l++)
+				indices.insert(indices.end(), lods[i].levels[l].indices.begin(), lods[i].levels[l].indices.end());
 		}
-		else if (prefix == "v ") {
-			sscanf_s(line.c_str(), "%f %f %f", &v.x, &v.y, &v.z);
-			verts.push_back(v);
-
-			if (first_vert) {
-				vmax = vmin = v;
-				first_vert = false;
-			}
-			else {
-				if (v.x > vmax.x) vmax.x = v.x;
-				if (v.y > vmax.y) vmax.y = v.y;
-				if (v.z > vmax.z) vmax.z = v.z;
+		b.indices->SetData(indices.size()*sizeof(int), indices.data(), GL_STATIC_DRAW);
+	}
+	else b.indices->SetData(data->indices.size()*sizeof(int), data->indices.data(), GL_STATIC_DRAW);
 
-				if (v.x < vmin.x) vmin.x = v.x;
-				if (v.y < vmin.y) vmin.y = v.y;
-				if (v.z < vmin.z) vmin.z = v.z;
-			}
-		}
-		else if (prefix == "vn") {
-			sscanf_s(line.c_str(), "%f %f %f", &v.x, &v.y, &v.z);
-			norms.push_back(v);	 
-		}
-		else if (prefix == "vt") {
-			sscanf_s(line.c_str(), "%f %f", &tc.x, &tc.y);
-			texs.push_back(tc);
-		}
-		else if (prefix == "f ")
+	if (data->HasNormals()) {
+		b.normals = new VertexBuffer(rc, GL_ARRAY_BUFFER);
+		if (compress && GLEW_ARB_vertex_type_2_10_10_10_rev)
 		{
-			char c = 0;
-			int i = 0;
-			int n = 0;
-			int vertsCount = verts.size();
-
-			for (int k = 0; k < 3; k++) {
-				read_num(line, c, i, n);
-				iverts.push_back(n > 0 ? n - 1 : vertsCount + n);
-
-				if (c == '/')
-				{
-					bool skip = line[i] == '/';
-					if (skip) i++;
-					read_num(line, c, i, n);
-
-					if (skip)
-						inorms.push_back(n > 0 ? n - 1 : vertsCount + n);
-					else {
-						itexs.push_back(n > 0 ? n - 1 : vertsCount + n);
-						if (c == '/') {
-							read_num(line, c, i, n);
-							inorms.push_back(n > 0 ? n - 1 : vertsCount + n);
-						}
-					}
-				}
-			}
+			vector<unsigned int> packed(data->normals.size());
+			for (int i = 0, n = packed.size(); i < n; i++)
+				packed[i] = EncodeSnorm1010102(data->normals[i]);
+			b.normals->SetData(packed.size()*sizeof(unsigned int), packed.data(), GL_STATIC_DRAW);
+			b.normalType = GL_INT_2_10_10_10_REV;
 		}
+		else b.normals->SetData(data->normals.size()*sizeof(Vector3f), data->normals.data(), GL_STATIC_DRAW);
 	}
-
-	file.close();
-
-	Mesh *m = new Mesh(rc);
-	m->SetFirstIndex(lastIndex);
-	m->SetIndicesCount(iverts.size() - lastIndex);
-	meshes.push_back(m);
-
-	m->boundingBox.front = Plane(0, 0, 1, -vmax.z);
-	m->boundingBox.back = Plane(0, 0, -1, vmin.z);
-	m->boundingBox.top = Plane(0, 1, 0, -vmax.y);
-	m->boundingBox.bottom = Plane(0, -1, 0, vmin.y);
-	m->boundingBox.left = Plane(-1, 0, 0, vmin.x);
-	m->boundingBox.right = Plane(1, 0, 0, -vmax.x);
-
-	m->boundingSphere.center = (vmax + vmin) / 2;
-	m->boundingSphere.radius = max(max(vmax.x - vmin.x, vmax.y - vmin.y), vmax.z - vmin.z);
-
-	int verticesCount = verts.size();
-	if (verticesCount == 0) return false;
-	int indicesCount = iverts.size();
-	bool hasNormals = norms.size() != 0;
-	bool hasTexCoords = texs.size() != 0;
-
-	if (hasNormals || hasTexCoords)
-	{
-		vector<Vector3f> norms_new;
-		vector<Vector2f> texs_new;
-
-		if (hasNormals) {
-			norms_new.resize(verticesCount);
-			memset(&norms_new[0], -1, verticesCount * sizeof(Vector3f));
-		}
-		if (hasTexCoords) {
-			texs_new.resize(verticesCount);
-			memset(&texs_new[0], -1, verticesCount * sizeof(Vector2f));
-		}
-
-		for (int i = 0, k = iverts.size(); i < k; i++) {
-			int iv = iverts[i];
-			int it = hasTexCoords ? itexs[i] : 0;
-			int in = hasNormals ? inorms[i] : 0;
-
-			if ((!hasNormals || *(int *)&norms_new[iv].x == -1) &&
-				(!hasTexCoords || *(int *)&texs_new[iv].x == -1))
-			{
-				if (hasNormals) norms_new[iv] = norms[in];
-				if (hasTexCoords) texs_new[iv] = texs[it];
-			}
-			else if (hasNormals && norms_new[iv] != norms[in] ||
-						hasTexCoords && texs_new[iv] != texs[it])
-			{
- 				int same = -1;
-				for (int j = verticesCount, n = verts.size(); j < n; j++)
-				{
-					if (verts[j] == verts[iv] &&
-						(!hasNormals || norms_new[j] == norms[in]) &&
-						(!hasTexCoords || texs_new[j] == texs[it]))
-					{
-						same = j;
-						break;
-					}
-				}
-
-				if (same != -1) iverts[i] = same;
-				else {
-					iverts[i] = verts.size();
-					verts.push_back(verts[iv]);
-					if (hasNormals) norms_new.push_back(norms[in]);
-					if (hasTexCoords) texs_new.push_back(texs[it]);
-				}
+	if (data->HasTexCoords()) {
+		b.texCoords = new VertexBuffer(rc, GL_ARRAY_BUFFER);
+		if (compress && GLEW_ARB_half_float_vertex)
+		{
+			vector<unsigned short> packed(data->texCoords.size() * 2);
+			for (int i = 0, n = data->texCoords.size(); i < n; i++) {
+				packed[i*2] = FloatToHalf(data->texCoords[i].x);
+				packed[i*2+1] = FloatToHalf(data->texCoords[i].y);
 			}
+			b.texCoords->SetData(packed.size()*sizeof(unsigned short), packed.data(), GL_STATIC_DRAW);
+			b.texCoordType = GL_HALF_FLOAT;
 		}
-
-		verticesCount = verts.size();
-
-		if (hasNormals) {
-			normals = new VertexBuffer(rc, GL_ARRAY_BUFFER);
-			normals->SetData(norms_new.size()*sizeof(Vector3f), norms_new.data(), GL_STATIC_DRAW);
-		}
-		if (hasTexCoords) {
-			texCoords = new VertexBuffer(rc, GL_ARRAY_BUFFER);
-			texCoords->SetData(texs_new.size()*sizeof(Vector2f), texs_new.data(), GL_STATIC_DRAW);
-		}
+		else b.texCoords->SetData(data->texCoords.size()*sizeof(Vector2f), data->texCoords.data(), GL_STATIC_DRAW);
 	}
 
-	vertices = new VertexBuffer(rc, GL_ARRAY_BUFFER);
-	indices = new VertexBuffer(rc, GL_ELEMENT_ARRAY_BUFFER);
-	vertices->SetData(verticesCount*sizeof(Vector3f), verts.data(), GL_STATIC_DRAW);
-	indices->SetData(indicesCount*sizeof(int), iverts.data(), GL_STATIC_DRAW);
-
-	for (int i = 0, s = meshes.size(); i < s; i++)
+	int lodFirst = (int)data->indices.size();
+	for (int i = 0, s = subMeshes.size(); i < s; i++)
 	{
-		Mesh *mesh = meshes[i];
-		mesh->vertices = new VertexBuffer(*vertices);
-		mesh->indices = new VertexBuffer(*indices);
-		if (normals)
-			mesh->normals = new VertexBuffer(*normals);
-		if (texCoords)
-			mesh->texCoords = new VertexBuffer(*texCoords);
-	}
-
-	if (meshes.size() == 1) meshes[0]->SetIndicesCount(-1);
-
-	delete vertices;
-	delete indices;
-	delete normals;
-	delete texCoords;
-	return true;
-}
-
-bool ModelLoader::loadRaw(const char *filename, vector<Mesh *> &meshes, bool separateMeshes)
-{
-	HANDLE hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) return false;
-
-	DWORD bytesRead = 0;
-
-	BYTE signature[4] = { };
-	ReadFile(hFile, signature, 3, &bytesRead, NULL);
-	if (*(int *)signature != 0x00574152) return false;
-
-	int verticesCount = 0;
-	int indicesCount = 0;
-	bool hasNormals = false;
-	bool hasTexCoords = false;
-	int numMeshes = 0;
-
-	ReadFile(hFile, &verticesCount, sizeof(int), &bytesRead, NULL);
-	ReadFile(hFile, &indicesCount, sizeof(int), &bytesRead, NULL);
-	ReadFile(hFile, &hasNormals, 1, &bytesRead, NULL);
-	ReadFile(hFile, &hasTexCoords, 1, &bytesRead, NULL);
-	ReadFile(hFile, &numMeshes, sizeof(int), &bytesRead, NULL);
-
-	Mesh mm(rc);
-	mm.vertices = new VertexBuffer(rc, GL_ARRAY_BUFFER);
-	mm.indices = new VertexBuffer(rc, GL_ELEMENT_ARRAY_BUFFER);
-	mm.normals = hasNormals ? new VertexBuffer(rc, GL_ARRAY_BUFFER) : NULL;
-	mm.texCoords = hasTexCoords ? new VertexBuffer(rc, GL_ARRAY_BUFFER) : NULL;
-
-	MeshDesc *meshDesc = new MeshDesc[numMeshes];
-	ReadFile(hFile, meshDesc, numMeshes*sizeof(MeshDesc), &bytesRead, NULL);
-
-	for (int i = 0; i < numMeshes; i++)
-	{
-		Mesh *m = new Mesh(mm);
+		const SubMesh &sm = subMeshes[i];
+		Mesh *m = new Mesh(rc, buffers);
 		meshes.push_back(m);
+		m->data = data;
+		if (task.bvh.Get()) m->bvh = task.bvh;
+
+		m->SetFirstIndex(sm.firstIndex);
+		if (s != 1 || !lods.empty()) m->SetIndicesCount(sm.indicesCount);
 
-		m->SetFirstIndex(meshDesc[i].firstIndex);
-		if (numMeshes != 1) {
-			int next = i == numMeshes - 1 ? indicesCount : meshDesc[i + 1].firstIndex;
-			m->SetIndicesCount(next - meshDesc[i].firstIndex);
+		if (!lods.empty())
+		{
+			for (int l = 0, nl = lods[i].GetLevelCount(); l < nl; l++) {
+				MeshLodRange range;
+				range.firstIndex = l == 0 ? sm.firstIndex : lodFirst;
+				range.indicesCount = (int)lods[i].levels[l].indices.size();
+				range.error = lods[i].levels[l].error;
+				m->lods.push_back(range);
+				if (l > 0) lodFirst += range.indicesCount;
+			}
 		}
 
-		Vector3f &vmin = meshDesc[i].vmin;
-		Vector3f &vmax = meshDesc[i].vmax;
+		const Vector3f &vmin = sm.vmin;
+		const Vector3f &vmax = sm.vmax;
 
 		m->boundingBox.front = Plane(0, 0, 1, -vmax.z);
 		m->boundingBox.back = Plane(0, 0, -1, vmin.z);
@@ -305,61 +110,72 @@ bool ModelLoader::loadRaw(const char *filename, vector<Mesh *> &meshes, bool sep
 		m->boundingSphere.center = (vmax + vmin) / 2;
 		m->boundingSphere.radius = max(max(vmax.x - vmin.x, vmax.y - vmin.y), vmax.z - vmin.z);
 	}
-	delete [] meshDesc;
-
-	Vector3f *verts = new Vector3f[verticesCount];
-	UINT *indx = new UINT[indicesCount];
-	ReadFile(hFile, verts, verticesCount*sizeof(Vector3f), &bytesRead, NULL);
-	ReadFile(hFile, indx, indicesCount*sizeof(UINT), &bytesRead, NULL);
-	
-	mm.vertices->SetData(verticesCount*sizeof(Vector3f), verts, GL_STATIC_DRAW);
-	mm.indices->SetData(indicesCount*sizeof(UINT), indx, GL_STATIC_DRAW);
-
-	delete [] verts;
-	delete [] indx;
-
-	if (hasNormals)
-	{
-		Vector3f *norms = new Vector3f[verticesCount];
-		ReadFile(hFile, norms, verticesCount*sizeof(Vector3f), &bytesRead, NULL);
-		mm.normals->SetData(verticesCount*sizeof(Vector3f), norms, GL_STATIC_DRAW);
-		delete [] norms;
-	}
-
-	if (hasTexCoords)
-	{
-		Vector2f *texs = new Vector2f[verticesCount];
-		ReadFile(hFile, texs, verticesCount*sizeof(Vector2f), &bytesRead, NULL);
-		mm.texCoords->SetData(verticesCount*sizeof(Vector2f), texs, GL_STATIC_DRAW);
-		delete [] texs;
-	}
+}
 
-	CloseHandle(hFile);
+bool ModelLoader::load(MeshDataLoad &task, vector<Mesh *> &meshes)
+{
+	PROFILE_SCOPE("ModelLoader::load");
+	setOptions(task);
+	if (!task.Load()) return false;
+	createMeshes(task, meshes);
 	return true;
 }
 
 bool ModelLoader::LoadObj(const char *filename, Mesh &mesh)
 {
 	vector<Mesh *> tmp;
-	bool result = loadObj(filename, tmp, false);
+	MeshDataLoad task(filename);
+	task.separateMeshes = false;
+	bool result = load(task, tmp);
 	if (result) mesh = *tmp[0];
+	for (int i = 0, s = tmp.size(); i < s; i++)
+		delete tmp[i];
 	return result;
 }
 
 bool ModelLoader::LoadObj(const char *filename, vector<Mesh *> &meshes)
 {
-	return loadObj(filename, meshes, true);
+	MeshDataLoad task(filename);
+	return load(task, meshes);
 }
 
 bool ModelLoader::LoadRaw(const char *filename, Mesh &mesh)
 {
 	vector<Mesh *> tmp;
-	bool result = loadRaw(filename, tmp, false);
+	MeshDataLoad task(filename);
+	task.raw = true;
+	bool result = load(task, tmp);
 	if (result) mesh = *tmp[0];
+	for (int i = 0, s = tmp.size(); i < s; i++)
+		delete tmp[i];
 	return result;
 }
 
 bool ModelLoader::LoadRaw(const char *filename, vector<Mesh *> &meshes)
 {
-	return loadRaw(filename, meshes, true);
-}
\ No newline at end of file
+	MeshDataLoad task(filename);
+	task.raw = true;
+	return load(task, meshes);
+}
+
+my_shared_ptr<ModelLoad> ModelLoader::LoadObjAsync(ResourceLoader &loader, const char *filename, bool separateMeshes)
+{
+	ModelLoad *task = new ModelLoad(*this, filename);
+	setOptions(*task);
+	task->separateMeshes = separateMeshes;
+	return loader.Submit(task);
+}
+
+my_shared_ptr<ModelLoad> ModelLoader::LoadRawAsync(ResourceLoader &loader, const char *filename)
+{
+	ModelLoad *task = new ModelLoad(*this, filename);
+	setOptions(*task);
+	task->raw = true;
+	return loader.Submit(task);
+}
+
+bool ModelLoad::Publish()
+{
+	loader.createMeshes(*this, meshes);
+	return true;
+}
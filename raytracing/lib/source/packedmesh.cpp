@@ -0,0 +1,213 @@
+#include "packedmesh.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <math.h>
+
+static short toSnorm16(float f) {
+	f = f < -1.0f ? -1.0f : (f > 1.0f ? 1.0f : f);
+	return (short)floor(f * 32767.0f + 0.5f);
+}
+
+static unsigned int packSnorm16(int x, int y) {
+	return (unsigned int)(unsigned short)x | (unsigned int)(unsigned short)y << 16;
+}
+
+unsigned int EncodeOctahedral(const Vector3f &n)
+{
+	float len = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	if (len <= 0.0f) return packSnorm16(0, 0); // decodes to +z
+	float x = n.x / len, y = n.y / len;
+	if (n.z < 0.0f) {
+		float fx = (1.0f - fabs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+		y = (1.0f - fabs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+		x = fx;
+	}
+
+	// of the four grid points around the projection, keep the one that
+	// decodes closest to n; rounding each axis alone can be off by twice as much
+	Vector3f dir = Normalize(n);
+	int x0 = (int)floor(max(x, -1.0f) * 32767.0f), y0 = (int)floor(max(y, -1.0f) * 32767.0f);
+	unsigned int best = packSnorm16(toSnorm16(x), toSnorm16(y));
+	float bestDot = Dot(DecodeOctahedral(best), dir);
+	for (int i = 0; i < 4; i++)
+	{
+		int qx = min(x0 + (i & 1), 32767), qy = min(y0 + (i >> 1), 32767);
+		unsigned int e = packSnorm16(qx, qy);
+		float d = Dot(DecodeOctahedral(e), dir);
+		if (d > bestDot) { best = e; bestDot = d; }
+	}
+	return best;
+}
+
+unsigned int EncodeSnorm1010102(const Vector3f &n)
+{
+	unsigned int e = 0;
+	for (int i = 0; i < 3; i++) {
+		float f = n[i] < -1.0f ? -1.0f : (n[i] > 1.0f ? 1.0f : n[i]);
+		int q = (int)floor(f * 511.0f + 0.5f);
+		e |= ((unsigned int)q & 0x3FF) << (10 * i);
+	}
+	return e;
+}
+
+unsigned short FloatToHalf(float f)
+{
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	unsigned int sign = (bits >> 16) & 0x8000;
+	unsigned int fexp = (bits >> 23) & 0xFF;
+	unsigned int mant = bits & 0x7FFFFF;
+
+	if (fexp == 0xFF) return (unsigned short)(sign | 0x7C00 | (mant ? 0x200 : 0));
+	int exp = (int)fexp - 127 + 15;
+	if (exp >= 31) return (unsigned short)(sign | 0x7C00);
+
+	unsigned int h, rest, half;
+	if (exp <= 0)
+	{
+		// denormal half, or zero below half the smallest one
+		if (exp < -10) return (unsigned short)sign;
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		h = mant >> shift;
+		rest = mant & ((1u << shift) - 1);
+		half = 1u << (shift - 1);
+	}
+	else
+	{
+		h = (unsigned int)exp << 10 | mant >> 13;
+		rest = mant & 0x1FFF;
+		half = 0x1000;
+	}
+	// a carry out of the mantissa correctly bumps the exponent, up to infinity
+	if (rest > half || (rest == half && (h & 1))) h++;
+	return (unsigned short)(sign | h);
+}
+
+void ComputeTangents(const Vector3f *vertices, const Vector2f *texCoords, const int *indices,
+	int indicesCount, Vector3f *tangents, Vector3f *binormals)
+{
+	for (int i = 0; i < indicesCount; i += 3)
+	{
+		int i1 = indices[i], i2 = indices[i+1], i3 = indices[i+2];
+
+		const Vector3f &v1 = vertices[i1];
+		const Vector3f &v2 = vertices[i2];
+		const Vector3f &v3 = vertices[i3];
+
+		const Vector2f &t1 = texCoords[i1];
+		const Vector2f &t2 = texCoords[i2];
+		const Vector2f &t3 = texCoords[i3];
+
+		Vector3f edge1 = v2 - v1;
+		Vector3f edge2 = v3 - v1;
+		Vector2f uv1 = t2 - t1;
+		Vector2f uv2 = t3 - t1;
+
+		float f = 1.0f / (uv1.x * uv2.y - uv2.x * uv1.y);
+		Vector3f tangent = (uv2.y * edge1 - uv1.y * edge2) * f;
+		Vector3f binormal = (uv1.x * edge2 - uv2.x * edge1) * f;
+		tangent.Normalize();
+		binormal.Normalize();
+
+		tangents[i1] = tangents[i2] = tangents[i3] = tangent;
+		binormals[i1] = binormals[i2] = binormals[i3] = binormal;
+	}
+}
+
+static unsigned short quantize(float f, float origin, float scale)
+{
+	if (scale <= 0.0f) return 0;
+	float q = floor((f - origin) / scale + 0.5f);
+	return (unsigned short)(q < 0.0f ? 0.0f : (q > 65535.0f ? 65535.0f : q));
+}
+
+void PackedMeshData::Pack(const MeshData &mesh, bool withTangents)
+{
+	PROFILE_SCOPE("PackedMeshData::Pack");
+	Clear();
+	int count = mesh.GetVerticesCount();
+	if (count == 0) return;
+
+	AABox bounds = mesh.GetBounds();
+	origin = bounds.vmin;
+	scale = (bounds.vmax - bounds.vmin) * (1.0f / 65535.0f);
+
+	positions.resize(count);
+	if (mesh.HasNormals()) normals.resize(count);
+	if (mesh.HasTexCoords()) texCoords.resize(count);
+	indices = mesh.indices;
+
+	vector<Vector3f> ts, bs;
+	if (withTangents && mesh.HasNormals() && mesh.HasTexCoords()) {
+		ts.resize(count);
+		bs.resize(count);
+		ComputeTangents(mesh.vertices.data(), mesh.texCoords.data(), mesh.indices.data(),
+			mesh.GetIndicesCount(), ts.data(), bs.data());
+		tangents.resize(count);
+		binormals.resize(count);
+	}
+
+	ParallelFor(0, count, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			const Vector3f &v = mesh.vertices[i];
+			PackedPosition &p = positions[i];
+			p.x = quantize(v.x, origin.x, scale.x);
+			p.y = quantize(v.y, origin.y, scale.y);
+			p.z = quantize(v.z, origin.z, scale.z);
+
+			if (!normals.empty()) normals[i] = EncodeOctahedral(mesh.normals[i]);
+			if (!texCoords.empty()) {
+				texCoords[i].u = FloatToHalf(mesh.texCoords[i].x);
+				texCoords[i].v = FloatToHalf(mesh.texCoords[i].y);
+			}
+			if (!tangents.empty()) {
+				tangents[i] = EncodeOctahedral(ts[i]);
+				binormals[i] = EncodeOctahedral(bs[i]);
+			}
+		}
+	}, 4096);
+}
+
+void PackedMeshData::Clear()
+{
+	positions.clear();
+	normals.clear();
+	texCoords.clear();
+	tangents.clear();
+	binormals.clear();
+	indices.clear();
+	origin = scale = Vector3f(0.0f);
+}
+
+void PackedMeshData::Unpack(MeshData &mesh) const
+{
+	int count = GetVerticesCount();
+	mesh.vertices.resize(count);
+	mesh.normals.resize(normals.size());
+	mesh.texCoords.resize(texCoords.size());
+	mesh.indices = indices;
+
+	ParallelFor(0, count, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			mesh.vertices[i] = GetVertex(i);
+			if (!normals.empty()) mesh.normals[i] = GetNormal(i);
+			if (!texCoords.empty()) mesh.texCoords[i] = GetTexCoord(i);
+		}
+	}, 4096);
+}
+
+Vector3f PackedMeshData::InterpolateNormal(int face, float u, float v) const
+{
+	const int *f = &indices[face * 3];
+	Vector3f n = GetNormal(f[0]) * (1.0f - u - v) + GetNormal(f[1]) * u + GetNormal(f[2]) * v;
+	n.Normalize();
+	return n;
+}
+
+Vector2f PackedMeshData::InterpolateTexCoord(int face, float u, float v) const
+{
+	const int *f = &indices[face * 3];
+	return GetTexCoord(f[0]) * (1.0f - u - v) + GetTexCoord(f[1]) * u + GetTexCoord(f[2]) * v;
+}
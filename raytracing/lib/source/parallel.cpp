@@ -0,0 +1,135 @@
+#include "parallel.h"
+
+#define MAX_THREADS 256
+
+static int threadCount = 0;
+
+struct ParallelJob
+{
+	ParallelTask *task;
+	volatile int next;
+	int end;
+	int grainSize;
+};
+
+static void runChunks(void *param)
+{
+	ParallelJob *job = (ParallelJob *)param;
+	for (;;)
+	{
+		int begin = AtomicAdd(&job->next, job->grainSize);
+		if (begin >= job->end) break;
+		int end = begin + job->grainSize;
+		job->task->Run(begin, end < job->end ? end : job->end);
+	}
+}
+
+int GetNumberOfThreads() {
+	return threadCount > 0 ? threadCount : GetProcessorCount();
+}
+
+void SetNumberOfThreads(int count) {
+	threadCount = count;
+}
+
+// Workers are started on first use and then wait between jobs, so a job
+// costs a wake-up instead of creating threads. One job runs at a time: a
+// RunParallel made while another is running, from inside a task or from
+// another thread, runs on its caller alone.
+struct WorkerPool
+{
+	Thread threads[MAX_THREADS - 1];
+	int started;
+	Mutex mutex;
+	ConditionVariable wake, done;
+	ParallelJob *job;  // NULL once the caller has run out of chunks
+	int jobId;         // workers join each job at most once
+	int workers;       // how many may join the current job
+	int running;       // workers inside the current job
+	bool busy, quit;
+
+	WorkerPool() : started(0), job(NULL), jobId(0), workers(0), running(0), busy(false), quit(false) { }
+
+	~WorkerPool() {
+		mutex.Lock();
+		quit = true;
+		wake.NotifyAll();
+		mutex.Unlock();
+		for (int i = 0; i < started; i++)
+			threads[i].Join();
+	}
+};
+
+static WorkerPool pool;
+
+static void workerMain(void *param)
+{
+	int index = (int)(size_t)param;
+	int seen = 0;
+	MutexLock lock(pool.mutex);
+	for (;;)
+	{
+		while (!pool.quit && (!pool.job || pool.jobId == seen))
+			pool.wake.Wait(pool.mutex);
+		if (pool.quit) break;
+
+		seen = pool.jobId;
+		if (index >= pool.workers) continue;
+		ParallelJob *job = pool.job;
+		pool.running++;
+
+		pool.mutex.Unlock();
+		runChunks(job);
+		pool.mutex.Lock();
+
+		if (--pool.running == 0) pool.done.NotifyAll();
+	}
+}
+
+void RunParallel(ParallelTask &task, int begin, int end, int grainSize)
+{
+	int count = end - begin;
+	if (count <= 0) return;
+
+	int threads = GetNumberOfThreads();
+	if (grainSize <= 0) {
+		grainSize = count / (threads * 8);
+		if (grainSize < 1) grainSize = 1;
+	}
+
+	int chunks = (count + grainSize - 1) / grainSize;
+	if (threads > chunks) threads = chunks;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+	if (threads <= 1) {
+		task.Run(begin, end);
+		return;
+	}
+
+	ParallelJob job = { &task, begin, end, grainSize };
+	pool.mutex.Lock();
+	if (pool.busy) {
+		pool.mutex.Unlock();
+		task.Run(begin, end);
+		return;
+	}
+	pool.busy = true;
+	while (pool.started < threads - 1) {
+		if (!pool.threads[pool.started].Start(workerMain, (void *)(size_t)pool.started)) break;
+		pool.started++;
+	}
+	pool.job = &job;
+	pool.jobId++;
+	pool.workers = threads - 1;
+	pool.wake.NotifyAll();
+	pool.mutex.Unlock();
+
+	// the calling thread takes chunks too, workers that are slow to wake
+	// simply leave more for the others
+	runChunks(&job);
+
+	MutexLock lock(pool.mutex);
+	pool.job = NULL;
+	while (pool.running > 0)
+		pool.done.Wait(pool.mutex);
+	pool.busy = false;
+}
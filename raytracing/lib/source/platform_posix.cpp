@@ -0,0 +1,248 @@
+#ifndef _WIN32
+
+#include "platform.h"
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+File::File() : handle(NULL) { }
+
+File::~File() {
+	Close();
+}
+
+bool File::Open(const char *filename, FileMode mode)
+{
+	Close();
+	handle = fopen(filename, mode == FILE_READ ? "rb" : "wb");
+	return handle != NULL;
+}
+
+void File::Close()
+{
+	if (handle) fclose((FILE *)handle);
+	handle = NULL;
+}
+
+bool File::IsOpen() const {
+	return handle != NULL;
+}
+
+bool File::Read(void *buffer, size_t size) {
+	return fread(buffer, 1, size, (FILE *)handle) == size;
+}
+
+bool File::Write(const void *buffer, size_t size) {
+	return fwrite(buffer, 1, size, (FILE *)handle) == size;
+}
+
+bool File::Skip(long long bytes) {
+	return fseeko((FILE *)handle, (off_t)bytes, SEEK_CUR) == 0;
+}
+
+long long File::GetSize() const
+{
+	struct stat st;
+	if (fstat(fileno((FILE *)handle), &st) != 0) return -1;
+	return st.st_size;
+}
+
+// pread leaves the stream's position and buffer alone
+bool File::ReadAt(long long offset, void *buffer, size_t size)
+{
+	int fd = fileno((FILE *)handle);
+	char *p = (char *)buffer;
+	while (size > 0)
+	{
+		ssize_t n = pread(fd, p, size, (off_t)offset);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		offset += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+MappedFile::MappedFile() : data(NULL), size(0), hMapping(NULL) { }
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+bool MappedFile::Open(const char *filename)
+{
+	Close();
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+
+	// the mapping stays valid after the descriptor is closed
+	struct stat st;
+	void *p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return false;
+
+	data = p;
+	size = (size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data) munmap((void *)data, size);
+	data = NULL;
+	size = 0;
+}
+
+double GetTime()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void SleepMs(int milliseconds)
+{
+	timespec ts;
+	ts.tv_sec = milliseconds / 1000;
+	ts.tv_nsec = (milliseconds % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+bool ReplaceFileWith(const char *to, const char *from)
+{
+	return rename(from, to) == 0;
+}
+
+int GetProcessIdentifier()
+{
+	return (int)getpid();
+}
+
+int GetProcessorCount()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+size_t GetPeakMemoryUsage()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+struct ThreadStart
+{
+	Thread::ThreadFunc func;
+	void *param;
+};
+
+static void *threadProc(void *param)
+{
+	ThreadStart start = *(ThreadStart *)param;
+	delete (ThreadStart *)param;
+	start.func(start.param);
+	return NULL;
+}
+
+Thread::Thread() : handle(NULL) { }
+
+Thread::~Thread() {
+	Join();
+}
+
+bool Thread::Start(ThreadFunc func, void *param)
+{
+	Join();
+	ThreadStart *start = new ThreadStart;
+	start->func = func;
+	start->param = param;
+
+	pthread_t *thread = new pthread_t;
+	if (pthread_create(thread, NULL, threadProc, start) != 0) {
+		delete thread;
+		delete start;
+		return false;
+	}
+	handle = thread;
+	return true;
+}
+
+void Thread::Join()
+{
+	if (!handle) return;
+	pthread_t *thread = (pthread_t *)handle;
+	pthread_join(*thread, NULL);
+	delete thread;
+	handle = NULL;
+}
+
+Mutex::Mutex()
+{
+	pthread_mutex_t *mutex = new pthread_mutex_t;
+	pthread_mutex_init(mutex, NULL);
+	handle = mutex;
+}
+
+Mutex::~Mutex()
+{
+	pthread_mutex_destroy((pthread_mutex_t *)handle);
+	delete (pthread_mutex_t *)handle;
+}
+
+void Mutex::Lock() {
+	pthread_mutex_lock((pthread_mutex_t *)handle);
+}
+
+void Mutex::Unlock() {
+	pthread_mutex_unlock((pthread_mutex_t *)handle);
+}
+
+ConditionVariable::ConditionVariable()
+{
+	pthread_cond_t *cond = new pthread_cond_t;
+	pthread_cond_init(cond, NULL);
+	handle = cond;
+}
+
+ConditionVariable::~ConditionVariable()
+{
+	pthread_cond_destroy((pthread_cond_t *)handle);
+	delete (pthread_cond_t *)handle;
+}
+
+void ConditionVariable::Wait(Mutex &mutex) {
+	pthread_cond_wait((pthread_cond_t *)handle, (pthread_mutex_t *)mutex.handle);
+}
+
+void ConditionVariable::NotifyOne() {
+	pthread_cond_signal((pthread_cond_t *)handle);
+}
+
+void ConditionVariable::NotifyAll() {
+	pthread_cond_broadcast((pthread_cond_t *)handle);
+}
+
+int AtomicAdd(volatile int *value, int add) {
+	return __sync_fetch_and_add(value, add);
+}
+
+int AtomicCompareExchange(volatile int *value, int exchange, int comparand) {
+	return __sync_val_compare_and_swap(value, comparand, exchange);
+}
+
+#endif // _WIN32
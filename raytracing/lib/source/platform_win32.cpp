@@ -0,0 +1,274 @@
+#ifdef _WIN32
+
+#include "platform.h"
+#include "common.h"
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+File::File() : handle(INVALID_HANDLE_VALUE) { }
+
+File::~File() {
+	Close();
+}
+
+bool File::Open(const char *filename, FileMode mode)
+{
+	Close();
+	if (mode == FILE_READ)
+		handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	else
+		handle = CreateFileA(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	return handle != INVALID_HANDLE_VALUE;
+}
+
+void File::Close()
+{
+	if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+	handle = INVALID_HANDLE_VALUE;
+}
+
+bool File::IsOpen() const {
+	return handle != INVALID_HANDLE_VALUE;
+}
+
+bool File::Read(void *buffer, size_t size)
+{
+	char *p = (char *)buffer;
+	while (size > 0)
+	{
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		DWORD bytesRead = 0;
+		if (!ReadFile(handle, p, chunk, &bytesRead, NULL) || bytesRead != chunk)
+			return false;
+		p += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+bool File::Write(const void *buffer, size_t size)
+{
+	const char *p = (const char *)buffer;
+	while (size > 0)
+	{
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		DWORD bytesWritten = 0;
+		if (!WriteFile(handle, p, chunk, &bytesWritten, NULL) || bytesWritten != chunk)
+			return false;
+		p += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+bool File::Skip(long long bytes)
+{
+	LARGE_INTEGER offset;
+	offset.QuadPart = bytes;
+	return SetFilePointerEx(handle, offset, NULL, FILE_CURRENT) != 0;
+}
+
+long long File::GetSize() const
+{
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size)) return -1;
+	return size.QuadPart;
+}
+
+// with an OVERLAPPED offset ReadFile doesn't depend on the file pointer
+bool File::ReadAt(long long offset, void *buffer, size_t size)
+{
+	char *p = (char *)buffer;
+	while (size > 0)
+	{
+		DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+		DWORD bytesRead = 0;
+		OVERLAPPED overlapped = { 0 };
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		if (!ReadFile(handle, p, chunk, &bytesRead, &overlapped) || bytesRead != chunk)
+			return false;
+		p += chunk;
+		offset += chunk;
+		size -= chunk;
+	}
+	return true;
+}
+
+MappedFile::MappedFile() : data(NULL), size(0), hMapping(NULL) { }
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+bool MappedFile::Open(const char *filename)
+{
+	Close();
+
+	HANDLE f = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE) return false;
+
+	// the mapping keeps the file open, the handle isn't needed after this
+	LARGE_INTEGER fileSize;
+	HANDLE m = NULL;
+	if (GetFileSizeEx(f, &fileSize) && fileSize.QuadPart != 0)
+		m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(f);
+	if (!m) return false;
+
+	data = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(m);
+		return false;
+	}
+
+	size = (size_t)fileSize.QuadPart;
+	hMapping = m;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data) UnmapViewOfFile(data);
+	if (hMapping) CloseHandle(hMapping);
+	data = NULL;
+	size = 0;
+	hMapping = NULL;
+}
+
+double GetTime()
+{
+	static LARGE_INTEGER freq = { };
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+}
+
+void SleepMs(int milliseconds) {
+	Sleep(milliseconds);
+}
+
+bool ReplaceFileWith(const char *to, const char *from)
+{
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+int GetProcessIdentifier()
+{
+	return (int)GetCurrentProcessId();
+}
+
+int GetProcessorCount()
+{
+	SYSTEM_INFO si = { };
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
+size_t GetPeakMemoryUsage()
+{
+	PROCESS_MEMORY_COUNTERS pmc = { };
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+	return pmc.PeakWorkingSetSize;
+}
+
+struct ThreadStart
+{
+	Thread::ThreadFunc func;
+	void *param;
+};
+
+static DWORD WINAPI threadProc(LPVOID param)
+{
+	ThreadStart start = *(ThreadStart *)param;
+	delete (ThreadStart *)param;
+	start.func(start.param);
+	return 0;
+}
+
+Thread::Thread() : handle(NULL) { }
+
+Thread::~Thread() {
+	Join();
+}
+
+bool Thread::Start(ThreadFunc func, void *param)
+{
+	Join();
+	ThreadStart *start = new ThreadStart;
+	start->func = func;
+	start->param = param;
+
+	handle = CreateThread(NULL, 0, threadProc, start, 0, NULL);
+	if (!handle) {
+		delete start;
+		return false;
+	}
+	return true;
+}
+
+void Thread::Join()
+{
+	if (!handle) return;
+	WaitForSingleObject(handle, INFINITE);
+	CloseHandle(handle);
+	handle = NULL;
+}
+
+Mutex::Mutex()
+{
+	CRITICAL_SECTION *section = new CRITICAL_SECTION;
+	InitializeCriticalSection(section);
+	handle = section;
+}
+
+Mutex::~Mutex()
+{
+	DeleteCriticalSection((CRITICAL_SECTION *)handle);
+	delete (CRITICAL_SECTION *)handle;
+}
+
+void Mutex::Lock() {
+	EnterCriticalSection((CRITICAL_SECTION *)handle);
+}
+
+void Mutex::Unlock() {
+	LeaveCriticalSection((CRITICAL_SECTION *)handle);
+}
+
+// condition variables need Vista or later
+ConditionVariable::ConditionVariable()
+{
+	CONDITION_VARIABLE *cond = new CONDITION_VARIABLE;
+	InitializeConditionVariable(cond);
+	handle = cond;
+}
+
+ConditionVariable::~ConditionVariable() {
+	delete (CONDITION_VARIABLE *)handle;
+}
+
+void ConditionVariable::Wait(Mutex &mutex) {
+	SleepConditionVariableCS((CONDITION_VARIABLE *)handle, (CRITICAL_SECTION *)mutex.handle, INFINITE);
+}
+
+void ConditionVariable::NotifyOne() {
+	WakeConditionVariable((CONDITION_VARIABLE *)handle);
+}
+
+void ConditionVariable::NotifyAll() {
+	WakeAllConditionVariable((CONDITION_VARIABLE *)handle);
+}
+
+int AtomicAdd(volatile int *value, int add) {
+	return (int)InterlockedExchangeAdd((volatile LONG *)value, add);
+}
+
+int AtomicCompareExchange(volatile int *value, int exchange, int comparand) {
+	return (int)InterlockedCompareExchange((volatile LONG *)value, exchange, comparand);
+}
+
+#endif // _WIN32
@@ -0,0 +1,200 @@
+#include "profiler.h"
+#include <string.h>
+
+static ProfileThreadData slots[PROFILE_MAX_THREADS];
+static volatile int slotCount = 0;
+static volatile int generation = 1;
+
+static THREAD_LOCAL ProfileThreadData *threadData = NULL;
+static THREAD_LOCAL int threadGeneration = 0;
+
+// collected from the slots at frame boundaries
+static vector<ProfileEvent> traceEvents;
+static vector<ProfileFrame> traceFrames;
+static double frameStart = 0.0;
+
+ProfileFrame::ProfileFrame() : start(0), end(0), threads(0)
+{
+	memset(stageTime, 0, sizeof(stageTime));
+	memset(stageCalls, 0, sizeof(stageCalls));
+	memset(counters, 0, sizeof(counters));
+}
+
+ProfileThreadData *GetProfileThreadData()
+{
+	if (threadData && threadGeneration == generation) return threadData;
+
+	int slot = AtomicAdd(&slotCount, 1);
+	if (slot >= PROFILE_MAX_THREADS) return NULL;
+
+	ProfileThreadData *t = &slots[slot];
+	t->index = slot;
+	memset(t->stageTime, 0, sizeof(t->stageTime));
+	memset(t->stageCalls, 0, sizeof(t->stageCalls));
+	memset(t->counters, 0, sizeof(t->counters));
+	t->events.clear();
+
+	threadData = t;
+	threadGeneration = generation;
+	return t;
+}
+
+bool IsProfilerCompiledIn()
+{
+#ifdef RT_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
+
+const char *GetProfileStageName(int stage)
+{
+	static const char *names[PROF_STAGE_COUNT] = { "camera", "intersect", "shadow", "shading" };
+	return stage >= 0 && stage < PROF_STAGE_COUNT ? names[stage] : "";
+}
+
+const char *GetProfileCounterName(int counter)
+{
+	static const char *names[PROF_COUNTER_COUNT] = { "rays", "shadow rays", "bytes loaded", "bytes written" };
+	return counter >= 0 && counter < PROF_COUNTER_COUNT ? names[counter] : "";
+}
+
+static void addScopeTotal(vector<ProfileScopeTotal> &scopes, const ProfileEvent &e)
+{
+	// literals from different files may differ in address, so names are compared
+	for (int i = 0, n = (int)scopes.size(); i < n; i++) {
+		if (scopes[i].name == e.name || !strcmp(scopes[i].name, e.name)) {
+			scopes[i].calls++;
+			scopes[i].time += e.end - e.start;
+			return;
+		}
+	}
+	ProfileScopeTotal total = { e.name, 1, e.end - e.start };
+	scopes.push_back(total);
+}
+
+// moves the events of every slot to the trace and frees the slots;
+// threads still holding one see the new generation and claim another
+static void collect(ProfileFrame *frame)
+{
+	int used = slotCount < PROFILE_MAX_THREADS ? slotCount : PROFILE_MAX_THREADS;
+	for (int i = 0; i < used; i++)
+	{
+		ProfileThreadData &t = slots[i];
+		if (frame) {
+			for (int s = 0; s < PROF_STAGE_COUNT; s++) {
+				frame->stageTime[s] += t.stageTime[s];
+				frame->stageCalls[s] += t.stageCalls[s];
+			}
+			for (int c = 0; c < PROF_COUNTER_COUNT; c++)
+				frame->counters[c] += t.counters[c];
+			for (int e = 0, n = (int)t.events.size(); e < n; e++)
+				addScopeTotal(frame->scopes, t.events[e]);
+		}
+		traceEvents.insert(traceEvents.end(), t.events.begin(), t.events.end());
+		t.events.clear();
+	}
+	if (frame) frame->threads = used;
+
+	slotCount = 0;
+	generation++;
+}
+
+void ProfileBeginFrame()
+{
+	collect(NULL);
+	frameStart = GetTime();
+}
+
+void ProfileEndFrame(ProfileFrame &frame)
+{
+	frame = ProfileFrame();
+	frame.start = frameStart;
+	frame.end = GetTime();
+	collect(&frame);
+	traceFrames.push_back(frame);
+}
+
+void PrintProfileFrame(FILE *f, const ProfileFrame &frame)
+{
+	double wall = frame.end - frame.start;
+	double threadTime = wall * (frame.threads > 0 ? frame.threads : 1);
+	fprintf(f, "  %-24s %10s %12s %10s %7s\n", "stage", "calls", "total ms", "avg us", "share");
+
+	for (int s = 0; s < PROF_STAGE_COUNT; s++) {
+		long long calls = frame.stageCalls[s];
+		double time = frame.stageTime[s];
+		fprintf(f, "  %-24s %10lld %12.3f %10.3f %6.1f%%\n", GetProfileStageName(s), calls,
+			time * 1000.0, calls ? time * 1e6 / calls : 0.0, threadTime > 0 ? time / threadTime * 100.0 : 0.0);
+	}
+	for (int i = 0, n = (int)frame.scopes.size(); i < n; i++) {
+		const ProfileScopeTotal &s = frame.scopes[i];
+		fprintf(f, "  %-24s %10lld %12.3f %10.3f %6.1f%%\n", s.name, s.calls,
+			s.time * 1000.0, s.time * 1e6 / s.calls, threadTime > 0 ? s.time / threadTime * 100.0 : 0.0);
+	}
+
+	fprintf(f, "  ");
+	for (int c = 0; c < PROF_COUNTER_COUNT; c++)
+		fprintf(f, "%s%s %lld", c ? ", " : "", GetProfileCounterName(c), frame.counters[c]);
+	fprintf(f, "\n  %.3f ms wall, %d threads; shares are of wall time x threads\n", wall * 1000.0, frame.threads);
+}
+
+static void writeString(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') fputc('\\', f);
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+bool WriteChromeTrace(const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+	if (!f) return false;
+
+	// timestamps are microseconds; thread 0 holds the frames, slot i is thread i + 1
+	double origin = traceFrames.empty() ? GetTime() : traceFrames[0].start;
+	for (int i = 0, n = (int)traceEvents.size(); i < n; i++)
+		if (traceEvents[i].start < origin) origin = traceEvents[i].start;
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"frames\"}}");
+
+	int maxThread = -1;
+	for (int i = 0, n = (int)traceEvents.size(); i < n; i++)
+	{
+		const ProfileEvent &e = traceEvents[i];
+		if (e.thread > maxThread) maxThread = e.thread;
+		fprintf(f, ",\n{\"name\":");
+		writeString(f, e.name);
+		fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			e.thread + 1, (e.start - origin) * 1e6, (e.end - e.start) * 1e6);
+	}
+	for (int i = 0; i <= maxThread; i++)
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", i + 1, i);
+
+	for (int i = 0, n = (int)traceFrames.size(); i < n; i++)
+	{
+		const ProfileFrame &frame = traceFrames[i];
+		fprintf(f, ",\n{\"name\":\"frame %d\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+			i, (frame.start - origin) * 1e6, (frame.end - frame.start) * 1e6);
+
+		// stage totals as counter tracks, in milliseconds summed over threads
+		fprintf(f, ",\n{\"name\":\"stages\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{", (frame.start - origin) * 1e6);
+		for (int s = 0; s < PROF_STAGE_COUNT; s++)
+			fprintf(f, "%s\"%s\":%.3f", s ? "," : "", GetProfileStageName(s), frame.stageTime[s] * 1000.0);
+		fprintf(f, "}}");
+	}
+	fprintf(f, "\n]}\n");
+	return fclose(f) == 0;
+}
+
+void ClearProfile()
+{
+	collect(NULL);
+	traceEvents.clear();
+	traceFrames.clear();
+}
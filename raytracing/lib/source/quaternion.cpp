@@ -97,6 +97,37 @@ Quaternion Quaternion::Multiply(const Quaternion &q, float scale) {
 	return Quaternion(q.x * scale, q.y * scale, q.z * scale, q.w * scale);
 }
 
+float Quaternion::Dot(const Quaternion &q1, const Quaternion &q2) {
+	return q1.x*q2.x + q1.y*q2.y + q1.z*q2.z + q1.w*q2.w;
+}
+
+Quaternion Quaternion::Slerp(const Quaternion &q1, const Quaternion &q2, float t)
+{
+	Quaternion to = q2;
+	float cosAngle = Dot(q1, q2);
+	if (cosAngle < 0.0f) {
+		to = -q2;
+		cosAngle = -cosAngle;
+	}
+
+	float k1, k2;
+	if (cosAngle > 0.9995f) {
+		// nearly parallel, sin() gets unstable, lerp is just as good here
+		k1 = 1.0f - t;
+		k2 = t;
+	}
+	else {
+		float angle = acos(cosAngle);
+		float s = 1.0f / sin(angle);
+		k1 = sin((1.0f - t) * angle) * s;
+		k2 = sin(t * angle) * s;
+	}
+
+	Quaternion q = q1 * k1 + to * k2;
+	q.Normalize();
+	return q;
+}
+
 Quaternion Quaternion::operator+(const Quaternion &q) const {
 	return Quaternion::Add(*this, q);
 }
@@ -0,0 +1,157 @@
+#include "raygen.h"
+#include "common.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#define RAYGEN_SSE
+#include <xmmintrin.h>
+#endif
+
+static unsigned int hashPixel(unsigned int x, unsigned int y, unsigned int seed)
+{
+	unsigned int h = x * 0x8da6b343u ^ y * 0xd8163841u ^ seed * 0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+CameraRayGenerator::CameraRayGenerator() :
+	width(0), height(0), fov(0),
+	pixelSizeX(0), pixelSizeY(0),
+	jitter(false), seed(0)
+{ }
+
+void CameraRayGenerator::SetResolution(int width, int height, float fovDegrees)
+{
+	if (width == this->width && height == this->height && fovDegrees == fov)
+		return;
+
+	this->width = width;
+	this->height = height;
+	fov = fovDegrees;
+
+	columnDirs.clear();
+	rowDirs.clear();
+	if (width <= 0 || height <= 0) return;
+
+	float tanHalfFov = tan(DEG_TO_RAD(fovDegrees * 0.5f));
+	float aspectRatio = (float)width / height;
+	pixelSizeX = 2.0f / width * tanHalfFov * aspectRatio;
+	pixelSizeY = 2.0f / height * tanHalfFov;
+
+	columnDirs.resize(GetPacketsPerRow() * RAY_PACKET_SIZE);
+	for (int x = 0, n = (int)columnDirs.size(); x < n; x++)
+		columnDirs[x] = (2.0f * ((x + 0.5f) / width) - 1.0f) * tanHalfFov * aspectRatio;
+
+	rowDirs.resize(height);
+	for (int y = 0; y < height; y++)
+		rowDirs[y] = (1.0f - 2.0f * ((y + 0.5f) / height)) * tanHalfFov;
+}
+
+void CameraRayGenerator::SetCamera(const Matrix44f &view)
+{
+	basis.xAxis = view.xAxis;
+	basis.yAxis = view.yAxis;
+	basis.zAxis = view.zAxis;
+	origin = view.translate;
+}
+
+void CameraRayGenerator::SetJitter(bool enable, unsigned int seed)
+{
+	jitter = enable;
+	this->seed = seed;
+}
+
+void CameraRayGenerator::getJitter(int x, int y, float &jx, float &jy) const
+{
+	unsigned int h = hashPixel(x, y, seed);
+	jx = ((h & 0xFFFF) / 65536.0f - 0.5f) * pixelSizeX;
+	jy = ((h >> 16) / 65536.0f - 0.5f) * -pixelSizeY;
+}
+
+Ray CameraRayGenerator::GetRay(int x, int y) const
+{
+	float cx = columnDirs[x], cy = rowDirs[y];
+	if (jitter) {
+		float jx, jy;
+		getJitter(x, y, jx, jy);
+		cx += jx;
+		cy += jy;
+	}
+
+	Vector3f dir = basis.xAxis * cx + basis.yAxis * cy - basis.zAxis;
+	dir.Normalize();
+	return Ray(origin, dir);
+}
+
+void CameraRayGenerator::GetDifferential(const Vector3f &dir, RayDifferential &diff) const
+{
+	// the unnormalized direction d = x cx + y cy - z changes by pixelSizeX * x
+	// per column and by -pixelSizeY * y per row; for the normalized one
+	// dD = (dd - D (D . dd)) / |d|, and 1 / |d| = D . -z for an orthonormal basis
+	float invLen = -Dot(dir, basis.zAxis);
+	Vector3f ddx = basis.xAxis * pixelSizeX;
+	Vector3f ddy = basis.yAxis * -pixelSizeY;
+	diff.dPdx = diff.dPdy = Vector3f(0.0f);
+	diff.dDdx = (ddx - dir * Dot(dir, ddx)) * invLen;
+	diff.dDdy = (ddy - dir * Dot(dir, ddy)) * invLen;
+}
+
+void CameraRayGenerator::GenerateRow(int y, RayPacket *packets) const
+{
+	const Vector3f &bx = basis.xAxis, &by = basis.yAxis, &bz = basis.zAxis;
+	int numPackets = GetPacketsPerRow();
+
+	for (int p = 0; p < numPackets; p++)
+	{
+		RayPacket &packet = packets[p];
+		int x0 = p * RAY_PACKET_SIZE;
+		packet.origin = origin;
+		packet.x = x0;
+		packet.y = y;
+		packet.count = min(RAY_PACKET_SIZE, width - x0);
+
+		float cx[RAY_PACKET_SIZE], cy[RAY_PACKET_SIZE];
+		for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+			cx[i] = columnDirs[x0 + i];
+			cy[i] = rowDirs[y];
+		}
+		if (jitter) {
+			for (int i = 0; i < packet.count; i++) {
+				float jx, jy;
+				getJitter(x0 + i, y, jx, jy);
+				cx[i] += jx;
+				cy[i] += jy;
+			}
+		}
+
+#ifdef RAYGEN_SSE
+		__m128 vx = _mm_loadu_ps(cx);
+		__m128 vy = _mm_loadu_ps(cy);
+
+		__m128 dx = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(bx.x)), _mm_mul_ps(vy, _mm_set1_ps(by.x))), _mm_set1_ps(bz.x));
+		__m128 dy = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(bx.y)), _mm_mul_ps(vy, _mm_set1_ps(by.y))), _mm_set1_ps(bz.y));
+		__m128 dz = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(vx, _mm_set1_ps(bx.z)), _mm_mul_ps(vy, _mm_set1_ps(by.z))), _mm_set1_ps(bz.z));
+
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128 invLen = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(len2));
+
+		_mm_storeu_ps(packet.dx, _mm_mul_ps(dx, invLen));
+		_mm_storeu_ps(packet.dy, _mm_mul_ps(dy, invLen));
+		_mm_storeu_ps(packet.dz, _mm_mul_ps(dz, invLen));
+#else
+		for (int i = 0; i < RAY_PACKET_SIZE; i++)
+		{
+			float dx = bx.x * cx[i] + by.x * cy[i] - bz.x;
+			float dy = bx.y * cx[i] + by.y * cy[i] - bz.y;
+			float dz = bx.z * cx[i] + by.z * cy[i] - bz.z;
+			float invLen = 1.0f / sqrt(dx*dx + dy*dy + dz*dz);
+			packet.dx[i] = dx * invLen;
+			packet.dy[i] = dy * invLen;
+			packet.dz[i] = dz * invLen;
+		}
+#endif
+	}
+}
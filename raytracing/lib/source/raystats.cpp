@@ -0,0 +1,104 @@
+#include "raystats.h"
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+void RayStats::Clear()
+{
+	memset(rays, 0, sizeof(rays));
+	memset(depthRays, 0, sizeof(depthRays));
+	steps = primTests = 0;
+}
+
+void RayStats::Add(const RayStats &stats)
+{
+	for (int i = 0; i < RAY_TYPE_COUNT; i++)
+		rays[i] += stats.rays[i];
+	for (int i = 0; i < RAY_STATS_MAX_DEPTH; i++)
+		depthRays[i] += stats.depthRays[i];
+	steps += stats.steps;
+	primTests += stats.primTests;
+}
+
+long long RayStats::GetRaysCount() const
+{
+	long long count = 0;
+	for (int i = 0; i < RAY_TYPE_COUNT; i++)
+		count += rays[i];
+	return count;
+}
+
+void RayStats::Print(FILE *f) const
+{
+	long long total = GetRaysCount();
+	fprintf(f, "  rays:");
+	for (int i = 0; i < RAY_TYPE_COUNT; i++)
+		fprintf(f, "%s %s %lld", i ? "," : "", GetRayTypeName(i), rays[i]);
+	fprintf(f, "\n  by depth:");
+	for (int i = 0; i < RAY_STATS_MAX_DEPTH && depthRays[i]; i++)
+		fprintf(f, " %d: %lld", i, depthRays[i]);
+	fprintf(f, "\n  per ray: %.2f steps, %.2f primitive tests\n",
+		total ? (double)steps / total : 0.0, total ? (double)primTests / total : 0.0);
+}
+
+const char *GetRayTypeName(int type)
+{
+	static const char *names[RAY_TYPE_COUNT] = { "camera", "reflection", "refraction", "shadow" };
+	return type >= 0 && type < RAY_TYPE_COUNT ? names[type] : "";
+}
+
+const char *GetHeatmapChannelName(int channel)
+{
+	static const char *names[HEATMAP_CHANNEL_COUNT] = { "rays", "steps", "tests", "depth" };
+	return channel >= 0 && channel < HEATMAP_CHANNEL_COUNT ? names[channel] : "";
+}
+
+static unsigned int channelValue(const PixelRayStats &p, HeatmapChannel channel)
+{
+	switch (channel)
+	{
+	case HEATMAP_RAYS: return p.rays;
+	case HEATMAP_STEPS: return p.steps;
+	case HEATMAP_PRIM_TESTS: return p.primTests;
+	default: return p.maxDepth;
+	}
+}
+
+// blue, cyan, green, yellow, red
+static void heatColor(float v, unsigned char *bgr)
+{
+	static const float ramp[5][3] = {
+		{ 0.0f, 0.0f, 0.5f }, { 0.0f, 0.8f, 1.0f }, { 0.1f, 0.9f, 0.1f },
+		{ 1.0f, 0.9f, 0.0f }, { 0.9f, 0.0f, 0.0f }
+	};
+	v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v) * 4.0f;
+	int i = v >= 4.0f ? 3 : (int)v;
+	float t = v - i;
+	for (int c = 0; c < 3; c++) {
+		float rgb = ramp[i][c] + (ramp[i + 1][c] - ramp[i][c]) * t;
+		bgr[2 - c] = (unsigned char)(rgb * 255.0f + 0.5f);
+	}
+}
+
+bool MakeHeatmap(const PixelRayStats *pixels, int width, int height, HeatmapChannel channel, Image &image)
+{
+	if (!image.Create(width, height, 24)) return false;
+
+	int count = width * height;
+	vector<unsigned int> values(count);
+	for (int i = 0; i < count; i++)
+		values[i] = channelValue(pixels[i], channel);
+
+	vector<unsigned int> sorted(values);
+	int p99 = (int)(count * 0.99);
+	if (p99 >= count) p99 = count - 1;
+	nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+	float scale = sorted[p99] > 0 ? 1.0f / sorted[p99] : 0.0f;
+
+	unsigned char *data = image.GetData();
+	for (int i = 0; i < count; i++)
+		heatColor(values[i] * scale, data + i * 3);
+	return true;
+}
@@ -0,0 +1,316 @@
+#include "raytracer.h"
+#include "arena.h"
+#include "parallel.h"
+#include "platform.h"
+#include "profiler.h"
+
+static Vector3f reflect(const Vector3f &i, const Vector3f &n) {
+	return i - n * (2.0f * Dot(n, i));
+}
+
+// same as GLSL refract, except that total internal reflection reflects
+// instead of returning a zero vector
+static Vector3f refract(const Vector3f &i, const Vector3f &n, float eta)
+{
+	float d = Dot(n, i);
+	float k = 1.0f - eta * eta * (1.0f - d * d);
+	if (k < 0.0f) return reflect(i, n);
+	return i * eta - n * (eta * d + sqrt(k));
+}
+
+// Igehy's differential transfer: the derivative of the hit point on a
+// surface with normal n, reached after distance t along direction d
+static Vector3f transferDerivative(const Vector3f &dP, const Vector3f &dD, const Vector3f &d,
+	float t, const Vector3f &n)
+{
+	Vector3f p = dP + dD * t;
+	float dn = Dot(d, n);
+	if (fabs(dn) < 1e-6f) return p; // grazing, the footprint is unbounded anyway
+	return p - d * (Dot(p, n) / dn);
+}
+
+// derivatives of reflect and refract for a change dD of the direction and
+// dN of the normal
+static Vector3f reflectDerivative(const Vector3f &d, const Vector3f &n, const Vector3f &dD, const Vector3f &dN)
+{
+	float dn = Dot(d, n);
+	float ddn = Dot(dD, n) + Dot(d, dN);
+	return dD - (dN * dn + n * ddn) * 2.0f;
+}
+
+static Vector3f refractDerivative(const Vector3f &d, const Vector3f &n, float eta,
+	const Vector3f &dD, const Vector3f &dN)
+{
+	float dn = Dot(d, n);
+	float k = 1.0f - eta * eta * (1.0f - dn * dn);
+	if (k <= 0.0f) return reflectDerivative(d, n, dD, dN);
+
+	// refract is eta d - mu n with mu = eta (d . n) + sqrt(k)
+	float root = sqrt(k);
+	float mu = eta * dn + root;
+	float ddn = Dot(dD, n) + Dot(d, dN);
+	float dmu = (eta + eta * eta * dn / root) * ddn;
+	return dD * eta - (n * dmu + dN * mu);
+}
+
+static float fresnel(const Vector3f &normal, const Vector3f &viewDir, float eta)
+{
+	float r0 = (1.0f - eta) / (1.0f + eta);
+	r0 *= r0;
+	return r0 + (1.0f - r0) * pow(1.0f - Dot(normal, viewDir), 5.0f);
+}
+
+static Color3f blinnPhong(const Scene &scene, const Material &m, const Color3f &color,
+	const Vector3f &normal, const Vector3f &lightDir, const Vector3f &viewDir)
+{
+	float diffuseCoeff = max(0.0f, Dot(normal, lightDir));
+	Color3f diffuse = color * (scene.lightAmbient + Color3f(diffuseCoeff));
+	if (m.type == MAT_DIFFUSE || m.type == MAT_MIRROR) return diffuse;
+
+	Vector3f halfDir = Normalize(lightDir + viewDir);
+	float specAngle = max(0.0f, Dot(normal, halfDir));
+	return diffuse + Color3f(pow(specAngle, m.specPower));
+}
+
+void RayTracer::countRay(TraceContext &ctx, RayType type, int depth, const TraversalStats &traversal)
+{
+	RayStats &s = *ctx.stats;
+	s.rays[type]++;
+	s.depthRays[depth < RAY_STATS_MAX_DEPTH ? depth : RAY_STATS_MAX_DEPTH - 1]++;
+	s.steps += traversal.steps;
+	s.primTests += traversal.primTests;
+
+	PixelRayStats &p = *ctx.pixel;
+	p.rays++;
+	p.steps += traversal.steps;
+	p.primTests += traversal.primTests;
+	if ((unsigned int)depth > p.maxDepth) p.maxDepth = depth;
+}
+
+// the material's texture at a hit, filtered over the footprint that hitDiff
+// and the normal derivatives give, or the finest level without them
+static Color3f textureColor(const Scene &scene, const Material &m, int object, const Point3f &hitPoint,
+	const Vector3f &normal, const RayDifferential *hitDiff, const Vector3f &dNdx, const Vector3f &dNdy)
+{
+	Vector2f uv, dUVdx, dUVdy;
+	if (object < (int)scene.spheres.size()) {
+		uv = SceneSphere::GetTexCoords(normal);
+		if (hitDiff) {
+			dUVdx = SceneSphere::GetTexDerivative(normal, dNdx);
+			dUVdy = SceneSphere::GetTexDerivative(normal, dNdy);
+		}
+	}
+	else {
+		Vector3f u, v;
+		scene.planes[object - scene.spheres.size()].GetTexAxes(u, v);
+		uv = Vector2f(Dot(hitPoint, u), Dot(hitPoint, v));
+		if (hitDiff) {
+			dUVdx = Vector2f(Dot(hitDiff->dPdx, u), Dot(hitDiff->dPdx, v));
+			dUVdy = Vector2f(Dot(hitDiff->dPdy, u), Dot(hitDiff->dPdy, v));
+		}
+	}
+
+	dUVdx = dUVdx * m.texScale;
+	dUVdy = dUVdy * m.texScale;
+	Color4f c;
+	if (m.texture >= 0) {
+		const MipTexture &texture = scene.textures[m.texture];
+		c = texture.Sample(uv * m.texScale, hitDiff ? texture.GetLod(dUVdx, dUVdy) : 0.0f);
+	}
+	else {
+		TextureCache &cache = *scene.textureCache;
+		c = cache.Sample(m.pagedTexture, uv * m.texScale, hitDiff ? cache.GetLod(m.pagedTexture, dUVdx, dUVdy) : 0.0f);
+	}
+	return Color3f(c.r, c.g, c.b);
+}
+
+Color3f RayTracer::castRay(const Scene &scene, const Ray &ray, const RayDifferential *diff, int objFrom,
+	int depth, RayType type, TraceContext &ctx) const
+{
+	ctx.rays++;
+	PROFILE_COUNT(PROF_RAYS, 1);
+	SceneHit hit;
+	TraversalStats traversal;
+	bool found;
+	{
+		PROFILE_STAGE(PROF_INTERSECT);
+		found = scene.Intersect(ray, objFrom, hit, ctx.stats ? &traversal : NULL);
+	}
+	if (ctx.stats) countRay(ctx, type, depth, traversal);
+	if (!found) return scene.backColor;
+
+	int numSpheres = (int)scene.spheres.size();
+	Point3f hitPoint = ray.p + ray.v * hit.t;
+	const Material *m;
+	Vector3f normal;
+	float radius = 0.0f;
+	if (hit.object < numSpheres) {
+		const SceneSphere &s = scene.spheres[hit.object];
+		m = &s.base;
+		normal = Normalize(hitPoint - s.center);
+		radius = s.radius;
+	}
+	else {
+		const ScenePlane &p = scene.planes[hit.object - numSpheres];
+		m = &p.base;
+		normal = p.normal;
+	}
+
+	// differentials at the hit point; sphere normals turn by dP / radius,
+	// plane normals don't turn
+	RayDifferential hitDiff;
+	Vector3f dNdx, dNdy;
+	if (diff) {
+		hitDiff.dPdx = transferDerivative(diff->dPdx, diff->dDdx, ray.v, hit.t, normal);
+		hitDiff.dPdy = transferDerivative(diff->dPdy, diff->dDdy, ray.v, hit.t, normal);
+		hitDiff.dDdx = diff->dDdx;
+		hitDiff.dDdy = diff->dDdy;
+		if (radius > 0.0f) {
+			dNdx = hitDiff.dPdx / radius;
+			dNdy = hitDiff.dPdy / radius;
+		}
+	}
+
+	Color3f albedo = m->color;
+	if (m->texture >= 0 || (m->pagedTexture >= 0 && scene.textureCache)) {
+		PROFILE_STAGE(PROF_SHADING);
+		albedo = albedo * textureColor(scene, *m, hit.object, hitPoint, normal, diff ? &hitDiff : NULL, dNdx, dNdy);
+	}
+
+	Vector3f toLight = scene.lightSource - hitPoint;
+	float lightDist = toLight.Length();
+	Vector3f lightDir = toLight / lightDist;
+
+	ctx.rays++;
+	PROFILE_COUNT(PROF_SHADOW_RAYS, 1);
+	bool last = depth + 1 >= maxDepth;
+	bool shadowed;
+	TraversalStats shadowTraversal;
+	{
+		PROFILE_STAGE(PROF_SHADOW);
+		shadowed = scene.IntersectAny(Ray(hitPoint, lightDir), hit.object, lightDist,
+			ctx.stats ? &shadowTraversal : NULL);
+	}
+	if (ctx.stats) countRay(ctx, RAY_SHADOW, depth, shadowTraversal);
+	if (shadowed) return albedo * (last ? 0.2f : 0.1f);
+
+	Vector3f viewDir = -ray.v;
+	if (last) {
+		PROFILE_STAGE(PROF_SHADING);
+		return blinnPhong(scene, *m, albedo, normal, lightDir, viewDir);
+	}
+
+	RayDifferential childDiff;
+	childDiff.dPdx = hitDiff.dPdx;
+	childDiff.dPdy = hitDiff.dPdy;
+
+	Color3f reflectColor = albedo;
+	if (m->type >= MAT_MIRROR) {
+		Ray reflectionRay(hitPoint, Normalize(reflect(ray.v, normal)));
+		if (diff) {
+			childDiff.dDdx = reflectDerivative(ray.v, normal, hitDiff.dDdx, dNdx);
+			childDiff.dDdy = reflectDerivative(ray.v, normal, hitDiff.dDdy, dNdy);
+		}
+		reflectColor = castRay(scene, reflectionRay, diff ? &childDiff : NULL, hit.object, depth + 1, RAY_REFLECTION, ctx);
+	}
+
+	Color3f refractColor = albedo;
+	if (m->type == MAT_GLASS) {
+		Ray refractionRay(hitPoint, Normalize(refract(ray.v, normal, m->refractIndex)));
+		if (diff) {
+			childDiff.dDdx = refractDerivative(ray.v, normal, m->refractIndex, hitDiff.dDdx, dNdx);
+			childDiff.dDdy = refractDerivative(ray.v, normal, m->refractIndex, hitDiff.dDdy, dNdy);
+		}
+		refractColor = castRay(scene, refractionRay, diff ? &childDiff : NULL, hit.object, depth + 1, RAY_REFRACTION, ctx);
+	}
+
+	PROFILE_STAGE(PROF_SHADING);
+	float k = fresnel(normal, viewDir, m->refractIndex);
+	Color3f color = refractColor * (1.0f - k) + reflectColor * k;
+	return blinnPhong(scene, *m, color, normal, lightDir, viewDir);
+}
+
+Color3f RayTracer::Trace(const Scene &scene, const Ray &ray) const
+{
+	TraceContext ctx;
+	return castRay(scene, ray, NULL, -1, 0, RAY_CAMERA, ctx);
+}
+
+void RayTracer::Render(const Scene &scene, const CameraRayGenerator &camera, Color3f *pixels)
+{
+	int width = camera.GetWidth();
+	int height = camera.GetHeight();
+	stats = RenderStats();
+	if (width <= 0 || height <= 0) return;
+
+	// per row, summed afterwards so threads never share a counter; scratch
+	// comes from the frame arenas so a frame makes no heap allocations
+	MemoryArena &arena = GetFrameArena();
+	ArenaScope scope(arena);
+	double *genTime = arena.AllocArray<double>(height);
+	double *traceTime = arena.AllocArray<double>(height);
+	long long *rowRays = arena.AllocArray<long long>(height);
+	RayStats *rowStats = rayStatsEnabled ? arena.AllocArray<RayStats>(height) : NULL;
+
+	rayStats.Clear();
+	pixelStats.clear();
+	if (rayStatsEnabled) {
+		PixelRayStats zero = { 0, 0, 0, 0 };
+		pixelStats.assign(width * height, zero);
+	}
+
+	// only textures use the differentials, so other scenes skip them
+	bool useDifferentials = rayDifferentials && (!scene.textures.empty() || scene.textureCache);
+
+	PROFILE_SCOPE("Render");
+	double start = GetTime();
+	auto renderRows = [&](int begin, int end) {
+		MemoryArena &rowArena = GetFrameArena();
+		ArenaScope rowScope(rowArena);
+		int packetsCount = camera.GetPacketsPerRow();
+		RayPacket *packets = rowArena.AllocArray<RayPacket>(packetsCount);
+		for (int y = begin; y < end; y++)
+		{
+			PROFILE_SCOPE("row");
+			double t0 = GetTime();
+			{
+				PROFILE_STAGE(PROF_CAMERA);
+				camera.GenerateRow(y, packets);
+			}
+			double t1 = GetTime();
+
+			TraceContext ctx;
+			if (rayStatsEnabled) ctx.stats = &rowStats[y];
+			Color3f *row = pixels + y * width;
+			for (int p = 0; p < packetsCount; p++) {
+				const RayPacket &packet = packets[p];
+				for (int i = 0; i < packet.count; i++) {
+					int x = packet.x + i;
+					if (rayStatsEnabled) ctx.pixel = &pixelStats[y * width + x];
+					Ray ray = packet.GetRay(i);
+					if (useDifferentials) {
+						RayDifferential diff;
+						camera.GetDifferential(ray.v, diff);
+						row[x] = castRay(scene, ray, &diff, -1, 0, RAY_CAMERA, ctx);
+					}
+					else row[x] = castRay(scene, ray, NULL, -1, 0, RAY_CAMERA, ctx);
+				}
+			}
+
+			genTime[y] = t1 - t0;
+			traceTime[y] = GetTime() - t1;
+			rowRays[y] = ctx.rays;
+		}
+	};
+	if (parallel) ParallelFor(0, height, renderRows, 1);
+	else renderRows(0, height);
+	stats.frameTime = GetTime() - start;
+
+	stats.cameraRays = (long long)width * height;
+	for (int y = 0; y < height; y++) {
+		stats.rayGenTime += genTime[y];
+		stats.traceTime += traceTime[y];
+		stats.rays += rowRays[y];
+		if (rayStatsEnabled) rayStats.Add(rowStats[y]);
+	}
+}
@@ -0,0 +1,192 @@
+#include "resourceloader.h"
+#include "bvhcache.h"
+#include "meshorder.h"
+#include "profiler.h"
+
+bool ReadTextFile(const char *filename, string &text)
+{
+	File file;
+	if (!file.Open(filename, FILE_READ)) return false;
+	long long size = file.GetSize();
+	if (size < 0) return false;
+
+	text.resize((size_t)size);
+	return size == 0 || file.Read(&text[0], (size_t)size);
+}
+
+bool MeshDataLoad::Load()
+{
+	PROFILE_SCOPE("MeshDataLoad::Load");
+	data = my_shared_ptr<MeshData>(new MeshData);
+	bool ok = raw ?
+		LoadRawMeshData(filename.c_str(), *data, subMeshes) :
+		LoadObjMeshData(filename.c_str(), *data, subMeshes, separateMeshes);
+	if (!ok) return false;
+
+	if (reorder) OptimizeMeshOrder(*data, subMeshes);
+	if (lodLevels > 1) BuildMeshLods(*data, subMeshes, lods, lodLevels);
+	if (buildBVH)
+	{
+		bvh = my_shared_ptr<BVH>(new BVH);
+		string cacheFile = GetBVHCachePath(filename.c_str());
+		// a mesh without a BVH is still a mesh
+		if (!LoadOrBuildBVH(*bvh, *data, cacheBVH ? cacheFile.c_str() : NULL, bvhParams))
+			bvh = my_shared_ptr<BVH>();
+	}
+	return true;
+}
+
+ResourceLoader::ResourceLoader(int threads) : pending(0), quit(false)
+{
+	if (threads <= 0) threads = GetProcessorCount() - 1;
+	threadCount = threads > 1 ? threads : 1;
+
+	this->threads = new Thread[threadCount];
+	for (int i = 0; i < threadCount; i++)
+		this->threads[i].Start(workerMain, this);
+}
+
+ResourceLoader::~ResourceLoader()
+{
+	mutex.Lock();
+	quit = true;
+	for (int i = 0, n = (int)queue.size(); i < n; i++)
+		queue[i]->state = LOAD_FAILED;
+	queue.clear();
+	wake.NotifyAll();
+	mutex.Unlock();
+
+	// workers finish the task they are loading first
+	delete [] threads;
+
+	for (int i = 0, n = (int)finished.size(); i < n; i++)
+		finished[i]->state = LOAD_FAILED;
+	finished.clear();
+}
+
+void ResourceLoader::submit(LoadTask *task)
+{
+	MutexLock lock(mutex);
+	task->state = LOAD_QUEUED;
+	task->loader = this;
+	queue.push_back(my_shared_ptr<LoadTask>(task));
+	pending++;
+	wake.NotifyOne();
+}
+
+void ResourceLoader::workerMain(void *param)
+{
+	ResourceLoader &loader = *(ResourceLoader *)param;
+	MutexLock lock(loader.mutex);
+	for (;;)
+	{
+		while (!loader.quit && loader.queue.empty())
+			loader.wake.Wait(loader.mutex);
+		if (loader.quit) break;
+
+		my_shared_ptr<LoadTask> task = loader.queue.front();
+		loader.queue.pop_front();
+		task->state = LOAD_LOADING;
+
+		loader.mutex.Unlock();
+		bool ok = task->Load();
+		loader.mutex.Lock();
+
+		if (ok) {
+			task->state = LOAD_LOADED;
+			loader.finished.push_back(task);
+		}
+		else {
+			task->state = LOAD_FAILED;
+			loader.pending--;
+		}
+		loader.loaded.NotifyAll();
+	}
+}
+
+void ResourceLoader::publish(LoadTask *task)
+{
+	bool ok = task->Publish();
+	MutexLock lock(mutex);
+	task->state = ok ? LOAD_READY : LOAD_FAILED;
+	pending--;
+}
+
+int ResourceLoader::Publish(double budget)
+{
+	PROFILE_SCOPE("ResourceLoader::Publish");
+	double start = GetTime();
+	int count = 0;
+	for (;;)
+	{
+		my_shared_ptr<LoadTask> task;
+		{
+			MutexLock lock(mutex);
+			if (finished.empty()) break;
+			task = finished.front();
+			finished.pop_front();
+		}
+		publish(task.Get());
+		count++;
+		if (GetTime() - start >= budget) break;
+	}
+	return count;
+}
+
+bool ResourceLoader::Finish(LoadTask *task)
+{
+	my_shared_ptr<LoadTask> handle;
+	bool loadHere = false;
+
+	mutex.Lock();
+	// another loader's workers would never wake us
+	if (task->loader != this) {
+		mutex.Unlock();
+		return task->IsReady();
+	}
+	if (task->state == LOAD_QUEUED)
+	{
+		// not started yet: loading it here beats waiting behind the queue
+		deque<my_shared_ptr<LoadTask> >::iterator it = queue.begin();
+		while (it != queue.end() && it->Get() != task) ++it;
+		if (it == queue.end()) {
+			mutex.Unlock();
+			return false;
+		}
+		handle = *it;
+		queue.erase(it);
+		task->state = LOAD_LOADING;
+		loadHere = true;
+	}
+	while (!loadHere && task->state == LOAD_LOADING)
+		loaded.Wait(mutex);
+	if (task->state == LOAD_LOADED)
+	{
+		deque<my_shared_ptr<LoadTask> >::iterator it = finished.begin();
+		while (it != finished.end() && it->Get() != task) ++it;
+		if (it == finished.end()) {
+			// a Publish on another thread is publishing it
+			mutex.Unlock();
+			return false;
+		}
+		handle = *it;
+		finished.erase(it);
+	}
+	mutex.Unlock();
+
+	if (loadHere && !task->Load())
+	{
+		MutexLock lock(mutex);
+		task->state = LOAD_FAILED;
+		pending--;
+		return false;
+	}
+	if (handle.Get()) publish(handle.Get());
+	return task->IsReady();
+}
+
+int ResourceLoader::GetPendingCount()
+{
+	MutexLock lock(mutex);
+	return pending;
+}
@@ -0,0 +1,315 @@
+#include "scene.h"
+#include "parallel.h"
+#include "common.h"
+
+struct SphereIntersector
+{
+	const SceneSphere *spheres;
+	int objFrom;
+	int object;
+	bool anyHit;
+
+	bool operator()(int i, const Ray &ray, float &tmax)
+	{
+		float t = 0;
+		if (i != objFrom && spheres[i].Intersect(ray, t) && t < tmax) {
+			object = i;
+			tmax = anyHit ? -1.0f : t;
+			return true;
+		}
+		return false;
+	}
+};
+
+Scene::Scene() : textureCache(NULL), accelType(ACCEL_NONE) {
+	lightAmbient = Color3f(0.1f);
+}
+
+void Scene::Build(SceneAccelType accelType, const GridParams &gridParams)
+{
+	this->accelType = accelType;
+	bvh.Clear();
+	grid.Clear();
+	hgrid.Clear();
+
+	int count = (int)spheres.size();
+	if (accelType == ACCEL_NONE || count == 0) return;
+
+	sphereBounds.resize(count);
+	AABox *bounds = sphereBounds.data();
+	const SceneSphere *s = spheres.data();
+	ParallelFor(0, count, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+			bounds[i] = s[i].GetBounds();
+	});
+
+	switch (accelType)
+	{
+	case ACCEL_BVH:
+		bvh.Build(bounds, count);
+		break;
+	case ACCEL_GRID:
+		grid.Build(bounds, count, gridParams);
+		break;
+	case ACCEL_HIERARCHICAL_GRID:
+		hgrid.Build(bounds, count, gridParams);
+		break;
+	default:
+		break;
+	}
+}
+
+size_t Scene::GetAccelMemoryUsage() const
+{
+	switch (accelType)
+	{
+	case ACCEL_BVH: return bvh.GetStats().memoryUsage;
+	case ACCEL_GRID: return grid.GetMemoryUsage();
+	case ACCEL_HIERARCHICAL_GRID: return hgrid.GetMemoryUsage();
+	default: return 0;
+	}
+}
+
+template<class Intersector, class Stats>
+bool Scene::traverseCounted(const Ray &ray, float &tmax, Intersector &intersector, Stats &stats) const
+{
+	switch (accelType)
+	{
+	case ACCEL_BVH: return bvh.Traverse(ray, tmax, intersector, stats);
+	case ACCEL_GRID: return grid.Traverse(ray, tmax, intersector, stats);
+	case ACCEL_HIERARCHICAL_GRID: return hgrid.Traverse(ray, tmax, intersector, stats);
+	default: break;
+	}
+
+	bool hit = false;
+	for (int i = 0, n = (int)spheres.size(); i < n; i++) {
+		stats.Test();
+		if (intersector(i, ray, tmax)) {
+			hit = true;
+			if (tmax < 0.0f) break;
+		}
+	}
+	return hit;
+}
+
+// without stats the counting compiles away
+template<class Intersector>
+bool Scene::traverseSpheres(const Ray &ray, float &tmax, Intersector &intersector, TraversalStats *stats) const
+{
+	if (stats) return traverseCounted(ray, tmax, intersector, *stats);
+	NoTraversalStats none;
+	return traverseCounted(ray, tmax, intersector, none);
+}
+
+bool Scene::Intersect(const Ray &ray, int objFrom, SceneHit &hit, TraversalStats *stats) const
+{
+	int numSpheres = (int)spheres.size();
+	bool found = false;
+	float tmax = hit.t;
+
+	SphereIntersector isect = { spheres.data(), objFrom, -1, false };
+	if (traverseSpheres(ray, tmax, isect, stats)) {
+		hit.t = tmax;
+		hit.object = isect.object;
+		found = true;
+	}
+
+	for (int i = 0, n = (int)planes.size(); i < n; i++) {
+		float t = 0;
+		if (i + numSpheres != objFrom && planes[i].Intersect(ray, t) && t < hit.t) {
+			hit.t = t;
+			hit.object = i + numSpheres;
+			found = true;
+		}
+	}
+	if (stats) stats->primTests += (int)planes.size();
+	return found;
+}
+
+bool Scene::IntersectAny(const Ray &ray, int objFrom, float tmax, TraversalStats *stats) const
+{
+	int numSpheres = (int)spheres.size();
+	for (int i = 0, n = (int)planes.size(); i < n; i++) {
+		if (stats) stats->Test();
+		float t = 0;
+		if (i + numSpheres != objFrom && planes[i].Intersect(ray, t) && t < tmax)
+			return true;
+	}
+
+	SphereIntersector isect = { spheres.data(), objFrom, -1, true };
+	return traverseSpheres(ray, tmax, isect, stats);
+}
+
+void MakeRoomScene(Scene &scene)
+{
+	scene.spheres.clear();
+	scene.planes.clear();
+	scene.textures.clear();
+
+	Material sphereMat(Color3f(), MAT_MIRROR_SPECULAR, 40.0f, 0.2f);
+	Material glassMat(Color3f(1, 1, 1), MAT_GLASS, 40.0f, 0.9f);
+
+	sphereMat.color = Color3f(1, 0, 0);
+	scene.spheres.push_back(SceneSphere(Point3f(-13, 0, -58), 5, sphereMat));
+	sphereMat.color = Color3f(0, 1, 0);
+	scene.spheres.push_back(SceneSphere(Point3f(0, 0, -54), 5, sphereMat));
+	scene.spheres.push_back(SceneSphere(Point3f(-6, 0, -20), 5, glassMat));
+
+	struct plane_t {
+		Vector3f normal;
+		float D;
+		Color3f color;
+	};
+
+	plane_t planes[6] =
+	{
+		{ Vector3f(0, 1, 0), 5, Color3f(1,1,1) },
+		{ Vector3f(0, 0, 1), 120, Color3f(1,0,0) },
+		{ Vector3f(1, 0, 0), 30, Color3f(0,0,1) },
+		{ Vector3f(-1, 0, 0), 30, Color3f(0,1,0) },
+		{ Vector3f(0, -1, 0), 30, Color3f(1,1,0) },
+		{ Vector3f(0, 0, -1), 50, Color3f(1,0,1) }
+	};
+
+	for (int i = 0; i < 6; i++) {
+		Material m(planes[i].color, MAT_MIRROR, 40.0f, 0.3f);
+		scene.planes.push_back(ScenePlane(planes[i].normal, planes[i].D, m));
+	}
+
+	scene.lightSource = Point3f(5, 20, 5);
+	scene.lightAmbient = Color3f(0.1f);
+	scene.backColor = Color3f(0.0f);
+}
+
+void SetRoomStartView(Camera &camera)
+{
+	camera.type = CAM_FREE;
+	camera.SetPosition(10, 2, 0);
+	camera.RotateY(20.0f);
+}
+
+static unsigned int hashTexel(unsigned int x, unsigned int y, unsigned int seed)
+{
+	unsigned int h = x * 0x8da6b343u ^ y * 0xd8163841u ^ seed * 0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	return h;
+}
+
+// texel colors for MakeTexturedRoomScene in 0..1, x and y scaled to 0..1
+static Color3f tilesTexel(float x, float y, float grain)
+{
+	int tx = (int)(x * 8.0f), ty = (int)(y * 8.0f);
+	float fx = x * 8.0f - tx, fy = y * 8.0f - ty;
+	if (fx < 0.04f || fy < 0.04f) return Color3f(0.35f + grain * 0.1f);
+	float c = (tx + ty) & 1 ? 0.9f : 0.55f;
+	return Color3f(c + grain * 0.1f, c + grain * 0.08f, c * 0.9f + grain * 0.1f);
+}
+
+static Color3f bricksTexel(float x, float y, float grain)
+{
+	float by = y * 16.0f;
+	int row = (int)by;
+	float bx = x * 8.0f + (row & 1) * 0.5f;
+	float fx = bx - floor(bx), fy = by - row;
+	if (fx < 0.03f || fy < 0.06f) return Color3f(0.8f + grain * 0.1f);
+	float tint = (hashTexel((int)bx, row, 7) & 0xff) / 255.0f * 0.2f;
+	return Color3f(0.7f + tint + grain * 0.1f, 0.35f + tint * 0.5f + grain * 0.08f, 0.3f + grain * 0.05f);
+}
+
+static Color3f ringsTexel(float x, float y, float grain)
+{
+	float dx = x - 0.5f, dy = y - 0.5f;
+	float r = sqrt(dx * dx + dy * dy) * 40.0f + grain * 0.6f;
+	float c = 0.5f + 0.5f * sin(r * 2.0f * M_PIf);
+	return Color3f(0.6f + 0.4f * c, 0.45f + 0.3f * c, 0.25f + 0.2f * c);
+}
+
+static void makeProceduralTexture(MipTexture &texture, int size, Color3f (*texel)(float, float, float), unsigned int seed)
+{
+	Image image;
+	image.Create(size, size, 24);
+	unsigned char *data = image.GetData();
+	ParallelFor(0, size, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			unsigned char *row = data + (size_t)y * size * 3;
+			for (int x = 0; x < size; x++, row += 3)
+			{
+				float grain = (hashTexel(x, y, seed) & 0xffff) / 65535.0f;
+				Color3f c = texel((x + 0.5f) / size, (y + 0.5f) / size, grain);
+				row[0] = (unsigned char)(min(c.b, 1.0f) * 255.0f);
+				row[1] = (unsigned char)(min(c.g, 1.0f) * 255.0f);
+				row[2] = (unsigned char)(min(c.r, 1.0f) * 255.0f);
+			}
+		}
+	});
+	texture.Create(image);
+}
+
+void MakeTexturedRoomScene(Scene &scene, int textureSize)
+{
+	MakeRoomScene(scene);
+	scene.textures.resize(3);
+	makeProceduralTexture(scene.textures[0], textureSize, tilesTexel, 1);
+	makeProceduralTexture(scene.textures[1], textureSize, bricksTexel, 2);
+	makeProceduralTexture(scene.textures[2], textureSize, ringsTexel, 3);
+
+	// floor and ceiling tiled, brick walls, wooden mirror spheres
+	for (int i = 0, n = (int)scene.planes.size(); i < n; i++) {
+		Material &m = scene.planes[i].base;
+		bool horizontal = fabs(scene.planes[i].normal.y) > 0.5f;
+		m.texture = horizontal ? 0 : 1;
+		m.texScale = horizontal ? 1.0f / 8.0f : 1.0f / 6.0f;
+		m.color = m.color * 0.5f + Color3f(0.5f);
+	}
+	for (int i = 0, n = (int)scene.spheres.size(); i < n; i++) {
+		Material &m = scene.spheres[i].base;
+		if (m.type == MAT_GLASS) continue;
+		m.texture = 2;
+		m.texScale = 2.0f;
+	}
+}
+
+static void addFlake(Scene &scene, const Point3f &center, float radius, const Vector3f &axis,
+	int level, const Material *materials)
+{
+	scene.spheres.push_back(SceneSphere(center, radius, materials[level % 3]));
+	if (level == 0) return;
+
+	Vector3f u = Cross(axis, fabs(axis.x) < 0.9f ? Vector3f(1, 0, 0) : Vector3f(0, 1, 0));
+	u.Normalize();
+	Vector3f v = Cross(axis, u);
+
+	// six children around the equator, three above them
+	float childRadius = radius / 3.0f;
+	for (int i = 0; i < 9; i++)
+	{
+		float elevation = i < 6 ? 0.0f : M_PIf / 3.0f;
+		float azimuth = i < 6 ? i * M_PIf / 3.0f : (i - 6) * 2.0f * M_PIf / 3.0f + M_PIf / 6.0f;
+		Vector3f dir = (u * cos(azimuth) + v * sin(azimuth)) * cos(elevation) + axis * sin(elevation);
+		addFlake(scene, center + dir * (radius + childRadius), childRadius, dir, level - 1, materials);
+	}
+}
+
+void MakeSphereFlakeScene(Scene &scene, int levels)
+{
+	scene.spheres.clear();
+	scene.planes.clear();
+	scene.textures.clear();
+
+	Material materials[3] = {
+		Material(Color3f(0.9f, 0.3f, 0.2f), MAT_MIRROR_SPECULAR, 40.0f, 0.3f),
+		Material(Color3f(0.8f, 0.8f, 0.8f), MAT_MIRROR_SPECULAR, 60.0f, 0.3f),
+		Material(Color3f(0.2f, 0.4f, 0.9f), MAT_DIFFUSE_SPECULAR, 20.0f, 0.3f)
+	};
+	addFlake(scene, Point3f(0.0f), 1.0f, Vector3f(0, 1, 0), levels, materials);
+
+	Material floor(Color3f(0.6f, 0.6f, 0.6f), MAT_DIFFUSE, 40.0f, 0.3f);
+	scene.planes.push_back(ScenePlane(Vector3f(0, 1, 0), 1.0f, floor));
+
+	scene.lightSource = Point3f(4, 6, 5);
+	scene.lightAmbient = Color3f(0.15f);
+	scene.backColor = Color3f(0.3f, 0.4f, 0.6f);
+}
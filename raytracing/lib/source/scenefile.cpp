@@ -0,0 +1,173 @@
+#include "scenefile.h"
+#include <fstream>
+#include <string>
+#include <map>
+#include <string.h>
+#include <stdio.h>
+
+static bool parseMaterialType(const char *name, int &type)
+{
+	static const char *names[] = {
+		"diffuse", "diffuse_specular", "mirror", "mirror_specular", "glass"
+	};
+	for (int i = 0; i < 5; i++) {
+		if (!strcmp(name, names[i])) {
+			type = MAT_DIFFUSE + i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// what the statements of one file share
+struct SceneFileState
+{
+	string directory; // of the scene file, with a trailing separator
+	map<string, Material> materials;
+	map<string, int> textures; // image path to index into Scene::textures
+	map<string, int> pagedTextures; // tiled file path to handle in Scene::textureCache
+};
+
+static bool loadTexture(const string &path, Scene &scene, SceneFileState &state, int &index)
+{
+	map<string, int>::const_iterator t = state.textures.find(path);
+	if (t != state.textures.end()) {
+		index = t->second;
+		return true;
+	}
+
+	Image image;
+	if (!image.LoadTga(path.c_str())) return false;
+	scene.textures.push_back(MipTexture());
+	if (!scene.textures.back().Create(image)) {
+		scene.textures.pop_back();
+		return false;
+	}
+	index = (int)scene.textures.size() - 1;
+	state.textures[path] = index;
+	return true;
+}
+
+static bool openPagedTexture(const string &path, Scene &scene, SceneFileState &state, int &handle)
+{
+	if (!scene.textureCache) return false;
+	map<string, int>::const_iterator t = state.pagedTextures.find(path);
+	if (t != state.pagedTextures.end()) {
+		handle = t->second;
+		return true;
+	}
+	handle = scene.textureCache->Open(path.c_str());
+	if (handle < 0) return false;
+	state.pagedTextures[path] = handle;
+	return true;
+}
+
+static bool parseLine(const char *line, Scene &scene, SceneFileState &state)
+{
+	map<string, Material> &materials = state.materials;
+	char cmd[32], name[64], ref[64];
+	int n = 0;
+	if (sscanf(line, " %31s%n", cmd, &n) != 1 || cmd[0] == '#') return true;
+	const char *args = line + n;
+
+	float x, y, z, w;
+	if (!strcmp(cmd, "light")) {
+		if (sscanf(args, "%f %f %f", &x, &y, &z) != 3) return false;
+		scene.lightSource = Point3f(x, y, z);
+	}
+	else if (!strcmp(cmd, "ambient")) {
+		if (sscanf(args, "%f %f %f", &x, &y, &z) != 3) return false;
+		scene.lightAmbient = Color3f(x, y, z);
+	}
+	else if (!strcmp(cmd, "background")) {
+		if (sscanf(args, "%f %f %f", &x, &y, &z) != 3) return false;
+		scene.backColor = Color3f(x, y, z);
+	}
+	else if (!strcmp(cmd, "material"))
+	{
+		char typeName[32];
+		Material m;
+		int count = sscanf(args, "%63s %31s %f %f %f %f %f", name, typeName,
+			&m.color.r, &m.color.g, &m.color.b, &m.specPower, &m.refractIndex);
+		if (count < 5 || !parseMaterialType(typeName, m.type)) return false;
+		materials[name] = m;
+	}
+	else if (!strcmp(cmd, "sphere"))
+	{
+		if (sscanf(args, "%f %f %f %f %63s", &x, &y, &z, &w, ref) != 5 || w <= 0.0f)
+			return false;
+		map<string, Material>::const_iterator m = materials.find(ref);
+		if (m == materials.end()) return false;
+		scene.spheres.push_back(SceneSphere(Point3f(x, y, z), w, m->second));
+	}
+	else if (!strcmp(cmd, "plane"))
+	{
+		if (sscanf(args, "%f %f %f %f %63s", &x, &y, &z, &w, ref) != 5) return false;
+		map<string, Material>::const_iterator m = materials.find(ref);
+		if (m == materials.end()) return false;
+
+		Vector3f normal(x, y, z);
+		float len = normal.Length();
+		if (len == 0.0f) return false;
+		scene.planes.push_back(ScenePlane(normal / len, w / len, m->second));
+	}
+	else if (!strcmp(cmd, "texture"))
+	{
+		char file[256];
+		w = 1.0f;
+		if (sscanf(args, "%63s %255s %f", ref, file, &w) < 2) return false;
+		map<string, Material>::iterator m = materials.find(ref);
+		if (m == materials.end()) return false;
+
+		string path = file;
+		bool absolute = file[0] == '/' || file[0] == '\\' || (file[0] && file[1] == ':');
+		if (!absolute) path = state.directory + path;
+		size_t length = path.size();
+		if (length > 4 && !strcmp(path.c_str() + length - 4, ".rtt")) {
+			if (!openPagedTexture(path, scene, state, m->second.pagedTexture)) return false;
+			m->second.texture = -1;
+		}
+		else {
+			if (!loadTexture(path, scene, state, m->second.texture)) return false;
+			m->second.pagedTexture = -1;
+		}
+		m->second.texScale = w;
+	}
+	else if (!strcmp(cmd, "room"))
+	{
+		Scene room;
+		MakeRoomScene(room);
+		scene.spheres.insert(scene.spheres.end(), room.spheres.begin(), room.spheres.end());
+		scene.planes.insert(scene.planes.end(), room.planes.begin(), room.planes.end());
+		scene.lightSource = room.lightSource;
+		scene.lightAmbient = room.lightAmbient;
+		scene.backColor = room.backColor;
+	}
+	else return false;
+	return true;
+}
+
+bool LoadSceneFile(const char *filename, Scene &scene, int *errorLine)
+{
+	if (errorLine) *errorLine = 0;
+	ifstream file(filename);
+	if (!file) return false;
+
+	scene.spheres.clear();
+	scene.planes.clear();
+	scene.textures.clear();
+	SceneFileState state;
+	const char *slash = strrchr(filename, '/'), *backslash = strrchr(filename, '\\');
+	if (!slash || (backslash && backslash > slash)) slash = backslash;
+	if (slash) state.directory.assign(filename, slash + 1);
+
+	string line;
+	for (int lineNumber = 1; getline(file, line); lineNumber++)
+	{
+		if (!parseLine(line.c_str(), scene, state)) {
+			if (errorLine) *errorLine = lineNumber;
+			return false;
+		}
+	}
+	return true;
+}
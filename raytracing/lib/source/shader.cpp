@@ -316,4 +316,25 @@ void ProgramObject::UniformMatrix(const char *name, int count, bool transpose, c
 		else if (t == GL_FLOAT_MAT3) glUniformMatrix3fv(i, count, transpose, v);
 		else glUniformMatrix2fv(i, count, transpose, v);
 	}
-}
\ No newline at end of file
+}
+
+bool ProgramLoad::Load()
+{
+	return ReadTextFile(vertPath.c_str(), vertSource) && ReadTextFile(fragPath.c_str(), fragSource);
+}
+
+bool ProgramLoad::Publish()
+{
+	program = new ProgramObject(rc);
+	Shader vertShader(GL_VERTEX_SHADER);
+	Shader fragShader(GL_FRAGMENT_SHADER);
+
+	if (vertShader.CompileSource(vertSource.c_str(), (int)vertSource.size()) &&
+		fragShader.CompileSource(fragSource.c_str(), (int)fragSource.size()))
+	{
+		program->AttachShader(vertShader);
+		program->AttachShader(fragShader);
+		program->Link();
+	}
+	return program->IsLinked();
+}
@@ -0,0 +1,379 @@
+#include "texcache.h"
+#include "profiler.h"
+#include <string.h>
+#include <math.h>
+
+#define TILE_FILE_VERSION 1
+#define TILE_HEADER_SIZE 24
+#define TILE_MAX_LEVELS 32
+
+// tileSlots and Slot::tile values besides slot and tile numbers
+#define TILE_EMPTY -1
+#define TILE_LOADING -2
+
+#define STATS_STRIPES 64
+
+// the stripe of TextureCacheStats a thread counts in, the same for every cache
+static THREAD_LOCAL int statsStripe = -1;
+static volatile int nextStatsStripe = 0;
+
+static void putU32(unsigned char *p, unsigned int v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static unsigned int getU32(const unsigned char *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+bool WriteTiledTexture(const char *filename, const MipTexture &texture, int tileSize)
+{
+	if (texture.IsEmpty() || tileSize <= 0) return false;
+	PROFILE_SCOPE("WriteTiledTexture");
+	File file;
+	if (!file.Open(filename, FILE_WRITE)) return false;
+
+	unsigned char header[TILE_HEADER_SIZE];
+	memcpy(header, "RTTX", 4);
+	putU32(header + 4, TILE_FILE_VERSION);
+	putU32(header + 8, texture.GetWidth());
+	putU32(header + 12, texture.GetHeight());
+	putU32(header + 16, tileSize);
+	putU32(header + 20, texture.GetLevelCount());
+	if (!file.Write(header, TILE_HEADER_SIZE)) return false;
+
+	// texels go out as they are in memory, BGRA8 on little-endian hosts;
+	// padding repeats the last row and column
+	vector<unsigned int> tile(tileSize * tileSize);
+	for (int l = 0, n = texture.GetLevelCount(); l < n; l++)
+	{
+		const MipLevel &m = texture.GetLevel(l);
+		int tilesX = (m.width + tileSize - 1) / tileSize;
+		int tilesY = (m.height + tileSize - 1) / tileSize;
+		for (int ty = 0; ty < tilesY; ty++)
+			for (int tx = 0; tx < tilesX; tx++)
+			{
+				for (int y = 0; y < tileSize; y++) {
+					int sy = min(ty * tileSize + y, m.height - 1);
+					for (int x = 0; x < tileSize; x++)
+						tile[y * tileSize + x] = texture.GetTexel(l, min(tx * tileSize + x, m.width - 1), sy);
+				}
+				if (!file.Write(tile.data(), tile.size() * sizeof(unsigned int)))
+					return false;
+			}
+	}
+	return true;
+}
+
+bool WriteTiledTexture(const char *filename, const Image &image, int tileSize)
+{
+	MipTexture texture;
+	return texture.Create(image, true, TEX_LAYOUT_LINEAR) && WriteTiledTexture(filename, texture, tileSize);
+}
+
+void TextureCacheStats::Add(const TextureCacheStats &s)
+{
+	lookups += s.lookups;
+	misses += s.misses;
+	evictions += s.evictions;
+	bytesRead += s.bytesRead;
+	stallTime += s.stallTime;
+}
+
+TextureCache::TextureCache() :
+	tileSize(0), tileBytes(0), slotCount(0),
+	memory(NULL), slots(NULL),
+	clockHand(0)
+{
+	stripes.resize(STATS_STRIPES);
+}
+
+TextureCache::~TextureCache() {
+	Clear();
+}
+
+void TextureCache::Clear()
+{
+	for (size_t i = 0; i < textures.size(); i++)
+		delete textures[i];
+	textures.clear();
+	tileSlots.clear();
+	delete[] memory;
+	delete[] slots;
+	memory = NULL;
+	slots = NULL;
+	slotCount = 0;
+	clockHand = 0;
+	ResetStats();
+}
+
+bool TextureCache::Create(size_t memoryLimit, int tileSize)
+{
+	Clear();
+	if (tileSize <= 0 || tileSize > 1024) return false;
+	this->tileSize = tileSize;
+	tileBytes = tileSize * tileSize * (int)sizeof(unsigned int);
+	size_t count = memoryLimit / tileBytes;
+	if (count < 4 || count > 0x7fffffff) return false;
+
+	// left uninitialized, the pages are only touched once tiles load
+	slotCount = (int)count;
+	memory = new unsigned int[count * tileSize * tileSize];
+	slots = new Slot[slotCount];
+	for (int i = 0; i < slotCount; i++) {
+		slots[i].tile = TILE_EMPTY;
+		slots[i].pins = 0;
+		slots[i].referenced = 0;
+	}
+	return true;
+}
+
+int TextureCache::Open(const char *filename)
+{
+	if (!slots) return -1;
+	Texture *texture = new Texture;
+	unsigned char header[TILE_HEADER_SIZE];
+	if (!texture->file.Open(filename, FILE_READ) || !texture->file.Read(header, TILE_HEADER_SIZE) ||
+		memcmp(header, "RTTX", 4))
+	{
+		delete texture;
+		return -1;
+	}
+
+	unsigned int width = getU32(header + 8), height = getU32(header + 12);
+	unsigned int levelCount = getU32(header + 20);
+	if (getU32(header + 4) != TILE_FILE_VERSION || (int)getU32(header + 16) != tileSize ||
+		width == 0 || height == 0 || width > 0x7fffffff || height > 0x7fffffff ||
+		levelCount == 0 || levelCount > TILE_MAX_LEVELS)
+	{
+		delete texture;
+		return -1;
+	}
+
+	// at most the full chain down to 1x1
+	int fullCount = 1;
+	for (unsigned int w = width, h = height; w > 1 || h > 1; w = max(w / 2, 1u), h = max(h / 2, 1u))
+		fullCount++;
+
+	long long offset = TILE_HEADER_SIZE;
+	long long firstTile = (long long)tileSlots.size();
+	int w = (int)width, h = (int)height;
+	for (int i = 0; i < (int)levelCount; i++)
+	{
+		Level m;
+		m.width = w;
+		m.height = h;
+		m.tilesX = (w + tileSize - 1) / tileSize;
+		m.firstTile = (int)min(firstTile, 0x7fffffffLL);
+		m.offset = offset;
+		texture->levels.push_back(m);
+
+		long long tiles = (long long)m.tilesX * ((h + tileSize - 1) / tileSize);
+		firstTile += tiles;
+		offset += tiles * tileBytes;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	if ((int)levelCount > fullCount || firstTile > 0x7fffffff || texture->file.GetSize() < offset) {
+		delete texture;
+		return -1;
+	}
+
+	texture->wrapS = texture->wrapT = TEX_WRAP_REPEAT;
+	tileSlots.resize((size_t)firstTile, TILE_EMPTY);
+	textures.push_back(texture);
+	return (int)textures.size() - 1;
+}
+
+void TextureCache::SetWrapMode(int texture, TextureWrap wrapS, TextureWrap wrapT)
+{
+	textures[texture]->wrapS = wrapS;
+	textures[texture]->wrapT = wrapT;
+}
+
+TextureCacheStats &TextureCache::getStats()
+{
+	if (statsStripe < 0) statsStripe = AtomicAdd(&nextStatsStripe, 1) & (STATS_STRIPES - 1);
+	return stripes[statsStripe].stats;
+}
+
+TextureCacheStats TextureCache::GetStats() const
+{
+	TextureCacheStats total;
+	for (size_t i = 0; i < stripes.size(); i++)
+		total.Add(stripes[i].stats);
+	return total;
+}
+
+void TextureCache::ResetStats()
+{
+	for (size_t i = 0; i < stripes.size(); i++)
+		stripes[i].stats = TextureCacheStats();
+}
+
+// Returns the tile's slot pinned, release it with releaseTile. A resident
+// tile costs an atomic increment and a check that the slot wasn't retired
+// meanwhile; the increment is a full barrier, so an evictor that retires
+// the slot either sees the pin or the reader sees the retirement.
+int TextureCache::acquireTile(Texture &texture, int level, int tx, int ty)
+{
+	TextureCacheStats &stats = getStats();
+	stats.lookups++;
+
+	const Level &m = texture.levels[level];
+	int tile = m.firstTile + ty * m.tilesX + tx;
+	int s = ((volatile int *)tileSlots.data())[tile];
+	if (s >= 0) {
+		Slot &slot = slots[s];
+		AtomicAdd(&slot.pins, 1);
+		if (slot.tile == tile) {
+			if (!slot.referenced) slot.referenced = 1;
+			return s;
+		}
+		releaseTile(s);
+	}
+	return loadTile(texture, level, tile, stats);
+}
+
+int TextureCache::loadTile(Texture &texture, int level, int tile, TextureCacheStats &stats)
+{
+	double start = GetTime();
+	stats.misses++;
+	volatile int *entry = (volatile int *)tileSlots.data() + tile;
+
+	int s;
+	for (;;)
+	{
+		mutex.Lock();
+		s = *entry;
+		if (s >= 0) {
+			// loaded by another thread; evicting takes the mutex, so it stays
+			AtomicAdd(&slots[s].pins, 1);
+			slots[s].referenced = 1;
+			mutex.Unlock();
+			break;
+		}
+		if (s == TILE_LOADING || (s = findVictim(stats)) < 0) {
+			// another thread is reading the tile, or every slot is pinned
+			mutex.Unlock();
+			SleepMs(0);
+			continue;
+		}
+
+		Slot &slot = slots[s];
+		AtomicAdd(&slot.pins, 1);
+		slot.referenced = 1;
+		*entry = TILE_LOADING;
+		mutex.Unlock();
+
+		// other misses go on while this one reads; a failed read leaves a
+		// black tile rather than retrying on every sample
+		const Level &m = texture.levels[level];
+		unsigned int *texels = memory + (size_t)s * tileSize * tileSize;
+		long long offset = m.offset + (long long)(tile - m.firstTile) * tileBytes;
+		if (!texture.file.ReadAt(offset, texels, tileBytes))
+			memset(texels, 0, tileBytes);
+		stats.bytesRead += tileBytes;
+
+		AtomicCompareExchange(&slot.tile, tile, TILE_LOADING);
+		AtomicCompareExchange(entry, s, TILE_LOADING);
+		break;
+	}
+	stats.stallTime += GetTime() - start;
+	return s;
+}
+
+// CLOCK over the slots, called with the mutex held: referenced slots get a
+// second chance, pinned and loading ones are skipped. The slot comes back
+// marked TILE_LOADING, -1 if every slot is in use.
+int TextureCache::findVictim(TextureCacheStats &stats)
+{
+	for (int n = 0; n < 2 * slotCount; n++)
+	{
+		int i = clockHand;
+		clockHand = clockHand + 1 < slotCount ? clockHand + 1 : 0;
+		Slot &slot = slots[i];
+		int old = slot.tile;
+		if (old == TILE_LOADING || slot.pins > 0) continue;
+		if (old == TILE_EMPTY) {
+			slot.tile = TILE_LOADING;
+			return i;
+		}
+		if (slot.referenced) {
+			slot.referenced = 0;
+			continue;
+		}
+
+		// retire first, then check for readers that pinned meanwhile
+		AtomicCompareExchange(&slot.tile, TILE_LOADING, old);
+		if (slot.pins > 0) {
+			AtomicCompareExchange(&slot.tile, old, TILE_LOADING);
+			continue;
+		}
+		tileSlots[old] = TILE_EMPTY;
+		stats.evictions++;
+		return i;
+	}
+	return -1;
+}
+
+void TextureCache::sampleBilinear(Texture &texture, int level, const Vector2f &uv, float *bgra)
+{
+	const Level &m = texture.levels[level];
+	float fx = FoldTexelCoord(uv.x * m.width - 0.5f), fy = FoldTexelCoord(uv.y * m.height - 0.5f);
+	float bx = floorf(fx), by = floorf(fy);
+	int x0 = (int)bx, y0 = (int)by;
+	int xs[2] = { WrapTexelCoord(x0, m.width, texture.wrapS), WrapTexelCoord(x0 + 1, m.width, texture.wrapS) };
+	int ys[2] = { WrapTexelCoord(y0, m.height, texture.wrapT), WrapTexelCoord(y0 + 1, m.height, texture.wrapT) };
+	size_t tileTexels = (size_t)tileSize * tileSize;
+
+	unsigned int t[4];
+	int tx = xs[0] / tileSize, ty = ys[0] / tileSize;
+	if (xs[0] >= 0 && xs[1] >= 0 && ys[0] >= 0 && ys[1] >= 0 &&
+		xs[1] / tileSize == tx && ys[1] / tileSize == ty)
+	{
+		// the whole footprint in one tile, pinned once
+		int s = acquireTile(texture, level, tx, ty);
+		const unsigned int *tile = memory + s * tileTexels;
+		for (int j = 0; j < 2; j++)
+			for (int i = 0; i < 2; i++)
+				t[j * 2 + i] = tile[(ys[j] % tileSize) * tileSize + xs[i] % tileSize];
+		releaseTile(s);
+	}
+	else
+	{
+		for (int j = 0; j < 2; j++)
+			for (int i = 0; i < 2; i++)
+			{
+				if (xs[i] < 0 || ys[j] < 0) {
+					t[j * 2 + i] = 0;
+					continue;
+				}
+				int s = acquireTile(texture, level, xs[i] / tileSize, ys[j] / tileSize);
+				t[j * 2 + i] = memory[s * tileTexels + (ys[j] % tileSize) * tileSize + xs[i] % tileSize];
+				releaseTile(s);
+			}
+	}
+	FilterTexels(t, fx - bx, fy - by, bgra);
+}
+
+Color4f TextureCache::Sample(int texture, const Vector2f &uv, float lod)
+{
+	Texture &t = *textures[texture];
+	int last = (int)t.levels.size() - 1;
+	lod = ClampTextureLod(lod, last);
+
+	int level = (int)lod;
+	float f = lod - level;
+	float bgra[4];
+	sampleBilinear(t, level, uv, bgra);
+	if (f > 0.0f && level < last) {
+		float next[4];
+		sampleBilinear(t, level + 1, uv, next);
+		BlendTexelLevels(bgra, next, f);
+	}
+	return BgraToColor(bgra);
+}
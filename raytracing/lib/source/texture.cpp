@@ -114,6 +114,14 @@ bool Texture2D::LoadFromTGA(const char *name)
 	return false;
 }
 
+void Texture2D::SetImage(const Image &img)
+{
+	ptr->width = img.GetWidth();
+	ptr->height = img.GetHeight();
+	texImage2D(target, img);
+	ptr->loaded = true;
+}
+
 void Texture2D::SetTexImage(GLenum level, GLint internalFormat, GLsizei width, GLsizei height,
 	GLint border, GLenum format, GLenum type, const GLvoid *data)
 {
@@ -154,4 +162,13 @@ bool CubeTexture::LoadFromTGA(const char **sides)
 	}
 	ptr->loaded = loaded;
 	return loaded;
-}
\ No newline at end of file
+}
+
+bool TextureLoad::Publish()
+{
+	// the decoded pixels aren't needed once GL has them
+	texture = my_shared_ptr<Texture2D>(new Texture2D(textureUnit));
+	texture->SetImage(image);
+	image = Image();
+	return true;
+}
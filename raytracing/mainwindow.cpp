@@ -1,12 +1,18 @@
 #include "mainwindow.h"
 #include "transform.h"
 #include "texture.h"
+#include "scene.h"
 
 #pragma comment(lib, "Winmm.lib")
 
 using namespace std;
 
+// seconds of each frame that may go to making GL objects for loaded files
+#define LOAD_PUBLISH_BUDGET 0.004
+
 MainWindow::MainWindow()
+	: width(0), height(0), needRedraw(false), quitRender(false), viewWidth(0), viewHeight(0),
+	loader(NULL), program(NULL), quad(NULL)
 {
 	this->Create("Ray tracing (esc to quit)", CW_USEDEFAULT, CW_USEDEFAULT, 800, 600);
 	//this->CreateFullScreen("");
@@ -17,80 +23,48 @@ MainWindow::MainWindow()
 
 void MainWindow::InitGeometry()
 {
-	const int numSpheres = 3;
-	const int numPlanes = 6;
 	char name[100] = "";
+	Scene scene;
+	MakeRoomScene(scene);
 
-	struct sphere_t {
-		Vector3f center;
-		float radius;
-		Color3f color;
-	};
-
-	struct plane_t {
-		Vector3f normal;
-		float D;
-		Color3f color;
-	};
-
-	sphere_t spheres[numSpheres] =
-	{
-		{ Vector3f(-13, 0, -58), 5, Color3f(1, 0, 0) },
-		{ Vector3f(0, 0, -54), 5, Color3f(0, 1, 0) },
-		{ Vector3f(-6, 0, -20), 5, Color3f(1, 1, 1) },
-	};
-	
-	plane_t planes[numPlanes] =
-	{
-	
-		{ Vector3f(0, 1, 0), 5, Color3f(1,1,1) },
-		{ Vector3f(0, 0, 1), 120, Color3f(1,0,0) },
-		{ Vector3f(1, 0, 0), 30, Color3f(0,0,1) },
-		{ Vector3f(-1, 0, 0), 30, Color3f(0,1,0) },
-		{ Vector3f(0, -1, 0), 30, Color3f(1,1,0) },
-		{ Vector3f(0, 0, -1), 50, Color3f(1,0,1) }
-	};
-
-
-	for (int i = 0; i < numSpheres; i++)
+	// the shader has fixed size arrays for exactly these objects
+	for (int i = 0, n = (int)scene.spheres.size(); i < n; i++)
 	{
+		const SceneSphere &s = scene.spheres[i];
 		StringCchPrintf(name, 100, "spheres[%d].center", i);
-		program->Uniform(name, 1, spheres[i].center.data);
+		program->Uniform(name, 1, s.center.data);
 		StringCchPrintf(name, 100, "spheres[%d].radius", i);
-		program->Uniform(name, spheres[i].radius);
+		program->Uniform(name, s.radius);
 		StringCchPrintf(name, 100, "spheres[%d].base.color", i);
-		program->Uniform(name, 1, spheres[i].color.data);
+		program->Uniform(name, 1, s.base.color.data);
 		StringCchPrintf(name, 100, "spheres[%d].base.specPower", i);
-		program->Uniform(name, 40.0f);
+		program->Uniform(name, s.base.specPower);
 		StringCchPrintf(name, 100, "spheres[%d].base.material", i);
-		program->Uniform(name, 3);
+		program->Uniform(name, s.base.type);
 		StringCchPrintf(name, 100, "spheres[%d].base.refractIndex", i);
-		program->Uniform(name, 0.2f);
+		program->Uniform(name, s.base.refractIndex);
 	}
 
-	program->Uniform("spheres[2].base.material", 4);
-	program->Uniform("spheres[2].base.refractIndex", 0.9f);
-
-	for (int i = 0; i < numPlanes; i++)
+	for (int i = 0, n = (int)scene.planes.size(); i < n; i++)
 	{
+		const ScenePlane &p = scene.planes[i];
 		StringCchPrintf(name, 100, "planes[%d].base.normal", i);
-		program->Uniform(name, 1, planes[i].normal.data);
+		program->Uniform(name, 1, p.normal.data);
 		StringCchPrintf(name, 100, "planes[%d].D", i);
-		program->Uniform(name, planes[i].D);
+		program->Uniform(name, p.D);
 		StringCchPrintf(name, 100, "planes[%d].base.color", i);
-		program->Uniform(name, 1, planes[i].color.data);
+		program->Uniform(name, 1, p.base.color.data);
 		StringCchPrintf(name, 100, "planes[%d].base.specPower", i);
-		program->Uniform(name, 40.0f);
+		program->Uniform(name, p.base.specPower);
 		StringCchPrintf(name, 100, "planes[%d].base.material", i);
-		program->Uniform(name, 2);
+		program->Uniform(name, p.base.type);
 		StringCchPrintf(name, 100, "planes[%d].base.refractIndex", i);
-		program->Uniform(name, 0.3f);
+		program->Uniform(name, p.base.refractIndex);
 	}
 
-
-	program->Uniform("lightSource", 1, Vector3f(5, 20, 5).data);
-	program->Uniform("lightAmbient", 1, Vector3f(0.1f).data);
-	program->Uniform("backColor", 0.0f, 0.0f, 0.0f);
+	program->Uniform("lightSource", 1, scene.lightSource.data);
+	program->Uniform("lightAmbient", 1, scene.lightAmbient.data);
+	program->Uniform("backColor", 1, scene.backColor.data);
 }
 
 void MainWindow::OnCreate()
@@ -104,24 +78,86 @@ void MainWindow::OnCreate()
 		glBindVertexArray(vao);
 	}
 
-	camera.type = CAM_FREE;
-	camera.SetPosition(10, 2, 0);
-	camera.RotateY(20.0f);
+	SetRoomStartView(camera);
 
-	program = new ProgramObject(m_rc, "shaders/shader.vert.glsl", "shaders/shader.frag.glsl");
-	program->Use();
+	// the files are read while the window comes up, see PublishLoads
+	loader = new ResourceLoader;
+	programLoad = loader->Submit(new ProgramLoad(m_rc, "shaders/shader.vert.glsl", "shaders/shader.frag.glsl"));
+	quadLoad = ModelLoader(m_rc).LoadObjAsync(*loader, "quad.obj", false);
 
-	quad = new Mesh(m_rc);
-	quad->LoadObj("quad.obj");
-	
-	InitGeometry();
+	// from here on GL belongs to the render thread
+	Redraw();
+	wglMakeCurrent(NULL, NULL);
+	renderThread.Start(renderMain, this);
 
 	SetTimer(m_hwnd, 1, 15, NULL);
 }
 
+void MainWindow::renderMain(void *param)
+{
+	((MainWindow *)param)->RenderLoop();
+}
+
+void MainWindow::RenderLoop()
+{
+	m_rc->MakeCurrent();
+	while (!quitRender)
+	{
+		pacer.BeginFrame();
+		bool redraw = PublishLoads();
+		if (views.Update()) redraw = true;
+
+		const ViewSnapshot &view = views.Get();
+		if (view.width != viewWidth || view.height != viewHeight)
+			Resize(view.width, view.height);
+
+		if (redraw) {
+			OnDisplay();
+			SwapBuffers(m_hdc);
+		}
+		pacer.Wait();
+	}
+	wglMakeCurrent(NULL, NULL);
+}
+
+void MainWindow::Redraw()
+{
+	ViewSnapshot &view = views.GetWriteSlot();
+	view.camera = camera;
+	view.width = width;
+	view.height = height;
+	views.Publish();
+}
+
+// true on the call that makes the last of them ready
+bool MainWindow::PublishLoads()
+{
+	if (program && quad) return false;
+	loader->Publish(LOAD_PUBLISH_BUDGET);
+
+	if (!program && programLoad->IsReady()) {
+		program = new ProgramObject(*programLoad->program);
+		program->Use();
+		InitGeometry();
+		programLoad = my_shared_ptr<ProgramLoad>();
+	}
+	if (!quad && quadLoad->IsReady() && !quadLoad->meshes.empty()) {
+		quad = quadLoad->meshes[0];
+		for (int i = 1, n = (int)quadLoad->meshes.size(); i < n; i++)
+			delete quadLoad->meshes[i];
+		quadLoad = my_shared_ptr<ModelLoad>();
+	}
+	if (!program || !quad) return false;
+	UpdateSize();
+	return true;
+}
+
 void MainWindow::OnDisplay()
 {
 	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+	if (!program || !quad) return;
+
+	RaytraceCamera camera = views.Get().camera;
 	m_rc->PushModelView();
 		camera.ApplyTransform(m_rc);
 		quad->Draw();
@@ -130,20 +166,36 @@ void MainWindow::OnDisplay()
 
 void MainWindow::OnSize(int w, int h)
 {
+	width = w;
+	height = h;
+	Redraw();
+}
+
+void MainWindow::Resize(int w, int h)
+{
+	viewWidth = w;
+	viewHeight = h;
 	glViewport(0, 0, w, h);
-	
-	RECT r = { };
-	GetClientRect(m_hwnd, &r);
-	Matrix44f orthoMat = Ortho2D(0, (float)r.right, 0, (float)r.bottom);
+
+	Matrix44f orthoMat = Ortho2D(0, (float)w, 0, (float)h);
 	m_rc->SetProjection(orthoMat);
+	UpdateSize();
+}
 
+// the shader's and the quad's share of a resize, once they are loaded
+void MainWindow::UpdateSize()
+{
+	if (!program || !quad) return;
+
+	RECT r = { 0, 0, viewWidth, viewHeight };
 	float fov = 45.0f;
 	program->Uniform("ImageWidth", r.right);
 	program->Uniform("ImageHeight", r.bottom);
 	program->Uniform("TanHalfFov", (float)tan(DEG_TO_RAD(fov * 0.5)));
 
 	if (r.right != 0 && r.bottom != 0) {
-		Vector3f *verts = (Vector3f *)quad->vertices->Map(GL_READ_WRITE);
+		quad->MakeUnique();
+		Vector3f *verts = (Vector3f *)quad->buffers->vertices->Map(GL_READ_WRITE);
 		if (verts)
 		{
 			for (int i = 0, n = quad->GetVerticesCount(); i < n; i++)
@@ -154,9 +206,8 @@ void MainWindow::OnSize(int w, int h)
 					verts[i].y = verts[i].y > 0 ? (float)r.bottom : (float)-r.bottom;
 			}
 		}
-		quad->vertices->Unmap();
+		quad->buffers->vertices->Unmap();
 	}
-	Redraw();
 }
 
 void MainWindow::OnTimer()
@@ -240,7 +291,20 @@ void MainWindow::OnMouseMove(UINT keysPressed, int x, int y)
 
 void MainWindow::OnDestroy()
 {
+	quitRender = true;
+	renderThread.Join();
+	m_rc->MakeCurrent();
+
 	timeEndPeriod(1);
+	// GL objects of loads never taken go while the context is there
+	delete loader;
+	programLoad = my_shared_ptr<ProgramLoad>();
+	if (quadLoad.Get()) {
+		for (int i = 0, n = (int)quadLoad->meshes.size(); i < n; i++)
+			delete quadLoad->meshes[i];
+		quadLoad->meshes.clear();
+	}
+	quadLoad = my_shared_ptr<ModelLoad>();
 	delete program;
 	delete quad;
 	PostQuitMessage(0);
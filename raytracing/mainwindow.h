@@ -5,18 +5,48 @@
 #include "raytracecamera.h"
 #include "shader.h"
 #include "mesh.h"
+#include "modelloader.h"
+#include "resourceloader.h"
+#include "triplebuffer.h"
+#include "framepacer.h"
+#include "platform.h"
 
+// What the render thread draws, as the window thread last saw it
+struct ViewSnapshot
+{
+	RaytraceCamera camera;
+	int width, height; // client area
+
+	ViewSnapshot() : width(0), height(0) { }
+};
+
+// Input is handled on the window thread, which publishes a ViewSnapshot
+// whenever the view changes. A render thread of its own owns the GL
+// context from OnCreate to OnDestroy and draws the newest snapshot, at a
+// rate kept by a FramePacer rather than by the timer.
 class MainWindow : public GLWindow
 {
 public:
 	MainWindow();
 private:
+	// window thread
 	RaytraceCamera camera;
-	ProgramObject *program;
-	Mesh *quad;
-
+	int width, height;
 	bool needRedraw;
 
+	TripleBuffer<ViewSnapshot> views;
+	Thread renderThread;
+	volatile bool quitRender;
+
+	// render thread, once OnCreate has started it
+	FramePacer pacer;
+	int viewWidth, viewHeight; // the size the GL state is set up for
+	ResourceLoader *loader;
+	my_shared_ptr<ProgramLoad> programLoad;
+	my_shared_ptr<ModelLoad> quadLoad;
+	ProgramObject *program; // NULL until loaded, as is quad
+	Mesh *quad;
+
 	WindowInfoStruct GetWindowInfo()
 	{
 		WindowInfoStruct wi = { };
@@ -33,6 +63,14 @@ private:
 	}
 
 	void InitGeometry();
+	bool PublishLoads();
+	void Resize(int w, int h);
+	void UpdateSize();
+	void RenderLoop();
+	static void renderMain(void *param);
+
+	// publishes the view for the render thread
+	void Redraw();
 
 	void OnCreate();
 	void OnDisplay();
@@ -0,0 +1,26 @@
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+
+// Pass/fail counting for the unit tests: each check that fails prints its
+// description, and main reports the counts and returns reportChecks().
+
+static int checks = 0, failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	checks++;
+	if (!ok) {
+		printf("FAIL %s\n", what);
+		failed++;
+	}
+}
+
+static int reportChecks()
+{
+	printf("%d of %d checks passed\n", checks - failed, checks);
+	return failed ? 1 : 0;
+}
+
+#endif // _CHECK_H_
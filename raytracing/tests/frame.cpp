@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <math.h>
+
+#include "triplebuffer.h"
+#include "framepacer.h"
+#include "platform.h"
+#include "check.h"
+
+// Render loop test: TripleBuffer handing snapshots from a writer thread to
+// a reader, and FramePacer's deadlines driven by a made-up clock.
+
+static bool near(double a, double b)
+{
+	return fabs(a - b) < 1e-9;
+}
+
+// large enough that a torn copy would show as a mismatch
+struct Snapshot
+{
+	int sequence;
+	int payload[63];
+
+	Snapshot() : sequence(0) {
+		for (int i = 0; i < 63; i++) payload[i] = 0;
+	}
+	void Fill(int sequence) {
+		this->sequence = sequence;
+		for (int i = 0; i < 63; i++) payload[i] = sequence * 63 + i;
+	}
+	bool IsWhole() const {
+		for (int i = 0; i < 63; i++)
+			if (payload[i] != sequence * 63 + i) return false;
+		return true;
+	}
+};
+
+static const int SNAPSHOTS = 200000;
+
+struct Stream
+{
+	TripleBuffer<Snapshot> buffer;
+	volatile int done;
+};
+
+static void writerMain(void *param)
+{
+	Stream &stream = *(Stream *)param;
+	for (int i = 1; i <= SNAPSHOTS; i++) {
+		stream.buffer.GetWriteSlot().Fill(i);
+		stream.buffer.Publish();
+		// lets the reader in on a single core too
+		if (i % 256 == 0) SleepMs(0);
+	}
+	AtomicAdd(&stream.done, 1);
+}
+
+static void testTripleBuffer()
+{
+	TripleBuffer<int> ints;
+	check(!ints.Update() && ints.Get() == 0, "nothing to take before the first Publish");
+	ints.Write(1);
+	check(ints.Update() && ints.Get() == 1, "Update takes a published value");
+	check(!ints.Update() && ints.Get() == 1, "Update is false with nothing new, the value stays");
+	ints.Write(2);
+	ints.Write(3);
+	check(ints.Update() && ints.Get() == 3, "Update takes the newest of several");
+	check(!ints.Update(), "values overwritten before Update are not handed out");
+	ints.GetWriteSlot() = 4;
+	check(!ints.Update() && ints.Get() == 3, "a write slot is unseen until Publish");
+	ints.Publish();
+	check(ints.Update() && ints.Get() == 4, "Publish hands over the write slot");
+
+	Stream stream;
+	stream.done = 0;
+	Thread writer;
+	writer.Start(writerMain, &stream);
+
+	int last = 0, taken = 0, torn = 0, stale = 0;
+	for (;;) {
+		bool writerDone = stream.done != 0;
+		if (stream.buffer.Update()) {
+			const Snapshot &snapshot = stream.buffer.Get();
+			if (!snapshot.IsWhole()) torn++;
+			if (snapshot.sequence <= last) stale++;
+			last = snapshot.sequence;
+			taken++;
+
+			// the reader's slot must not change while the writer goes on
+			SleepMs(0);
+			if (snapshot.sequence != last || !snapshot.IsWhole()) torn++;
+		}
+		// an Update after the writer finished must see its last value
+		else if (writerDone) break;
+	}
+	writer.Join();
+
+	check(taken > 0, "the reader takes snapshots");
+	check(torn == 0, "no snapshot is torn or changed while held");
+	check(stale == 0, "each Update is newer than the last");
+	check(last == SNAPSHOTS, "the last snapshot is delivered");
+	check(!stream.buffer.Update(), "nothing new after the last snapshot");
+}
+
+static void testFramePacer()
+{
+	FramePacer pacer(0.01);
+	check(near(pacer.GetWaitTime(5.0), 0.0), "no wait before the first frame");
+	check(near(pacer.BeginFrame(1.0), 0.0), "the first frame has dt 0");
+	check(near(pacer.GetWaitTime(1.004), 0.006), "the next frame is due an interval after the first");
+
+	// a frame late by less than an interval keeps the grid
+	check(near(pacer.BeginFrame(1.0105), 0.0105), "dt of a slightly late frame");
+	check(near(pacer.GetWaitTime(1.0105), 0.0095), "the deadline stays on the grid");
+	check(pacer.GetStats().missed == 0, "a slightly late frame misses nothing");
+
+	check(near(pacer.BeginFrame(1.02), 0.0095), "dt of a frame on time");
+	check(near(pacer.GetWaitTime(1.02), 0.01), "the next deadline after a frame on time");
+
+	// due at 1.03, starting at 1.0655 drops the deadlines at 1.03, 1.04
+	// and 1.05 and is due again at 1.07
+	pacer.BeginFrame(1.0655);
+	check(pacer.GetStats().missed == 3, "a frame 3.55 intervals late misses 3");
+	check(near(pacer.GetWaitTime(1.0655), 0.0045), "the deadline after a miss is back on the grid");
+	check(near(pacer.GetWaitTime(1.08), 0.0), "no wait past the deadline");
+
+	pacer.BeginFrame(1.07);
+	check(pacer.GetStats().missed == 3, "a frame on time after a miss misses nothing");
+	check(near(pacer.GetWaitTime(1.07), 0.01), "frames go on along the grid");
+
+	const FramePacerStats &stats = pacer.GetStats();
+	check(stats.frames == 5, "frames are counted");
+	check(near(stats.totalTime, 0.07), "total time runs from the first frame to the last");
+	check(near(stats.maxFrameTime, 0.0455), "the longest frame is kept");
+	check(near(stats.AverageFrameTime(), 0.0175), "average frame time");
+
+	pacer.ResetStats();
+	check(pacer.GetStats().frames == 0 && pacer.GetStats().missed == 0, "ResetStats clears the stats");
+	pacer.BeginFrame(1.08);
+	check(near(pacer.GetWaitTime(1.08), 0.01), "ResetStats keeps the grid");
+}
+
+int main()
+{
+	testTripleBuffer();
+	testFramePacer();
+
+	return reportChecks();
+}
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+
+#include "scene.h"
+#include "scenefile.h"
+#include "camerapath.h"
+#include "raygen.h"
+#include "raytracer.h"
+#include "parallel.h"
+#include "image.h"
+#include "raytracecamera.h"
+
+using namespace std;
+
+// Golden-image regression test: renders the canonical scenes headlessly and
+// compares them with reference renders in tests/golden. A case passes when
+// few enough pixels differ by more than a small tolerance and the structural
+// similarity (SSIM) of the luminance stays high; otherwise name_out.tga and
+// name_diff.tga are written to the current directory for inspection.
+//
+// References are name.pfm (float RGB) or name.tga; -update rewrites them as
+// .tga from the current renderer, after a change to the output is intended.
+
+#define GOLDEN_WIDTH 160
+#define GOLDEN_HEIGHT 120
+
+struct GoldenTolerance
+{
+	float pixelTolerance; // per channel difference a pixel may have
+	float maxBadPixels;   // fraction of pixels allowed past pixelTolerance
+	float minSsim;
+
+	GoldenTolerance() : pixelTolerance(3.0f / 255.0f), maxBadPixels(0.002f), minSsim(0.99f) { }
+};
+
+struct GoldenCase
+{
+	const char *name;
+	const char *reference; // several accelerators share one reference
+	const char *scene;     // room, room.scene or flake3
+	SceneAccelType accel;
+};
+
+static const GoldenCase cases[] =
+{
+	{ "room_none", "room", "room", ACCEL_NONE },
+	{ "room_bvh", "room", "room", ACCEL_BVH },
+	{ "room_grid", "room", "room", ACCEL_GRID },
+	{ "room_hgrid", "room", "room", ACCEL_HIERARCHICAL_GRID },
+	{ "roomfile_grid", "roomfile", "room.scene", ACCEL_GRID },
+	{ "flake3_bvh", "flake3", "flake3", ACCEL_BVH },
+	{ "flake3_grid", "flake3", "flake3", ACCEL_GRID },
+	{ "flake3_hgrid", "flake3", "flake3", ACCEL_HIERARCHICAL_GRID },
+};
+
+struct GoldenMetrics
+{
+	float maxError;
+	float rmse;
+	float badPixels; // fraction
+	float ssim;
+};
+
+static void printUsage()
+{
+	printf(
+		"usage: rtgolden <reference dir> [options]\n"
+		"  -scenes <dir>     directory with room.scene (default <reference dir>/../../scenes)\n"
+		"  -update           write the current renders as the references\n"
+		"  -cases <list>     comma separated case names (default all)\n");
+}
+
+static float clamp01(float c)
+{
+	return c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+}
+
+static bool saveTga(const char *filename, const vector<Color3f> &pixels, int width, int height)
+{
+	Image image;
+	image.Create(width, height, 24);
+	unsigned char *data = image.GetData();
+	for (int i = 0, n = width * height; i < n; i++) {
+		data[i*3 + 0] = ColorToByte(pixels[i].b);
+		data[i*3 + 1] = ColorToByte(pixels[i].g);
+		data[i*3 + 2] = ColorToByte(pixels[i].r);
+	}
+	return image.SaveTga(filename);
+}
+
+// Portable float map: "PF", width and height, then a scale whose sign gives
+// the byte order, then RGB float rows from the bottom up
+static bool loadPfm(const char *filename, vector<Color3f> &pixels, int &width, int &height)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) return false;
+
+	char magic[3] = { 0 };
+	float scale = 0;
+	bool ok = fscanf(f, "%2s %d %d %f", magic, &width, &height, &scale) == 4 &&
+		!strcmp(magic, "PF") && width > 0 && height > 0 && scale != 0 && fgetc(f) != EOF;
+
+	if (ok) {
+		pixels.resize(width * height);
+		for (int y = height - 1; ok && y >= 0; y--)
+			ok = fread(&pixels[y * width], sizeof(Color3f), width, f) == (size_t)width;
+	}
+	fclose(f);
+	if (!ok) return false;
+
+	unsigned int probe = 1;
+	bool littleEndian = *(unsigned char *)&probe == 1;
+	if ((scale < 0) != littleEndian)
+	{
+		unsigned char *b = (unsigned char *)pixels.data();
+		for (size_t i = 0, n = pixels.size() * 3; i < n; i++, b += 4) {
+			unsigned char t = b[0]; b[0] = b[3]; b[3] = t;
+			t = b[1]; b[1] = b[2]; b[2] = t;
+		}
+	}
+	return true;
+}
+
+static bool loadTga(const char *filename, vector<Color3f> &pixels, int &width, int &height)
+{
+	Image image;
+	if (!image.LoadTga(filename) || image.GetDepth() < 24) return false;
+	width = image.GetWidth();
+	height = image.GetHeight();
+	pixels.resize(width * height);
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++) {
+			Color4b c = image.GetPixel(x, y);
+			// GetPixel returns the stored BGR order
+			pixels[x + y * width] = Color3f(c.b / 255.0f, c.g / 255.0f, c.r / 255.0f);
+		}
+	return true;
+}
+
+static bool loadReference(const string &dir, const char *name, vector<Color3f> &pixels, int &width, int &height)
+{
+	string base = dir + "/" + name;
+	return loadPfm((base + ".pfm").c_str(), pixels, width, height) ||
+		loadTga((base + ".tga").c_str(), pixels, width, height);
+}
+
+static bool buildScene(const char *name, const string &sceneDir, Scene &scene, Matrix44f &view)
+{
+	if (!strcmp(name, "room") || !strcmp(name, "room.scene"))
+	{
+		if (!strcmp(name, "room")) MakeRoomScene(scene);
+		else if (!LoadSceneFile((sceneDir + "/room.scene").c_str(), scene)) return false;
+
+		RaytraceCamera camera;
+		SetRoomStartView(camera);
+		view = camera.GetViewMatrix();
+		return true;
+	}
+	if (!strcmp(name, "flake3")) {
+		MakeSphereFlakeScene(scene, 3);
+		view = LookAtView(Point3f(2.6f, 1.9f, 3.4f), Point3f(0.0f, 0.2f, 0.0f));
+		return true;
+	}
+	return false;
+}
+
+static float luminance(const Color3f &c)
+{
+	return 0.2126f * clamp01(c.r) + 0.7152f * clamp01(c.g) + 0.0722f * clamp01(c.b);
+}
+
+// mean SSIM of the luminance over 8x8 windows, stepping by 4
+static float computeSsim(const vector<Color3f> &a, const vector<Color3f> &b, int width, int height)
+{
+	const int window = 8, step = 4;
+	const float c1 = 0.01f * 0.01f, c2 = 0.03f * 0.03f;
+	double sum = 0;
+	int count = 0;
+
+	for (int y0 = 0; y0 + window <= height; y0 += step)
+		for (int x0 = 0; x0 + window <= width; x0 += step)
+		{
+			double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+			for (int y = y0; y < y0 + window; y++)
+				for (int x = x0; x < x0 + window; x++) {
+					double la = luminance(a[x + y * width]), lb = luminance(b[x + y * width]);
+					sa += la; sb += lb;
+					saa += la * la; sbb += lb * lb; sab += la * lb;
+				}
+			const double n = window * window;
+			double ma = sa / n, mb = sb / n;
+			double va = saa / n - ma * ma, vb = sbb / n - mb * mb, cov = sab / n - ma * mb;
+			sum += ((2 * ma * mb + c1) * (2 * cov + c2)) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+			count++;
+		}
+	return count ? (float)(sum / count) : 1.0f;
+}
+
+static GoldenMetrics compare(const vector<Color3f> &image, const vector<Color3f> &reference,
+	int width, int height, const GoldenTolerance &tolerance, vector<Color3f> &diff)
+{
+	GoldenMetrics m = { 0, 0, 0, 0 };
+	double squared = 0;
+	int bad = 0;
+	diff.resize(image.size());
+
+	for (int i = 0, n = width * height; i < n; i++)
+	{
+		const Color3f &a = image[i], &b = reference[i];
+		float dr = fabs(clamp01(a.r) - clamp01(b.r));
+		float dg = fabs(clamp01(a.g) - clamp01(b.g));
+		float db = fabs(clamp01(a.b) - clamp01(b.b));
+		float e = max(max(dr, dg), db);
+
+		m.maxError = max(m.maxError, e);
+		squared += dr * dr + dg * dg + db * db;
+		if (e > tolerance.pixelTolerance) bad++;
+
+		// amplified, with pixels past the tolerance marked red
+		diff[i] = e > tolerance.pixelTolerance ? Color3f(1.0f, 0.0f, 0.0f) :
+			Color3f(dr * 16.0f, dg * 16.0f, db * 16.0f);
+	}
+	m.rmse = (float)sqrt(squared / (width * height * 3.0));
+	m.badPixels = (float)bad / (width * height);
+	m.ssim = computeSsim(image, reference, width, height);
+	return m;
+}
+
+static bool caseEnabled(const vector<string> &list, const char *name)
+{
+	if (list.empty()) return true;
+	for (int i = 0, n = (int)list.size(); i < n; i++)
+		if (list[i] == name) return true;
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2 || argv[1][0] == '-') {
+		printUsage();
+		return 1;
+	}
+	string refDir = argv[1];
+	string sceneDir = refDir + "/../../scenes";
+	bool update = false;
+	vector<string> enabled;
+
+	for (int i = 2; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (!strcmp(arg, "-scenes") && hasValue) sceneDir = argv[++i];
+		else if (!strcmp(arg, "-update")) update = true;
+		else if (!strcmp(arg, "-cases") && hasValue) {
+			for (char *s = strtok(argv[++i], ","); s; s = strtok(NULL, ","))
+				enabled.push_back(s);
+		}
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	// tile order doesn't change the output, a single thread keeps the test light
+	SetNumberOfThreads(1);
+	GoldenTolerance tolerance;
+	int failed = 0, run = 0;
+	vector<string> updated;
+
+	for (int c = 0, nc = sizeof(cases) / sizeof(cases[0]); c < nc; c++)
+	{
+		const GoldenCase &gc = cases[c];
+		if (!caseEnabled(enabled, gc.name)) continue;
+		run++;
+
+		Scene scene;
+		Matrix44f view;
+		if (!buildScene(gc.scene, sceneDir, scene, view)) {
+			printf("FAIL %-16s can't load scene %s\n", gc.name, gc.scene);
+			failed++;
+			continue;
+		}
+		scene.Build(gc.accel);
+
+		CameraRayGenerator camera;
+		camera.SetResolution(GOLDEN_WIDTH, GOLDEN_HEIGHT, 45.0f);
+		camera.SetCamera(view);
+		vector<Color3f> pixels(GOLDEN_WIDTH * GOLDEN_HEIGHT);
+		RayTracer tracer;
+		tracer.Render(scene, camera, pixels.data());
+
+		if (update)
+		{
+			// the first case of a reference writes it, the others are still checked
+			bool written = false;
+			for (int i = 0, n = (int)updated.size(); i < n; i++)
+				if (updated[i] == gc.reference) written = true;
+			if (!written) {
+				string file = refDir + "/" + gc.reference + ".tga";
+				if (!saveTga(file.c_str(), pixels, GOLDEN_WIDTH, GOLDEN_HEIGHT)) {
+					printf("FAIL %-16s can't write %s\n", gc.name, file.c_str());
+					failed++;
+					continue;
+				}
+				printf("wrote %s\n", file.c_str());
+				updated.push_back(gc.reference);
+			}
+		}
+
+		vector<Color3f> reference;
+		int width = 0, height = 0;
+		if (!loadReference(refDir, gc.reference, reference, width, height)) {
+			printf("FAIL %-16s no reference %s/%s.pfm or .tga\n", gc.name, refDir.c_str(), gc.reference);
+			failed++;
+			continue;
+		}
+		if (width != GOLDEN_WIDTH || height != GOLDEN_HEIGHT) {
+			printf("FAIL %-16s reference is %dx%d, expected %dx%d\n", gc.name,
+				width, height, GOLDEN_WIDTH, GOLDEN_HEIGHT);
+			failed++;
+			continue;
+		}
+
+		vector<Color3f> diff;
+		GoldenMetrics m = compare(pixels, reference, width, height, tolerance, diff);
+		bool pass = m.badPixels <= tolerance.maxBadPixels && m.ssim >= tolerance.minSsim;
+		printf("%s %-16s max %.4f  rmse %.5f  over tolerance %.3f%%  ssim %.5f\n", pass ? "ok  " : "FAIL",
+			gc.name, m.maxError, m.rmse, m.badPixels * 100.0f, m.ssim);
+
+		if (!pass) {
+			failed++;
+			string out = string(gc.name) + "_out.tga", diffName = string(gc.name) + "_diff.tga";
+			saveTga(out.c_str(), pixels, width, height);
+			saveTga(diffName.c_str(), diff, width, height);
+			printf("     wrote %s and %s\n", out.c_str(), diffName.c_str());
+		}
+	}
+
+	if (run == 0) {
+		printf("no cases match\n");
+		return 1;
+	}
+	printf("%d of %d cases passed\n", run - failed, run);
+	return failed ? 1 : 0;
+}
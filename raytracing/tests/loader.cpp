@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <vector>
+
+#include "resourceloader.h"
+#include "platform.h"
+#include "check.h"
+
+using namespace std;
+
+// ResourceLoader test: the CPU stages of the file loads, the order and
+// budget of Publish, Finish on queued and loaded tasks, failed loads and
+// the destructor dropping what is still queued. Runs headless; the one
+// argument is a TGA file to load, a quad OBJ is written to the current
+// directory.
+
+// lets a test hold a worker inside Load
+struct Gate
+{
+	Mutex mutex;
+	ConditionVariable changed;
+	bool open;
+
+	Gate() : open(false) { }
+
+	void Wait() {
+		MutexLock lock(mutex);
+		while (!open) changed.Wait(mutex);
+	}
+	void Open() {
+		MutexLock lock(mutex);
+		open = true;
+		changed.NotifyAll();
+	}
+};
+
+class RecordTask : public LoadTask
+{
+public:
+	int id;
+	volatile int loads;
+
+	RecordTask(int id, vector<int> *published, Gate *gate = NULL, bool fail = false)
+		: id(id), loads(0), published(published), gate(gate), fail(fail) { }
+
+	bool Load() {
+		AtomicAdd(&loads, 1);
+		if (gate) gate->Wait();
+		return !fail;
+	}
+	bool Publish() {
+		published->push_back(id);
+		return true;
+	}
+private:
+	vector<int> *published;
+	Gate *gate;
+	bool fail;
+};
+
+static bool waitForState(const LoadTask *task, LoadState state, double timeout = 10.0)
+{
+	double start = GetTime();
+	while (task->GetState() != state) {
+		if (GetTime() - start > timeout) return false;
+		SleepMs(1);
+	}
+	return true;
+}
+
+static bool drain(ResourceLoader &loader, double timeout = 10.0)
+{
+	double start = GetTime();
+	while (loader.GetPendingCount() > 0) {
+		if (GetTime() - start > timeout) return false;
+		loader.Publish(1.0);
+		SleepMs(1);
+	}
+	return true;
+}
+
+static void testFileLoads(const char *tgaFile)
+{
+	FILE *f = fopen("loader_quad.obj", "w");
+	check(f != NULL, "write loader_quad.obj");
+	if (!f) return;
+	fprintf(f, "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3\nf 1 3 4\n");
+	fclose(f);
+
+	Image reference;
+	reference.LoadTga(tgaFile);
+
+	ResourceLoader loader(2);
+	MeshDataLoad *mesh = new MeshDataLoad("loader_quad.obj");
+	mesh->buildBVH = true;
+	mesh->cacheBVH = false;
+	my_shared_ptr<MeshDataLoad> meshLoad = loader.Submit(mesh);
+	my_shared_ptr<ImageLoad> imageLoad = loader.Submit(new ImageLoad(tgaFile));
+	my_shared_ptr<MeshDataLoad> missingMesh = loader.Submit(new MeshDataLoad("loader_missing.obj"));
+	my_shared_ptr<ImageLoad> missingImage = loader.Submit(new ImageLoad("loader_missing.tga"));
+
+	check(drain(loader), "file loads finish");
+	check(meshLoad->IsReady(), "MeshDataLoad is ready");
+	check(meshLoad->data.Get() && meshLoad->data->GetFaceCount() == 2, "MeshDataLoad parsed the quad");
+	check(meshLoad->subMeshes.size() == 1, "MeshDataLoad has one submesh");
+	check(meshLoad->bvh.Get() && !meshLoad->bvh->IsEmpty(), "MeshDataLoad built a BVH");
+	check(imageLoad->IsReady(), "ImageLoad is ready");
+	check(reference.IsGood() && imageLoad->image.GetWidth() == reference.GetWidth() &&
+		imageLoad->image.GetHeight() == reference.GetHeight(), "ImageLoad decoded the TGA");
+	check(missingMesh->GetState() == LOAD_FAILED, "missing OBJ fails");
+	check(missingImage->GetState() == LOAD_FAILED, "missing TGA fails");
+	check(loader.GetPendingCount() == 0, "nothing pending after failures");
+
+	remove("loader_quad.obj");
+}
+
+static void testPublishOrder()
+{
+	vector<int> published;
+	ResourceLoader loader(1);
+	vector<my_shared_ptr<RecordTask> > tasks;
+	for (int i = 0; i < 3; i++)
+		tasks.push_back(loader.Submit(new RecordTask(i, &published)));
+	check(waitForState(tasks[2].Get(), LOAD_LOADED), "tasks load");
+
+	// a zero budget still publishes one
+	check(loader.Publish(0.0) == 1, "Publish(0) publishes one task");
+	check(tasks[0]->IsReady() && tasks[1]->GetState() == LOAD_LOADED, "the first loaded is published first");
+	check(loader.Publish(10.0) == 2, "a large budget publishes the rest");
+	check(published.size() == 3 && published[0] == 0 && published[1] == 1 && published[2] == 2,
+		"tasks are published in the order they loaded");
+	check(loader.Publish(10.0) == 0, "nothing left to publish");
+}
+
+static void testFinish()
+{
+	vector<int> published;
+	Gate gate;
+	ResourceLoader loader(1);
+	my_shared_ptr<RecordTask> blocker = loader.Submit(new RecordTask(0, &published, &gate));
+	check(waitForState(blocker.Get(), LOAD_LOADING), "the worker takes the first task");
+
+	// the only worker is busy, so Finish loads the queued task itself
+	my_shared_ptr<RecordTask> queued = loader.Submit(new RecordTask(1, &published));
+	check(loader.Finish(queued.Get()), "Finish on a queued task");
+	check(queued->IsReady() && queued->loads == 1, "a queued task is loaded once by Finish");
+	check(blocker->GetState() == LOAD_LOADING, "Finish doesn't wait for other tasks");
+
+	my_shared_ptr<RecordTask> failing = loader.Submit(new RecordTask(2, &published, NULL, true));
+	check(!loader.Finish(failing.Get()) && failing->GetState() == LOAD_FAILED, "Finish on a failing task");
+
+	gate.Open();
+	check(waitForState(blocker.Get(), LOAD_LOADED), "the held task loads");
+	check(loader.Finish(blocker.Get()), "Finish on a loaded task");
+	check(loader.Finish(blocker.Get()), "Finish on a ready task");
+	check(loader.Publish(10.0) == 0, "Finish took the task out of the publish queue");
+	check(published.size() == 2 && published[0] == 1 && published[1] == 0, "each task is published once");
+	check(loader.GetPendingCount() == 0, "nothing pending after Finish");
+}
+
+static void testFinishForeign()
+{
+	vector<int> published;
+	Gate gate;
+	ResourceLoader loader(1), other(1);
+	my_shared_ptr<RecordTask> loading = other.Submit(new RecordTask(0, &published, &gate));
+	check(waitForState(loading.Get(), LOAD_LOADING), "the other loader takes its task");
+	my_shared_ptr<RecordTask> queued = other.Submit(new RecordTask(1, &published));
+
+	// neither may wait on this loader's workers
+	check(!loader.Finish(loading.Get()), "Finish on another loader's loading task");
+	check(!loader.Finish(queued.Get()) && queued->GetState() == LOAD_QUEUED,
+		"Finish on another loader's queued task");
+
+	gate.Open();
+	check(other.Finish(queued.Get()) && other.Finish(loading.Get()), "the other loader finishes them");
+	my_shared_ptr<RecordTask> unsubmitted(new RecordTask(2, &published));
+	check(!loader.Finish(unsubmitted.Get()), "Finish on a task never submitted");
+}
+
+static Gate *delayedGate;
+
+static void openLater(void *)
+{
+	SleepMs(50);
+	delayedGate->Open();
+}
+
+static void testDestructor()
+{
+	vector<int> published;
+	Gate gate;
+	my_shared_ptr<RecordTask> loading, queued[2];
+	Thread opener;
+	{
+		ResourceLoader loader(1);
+		loading = loader.Submit(new RecordTask(0, &published, &gate));
+		check(waitForState(loading.Get(), LOAD_LOADING), "the worker takes the first task");
+		queued[0] = loader.Submit(new RecordTask(1, &published));
+		queued[1] = loader.Submit(new RecordTask(2, &published));
+
+		// the destructor drops the queue at once, then waits for the task
+		// a worker is loading
+		delayedGate = &gate;
+		opener.Start(openLater, NULL);
+	}
+	opener.Join();
+	check(queued[0]->GetState() == LOAD_FAILED && queued[1]->GetState() == LOAD_FAILED,
+		"queued tasks fail when the loader goes");
+	check(queued[0]->loads == 0 && queued[1]->loads == 0, "queued tasks are never loaded");
+	check(loading->GetState() == LOAD_FAILED, "a task loaded but not published fails");
+	check(published.empty(), "the destructor publishes nothing");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		printf("usage: rtloader <file.tga>\n");
+		return 1;
+	}
+
+	testFileLoads(argv[1]);
+	testPublishOrder();
+	testFinish();
+	testFinishForeign();
+	testDestructor();
+
+	return reportChecks();
+}
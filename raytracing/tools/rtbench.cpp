@@ -0,0 +1,1491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <fstream>
+
+#include "common.h"
+#include "arena.h"
+#include "scene.h"
+#include "raygen.h"
+#include "raytracer.h"
+#include "parallel.h"
+#include "bvh.h"
+#include "compressedbvh.h"
+#include "packedmesh.h"
+#include "meshorder.h"
+#include "meshlod.h"
+#include "meshloader.h"
+#include "resourceloader.h"
+#include "framebuffer.h"
+#include "miptexture.h"
+#include "texcache.h"
+#include "image.h"
+#include "camerapath.h"
+#include "raytracecamera.h"
+
+using namespace std;
+
+// Fixed scenes and workloads for tracking tracing performance over time.
+// Every case is named scene/accel/workload/WxH/tN, and a run writes all of
+// them to a JSON file that -compare can check against an earlier run.
+
+#define BENCH_VERSION 1
+
+struct BenchOptions
+{
+	int width, height;
+	int reps;
+	vector<int> threads;
+	vector<string> scenes; // empty runs all
+	vector<string> objFiles;
+	bool quick;
+};
+
+struct BenchResult
+{
+	string name;
+	string scene, accel, workload;
+	int threads;
+	double buildMs;
+	double msPerFrame;
+	double raysPerSec;
+	long long rays;
+	long long checksum; // hit counts or summed pixels, changes when the output does
+	size_t accelBytes;
+	double peakRssMb;
+};
+
+struct TraceCount
+{
+	long long rays;
+	long long checksum;
+
+	TraceCount() : rays(0), checksum(0) { }
+};
+
+static vector<BenchResult> results;
+
+// every heap allocation the program makes, so frame loops can be checked
+// for allocations that happen in steady state; all the forms are replaced,
+// so whatever a new returns goes back to free
+static volatile int heapAllocations = 0;
+
+// GCC inlines these into delete expressions and then takes the free for a
+// mismatch with the new it sees, though that new is the malloc below; the
+// warning stays off for the rest of the file, where those deletes are
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size)
+{
+	AtomicAdd(&heapAllocations, 1);
+	void *p = malloc(size ? size : 1);
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+	free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, size_t) throw()
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) throw()
+{
+	free(p);
+}
+#endif
+
+static void printUsage()
+{
+	printf(
+		"usage: rtbench [options]\n"
+		"       rtbench -compare <baseline.json> <current.json> [-threshold <percent>]\n"
+		"  -json <file>       results file (default rtbench.json)\n"
+		"  -w <width>         image width (default 640)\n"
+		"  -h <height>        image height (default 480)\n"
+		"  -threads <list>    thread counts, e.g. 1,4,8 (default 1 and all cores)\n"
+		"  -reps <n>          timed frames per case, the median is reported (default 5)\n"
+		"  -scenes <list>     room, flake, mesh, obj, city, moving, post, texture,\n"
+		"                     textured, load\n"
+		"                     (default all);\n"
+		"                     post and texture time tone mapping and texture fetches,\n"
+		"                     their rays are pixels and samples; load times model\n"
+		"                     loading, the -obj files or generated ones\n"
+		"  -obj <file>        adds an OBJ mesh to the mesh cases, may be repeated\n"
+		"  -quick             smaller scenes, for a fast sanity run\n"
+		"  -threshold <pct>   slowdown reported as a regression (default 5)\n");
+}
+
+static bool parseIntList(const char *s, vector<int> &list)
+{
+	list.clear();
+	while (*s) {
+		char *end;
+		long n = strtol(s, &end, 10);
+		if (end == s || n <= 0) return false;
+		list.push_back((int)n);
+		s = *end == ',' ? end + 1 : end;
+		if (*end && *end != ',') return false;
+	}
+	return !list.empty();
+}
+
+static void parseStringList(const char *s, vector<string> &list)
+{
+	list.clear();
+	string item;
+	for (; ; s++) {
+		if (*s == ',' || *s == 0) {
+			if (!item.empty()) list.push_back(item);
+			item.clear();
+			if (*s == 0) break;
+		}
+		else item += *s;
+	}
+}
+
+static bool sceneEnabled(const BenchOptions &opts, const char *name)
+{
+	return opts.scenes.empty() || find(opts.scenes.begin(), opts.scenes.end(), name) != opts.scenes.end();
+}
+
+// one untimed frame first, so the data is paged in and caches are warm
+template<class Func>
+static double medianFrameTime(int reps, const Func &frame)
+{
+	frame();
+	vector<double> times(reps);
+	for (int i = 0; i < reps; i++) {
+		double t0 = GetTime();
+		frame();
+		times[i] = GetTime() - t0;
+	}
+	sort(times.begin(), times.end());
+	return times[reps / 2];
+}
+
+// heap and frame arena allocations of one frame, after a first frame that
+// may still grow buffers
+template<class Func>
+static void printFrameAllocations(const BenchOptions &opts, const char *scene, const char *accel,
+	const char *workload, const Func &frame)
+{
+	frame();
+	BeginFrameAllocations();
+	int before = heapAllocations;
+	frame();
+	int heap = heapAllocations - before;
+	FrameAllocStats arena = GetFrameAllocStats();
+
+	printf("%s/%s/%s/%dx%d/t%d: %d heap allocations a frame, %lld from frame arenas (%.1f KB on %d threads)\n",
+		scene, accel, workload, opts.width, opts.height, GetNumberOfThreads(), heap,
+		arena.total.allocations, arena.total.bytes / 1024.0, arena.threads);
+	fflush(stdout);
+}
+
+static void addResult(const BenchOptions &opts, const char *scene, const char *accel,
+	const char *workload, double buildTime, double frameTime, const TraceCount &count, size_t accelBytes)
+{
+	char name[256];
+	sprintf(name, "%s/%s/%s/%dx%d/t%d", scene, accel, workload, opts.width, opts.height, GetNumberOfThreads());
+
+	BenchResult r;
+	r.name = name;
+	r.scene = scene;
+	r.accel = accel;
+	r.workload = workload;
+	r.threads = GetNumberOfThreads();
+	r.buildMs = buildTime * 1000.0;
+	r.msPerFrame = frameTime * 1000.0;
+	r.raysPerSec = frameTime > 0 ? count.rays / frameTime : 0;
+	r.rays = count.rays;
+	r.checksum = count.checksum;
+	r.accelBytes = accelBytes;
+	r.peakRssMb = GetPeakMemoryUsage() / (1024.0 * 1024.0);
+	results.push_back(r);
+
+	printf("%-44s build %9.2f ms  frame %9.2f ms  %8.2f Mrays/s\n", name,
+		r.buildMs, r.msPerFrame, r.raysPerSec * 1e-6);
+	fflush(stdout);
+}
+
+// primary rays with an optional shadow ray from every hit
+static TraceCount traceScene(const Scene &scene, const CameraRayGenerator &camera, bool shadows)
+{
+	int height = camera.GetHeight();
+	vector<TraceCount> rows(height);
+
+	ParallelFor(0, height, [&](int begin, int end) {
+		vector<RayPacket> packets(camera.GetPacketsPerRow());
+		for (int y = begin; y < end; y++)
+		{
+			camera.GenerateRow(y, packets.data());
+			TraceCount &c = rows[y];
+			for (int p = 0, n = (int)packets.size(); p < n; p++)
+			{
+				const RayPacket &packet = packets[p];
+				for (int i = 0; i < packet.count; i++)
+				{
+					Ray ray = packet.GetRay(i);
+					SceneHit hit;
+					c.rays++;
+					if (!scene.Intersect(ray, -1, hit)) continue;
+					c.checksum++;
+					if (!shadows) continue;
+
+					Point3f hitPoint = ray.p + ray.v * hit.t;
+					Vector3f toLight = scene.lightSource - hitPoint;
+					c.rays++;
+					if (scene.IntersectAny(Ray(hitPoint, toLight), hit.object, toLight.Length()))
+						c.checksum++;
+				}
+			}
+		}
+	}, 1);
+
+	TraceCount total;
+	for (int y = 0; y < height; y++) {
+		total.rays += rows[y].rays;
+		total.checksum += rows[y].checksum;
+	}
+	return total;
+}
+
+static TraceCount renderScene(const Scene &scene, const CameraRayGenerator &camera, vector<Color3f> &pixels,
+	bool rayDifferentials = true)
+{
+	RayTracer tracer;
+	tracer.EnableRayDifferentials(rayDifferentials);
+	tracer.Render(scene, camera, pixels.data());
+
+	TraceCount count;
+	count.rays = tracer.GetStats().rays;
+	for (int i = 0, n = (int)pixels.size(); i < n; i++) {
+		const Color3f &c = pixels[i];
+		count.checksum += (long long)((c.r + c.g + c.b) * 255.0f);
+	}
+	return count;
+}
+
+template<class Accel>
+static TraceCount traceMesh(const Accel &accel, const CameraRayGenerator &camera,
+	const Point3f &light, bool shadows)
+{
+	int height = camera.GetHeight();
+	vector<TraceCount> rows(height);
+
+	ParallelFor(0, height, [&](int begin, int end) {
+		vector<RayPacket> packets(camera.GetPacketsPerRow());
+		for (int y = begin; y < end; y++)
+		{
+			camera.GenerateRow(y, packets.data());
+			TraceCount &c = rows[y];
+			for (int p = 0, n = (int)packets.size(); p < n; p++)
+			{
+				const RayPacket &packet = packets[p];
+				for (int i = 0; i < packet.count; i++)
+				{
+					Ray ray = packet.GetRay(i);
+					RayHit hit;
+					c.rays++;
+					if (!accel.Intersect(ray, hit)) continue;
+					c.checksum++;
+					if (!shadows) continue;
+
+					// pulled back slightly so the ray doesn't hit its own triangle
+					Point3f hitPoint = ray.p + ray.v * (hit.t * 0.9999f);
+					Vector3f toLight = light - hitPoint;
+					c.rays++;
+					if (accel.IntersectAny(Ray(hitPoint, toLight), toLight.Length()))
+						c.checksum++;
+				}
+			}
+		}
+	}, 1);
+
+	TraceCount total;
+	for (int y = 0; y < height; y++) {
+		total.rays += rows[y].rays;
+		total.checksum += rows[y].checksum;
+	}
+	return total;
+}
+
+// primary rays shaded with the mesh's interpolated normals and a checker
+// pattern from its texture coordinates, the attribute reads of a hit
+template<class Accel, class Attribs>
+static TraceCount shadeMesh(const Accel &accel, const Attribs &attribs, const CameraRayGenerator &camera,
+	const Point3f &light)
+{
+	int height = camera.GetHeight();
+	vector<TraceCount> rows(height);
+
+	ParallelFor(0, height, [&](int begin, int end) {
+		vector<RayPacket> packets(camera.GetPacketsPerRow());
+		for (int y = begin; y < end; y++)
+		{
+			camera.GenerateRow(y, packets.data());
+			TraceCount &c = rows[y];
+			for (int p = 0, n = (int)packets.size(); p < n; p++)
+			{
+				const RayPacket &packet = packets[p];
+				for (int i = 0; i < packet.count; i++)
+				{
+					Ray ray = packet.GetRay(i);
+					RayHit hit;
+					c.rays++;
+					if (!accel.Intersect(ray, hit)) continue;
+
+					Point3f hitPoint = ray.p + ray.v * hit.t;
+					Vector3f normal = attribs.InterpolateNormal(hit.primitive, hit.u, hit.v);
+					float diffuse = max(Dot(normal, Normalize(light - hitPoint)), 0.0f);
+					if (attribs.HasTexCoords()) {
+						Vector2f uv = attribs.InterpolateTexCoord(hit.primitive, hit.u, hit.v);
+						if (((int)floor(uv.x * 64.0f) + (int)floor(uv.y * 32.0f)) & 1) diffuse *= 0.5f;
+					}
+					c.checksum += (long long)(diffuse * 255.0f);
+				}
+			}
+		}
+	}, 1);
+
+	TraceCount total;
+	for (int y = 0; y < height; y++) {
+		total.rays += rows[y].rays;
+		total.checksum += rows[y].checksum;
+	}
+	return total;
+}
+
+static void benchSphereScene(const BenchOptions &opts, const char *name, const Scene &source,
+	const Matrix44f &view, const SceneAccelType *accels, const char **accelNames, int accelCount)
+{
+	CameraRayGenerator camera;
+	camera.SetResolution(opts.width, opts.height, 45.0f);
+	camera.SetCamera(view);
+	vector<Color3f> pixels(opts.width * opts.height);
+
+	for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+	{
+		SetNumberOfThreads(opts.threads[t]);
+		for (int a = 0; a < accelCount; a++)
+		{
+			Scene scene = source;
+			double t0 = GetTime();
+			scene.Build(accels[a]);
+			double buildTime = GetTime() - t0;
+			size_t bytes = scene.GetAccelMemoryUsage();
+
+			TraceCount count;
+			double frame = medianFrameTime(opts.reps, [&]() { count = traceScene(scene, camera, false); });
+			addResult(opts, name, accelNames[a], "primary", buildTime, frame, count, bytes);
+
+			frame = medianFrameTime(opts.reps, [&]() { count = traceScene(scene, camera, true); });
+			addResult(opts, name, accelNames[a], "shadow", buildTime, frame, count, bytes);
+
+			frame = medianFrameTime(opts.reps, [&]() { count = renderScene(scene, camera, pixels); });
+			addResult(opts, name, accelNames[a], "full", buildTime, frame, count, bytes);
+			printFrameAllocations(opts, name, accelNames[a], "full", [&]() { renderScene(scene, camera, pixels); });
+		}
+	}
+}
+
+static void benchRoom(const BenchOptions &opts)
+{
+	Scene scene;
+	MakeRoomScene(scene);
+
+	RaytraceCamera camera;
+	SetRoomStartView(camera);
+
+	SceneAccelType accels[] = { ACCEL_GRID };
+	const char *names[] = { "grid" };
+	benchSphereScene(opts, "room", scene, camera.GetViewMatrix(), accels, names, 1);
+}
+
+static void benchFlakes(const BenchOptions &opts)
+{
+	SceneAccelType accels[] = { ACCEL_BVH, ACCEL_GRID, ACCEL_HIERARCHICAL_GRID };
+	const char *names[] = { "bvh", "grid", "hgrid" };
+	Matrix44f view = LookAtView(Point3f(2.6f, 1.9f, 3.4f), Point3f(0.0f, 0.2f, 0.0f));
+
+	for (int levels = 3, maxLevels = opts.quick ? 4 : 5; levels <= maxLevels; levels++)
+	{
+		Scene scene;
+		MakeSphereFlakeScene(scene, levels);
+		char name[32];
+		sprintf(name, "flake%d", levels);
+		benchSphereScene(opts, name, scene, view, accels, names, 3);
+	}
+}
+
+// tone mapping and 8 bit conversion of an over-exposed room render
+static void benchPost(const BenchOptions &opts)
+{
+	Scene scene;
+	MakeRoomScene(scene);
+	scene.Build(ACCEL_GRID);
+	RaytraceCamera view;
+	SetRoomStartView(view);
+	CameraRayGenerator camera;
+	camera.SetResolution(opts.width, opts.height, 45.0f);
+	camera.SetCamera(view.GetViewMatrix());
+
+	FrameBuffer frame;
+	frame.Create(opts.width, opts.height);
+	RayTracer tracer;
+	tracer.Render(scene, camera, frame.GetPixels());
+	float *data = frame.GetData();
+	for (int i = 0, n = opts.width * opts.height * 3; i < n; i++)
+		data[i] *= 4.0f;
+
+	const char *workloads[] = { "linear", "srgb-dither" };
+	for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+	{
+		SetNumberOfThreads(opts.threads[t]);
+		for (int op = 0; op < TONEMAP_OPERATOR_COUNT; op++)
+			for (int w = 0; w < 2; w++)
+			{
+				ToneMapParams params;
+				params.op = (ToneMapOperator)op;
+				params.srgb = params.dither = w == 1;
+				Image image;
+				double time = medianFrameTime(opts.reps, [&]() { frame.Convert(image, params); });
+
+				TraceCount count;
+				count.rays = (long long)opts.width * opts.height;
+				for (int i = 0, n = image.GetDataSize(); i < n; i++)
+					count.checksum += image.GetData()[i];
+				addResult(opts, "post", GetToneMapName(op), workloads[w], 0.0, time, count, 0);
+			}
+	}
+}
+
+// hash of the sample index, spread over [0, 1)
+static float hashToUnit(unsigned int i)
+{
+	i ^= i >> 16; i *= 0x7feb352d;
+	i ^= i >> 15; i *= 0x846ca68b;
+	i ^= i >> 16;
+	return (i >> 8) * (1.0f / 16777216.0f);
+}
+
+// rows and columns walk the finest level one texel per sample, random
+// jumps anywhere; trilinear adds a random level of detail
+static TraceCount sampleTexture(const MipTexture &texture, const char *workload, int samples)
+{
+	int size = texture.GetWidth();
+	float texel = 1.0f / size;
+	bool columns = !strcmp(workload, "columns");
+	bool random = !strcmp(workload, "random") || !strcmp(workload, "trilinear");
+	bool trilinear = !strcmp(workload, "trilinear");
+	int levels = texture.GetLevelCount();
+
+	const int chunk = 4096;
+	vector<long long> sums((samples + chunk - 1) / chunk);
+	ParallelFor(0, (int)sums.size(), [&](int begin, int end) {
+		for (int c = begin; c < end; c++)
+		{
+			float sum = 0;
+			for (int i = c * chunk, n = min(samples, (c + 1) * chunk); i < n; i++)
+			{
+				Vector2f uv;
+				float lod = 0;
+				if (random) {
+					uv = Vector2f(hashToUnit(i * 2), hashToUnit(i * 2 + 1));
+					if (trilinear) lod = hashToUnit(i * 3 + 7) * (levels - 1);
+				}
+				else {
+					float a = (i % size + 0.5f) * texel, b = (i / size + 0.5f) * texel;
+					uv = columns ? Vector2f(b, a) : Vector2f(a, b);
+				}
+				Color4f color = texture.Sample(uv, lod);
+				sum += color.r + color.g + color.b;
+			}
+			sums[c] = (long long)sum;
+		}
+	}, 1);
+
+	TraceCount count;
+	count.rays = samples;
+	for (int i = 0, n = (int)sums.size(); i < n; i++)
+		count.checksum += sums[i];
+	return count;
+}
+
+static void benchTextures(const BenchOptions &opts)
+{
+	int size = opts.quick ? 1024 : 4096;
+	Image image;
+	image.Create(size, size, 32);
+	unsigned char *data = image.GetData();
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++) {
+			unsigned char *t = data + ((size_t)y * size + x) * 4;
+			t[0] = (unsigned char)(x ^ y);
+			t[1] = (unsigned char)(x * 255 / size);
+			t[2] = (unsigned char)(y * 255 / size);
+			t[3] = 255;
+		}
+
+	TextureLayout layouts[] = { TEX_LAYOUT_LINEAR, TEX_LAYOUT_TILED };
+	const char *layoutNames[] = { "linear", "tiled" };
+	const char *workloads[] = { "rows", "columns", "random", "trilinear" };
+	char name[32];
+	sprintf(name, "tex%d", size);
+	int samples = opts.width * opts.height * 4;
+
+	for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+	{
+		SetNumberOfThreads(opts.threads[t]);
+		for (int l = 0; l < 2; l++)
+		{
+			MipTexture texture;
+			double t0 = GetTime();
+			texture.Create(image, true, layouts[l]);
+			double buildTime = GetTime() - t0;
+
+			for (int w = 0; w < 4; w++)
+			{
+				texture.SetFilter(w == 3 ? TEX_FILTER_TRILINEAR : TEX_FILTER_BILINEAR);
+				TraceCount count;
+				double frame = medianFrameTime(opts.reps, [&]() { count = sampleTexture(texture, workloads[w], samples); });
+				addResult(opts, name, layoutNames[l], workloads[w], buildTime, frame, count, texture.GetMemoryUsage());
+			}
+		}
+	}
+}
+
+// The textured room with and without ray differentials: the finest mip
+// level everywhere against the level each hit's footprint picks. Besides the
+// time, the texel memory one frame reads is measured in a separate untimed
+// single threaded frame and stored in place of the accel size.
+//
+// The paged cases render the same textures from tiled files through a
+// TextureCache with a quarter of their size, reporting the cache's hit rate,
+// disk reads and stalls for the last timed frame; the stored bytes are
+// the bytes read.
+static void benchTexturedRoom(const BenchOptions &opts)
+{
+	int size = opts.quick ? 512 : 2048;
+	Scene scene;
+	MakeTexturedRoomScene(scene, size);
+	scene.Build(ACCEL_GRID);
+	size_t textureBytes = 0;
+	for (int i = 0, n = (int)scene.textures.size(); i < n; i++)
+		textureBytes += scene.textures[i].GetMemoryUsage();
+
+	RaytraceCamera view;
+	SetRoomStartView(view);
+	CameraRayGenerator camera;
+	camera.SetResolution(opts.width, opts.height, 45.0f);
+	camera.SetCamera(view.GetViewMatrix());
+	vector<Color3f> pixels(opts.width * opts.height);
+
+	const char *workloads[] = { "lod0", "raydiff" };
+	for (int w = 0; w < 2; w++)
+	{
+		bool rayDifferentials = w == 1;
+		for (int i = 0, n = (int)scene.textures.size(); i < n; i++)
+			scene.textures[i].EnableAccessTracking(true);
+		{
+			RayTracer tracer;
+			tracer.SetParallel(false);
+			tracer.EnableRayDifferentials(rayDifferentials);
+			tracer.Render(scene, camera, pixels.data());
+		}
+		size_t touched = 0;
+		for (int i = 0, n = (int)scene.textures.size(); i < n; i++) {
+			touched += scene.textures[i].GetBytesTouched();
+			scene.textures[i].EnableAccessTracking(false);
+		}
+		printf("textured/%s: %.1f MB of %.1f MB of texels read per frame\n", workloads[w],
+			touched / (1024.0 * 1024.0), textureBytes / (1024.0 * 1024.0));
+
+		for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+		{
+			SetNumberOfThreads(opts.threads[t]);
+			TraceCount count;
+			double frame = medianFrameTime(opts.reps, [&]() { count = renderScene(scene, camera, pixels, rayDifferentials); });
+			addResult(opts, "textured", "grid", workloads[w], 0.0, frame, count, touched);
+		}
+	}
+
+	// the same materials on paged copies of the textures
+	TextureCache cache;
+	Scene paged = scene;
+	paged.textureCache = &cache;
+	paged.textures.clear();
+	cache.Create(textureBytes / 4);
+	vector<string> files;
+	for (int i = 0, n = (int)scene.textures.size(); i < n; i++) {
+		char name[64];
+		sprintf(name, "rtbench_texture%d.rtt", i);
+		files.push_back(name);
+		if (!WriteTiledTexture(name, scene.textures[i]) || cache.Open(name) != i) {
+			fprintf(stderr, "can't write %s\n", name);
+			for (int j = 0; j <= i; j++) remove(files[j].c_str());
+			return;
+		}
+	}
+	for (int i = 0, n = (int)paged.spheres.size() + (int)paged.planes.size(); i < n; i++) {
+		int s = (int)paged.spheres.size();
+		Material &m = i < s ? paged.spheres[i].base : paged.planes[i - s].base;
+		m.pagedTexture = m.texture;
+		m.texture = -1;
+	}
+
+	const char *pagedWorkloads[] = { "paged-lod0", "paged-raydiff" };
+	for (int w = 0; w < 2; w++)
+	{
+		bool rayDifferentials = w == 1;
+		for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+		{
+			SetNumberOfThreads(opts.threads[t]);
+			TraceCount count;
+			TextureCacheStats stats;
+			double frame = medianFrameTime(opts.reps, [&]() {
+				cache.ResetStats();
+				count = renderScene(paged, camera, pixels, rayDifferentials);
+				stats = cache.GetStats();
+			});
+			addResult(opts, "textured", "grid", pagedWorkloads[w], 0.0, frame, count, (size_t)stats.bytesRead);
+			printf("  cache %.1f MB: %.2f%% hits, %.2f MB read, %.2f ms stalled, %lld evictions\n",
+				cache.GetMemoryLimit() / (1024.0 * 1024.0), stats.HitRate() * 100.0,
+				stats.bytesRead / (1024.0 * 1024.0), stats.stallTime * 1000.0, stats.evictions);
+		}
+	}
+	for (size_t i = 0; i < files.size(); i++)
+		remove(files[i].c_str());
+}
+
+// bumpy sphere with roughly faceCount triangles, so the mesh cases
+// don't depend on model files
+static void makeBumpySphere(MeshData &mesh, int faceCount)
+{
+	int segments = (int)sqrt((float)faceCount);
+	int rings = segments / 2;
+	mesh.vertices.clear();
+	mesh.texCoords.clear();
+	mesh.indices.clear();
+
+	for (int r = 0; r <= rings; r++)
+	{
+		float theta = M_PIf * r / rings;
+		for (int s = 0; s <= segments; s++)
+		{
+			float phi = 2.0f * M_PIf * s / segments;
+			float radius = 1.0f + 0.08f * sin(7.0f * theta) * sin(9.0f * phi) + 0.02f * sin(40.0f * phi);
+			mesh.vertices.push_back(Vector3f(
+				radius * sin(theta) * cos(phi),
+				radius * cos(theta),
+				radius * sin(theta) * sin(phi)));
+			mesh.texCoords.push_back(Vector2f((float)s / segments, (float)r / rings));
+		}
+	}
+
+	for (int r = 0; r < rings; r++)
+	{
+		for (int s = 0; s < segments; s++)
+		{
+			int i0 = r * (segments + 1) + s, i1 = i0 + 1;
+			int i2 = i0 + segments + 1, i3 = i2 + 1;
+			int quad[6] = { i0, i2, i1, i1, i2, i3 };
+			mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+		}
+	}
+
+	// smooth normals, the area weighted sums of the face normals
+	mesh.normals.assign(mesh.vertices.size(), Vector3f(0.0f));
+	for (int i = 0, n = (int)mesh.indices.size(); i < n; i += 3)
+	{
+		const int *f = &mesh.indices[i];
+		Vector3f faceNormal = Cross(mesh.vertices[f[1]] - mesh.vertices[f[0]], mesh.vertices[f[2]] - mesh.vertices[f[0]]);
+		for (int k = 0; k < 3; k++) mesh.normals[f[k]] += faceNormal;
+	}
+	for (int i = 0, n = (int)mesh.normals.size(); i < n; i++) {
+		// the poles' degenerate faces leave no normal on some vertices
+		if (mesh.normals[i].Length() > 0.0f) mesh.normals[i].Normalize();
+		else mesh.normals[i] = mesh.vertices[i] * (1.0f / mesh.vertices[i].Length());
+	}
+}
+
+// how far the packed attributes are from the originals
+static void printPackingError(const char *name, const MeshData &mesh, const PackedMeshData &packed)
+{
+	float positionError = 0, normalError = 0, texCoordError = 0;
+	for (int i = 0, n = mesh.GetVerticesCount(); i < n; i++)
+	{
+		Vector3f d = packed.GetVertex(i) - mesh.vertices[i];
+		positionError = max(positionError, max(max(fabs(d.x), fabs(d.y)), fabs(d.z)));
+		if (mesh.HasNormals()) {
+			// acos of the dot product can't resolve angles this small in floats
+			Vector3f a = packed.GetNormal(i), b = Normalize(mesh.normals[i]);
+			normalError = max(normalError, (float)atan2(Cross(a, b).Length(), Dot(a, b)) * 180.0f / M_PIf);
+		}
+		if (mesh.HasTexCoords()) {
+			Vector2f d = packed.GetTexCoord(i) - mesh.texCoords[i];
+			texCoordError = max(texCoordError, max(fabs(d.x), fabs(d.y)));
+		}
+	}
+	AABox bounds = mesh.GetBounds();
+	printf("%s: mesh %.1f MB packed to %.1f MB; max error %g of %g in positions, %g degrees in normals, %g in texture coordinates\n",
+		name, mesh.GetMemoryUsage() / (1024.0 * 1024.0), packed.GetMemoryUsage() / (1024.0 * 1024.0),
+		positionError, (bounds.vmax - bounds.vmin).Length(), normalError, texCoordError);
+}
+
+// BVH, SBVH and CompressedBVH side by side on the same mesh
+static void benchMesh(const BenchOptions &opts, const char *name, const MeshData &mesh)
+{
+	AABox bounds = mesh.GetBounds();
+	Point3f center = (bounds.vmin + bounds.vmax) * 0.5f;
+	float size = (bounds.vmax - bounds.vmin).Length();
+	Point3f light = center + Vector3f(-0.5f, 1.5f, 1.0f) * size;
+
+	CameraRayGenerator camera;
+	camera.SetResolution(opts.width, opts.height, 45.0f);
+	camera.SetCamera(LookAtView(center + Vector3f(0.35f, 0.45f, 1.0f) * size, center));
+
+	for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+	{
+		SetNumberOfThreads(opts.threads[t]);
+		for (int spatial = 0; spatial < 2; spatial++)
+		{
+			BVHBuildParams params;
+			params.spatialSplits = spatial != 0;
+			const char *accelName = spatial ? "sbvh" : "bvh";
+
+			BVH bvh;
+			double t0 = GetTime();
+			bvh.Build(mesh, params);
+			double buildTime = GetTime() - t0;
+			size_t bytes = bvh.GetStats().memoryUsage;
+
+			TraceCount count;
+			double frame = medianFrameTime(opts.reps, [&]() { count = traceMesh(bvh, camera, light, false); });
+			addResult(opts, name, accelName, "primary", buildTime, frame, count, bytes);
+			frame = medianFrameTime(opts.reps, [&]() { count = traceMesh(bvh, camera, light, true); });
+			addResult(opts, name, accelName, "shadow", buildTime, frame, count, bytes);
+
+			if (spatial) continue;
+
+			// compressed from the plain BVH, its build time includes that build
+			CompressedBVH cbvh;
+			t0 = GetTime();
+			cbvh.Build(bvh);
+			double compressTime = GetTime() - t0;
+			bytes = cbvh.GetStats().memoryUsage;
+
+			frame = medianFrameTime(opts.reps, [&]() { count = traceMesh(cbvh, camera, light, false); });
+			addResult(opts, name, "cbvh", "primary", buildTime + compressTime, frame, count, bytes);
+			frame = medianFrameTime(opts.reps, [&]() { count = traceMesh(cbvh, camera, light, true); });
+			addResult(opts, name, "cbvh", "shadow", buildTime + compressTime, frame, count, bytes);
+			if (mesh.HasNormals()) {
+				frame = medianFrameTime(opts.reps, [&]() { count = shadeMesh(cbvh, mesh, camera, light); });
+				addResult(opts, name, "cbvh", "shade", buildTime + compressTime, frame, count, bytes);
+			}
+
+			// the same tree over packed vertices; the cbvh cases leave out the
+			// float mesh they share, these count the packed one they own
+			PackedMeshData packed;
+			CompressedBVH pcbvh;
+			t0 = GetTime();
+			packed.Pack(mesh);
+			{
+				MeshData decoded;
+				packed.Unpack(decoded);
+				BVH decodedBVH;
+				decodedBVH.Build(decoded, params);
+				pcbvh.Build(decodedBVH, &packed);
+			}
+			double packTime = GetTime() - t0;
+			if (t == 0) printPackingError(name, mesh, packed);
+			bytes = pcbvh.GetStats().memoryUsage;
+			size_t meshBytes = packed.GetMemoryUsage();
+
+			frame = medianFrameTime(opts.reps, [&]() { count = traceMesh(pcbvh, camera, light, false); });
+			addResult(opts, name, "packed", "primary", packTime, frame, count, bytes + meshBytes);
+			frame = medianFrameTime(opts.reps, [&]() { count = traceMesh(pcbvh, camera, light, true); });
+			addResult(opts, name, "packed", "shadow", packTime, frame, count, bytes + meshBytes);
+			if (packed.HasNormals()) {
+				frame = medianFrameTime(opts.reps, [&]() { count = shadeMesh(pcbvh, packed, camera, light); });
+				addResult(opts, name, "packed", "shade", packTime, frame, count, bytes + meshBytes);
+			}
+		}
+	}
+}
+
+// the worst case for a loader: triangles and vertices in random order
+static void shuffleMesh(MeshData &mesh)
+{
+	int faceCount = mesh.GetFaceCount();
+	for (int i = faceCount - 1; i > 0; i--) {
+		int j = min((int)(hashToUnit(i) * (i + 1)), i);
+		for (int k = 0; k < 3; k++) swap(mesh.indices[i * 3 + k], mesh.indices[j * 3 + k]);
+	}
+
+	int verticesCount = mesh.GetVerticesCount();
+	vector<int> newIndex(verticesCount);
+	for (int i = 0; i < verticesCount; i++) newIndex[i] = i;
+	for (int i = verticesCount - 1; i > 0; i--)
+		swap(newIndex[i], newIndex[min((int)(hashToUnit(i + faceCount) * (i + 1)), i)]);
+
+	MeshData shuffled;
+	shuffled.vertices.resize(verticesCount);
+	shuffled.normals.resize(mesh.normals.size());
+	shuffled.texCoords.resize(mesh.texCoords.size());
+	for (int i = 0; i < verticesCount; i++) {
+		shuffled.vertices[newIndex[i]] = mesh.vertices[i];
+		if (mesh.HasNormals()) shuffled.normals[newIndex[i]] = mesh.normals[i];
+		if (mesh.HasTexCoords()) shuffled.texCoords[newIndex[i]] = mesh.texCoords[i];
+	}
+	shuffled.indices.resize(mesh.indices.size());
+	for (int i = 0, n = (int)mesh.indices.size(); i < n; i++)
+		shuffled.indices[i] = newIndex[mesh.indices[i]];
+	mesh.vertices.swap(shuffled.vertices);
+	mesh.normals.swap(shuffled.normals);
+	mesh.texCoords.swap(shuffled.texCoords);
+	mesh.indices.swap(shuffled.indices);
+}
+
+// OptimizeMeshOrder against the order a mesh came in. Only the cbvh reads
+// vertices through the index buffer; the BVH copies its triangles into leaf
+// order and doesn't care.
+static void benchMeshOrder(const BenchOptions &opts, const char *name, const char *orderName, const MeshData &mesh)
+{
+	AABox bounds = mesh.GetBounds();
+	Point3f center = (bounds.vmin + bounds.vmax) * 0.5f;
+	float size = (bounds.vmax - bounds.vmin).Length();
+	Point3f light = center + Vector3f(-0.5f, 1.5f, 1.0f) * size;
+
+	CameraRayGenerator camera;
+	camera.SetResolution(opts.width, opts.height, 45.0f);
+	camera.SetCamera(LookAtView(center + Vector3f(0.35f, 0.45f, 1.0f) * size, center));
+
+	MeshData reordered = mesh;
+	vector<SubMesh> whole(1);
+	whole[0].firstIndex = 0;
+	whole[0].indicesCount = reordered.GetIndicesCount();
+	double t0 = GetTime();
+	OptimizeMeshOrder(reordered, whole);
+	double reorderTime = GetTime() - t0;
+	printf("%s: ACMR at %d vertices %.3f %s, %.3f reordered in %.1f ms\n", name, MESH_VERTEX_CACHE_SIZE,
+		ComputeACMR(mesh.indices.data(), mesh.GetIndicesCount()), orderName,
+		ComputeACMR(reordered.indices.data(), reordered.GetIndicesCount()), reorderTime * 1000.0);
+
+	for (int r = 0; r < 2; r++)
+	{
+		const MeshData &m = r ? reordered : mesh;
+		string scene = string(name) + "-" + (r ? "reordered" : orderName);
+		for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+		{
+			SetNumberOfThreads(opts.threads[t]);
+			BVH bvh;
+			CompressedBVH cbvh;
+			t0 = GetTime();
+			bvh.Build(m);
+			cbvh.Build(bvh);
+			double buildTime = GetTime() - t0;
+			size_t bytes = cbvh.GetStats().memoryUsage;
+
+			TraceCount count;
+			double frame = medianFrameTime(opts.reps, [&]() { count = traceMesh(cbvh, camera, light, false); });
+			addResult(opts, scene.c_str(), "cbvh", "primary", buildTime, frame, count, bytes);
+			frame = medianFrameTime(opts.reps, [&]() { count = traceMesh(cbvh, camera, light, true); });
+			addResult(opts, scene.c_str(), "cbvh", "shadow", buildTime, frame, count, bytes);
+			if (m.HasNormals()) {
+				frame = medianFrameTime(opts.reps, [&]() { count = shadeMesh(cbvh, m, camera, light); });
+				addResult(opts, scene.c_str(), "cbvh", "shade", buildTime, frame, count, bytes);
+			}
+		}
+	}
+}
+
+static void benchMeshes(const BenchOptions &opts)
+{
+	if (sceneEnabled(opts, "mesh"))
+	{
+		int sizes[2] = { 250000, 1000000 };
+		if (opts.quick) sizes[0] = sizes[1] = 100000;
+		for (int i = 0; i < (opts.quick ? 1 : 2); i++) {
+			MeshData mesh;
+			makeBumpySphere(mesh, sizes[i]);
+			char name[32];
+			sprintf(name, "mesh%dk", sizes[i] / 1000);
+			benchMesh(opts, name, mesh);
+			shuffleMesh(mesh);
+			benchMeshOrder(opts, name, "shuffled", mesh);
+		}
+	}
+
+	if (sceneEnabled(opts, "obj"))
+	{
+		for (int i = 0, n = (int)opts.objFiles.size(); i < n; i++)
+		{
+			MeshData mesh;
+			vector<SubMesh> subMeshes;
+			if (!LoadObjMeshData(opts.objFiles[i].c_str(), mesh, subMeshes, false)) {
+				fprintf(stderr, "can't load %s\n", opts.objFiles[i].c_str());
+				continue;
+			}
+			string name = opts.objFiles[i];
+			size_t slash = name.find_last_of("/\\");
+			if (slash != string::npos) name = name.substr(slash + 1);
+			benchMesh(opts, name.c_str(), mesh);
+			benchMeshOrder(opts, name.c_str(), "file", mesh);
+		}
+	}
+}
+
+static bool writeObj(const char *filename, const MeshData &mesh)
+{
+	FILE *f = fopen(filename, "w");
+	if (!f) return false;
+	for (int i = 0, n = (int)mesh.vertices.size(); i < n; i++)
+		fprintf(f, "v %f %f %f\n", mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z);
+	for (int i = 0, n = (int)mesh.indices.size(); i < n; i += 3)
+		fprintf(f, "f %d %d %d\n", mesh.indices[i] + 1, mesh.indices[i + 1] + 1, mesh.indices[i + 2] + 1);
+	return fclose(f) == 0;
+}
+
+// Startup loading of a few models with BVHs: one after another on the main
+// thread, as the viewer used to, against a ResourceLoader while the main
+// thread runs 16 ms frames that publish within a 2 ms budget. A stall is the
+// longest the main thread spent in loading between two frames.
+static void benchLoading(const BenchOptions &opts)
+{
+	vector<string> files = opts.objFiles;
+	vector<string> generated;
+	if (files.empty())
+	{
+		for (int i = 0; i < 4; i++) {
+			MeshData mesh;
+			makeBumpySphere(mesh, opts.quick ? 50000 : 200000);
+			char name[32];
+			sprintf(name, "rtbench_load%d.obj", i);
+			if (!writeObj(name, mesh)) {
+				fprintf(stderr, "can't write %s\n", name);
+				return;
+			}
+			generated.push_back(name);
+		}
+		files = generated;
+	}
+
+	double t0 = GetTime(), stall = 0;
+	for (int i = 0, n = (int)files.size(); i < n; i++) {
+		double start = GetTime();
+		MeshDataLoad task(files[i].c_str());
+		task.buildBVH = true;
+		task.cacheBVH = false;
+		if (!task.Load()) fprintf(stderr, "can't load %s\n", files[i].c_str());
+		stall = max(stall, GetTime() - start);
+	}
+	double syncTime = GetTime() - t0;
+	printf("load/%d files/sync: ready after %.1f ms, longest stall %.1f ms\n",
+		(int)files.size(), syncTime * 1000.0, stall * 1000.0);
+
+	ResourceLoader loader;
+	vector<my_shared_ptr<MeshDataLoad> > tasks;
+	t0 = GetTime();
+	stall = 0;
+	for (int i = 0, n = (int)files.size(); i < n; i++) {
+		MeshDataLoad *task = new MeshDataLoad(files[i].c_str());
+		task->buildBVH = true;
+		task->cacheBVH = false;
+		tasks.push_back(loader.Submit(task));
+	}
+	stall = GetTime() - t0;
+	int frames = 0;
+	while (loader.GetPendingCount() > 0)
+	{
+		double frameStart = GetTime();
+		loader.Publish(0.002);
+		stall = max(stall, GetTime() - frameStart);
+		frames++;
+		int rest = (int)((0.016 - (GetTime() - frameStart)) * 1000.0);
+		if (rest > 0) SleepMs(rest);
+	}
+	double asyncTime = GetTime() - t0;
+	int ready = 0;
+	for (int i = 0, n = (int)tasks.size(); i < n; i++)
+		if (tasks[i]->IsReady()) ready++;
+	printf("load/%d files/async: ready after %.1f ms (%d frames, %d loaded), longest stall %.2f ms\n",
+		(int)files.size(), asyncTime * 1000.0, frames, ready, stall * 1000.0);
+	fflush(stdout);
+
+	for (int i = 0, n = (int)generated.size(); i < n; i++)
+		remove(generated[i].c_str());
+}
+
+struct CityInstance
+{
+	Vector3f offset;
+	int mesh, level;
+};
+
+// instances are translated copies, so the ray only moves into the mesh's
+// space and t stays the same
+struct CityIntersector
+{
+	const vector<CityInstance> *instances;
+	const vector<vector<BVH> > *levels; // by mesh, then level
+	RayHit hit;
+	int instance;
+
+	bool operator()(int prim, const Ray &ray, float &tmax)
+	{
+		const CityInstance &c = (*instances)[prim];
+		RayHit h;
+		h.t = tmax;
+		if (!(*levels)[c.mesh][c.level].Intersect(Ray(ray.p - c.offset, ray.v), h)) return false;
+		tmax = h.t;
+		hit = h;
+		instance = prim;
+		return true;
+	}
+};
+
+static TraceCount renderCity(const BVH &top, const vector<CityInstance> &instances,
+	const vector<vector<BVH> > &levels, const vector<vector<MeshData> > &levelMeshes,
+	const CameraRayGenerator &camera, const Point3f &light, vector<float> &image)
+{
+	int width = camera.GetWidth(), height = camera.GetHeight();
+	image.assign(width * height, 0.0f);
+	vector<TraceCount> rows(height);
+
+	ParallelFor(0, height, [&](int begin, int end) {
+		vector<RayPacket> packets(camera.GetPacketsPerRow());
+		CityIntersector intersector;
+		intersector.instances = &instances;
+		intersector.levels = &levels;
+		for (int y = begin; y < end; y++)
+		{
+			camera.GenerateRow(y, packets.data());
+			TraceCount &c = rows[y];
+			for (int p = 0, n = (int)packets.size(); p < n; p++)
+			{
+				const RayPacket &packet = packets[p];
+				for (int i = 0; i < packet.count; i++)
+				{
+					Ray ray = packet.GetRay(i);
+					float tmax = FLT_MAX;
+					c.rays++;
+					if (!top.Traverse(ray, tmax, intersector)) continue;
+
+					const CityInstance &inst = instances[intersector.instance];
+					const RayHit &hit = intersector.hit;
+					Point3f hitPoint = ray.p + ray.v * hit.t;
+					Vector3f normal = levelMeshes[inst.mesh][inst.level].InterpolateNormal(hit.primitive, hit.u, hit.v);
+					float shade = 0.1f + 0.9f * max(Dot(normal, Normalize(light - hitPoint)), 0.0f);
+					image[y * width + packet.x + i] = shade;
+					c.checksum += (long long)(shade * 255.0f);
+				}
+			}
+		}
+	}, 1);
+
+	TraceCount total;
+	for (int y = 0; y < height; y++) {
+		total.rays += rows[y].rays;
+		total.checksum += rows[y].checksum;
+	}
+	return total;
+}
+
+// A grid of mesh instances seen at a low angle, from a few units to the far
+// side of the city: the full meshes against levels of detail picked per
+// instance for at most 1 and 4 pixels of error. Image error is against the
+// full meshes' frame.
+static void benchCity(const BenchOptions &opts)
+{
+	int sizes[4] = { 50000, 100000, 200000, 400000 };
+	int side = opts.quick ? 12 : 24;
+	const float spacing = 3.0f;
+	int meshCount = 4;
+	if (opts.quick) for (int i = 0; i < meshCount; i++) sizes[i] /= 5;
+
+	vector<MeshData> meshes(meshCount);
+	for (int i = 0; i < meshCount; i++)
+		makeBumpySphere(meshes[i], sizes[i]);
+
+	// one task a mesh
+	vector<MeshLod> lods(meshCount);
+	double t0 = GetTime();
+	ParallelFor(0, meshCount, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+			lods[i].Build(meshes[i], 0, meshes[i].GetIndicesCount());
+	}, 1);
+	double lodTime = GetTime() - t0;
+
+	vector<vector<MeshData> > levelMeshes(meshCount);
+	vector<vector<BVH> > levels(meshCount);
+	size_t bytes = 0;
+	for (int i = 0; i < meshCount; i++)
+	{
+		int n = lods[i].GetLevelCount();
+		levelMeshes[i].resize(n);
+		levels[i].resize(n);
+		printf("city mesh %d:", i);
+		for (int l = 0; l < n; l++) {
+			lods[i].GetLevelMesh(meshes[i], l, levelMeshes[i][l]);
+			levels[i][l].Build(levelMeshes[i][l]);
+			bytes += levels[i][l].GetStats().memoryUsage;
+			printf(" %d (%.4f)", lods[i].GetFaceCount(l), lods[i].levels[l].error);
+		}
+		printf(" faces (error)\n");
+	}
+	printf("city: levels of detail of %d meshes built in %.0f ms\n", meshCount, lodTime * 1000.0);
+
+	vector<CityInstance> instances;
+	vector<AABox> boxes;
+	for (int z = 0; z < side; z++)
+	{
+		for (int x = 0; x < side; x++)
+		{
+			CityInstance c;
+			c.offset = Vector3f(x * spacing, 1.0f, z * spacing);
+			c.mesh = (x * 7 + z * 3) % meshCount;
+			c.level = 0;
+			instances.push_back(c);
+			AABox box = meshes[c.mesh].GetBounds();
+			box.vmin += c.offset;
+			box.vmax += c.offset;
+			boxes.push_back(box);
+		}
+	}
+	BVH top;
+	top.Build(boxes.data(), (int)boxes.size());
+	bytes += top.GetStats().memoryUsage;
+
+	Point3f eye(-4.0f, 3.0f, -4.0f);
+	Point3f light(-0.3f * side * spacing, 2.0f * side * spacing, 0.5f * side * spacing);
+	CameraRayGenerator camera;
+	camera.SetResolution(opts.width, opts.height, 45.0f);
+	camera.SetCamera(LookAtView(eye, Point3f(0.6f * side * spacing, 0.0f, 0.6f * side * spacing)));
+	float screenScale = GetLodScreenScale(opts.height, 45.0f);
+
+	const char *workloads[] = { "full", "lod1px", "lod4px" };
+	float maxPixelErrors[] = { 0.0f, 1.0f, 4.0f };
+	vector<float> reference, image;
+	for (int w = 0; w < 3; w++)
+	{
+		// the BVHs the frame can touch, each shared level counted once
+		long long faces = 0, fullFaces = 0;
+		size_t usedBytes = 0;
+		vector<vector<char> > used(meshCount, vector<char>(MESH_LOD_LEVELS, 0));
+		for (int i = 0, n = (int)instances.size(); i < n; i++)
+		{
+			CityInstance &c = instances[i];
+			Vector3f toCenter = c.offset - eye;
+			float distance = max(toCenter.Length() - 1.2f, 0.01f);
+			c.level = w == 0 ? 0 : lods[c.mesh].Select(distance, screenScale, maxPixelErrors[w]);
+			faces += lods[c.mesh].GetFaceCount(c.level);
+			fullFaces += lods[c.mesh].GetFaceCount(0);
+			if (!used[c.mesh][c.level]) {
+				used[c.mesh][c.level] = 1;
+				usedBytes += levels[c.mesh][c.level].GetStats().memoryUsage;
+			}
+		}
+
+		for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+		{
+			SetNumberOfThreads(opts.threads[t]);
+			TraceCount count;
+			double frame = medianFrameTime(opts.reps, [&]() {
+				count = renderCity(top, instances, levels, levelMeshes, camera, light, image);
+			});
+			addResult(opts, "city", "bvh", workloads[w], lodTime, frame, count, bytes);
+		}
+
+		if (w == 0) {
+			reference = image;
+			printf("city/full: %.1fM triangles in %d instances, %.1f MB of BVHs\n", fullFaces / 1e6,
+				(int)instances.size(), usedBytes / (1024.0 * 1024.0));
+			continue;
+		}
+		double sum = 0;
+		int off = 0;
+		for (int i = 0, n = (int)image.size(); i < n; i++) {
+			float d = fabs(image[i] - reference[i]);
+			sum += d;
+			if (d > 8.0f / 255.0f) off++;
+		}
+		printf("city/%s: %.1fM of %.1fM triangles, %.1f MB of BVHs, mean pixel error %.3f/255, %.2f%% of pixels off by more than 8/255\n",
+			workloads[w], faces / 1e6, fullFaces / 1e6, usedBytes / (1024.0 * 1024.0),
+			sum / image.size() * 255.0, 100.0 * off / image.size());
+	}
+}
+
+// Many small spheres that move every frame, so each frame pays for the
+// rebuild: the case the grids were added for, against the BVH.
+static void benchMoving(const BenchOptions &opts)
+{
+	int count = opts.quick ? 100000 : 1000000;
+	const float side = 100.0f;
+	float radius = side * pow(0.05f * 3.0f / (4.0f * M_PIf * count), 1.0f / 3.0f);
+
+	Scene scene;
+	scene.lightSource = Point3f(0, 2 * side, side);
+	scene.lightAmbient = Color3f(0.1f);
+	scene.backColor = Color3f(0.0f);
+
+	vector<Point3f> base(count);
+	vector<Vector3f> offset(count);
+	unsigned int seed = 12345;
+	for (int i = 0; i < count; i++) {
+		float r[6];
+		for (int k = 0; k < 6; k++) {
+			seed = seed * 1664525u + 1013904223u;
+			r[k] = (seed >> 8) * (1.0f / 16777216.0f);
+		}
+		base[i] = Point3f(r[0] - 0.5f, r[1] - 0.5f, r[2] - 0.5f) * side;
+		offset[i] = Vector3f(r[3] - 0.5f, r[4] - 0.5f, r[5] - 0.5f) * (4.0f * radius);
+		scene.spheres.push_back(SceneSphere(base[i], radius, Material()));
+	}
+
+	char name[32];
+	sprintf(name, "moving%dk", count / 1000);
+
+	CameraRayGenerator camera;
+	camera.SetResolution(opts.width, opts.height, 45.0f);
+	camera.SetCamera(LookAtView(Point3f(0.9f, 0.6f, 1.2f) * side, Point3f(0.0f)));
+
+	SceneAccelType accels[] = { ACCEL_BVH, ACCEL_GRID, ACCEL_HIERARCHICAL_GRID };
+	const char *accelNames[] = { "bvh", "grid", "hgrid" };
+
+	for (int t = 0, nt = (int)opts.threads.size(); t < nt; t++)
+	{
+		SetNumberOfThreads(opts.threads[t]);
+		for (int a = 0; a < 3; a++)
+		{
+			int frameIndex = 0;
+			vector<double> buildTimes;
+			TraceCount trace;
+			double frame = medianFrameTime(opts.reps, [&]() {
+				float phase = sin(frameIndex++ * 0.3f);
+				SceneSphere *s = scene.spheres.data();
+				ParallelFor(0, count, [&](int begin, int end) {
+					for (int i = begin; i < end; i++)
+						s[i].center = base[i] + offset[i] * phase;
+				});
+
+				double t0 = GetTime();
+				scene.Build(accels[a]);
+				buildTimes.push_back(GetTime() - t0);
+				trace = traceScene(scene, camera, false);
+			});
+
+			sort(buildTimes.begin(), buildTimes.end());
+			addResult(opts, name, accelNames[a], "animated", buildTimes[buildTimes.size() / 2],
+				frame, trace, scene.GetAccelMemoryUsage());
+		}
+	}
+}
+
+static bool writeJson(const char *filename, const BenchOptions &opts)
+{
+	FILE *f = fopen(filename, "w");
+	if (!f) return false;
+
+	// one result per line, which is all loadResults relies on
+	fprintf(f, "{\n\t\"version\": %d,\n\t\"processors\": %d,\n\t\"width\": %d,\n\t\"height\": %d,\n"
+		"\t\"reps\": %d,\n\t\"peak_rss_mb\": %.1f,\n\t\"results\": [\n",
+		BENCH_VERSION, GetProcessorCount(), opts.width, opts.height, opts.reps,
+		GetPeakMemoryUsage() / (1024.0 * 1024.0));
+
+	for (int i = 0, n = (int)results.size(); i < n; i++)
+	{
+		const BenchResult &r = results[i];
+		fprintf(f, "\t\t{\"name\": \"%s\", \"scene\": \"%s\", \"accel\": \"%s\", \"workload\": \"%s\", "
+			"\"threads\": %d, \"build_ms\": %.3f, \"ms_per_frame\": %.3f, \"rays_per_sec\": %.0f, "
+			"\"rays\": %lld, \"checksum\": %lld, \"accel_bytes\": %llu, \"peak_rss_mb\": %.1f}%s\n",
+			r.name.c_str(), r.scene.c_str(), r.accel.c_str(), r.workload.c_str(), r.threads,
+			r.buildMs, r.msPerFrame, r.raysPerSec, r.rays, r.checksum,
+			(unsigned long long)r.accelBytes, r.peakRssMb, i + 1 < n ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+	return fclose(f) == 0;
+}
+
+static bool readString(const string &line, const char *key, string &value)
+{
+	size_t pos = line.find(key);
+	if (pos == string::npos) return false;
+	pos = line.find('"', pos + strlen(key) + 1);
+	if (pos == string::npos) return false;
+	size_t end = line.find('"', pos + 1);
+	if (end == string::npos) return false;
+	value = line.substr(pos + 1, end - pos - 1);
+	return true;
+}
+
+static bool readNumber(const string &line, const char *key, double &value)
+{
+	size_t pos = line.find(key);
+	if (pos == string::npos) return false;
+	pos = line.find(':', pos);
+	return pos != string::npos && sscanf(line.c_str() + pos + 1, "%lf", &value) == 1;
+}
+
+struct StoredResult
+{
+	double buildMs;
+	double msPerFrame;
+	double checksum;
+};
+
+static bool loadResults(const char *filename, map<string, StoredResult> &stored)
+{
+	ifstream file(filename);
+	if (!file) return false;
+
+	string line;
+	while (getline(file, line))
+	{
+		string name;
+		StoredResult r;
+		if (!readString(line, "\"name\"", name)) continue;
+		if (!readNumber(line, "\"ms_per_frame\"", r.msPerFrame) ||
+			!readNumber(line, "\"build_ms\"", r.buildMs) ||
+			!readNumber(line, "\"checksum\"", r.checksum))
+			return false;
+		stored[name] = r;
+	}
+	return true;
+}
+
+static int compareResults(const char *baseFile, const char *currentFile, double threshold)
+{
+	map<string, StoredResult> base, current;
+	if (!loadResults(baseFile, base)) {
+		fprintf(stderr, "can't read %s\n", baseFile);
+		return 2;
+	}
+	if (!loadResults(currentFile, current)) {
+		fprintf(stderr, "can't read %s\n", currentFile);
+		return 2;
+	}
+
+	int regressions = 0, improvements = 0, compared = 0;
+	printf("%-44s %10s %10s %8s\n", "case", "base ms", "new ms", "change");
+
+	for (map<string, StoredResult>::const_iterator it = current.begin(); it != current.end(); ++it)
+	{
+		map<string, StoredResult>::const_iterator b = base.find(it->first);
+		if (b == base.end()) continue;
+		compared++;
+
+		const StoredResult &o = b->second, &n = it->second;
+		double change = o.msPerFrame > 0 ? (n.msPerFrame / o.msPerFrame - 1.0) * 100.0 : 0.0;
+		const char *status = "";
+		if (change > threshold) { status = "REGRESSION"; regressions++; }
+		else if (change < -threshold) { status = "faster"; improvements++; }
+		printf("%-44s %10.2f %10.2f %+7.1f%% %s\n", it->first.c_str(), o.msPerFrame, n.msPerFrame, change, status);
+
+		// builds under a millisecond are too noisy to compare
+		if (o.buildMs >= 1.0 && n.buildMs > o.buildMs * (1.0 + threshold / 100.0)) {
+			printf("%-44s build %.2f -> %.2f ms BUILD REGRESSION\n", it->first.c_str(), o.buildMs, n.buildMs);
+			regressions++;
+		}
+		if (o.checksum != n.checksum)
+			printf("%-44s output changed (checksum %.0f -> %.0f)\n", it->first.c_str(), o.checksum, n.checksum);
+	}
+
+	printf("%d cases compared, %d regressions, %d faster (threshold %.1f%%)\n",
+		compared, regressions, improvements, threshold);
+	return regressions ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions opts;
+	opts.width = 640;
+	opts.height = 480;
+	opts.reps = 5;
+	opts.quick = false;
+	const char *jsonFile = "rtbench.json";
+	const char *compare[2] = { NULL, NULL };
+	double threshold = 5.0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		bool ok = value != NULL;
+
+		if (!strcmp(arg, "-quick")) { opts.quick = true; continue; }
+		else if (!strcmp(arg, "-compare") && i + 2 < argc) {
+			compare[0] = argv[i + 1];
+			compare[1] = argv[i + 2];
+			i += 2;
+			continue;
+		}
+		else if (!strcmp(arg, "-json") && ok) jsonFile = value;
+		else if (!strcmp(arg, "-w") && ok) opts.width = atoi(value);
+		else if (!strcmp(arg, "-h") && ok) opts.height = atoi(value);
+		else if (!strcmp(arg, "-reps") && ok) opts.reps = atoi(value);
+		else if (!strcmp(arg, "-threads") && ok) ok = parseIntList(value, opts.threads);
+		else if (!strcmp(arg, "-scenes") && ok) parseStringList(value, opts.scenes);
+		else if (!strcmp(arg, "-obj") && ok) opts.objFiles.push_back(value);
+		else if (!strcmp(arg, "-threshold") && ok) threshold = atof(value);
+		else ok = false;
+
+		if (!ok) {
+			printUsage();
+			return 2;
+		}
+		i++;
+	}
+
+	if (compare[0])
+		return compareResults(compare[0], compare[1], threshold);
+
+	if (opts.width <= 0 || opts.height <= 0 || opts.reps <= 0) {
+		printUsage();
+		return 2;
+	}
+	if (opts.threads.empty()) {
+		opts.threads.push_back(1);
+		if (GetProcessorCount() > 1) opts.threads.push_back(GetProcessorCount());
+	}
+
+	if (sceneEnabled(opts, "room")) benchRoom(opts);
+	if (sceneEnabled(opts, "flake")) benchFlakes(opts);
+	benchMeshes(opts);
+	if (sceneEnabled(opts, "city")) benchCity(opts);
+	if (sceneEnabled(opts, "moving")) benchMoving(opts);
+	if (sceneEnabled(opts, "post")) benchPost(opts);
+	if (sceneEnabled(opts, "texture")) benchTextures(opts);
+	if (sceneEnabled(opts, "textured")) benchTexturedRoom(opts);
+	if (sceneEnabled(opts, "load")) benchLoading(opts);
+
+	if (!writeJson(jsonFile, opts)) {
+		fprintf(stderr, "can't write %s\n", jsonFile);
+		return 2;
+	}
+	printf("peak RSS %.1f MB, results in %s\n", GetPeakMemoryUsage() / (1024.0 * 1024.0), jsonFile);
+	return 0;
+}
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+#include "scene.h"
+#include "scenefile.h"
+#include "camerapath.h"
+#include "raygen.h"
+#include "raytracer.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "image.h"
+#include "imagewriter.h"
+#include "framebuffer.h"
+#include "texcache.h"
+#include "raytracecamera.h"
+
+using namespace std;
+
+static void printUsage()
+{
+	printf(
+		"usage: rtrender [options]\n"
+		"  -scene <file>     scene description, see scenefile.h (default: the room)\n"
+		"  -path <file>      camera keyframes, see camerapath.h (default: the viewer's start view)\n"
+		"  -frames <n>       frames spread evenly over the path (default 1)\n"
+		"  -o <file>         output image, .tga, .ppm, .pfm or .hdr (default out.tga);\n"
+		"                    with several frames a pattern such as frame%%04d.tga\n"
+		"  -rle              run-length encode .tga output\n"
+		"  -tonemap <op>     none, reinhard or aces for 8 bit output (default none)\n"
+		"  -exposure <stops> scales the pixels by 2^stops before the tone map\n"
+		"  -srgb             sRGB encode 8 bit output\n"
+		"  -dither           ordered dither when quantizing to 8 bit\n"
+		"  -w <width>        image width (default 800)\n"
+		"  -h <height>       image height (default 600)\n"
+		"  -fov <degrees>    vertical field of view (default 45)\n"
+		"  -threads <n>      worker threads, 0 for all cores (default 0)\n"
+		"  -accel <type>     none, bvh, grid or hgrid (default grid)\n"
+		"  -nodiff           no ray differentials, textures sample their finest level\n"
+		"  -texcache <MB>    memory for paged .rtt textures (default 256)\n"
+		"  -raystats         print ray counts per frame and write heatmaps next to\n"
+		"                    each image: name_rays.tga, _steps, _tests and _depth\n"
+		"  -profile          print a per-frame stage summary (RT_PROFILE builds)\n"
+		"  -trace <file>     write a Chrome trace of the run (RT_PROFILE builds)\n");
+}
+
+static bool parseAccel(const char *name, SceneAccelType &type)
+{
+	if (!strcmp(name, "none")) type = ACCEL_NONE;
+	else if (!strcmp(name, "bvh")) type = ACCEL_BVH;
+	else if (!strcmp(name, "grid")) type = ACCEL_GRID;
+	else if (!strcmp(name, "hgrid")) type = ACCEL_HIERARCHICAL_GRID;
+	else return false;
+	return true;
+}
+
+// accepts exactly one %d conversion, optionally zero padded to at most
+// 16 digits, so a pattern of up to 1000 characters expands to fewer than 1024
+static bool isFramePattern(const char *pattern)
+{
+	const char *p = strchr(pattern, '%');
+	if (!p || strchr(p + 1, '%')) return false;
+	p++;
+	int width = 0;
+	while (*p >= '0' && *p <= '9') {
+		width = width * 10 + (*p++ - '0');
+		if (width > 16) return false;
+	}
+	return *p == 'd';
+}
+
+static bool saveFrame(const char *filename, const FrameBuffer &frame, ImageFormat format,
+	const ToneMapParams &toneMap, bool parallel, ImageWriteStats &stats)
+{
+	PROFILE_SCOPE("output");
+	ImageWriter writer;
+	writer.SetParallel(parallel);
+	bool saved = writer.Write(filename, frame, format, toneMap);
+	stats = writer.GetStats();
+	return saved;
+}
+
+// name.tga -> name_rays.tga and so on
+static bool saveHeatmaps(const string &filename, const PixelRayStats *stats, int width, int height)
+{
+	string base = filename;
+	size_t dot = base.find_last_of('.');
+	if (dot != string::npos && base.find_first_of("/\\", dot) == string::npos)
+		base = base.substr(0, dot);
+
+	for (int c = 0; c < HEATMAP_CHANNEL_COUNT; c++) {
+		Image image;
+		string name = base + "_" + GetHeatmapChannelName(c) + ".tga";
+		if (!MakeHeatmap(stats, width, height, (HeatmapChannel)c, image) || !image.SaveTga(name.c_str()))
+			return false;
+	}
+	return true;
+}
+
+struct FrameResult
+{
+	float time;
+	RenderStats stats;
+	double writeTime;
+	ImageWriteStats writeStats;
+	bool saved;
+	string filename;
+	ProfileFrame profile;
+	RayStats rayStats;
+	TextureCacheStats textureStats;
+};
+
+static void printTextureStats(const char *label, const TextureCacheStats &s)
+{
+	printf("%s  textures %6.2f%% hits, %8.2f MB read, %7.2f ms stalled, %lld evictions\n", label,
+		s.HitRate() * 100.0, s.bytesRead / (1024.0 * 1024.0), s.stallTime * 1000.0, s.evictions);
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = "out.tga";
+	const char *sceneFile = NULL;
+	const char *pathFile = NULL;
+	int frames = 1;
+	int width = 800, height = 600;
+	float fov = 45.0f;
+	int threads = 0;
+	SceneAccelType accel = ACCEL_GRID;
+	bool profile = false;
+	bool rayStats = false;
+	bool rle = false;
+	bool rayDifferentials = true;
+	int textureCacheMb = 256;
+	ToneMapParams toneMap;
+	const char *traceFile = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		bool ok = value != NULL;
+
+		if (!strcmp(arg, "-profile")) { profile = true; continue; }
+		else if (!strcmp(arg, "-raystats")) { rayStats = true; continue; }
+		else if (!strcmp(arg, "-rle")) { rle = true; continue; }
+		else if (!strcmp(arg, "-nodiff")) { rayDifferentials = false; continue; }
+		else if (!strcmp(arg, "-srgb")) { toneMap.srgb = true; continue; }
+		else if (!strcmp(arg, "-dither")) { toneMap.dither = true; continue; }
+		else if (!strcmp(arg, "-tonemap") && ok) ok = ParseToneMap(value, toneMap.op);
+		else if (!strcmp(arg, "-exposure") && ok) toneMap.exposure = (float)atof(value);
+		else if (!strcmp(arg, "-o") && ok) output = value;
+		else if (!strcmp(arg, "-scene") && ok) sceneFile = value;
+		else if (!strcmp(arg, "-path") && ok) pathFile = value;
+		else if (!strcmp(arg, "-frames") && ok) frames = atoi(value);
+		else if (!strcmp(arg, "-w") && ok) width = atoi(value);
+		else if (!strcmp(arg, "-h") && ok) height = atoi(value);
+		else if (!strcmp(arg, "-fov") && ok) fov = (float)atof(value);
+		else if (!strcmp(arg, "-threads") && ok) threads = atoi(value);
+		else if (!strcmp(arg, "-accel") && ok) ok = parseAccel(value, accel);
+		else if (!strcmp(arg, "-trace") && ok) traceFile = value;
+		else if (!strcmp(arg, "-texcache") && ok) ok = (textureCacheMb = atoi(value)) > 0;
+		else ok = false;
+
+		if (!ok) {
+			printUsage();
+			return 1;
+		}
+		i++;
+	}
+
+	if (width <= 0 || height <= 0 || width > 65535 || height > 65535) {
+		fprintf(stderr, "invalid resolution %dx%d\n", width, height);
+		return 1;
+	}
+	if (frames <= 0) {
+		fprintf(stderr, "invalid frame count %d\n", frames);
+		return 1;
+	}
+	if (frames > 1 && (!isFramePattern(output) || strlen(output) > 1000)) {
+		fprintf(stderr, "%s: several frames need a pattern with one %%d in it, padded to at most 16 digits\n", output);
+		return 1;
+	}
+	ImageFormat format;
+	if (!GetImageFormat(output, format)) {
+		fprintf(stderr, "%s: unknown image format, use .tga, .ppm, .pfm or .hdr\n", output);
+		return 1;
+	}
+	if (rle && format == IMAGE_TGA) format = IMAGE_TGA_RLE;
+	SetNumberOfThreads(threads);
+	if ((profile || traceFile) && !IsProfilerCompiledIn())
+		fprintf(stderr, "warning: built without RT_PROFILE, -profile and -trace report nothing\n");
+
+	TextureCache textureCache;
+	if (!textureCache.Create((size_t)textureCacheMb << 20)) {
+		fprintf(stderr, "invalid texture cache size %d MB\n", textureCacheMb);
+		return 1;
+	}
+
+	Scene scene;
+	scene.textureCache = &textureCache;
+	int errorLine = 0;
+	if (!sceneFile) MakeRoomScene(scene);
+	else if (!LoadSceneFile(sceneFile, scene, &errorLine)) {
+		if (errorLine) fprintf(stderr, "%s(%d): syntax error\n", sceneFile, errorLine);
+		else fprintf(stderr, "can't open %s\n", sceneFile);
+		return 1;
+	}
+
+	CameraPath path;
+	if (pathFile && !path.Load(pathFile, &errorLine)) {
+		if (errorLine) fprintf(stderr, "%s(%d): syntax error\n", pathFile, errorLine);
+		else fprintf(stderr, "can't open %s\n", pathFile);
+		return 1;
+	}
+
+	RaytraceCamera camera;
+	SetRoomStartView(camera);
+	Matrix44f startView = camera.GetViewMatrix();
+
+	double t0 = GetTime();
+	scene.Build(accel);
+	double buildTime = GetTime() - t0;
+
+	CameraRayGenerator rays;
+	rays.SetResolution(width, height, fov);
+
+	// A single frame keeps every thread busy with its rows; once there are
+	// enough frames, whole frames go to the threads instead, which also
+	// overlaps the file writes with rendering.
+	bool frameParallel = frames >= GetNumberOfThreads() && GetNumberOfThreads() > 1;
+	vector<FrameResult> results(frames);
+
+	// frames rendered in parallel can't be told apart, they get one summary
+	ProfileFrame batchProfile;
+	if (frameParallel) ProfileBeginFrame();
+
+	double start = GetTime();
+	ParallelFor(0, frameParallel ? frames : 1, [&](int begin, int end) {
+		FrameBuffer frame;
+		frame.Create(width, height);
+		CameraRayGenerator frameRays = rays;
+		RayTracer tracer;
+		tracer.SetParallel(!frameParallel);
+		tracer.EnableRayStats(rayStats);
+		tracer.EnableRayDifferentials(rayDifferentials);
+
+		if (!frameParallel) end = frames;
+		for (int f = begin; f < end; f++)
+		{
+			FrameResult &r = results[f];
+			if (!frameParallel) ProfileBeginFrame();
+			r.time = frames > 1 ?
+				path.GetStartTime() + (path.GetEndTime() - path.GetStartTime()) * f / (frames - 1) :
+				path.GetStartTime();
+			frameRays.SetCamera(path.IsEmpty() ? startView : path.GetViewMatrix(r.time));
+			tracer.Render(scene, frameRays, frame.GetPixels());
+			r.stats = tracer.GetStats();
+			if (!frameParallel) {
+				r.textureStats = textureCache.GetStats();
+				textureCache.ResetStats();
+			}
+
+			char filename[1024];
+			if (frames > 1) sprintf(filename, output, f);
+			r.filename = frames > 1 ? filename : output;
+
+			double tw = GetTime();
+			r.saved = saveFrame(r.filename.c_str(), frame, format, toneMap, !frameParallel, r.writeStats);
+			if (rayStats) {
+				r.rayStats = tracer.GetRayStats();
+				if (!saveHeatmaps(r.filename, tracer.GetPixelRayStats(), width, height))
+					r.saved = false;
+			}
+			r.writeTime = GetTime() - tw;
+			if (!frameParallel) ProfileEndFrame(r.profile);
+		}
+	}, 1);
+	double totalTime = GetTime() - start;
+	if (frameParallel) ProfileEndFrame(batchProfile);
+
+	printf("%dx%d, %d threads, %s\n", width, height, GetNumberOfThreads(),
+		frameParallel ? "frames in parallel" : "rows in parallel");
+	printf("build     %8.2f ms\n", buildTime * 1000.0);
+
+	bool failed = false;
+	RenderStats total;
+	for (int f = 0; f < frames; f++)
+	{
+		const FrameResult &r = results[f];
+		printf("frame %4d  t=%7.3f  render %8.2f ms  write %6.2f ms %7.1f MB/s  %s%s\n", f, r.time,
+			r.stats.frameTime * 1000.0, r.writeTime * 1000.0, r.writeStats.Throughput(), r.filename.c_str(),
+			r.saved ? "" : " (write failed)");
+		if (!r.saved) failed = true;
+		if (rayStats) r.rayStats.Print(stdout);
+		if (textureCache.GetTextureCount() > 0 && !frameParallel) printTextureStats("           ", r.textureStats);
+		if (profile && !frameParallel) PrintProfileFrame(stdout, r.profile);
+		total.cameraRays += r.stats.cameraRays;
+		total.rays += r.stats.rays;
+		total.rayGenTime += r.stats.rayGenTime;
+		total.traceTime += r.stats.traceTime;
+	}
+
+	// frames rendered in parallel share the cache, so only the sum is known
+	if (textureCache.GetTextureCount() > 0 && frameParallel)
+		printTextureStats("all frames ", textureCache.GetStats());
+	if (profile && frameParallel) {
+		printf("all frames\n");
+		PrintProfileFrame(stdout, batchProfile);
+	}
+	if (traceFile && !WriteChromeTrace(traceFile)) {
+		fprintf(stderr, "can't write %s\n", traceFile);
+		failed = true;
+	}
+
+	printf("total     %8.2f ms, %.2f frames/s\n", totalTime * 1000.0, frames / totalTime);
+	printf("ray gen   %8.2f Mrays/s per thread\n", total.RayGenRate() * 1e-6);
+	printf("trace     %8.2f Mrays/s per thread, %lld rays\n", total.TraceRate() * 1e-6, total.rays);
+	return failed ? 1 : 0;
+}
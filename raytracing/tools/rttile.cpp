@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "texcache.h"
+#include "platform.h"
+
+// Converts TGA images to the tiled, mip mapped files TextureCache pages
+// textures in from, see texcache.h.
+
+static void printUsage()
+{
+	printf(
+		"usage: rttile [options] <input.tga> <output.rtt>\n"
+		"  -tile <n>   tile size in texels (default %d, what TextureCache expects)\n",
+		TEX_CACHE_TILE_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+	int tileSize = TEX_CACHE_TILE_SIZE;
+	const char *files[2] = { NULL, NULL };
+	int fileCount = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-tile") && i + 1 < argc) {
+			tileSize = atoi(argv[++i]);
+			if (tileSize <= 0 || tileSize > 1024) {
+				fprintf(stderr, "invalid tile size %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (argv[i][0] != '-' && fileCount < 2) files[fileCount++] = argv[i];
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if (fileCount != 2) {
+		printUsage();
+		return 1;
+	}
+
+	double t0 = GetTime();
+	Image image;
+	if (!image.LoadTga(files[0])) {
+		fprintf(stderr, "can't load %s\n", files[0]);
+		return 1;
+	}
+	double t1 = GetTime();
+	if (!WriteTiledTexture(files[1], image, tileSize)) {
+		fprintf(stderr, "can't write %s\n", files[1]);
+		return 1;
+	}
+	double t2 = GetTime();
+
+	printf("%s: %dx%d, load %.2f ms, tile and write %.2f ms\n", files[1],
+		image.GetWidth(), image.GetHeight(), (t1 - t0) * 1000.0, (t2 - t1) * 1000.0);
+	return 0;
+}